@@ -58,6 +58,9 @@ linuxarmv6l:
 	
 linuxarmv7l:
 	ADDON_LIBS_EXCLUDE =
+	# NEON kernels for the Hamming matching, gray conversion & warp (see cv::fixedpoint),
+	# remove it for ARMv7 boards without NEON. The ARMv6 boards use the scalar fixed point kernels.
+	ADDON_CFLAGS = -mfpu=neon
 	
 osx:
 win_cb:
@@ -0,0 +1,355 @@
+//
+//  allocations.cpp
+//
+//  Heap allocations per frame of the PatternTracker stages once the buffers are warmed up.
+//  With glibc they're counted by interposing malloc & co, so the cv::Mat buffers of cv::fastMalloc,
+//  e.g. the gray, descriptor & warped images of FrameData being reallocated, are counted along with
+//  operator new. Elsewhere only the global operator new is replaced and the cv::Mat buffers aren't.
+//
+//  usage : allocations [pattern image path] [frames = 100] [--record <file>] [--baseline <file>]
+//  Without image, a synthetic textured pattern is used.
+//  --record writes the max allocations per frame of each configuration & stage to a file,
+//  --baseline reads them back and exits with 1 when a stage allocates more than it did.
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+using namespace cv;
+
+namespace {
+    
+    std::atomic<unsigned long long> numAllocations(0);
+    std::atomic<unsigned long long> numAllocatedBytes(0);
+    
+    void countAllocation(size_t size)
+    {
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+        numAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    
+    struct AllocationCount
+    {
+        AllocationCount() : count(numAllocations.load()), bytes(numAllocatedBytes.load()) {}
+        
+        unsigned long long count, bytes;
+    };
+    
+    /**
+     * Allocations per frame of one stage, mean & max over the measured frames
+     */
+    struct StageAllocations
+    {
+        StageAllocations() : count(0), maxCount(0), bytes(0), numFrames(0) {}
+        
+        void add(const AllocationCount& start)
+        {
+            const AllocationCount end;
+            const unsigned long long n = end.count - start.count;
+            count += n;
+            maxCount = std::max(maxCount, n);
+            bytes += end.bytes - start.bytes;
+            numFrames++;
+        }
+        
+        double getMean() const { return numFrames ? (double)count / numFrames : 0; }
+        double getMeanBytes() const { return numFrames ? (double)bytes / numFrames : 0; }
+        
+        unsigned long long count, maxCount, bytes;
+        int numFrames;
+    };
+    
+    Mat syntheticPattern(Size size)
+    {
+        RNG rng(0x5eed);
+        Mat pattern(size, CV_8UC1);
+        randu(pattern, Scalar(0), Scalar(256));
+        GaussianBlur(pattern, pattern, Size(5, 5), 2);
+        for (int i = 0; i < 200; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(pattern, Rect(p.x, p.y, rng.uniform(10, 60), rng.uniform(10, 60)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return pattern;
+    }
+    
+    /**
+     * Max allocations per frame, by configuration & stage
+     */
+    typedef std::map<std::string, unsigned long long> Baseline;
+    
+    std::string baselineKey(const char* config, const char* stage)
+    {
+        return std::string(config) + '\t' + stage;
+    }
+    
+    bool readBaseline(const std::string& path, Baseline& baseline)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+            return false;
+        
+        std::string line;
+        while (std::getline(file, line))
+        {
+            // config <tab> stage <tab> max
+            const size_t tab = line.rfind('\t');
+            if (tab == std::string::npos)
+                continue;
+            baseline[line.substr(0, tab)] = strtoull(line.c_str() + tab + 1, 0, 10);
+        }
+        return true;
+    }
+    
+    bool writeBaseline(const std::string& path, const Baseline& baseline)
+    {
+        std::ofstream file(path.c_str());
+        for (const auto & entry : baseline)
+            file << entry.first << '\t' << entry.second << '\n';
+        return (bool)file;
+    }
+    
+    // The pattern slowly drifting across the frame, like a handheld camera would see it
+    Mat driftingHomography(int frame, Size patternSize, Size frameSize)
+    {
+        const float w = patternSize.width, h = patternSize.height;
+        const float scale = 0.5f * std::min(frameSize.width / w, frameSize.height / h);
+        const float t = frame * 0.05f;
+        const Point2f center(frameSize.width * (0.5f + 0.1f * std::sin(t)), frameSize.height * (0.5f + 0.1f * std::cos(0.7f * t)));
+        
+        std::vector<Point2f> src(4), dst(4);
+        src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+        for (int i = 0; i < 4; i++)
+        {
+            const float tilt = 1 + 0.05f * std::sin(t + i);
+            dst[i] = center + (src[i] - Point2f(w * 0.5f, h * 0.5f)) * scale * tilt;
+        }
+        return getPerspectiveTransform(src, dst);
+    }
+}
+
+#ifdef __GLIBC__
+
+// Every allocation of the process goes through these, OpenCV's included, the ones of glibc doing the work
+extern "C" {
+    
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* p, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    
+    void* malloc(size_t size) noexcept
+    {
+        countAllocation(size);
+        return __libc_malloc(size);
+    }
+    
+    void* calloc(size_t count, size_t size) noexcept
+    {
+        countAllocation(count * size);
+        return __libc_calloc(count, size);
+    }
+    
+    void* realloc(void* p, size_t size) noexcept
+    {
+        countAllocation(size);
+        return __libc_realloc(p, size);
+    }
+    
+    void* memalign(size_t alignment, size_t size) noexcept
+    {
+        countAllocation(size);
+        return __libc_memalign(alignment, size);
+    }
+    
+    void* aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        countAllocation(size);
+        return __libc_memalign(alignment, size);
+    }
+    
+    int posix_memalign(void** p, size_t alignment, size_t size) noexcept
+    {
+        countAllocation(size);
+        *p = __libc_memalign(alignment, size);
+        return *p ? 0 : ENOMEM;
+    }
+}
+
+#else
+
+void* operator new(std::size_t size)
+{
+    countAllocation(size);
+    
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+#endif
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> positional;
+    std::string recordPath, baselinePath;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+            baselinePath = argv[++i];
+        else
+            positional.push_back(argv[i]);
+    }
+    
+    const int numFrames = positional.size() > 1 ? atoi(positional[1].c_str()) : 100;
+    const int numWarmupFrames = 20;
+    const Size frameSize(1280, 720);
+    
+    Baseline baseline, measured;
+    if (!baselinePath.empty() && !readBaseline(baselinePath, baseline))
+    {
+        fprintf(stderr, "can't read the baseline %s\n", baselinePath.c_str());
+        return 2;
+    }
+    
+    Mat pattern;
+    if (!positional.empty())
+        pattern = imread(positional[0], IMREAD_GRAYSCALE);
+    if (pattern.empty())
+        pattern = syntheticPattern(Size(640, 480));
+    
+    std::vector<Mat> frames(numWarmupFrames + numFrames);
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        warpPerspective(pattern, frames[f], driftingHomography(f, pattern.size(), frameSize), frameSize, INTER_LINEAR, BORDER_CONSTANT, Scalar(127));
+        Mat noise(frameSize, CV_16SC1);
+        randn(noise, Scalar(0), Scalar(4));
+        add(frames[f], noise, frames[f], noArray(), CV_8U);
+    }
+    
+    struct Config
+    {
+        const char* name;
+        MatcherType matcher;
+        int refinement;     // -1 for none
+        bool flow;
+    };
+    const Config configs[] = {
+        { "packed",         MATCHER_PACKED_HAMMING,     -1,                         false },
+        { "packed warp",    MATCHER_PACKED_HAMMING,     REFINEMENT_WARP,            false },
+        { "packed lm",      MATCHER_PACKED_HAMMING,     REFINEMENT_INLIERS_LM,      false },
+        { "packed patch",   MATCHER_PACKED_HAMMING,     REFINEMENT_PATCH_ALIGNMENT, false },
+        { "mih lm",         MATCHER_MULTI_INDEX_HASH,   REFINEMENT_INLIERS_LM,      false },
+        { "bruteforce lm",  MATCHER_BRUTEFORCE,         REFINEMENT_INLIERS_LM,      false },
+        { "packed lm flow", MATCHER_PACKED_HAMMING,     REFINEMENT_INLIERS_LM,      true  },
+    };
+    
+    printf("allocations per frame after %d warm-up frames, mean (max)\n\n", numWarmupFrames);
+    printf("%-16s %6s %12s %12s %12s %12s %12s %12s\n", "config", "found", "prepare", "extract", "match", "integrate", "find()", "find() KB");
+    
+    for (const Config& config : configs)
+    {
+        StageAllocations prepare, extract, match, integrate, find;
+        int numFound = 0;
+        
+        // The stages one by one, as PipelinedTracker runs them, then find() on another tracker
+        for (int pass = 0; pass < 2; pass++)
+        {
+            PatternTracker tracker;
+            tracker.setup(config.matcher);
+            tracker.add(pattern);
+            tracker.enableHomographyRefinement = config.refinement >= 0;
+            if (config.refinement >= 0)
+                tracker.refinementMethod = (RefinementMethod)config.refinement;
+            tracker.enableOpticalFlowTracking = config.flow;
+            tracker.getDatabase().train();
+            
+            FrameData frame;
+            for (size_t f = 0; f < frames.size(); f++)
+            {
+                const bool measured = f >= (size_t)numWarmupFrames;
+                const Rect full(0, 0, frames[f].cols, frames[f].rows);
+                
+                if (pass == 1)
+                {
+                    AllocationCount start;
+                    const bool found = tracker.find(frames[f]);
+                    if (measured)
+                    {
+                        find.add(start);
+                        numFound += found;
+                    }
+                    continue;
+                }
+                
+                AllocationCount start;
+                tracker.prepare(frames[f], frame);
+                if (measured) prepare.add(start);
+                
+                start = AllocationCount();
+                tracker.extract(frame, full);
+                if (measured) extract.add(start);
+                
+                start = AllocationCount();
+                tracker.match(frame);
+                if (measured) match.add(start);
+                
+                start = AllocationCount();
+                tracker.integrate(frame);
+                if (measured) integrate.add(start);
+            }
+        }
+        
+        char cells[5][32];
+        const StageAllocations* stages[5] = { &prepare, &extract, &match, &integrate, &find };
+        const char* stageNames[5] = { "prepare", "extract", "match", "integrate", "find" };
+        for (int s = 0; s < 5; s++)
+        {
+            snprintf(cells[s], sizeof(cells[s]), "%.1f (%llu)", stages[s]->getMean(), stages[s]->maxCount);
+            measured[baselineKey(config.name, stageNames[s])] = stages[s]->maxCount;
+        }
+        
+        printf("%-16s %5.0f%% %12s %12s %12s %12s %12s %12.1f\n", config.name, 100. * numFound / numFrames,
+               cells[0], cells[1], cells[2], cells[3], cells[4], find.getMeanBytes() / 1024);
+    }
+    
+    if (!recordPath.empty() && !writeBaseline(recordPath, measured))
+    {
+        fprintf(stderr, "can't write the baseline %s\n", recordPath.c_str());
+        return 2;
+    }
+    
+    // A stage allocating more than it used to is a regression, a missing one can't be compared
+    int numRegressions = 0;
+    for (const auto & entry : baseline)
+    {
+        const auto it = measured.find(entry.first);
+        if (it == measured.end() || it->second <= entry.second)
+            continue;
+        
+        std::string name = entry.first;
+        name[name.find('\t')] = ' ';
+        printf("%sregression : %s, max %llu allocations per frame instead of %llu\n", numRegressions ? "" : "\n",
+               name.c_str(), it->second, entry.second);
+        numRegressions++;
+    }
+    
+    return numRegressions ? 1 : 0;
+}
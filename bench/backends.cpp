@@ -0,0 +1,157 @@
+//
+//  backends.cpp
+//
+//  Descriptor size, extraction cost, detection rate & corner error of the registered
+//  feature backends, on frames showing a pattern under scale changes, in-plane rotations,
+//  perspective & sensor noise with blur.
+//
+//  usage : backends [pattern image path] [frames per condition = 30]
+//  Without image, a synthetic textured pattern is used.
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cv;
+
+namespace {
+    
+    enum Condition { CONDITION_SCALE, CONDITION_ROTATION, CONDITION_PERSPECTIVE, CONDITION_NOISE, NUM_CONDITIONS };
+    const char* conditionNames[] = { "scale", "rotation", "perspective", "noise" };
+    
+    struct Frame
+    {
+        Mat image;
+        Mat homography;
+    };
+    
+    Mat syntheticPattern(Size size)
+    {
+        RNG rng(0x5eed);
+        Mat pattern(size, CV_8UC1);
+        randu(pattern, Scalar(0), Scalar(256));
+        GaussianBlur(pattern, pattern, Size(5, 5), 2);
+        for (int i = 0; i < 200; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(pattern, Rect(p.x, p.y, rng.uniform(10, 60), rng.uniform(10, 60)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return pattern;
+    }
+    
+    // Pattern centered in the frame, scaled & rotated, its corners moved by up to perspective of its size
+    Mat homography(RNG& rng, Size patternSize, Size frameSize, float scale, float angle, float perspective)
+    {
+        const float w = patternSize.width, h = patternSize.height;
+        const float s = scale * 0.5f * std::min(frameSize.width / w, frameSize.height / h);
+        const Point2f center(frameSize.width * 0.5f, frameSize.height * 0.5f);
+        const float c = std::cos(angle * (float)CV_PI / 180), n = std::sin(angle * (float)CV_PI / 180);
+        
+        std::vector<Point2f> src(4), dst(4);
+        src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+        for (int i = 0; i < 4; i++)
+        {
+            Point2f p = (src[i] - Point2f(w * 0.5f, h * 0.5f)) * s;
+            p += Point2f(rng.uniform(-perspective, perspective) * w * s, rng.uniform(-perspective, perspective) * h * s);
+            dst[i] = center + Point2f(c * p.x - n * p.y, n * p.x + c * p.y);
+        }
+        return getPerspectiveTransform(src, dst);
+    }
+    
+    std::vector<Frame> makeFrames(const Mat& pattern, Size frameSize, Condition condition, int numFrames)
+    {
+        RNG rng(42 + condition);
+        std::vector<Frame> frames(numFrames);
+        for (Frame& frame : frames)
+        {
+            float scale = 1, angle = rng.uniform(-10.f, 10.f), perspective = 0.05f, sigma = 4;
+            switch (condition)
+            {
+                case CONDITION_SCALE:       scale = rng.uniform(0.4f, 1.6f); break;
+                case CONDITION_ROTATION:    angle = rng.uniform(-180.f, 180.f); break;
+                case CONDITION_PERSPECTIVE: perspective = rng.uniform(0.1f, 0.25f); break;
+                case CONDITION_NOISE:       sigma = 16; break;
+                default: break;
+            }
+            
+            frame.homography = homography(rng, pattern.size(), frameSize, scale, angle, perspective);
+            warpPerspective(pattern, frame.image, frame.homography, frameSize, INTER_LINEAR, BORDER_CONSTANT, Scalar(127));
+            if (condition == CONDITION_NOISE)
+                GaussianBlur(frame.image, frame.image, Size(5, 5), 1.5);
+            
+            Mat noise(frameSize, CV_16SC1);
+            randn(noise, Scalar(0), Scalar(sigma));
+            add(frame.image, noise, frame.image, noArray(), CV_8U);
+        }
+        return frames;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 2 ? atoi(argv[2]) : 30;
+    const Size frameSize(1280, 720);
+    
+    Mat pattern;
+    if (argc > 1)
+        pattern = imread(argv[1], IMREAD_GRAYSCALE);
+    if (pattern.empty())
+        pattern = syntheticPattern(Size(640, 480));
+    
+    // The same frames for every backend
+    std::vector< std::vector<Frame> > frames(NUM_CONDITIONS);
+    for (int c = 0; c < NUM_CONDITIONS; c++)
+        frames[c] = makeFrames(pattern, frameSize, (Condition)c, numFrames);
+    
+    std::vector<Point2f> corners(4), expected;
+    corners[0] = Point2f(0, 0);
+    corners[1] = Point2f(pattern.cols, 0);
+    corners[2] = Point2f(pattern.cols, pattern.rows);
+    corners[3] = Point2f(0, pattern.rows);
+    
+    printf("%-12s %6s %12s", "backend", "bytes", "extract (ms)");
+    for (int c = 0; c < NUM_CONDITIONS; c++)
+        printf(" %12s %10s", conditionNames[c], "error (px)");
+    printf("\n");
+    
+    for (const std::string& name : FeatureBackend::getNames())
+    {
+        PatternTracker tracker;
+        tracker.setFeatureBackend(name);
+        tracker.setup();
+        tracker.add(pattern);
+        
+        // Every frame goes through detection
+        tracker.enableOpticalFlowTracking = false;
+        tracker.enableRoiPrediction = false;
+        
+        tracker.find(frames[0][0].image); // warm up & train the matcher
+        
+        double extractMs = 0;
+        int numFound[NUM_CONDITIONS] = {};
+        double error[NUM_CONDITIONS] = {};
+        for (int c = 0; c < NUM_CONDITIONS; c++)
+        {
+            for (const Frame& frame : frames[c])
+            {
+                if (tracker.find(frame.image))
+                {
+                    perspectiveTransform(corners, expected, frame.homography);
+                    for (int i = 0; i < 4; i++)
+                        error[c] += norm(tracker.getQuad()[i] - expected[i]) / 4;
+                    numFound[c]++;
+                }
+                extractMs += tracker.getTimings().detection + tracker.getTimings().description;
+            }
+        }
+        
+        printf("%-12s %6d %12.2f", name.c_str(), tracker.getFeatureBackend().descriptorSize(), extractMs / (numFrames * NUM_CONDITIONS));
+        for (int c = 0; c < NUM_CONDITIONS; c++)
+            printf(" %6d / %3d %10.3f", numFound[c], numFrames, numFound[c] ? error[c] / numFound[c] : 0.);
+        printf("\n");
+    }
+    
+    return 0;
+}
@@ -0,0 +1,88 @@
+//
+//  extraction.cpp
+//
+//  Scaling of the tiled parallel feature extraction from 1 to N threads on 720p & 1080p frames.
+//
+//  usage : extraction [image path] [frames = 30]
+//  Without image, a synthetic textured frame is used.
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace cv;
+
+namespace {
+    
+    // Expose the extraction step
+    class ExtractionTracker : public PatternTracker
+    {
+    public:
+        using PatternTracker::extractFeatures;
+    };
+    
+    Mat syntheticFrame(Size size)
+    {
+        RNG rng(0x5eed);
+        Mat frame(size, CV_8UC1);
+        randu(frame, Scalar(0), Scalar(256));
+        GaussianBlur(frame, frame, Size(5, 5), 2);
+        for (int i = 0; i < 400; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(frame, Rect(p.x, p.y, rng.uniform(10, 80), rng.uniform(10, 80)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return frame;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 2 ? atoi(argv[2]) : 30;
+    const int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    const Size sizes[] = { Size(1280, 720), Size(1920, 1080) };
+    
+    Mat source;
+    if (argc > 1)
+        source = imread(argv[1], IMREAD_GRAYSCALE);
+    
+    ExtractionTracker tracker;
+    tracker.setup();
+    
+    printf("%-10s %8s %10s %12s %10s\n", "size", "threads", "keypoints", "frame (ms)", "speedup");
+    
+    for (const Size& size : sizes)
+    {
+        Mat frame;
+        if (source.empty())
+            frame = syntheticFrame(size);
+        else
+            resize(source, frame, size);
+        
+        double singleMs = 0;
+        for (int threads = 1; threads <= maxThreads; threads++)
+        {
+            // 1 thread is the regular, untiled, extraction
+            tracker.numExtractionThreads = threads;
+            
+            std::vector<KeyPoint> keypoints;
+            Mat descriptors;
+            tracker.extractFeatures(frame, keypoints, descriptors); // warm up
+            
+            int64 t0 = getTickCount();
+            for (int f = 0; f < numFrames; f++)
+                tracker.extractFeatures(frame, keypoints, descriptors);
+            double ms = (getTickCount() - t0) * 1000. / getTickFrequency() / numFrames;
+            
+            if (threads == 1)
+                singleMs = ms;
+            
+            printf("%4dx%-5d %8d %10d %12.2f %10.2f\n", size.width, size.height, threads, (int)keypoints.size(), ms, singleMs / ms);
+        }
+    }
+    
+    return 0;
+}
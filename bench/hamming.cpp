@@ -0,0 +1,115 @@
+//
+//  hamming.cpp
+//
+//  Microbenchmark of the packed Hamming kNN kernels against cv::BruteForceMatcher<cv::HammingLUT>,
+//  checking that every implementation returns the same 2 nearest neighbours.
+//
+//  usage : hamming [frames = 20]
+//
+
+#include "PackedHammingMatcher.h"
+#include "HammingKernel.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cv;
+
+namespace {
+    
+    const int numQueries = 500;
+    const int descriptorsPerPattern = 500;
+    
+    void randomDescriptors(Mat& descriptors, int rows, RNG& rng)
+    {
+        descriptors.create(rows, 32, CV_8U);
+        for (int i = 0; i < rows; i++)
+            for (int j = 0; j < 32; j++)
+                descriptors.at<uchar>(i, j) = (uchar)rng.uniform(0, 256);
+    }
+    
+    double knnMatchMs(DescriptorMatcher& matcher, const std::vector<Mat>& frames, std::vector< std::vector< std::vector<DMatch> > >& results)
+    {
+        results.resize(frames.size());
+        int64 t0 = getTickCount();
+        for (size_t f = 0; f < frames.size(); f++)
+            matcher.knnMatch(frames[f], results[f], 2);
+        return (getTickCount() - t0) * 1000. / getTickFrequency() / frames.size();
+    }
+    
+    // Same distances, and same indices unless the distances are tied
+    int countMismatches(const std::vector< std::vector< std::vector<DMatch> > >& a, const std::vector< std::vector< std::vector<DMatch> > >& b)
+    {
+        int mismatches = 0;
+        for (size_t f = 0; f < a.size(); f++)
+        {
+            for (size_t q = 0; q < a[f].size(); q++)
+            {
+                const std::vector<DMatch>& ma = a[f][q];
+                const std::vector<DMatch>& mb = b[f][q];
+                bool same = ma.size() == mb.size();
+                for (size_t i = 0; same && i < ma.size(); i++)
+                {
+                    bool tied = ma.size() > 1 && ma[0].distance == ma[1].distance;
+                    same = ma[i].distance == mb[i].distance
+                        && (tied || (ma[i].imgIdx == mb[i].imgIdx && ma[i].trainIdx == mb[i].trainIdx));
+                }
+                mismatches += !same;
+            }
+        }
+        return mismatches;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 1 ? atoi(argv[1]) : 20;
+    const int trainSizes[] = { 500, 5000, 50000 };
+    const hamming::Implementation implementations[] = { hamming::IMPL_SCALAR, hamming::IMPL_AVX2, hamming::IMPL_AVX512_VPOPCNTQ, hamming::IMPL_NEON };
+    
+    RNG rng(0x5eed);
+    
+    printf("best implementation : %s\n", hamming::getImplementationName(hamming::getBestImplementation()));
+    printf("%-18s %8s %12s %10s %12s\n", "matcher", "train", "frame (ms)", "speedup", "mismatches");
+    
+    for (int trainSize : trainSizes)
+    {
+        std::vector<Mat> train;
+        for (int n = 0; n < trainSize; n += descriptorsPerPattern)
+        {
+            train.push_back(Mat());
+            randomDescriptors(train.back(), std::min(descriptorsPerPattern, trainSize - n), rng);
+        }
+        
+        std::vector<Mat> frames(numFrames);
+        for (auto & frame : frames)
+            randomDescriptors(frame, numQueries, rng);
+        
+        std::vector< std::vector< std::vector<DMatch> > > expected, results;
+        
+        BruteForceMatcher<HammingLUT> reference;
+        reference.add(train);
+        reference.train();
+        const double referenceMs = knnMatchMs(reference, frames, expected);
+        printf("%-18s %8d %12.3f %10.2f %12d\n", "hamming_lut", trainSize, referenceMs, 1., 0);
+        
+        PackedHammingMatcher packed;
+        packed.add(train);
+        packed.train();
+        
+        for (auto implementation : implementations)
+        {
+            hamming::setImplementation(implementation);
+            if (hamming::getImplementation() != implementation)
+                continue; // not supported here
+            
+            const double ms = knnMatchMs(packed, frames, results);
+            printf("%-18s %8d %12.3f %10.2f %12d\n", hamming::getImplementationName(implementation), trainSize, ms,
+                   referenceMs / ms, countMismatches(expected, results));
+        }
+        
+        hamming::setImplementation(hamming::getBestImplementation());
+    }
+    
+    return 0;
+}
@@ -0,0 +1,104 @@
+//
+//  ingest.cpp
+//
+//  Time of PatternTracker::prepare() on NV12 & YUYV camera frames, converted to BGR first
+//  as toCv(ofPixels) requires, or read in place with the YUV pixel formats, at 720p & 1080p
+//  with & without rescale. Also reports the largest difference between the luma read from
+//  the packed frames and the Y plane path.
+//
+//  usage : ingest [frames = 100]
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cv;
+
+namespace {
+    
+    Mat syntheticLuma(Size size)
+    {
+        RNG rng(0x5eed);
+        Mat luma(size, CV_8UC1);
+        randu(luma, Scalar(0), Scalar(256));
+        GaussianBlur(luma, luma, Size(5, 5), 2);
+        for (int i = 0; i < 400; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(luma, Rect(p.x, p.y, rng.uniform(10, 80), rng.uniform(10, 80)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return luma;
+    }
+    
+    template <typename Prepare>
+    double meanMs(int numFrames, Prepare prepare)
+    {
+        prepare();
+        const int64 start = getTickCount();
+        for (int i = 0; i < numFrames; i++)
+            prepare();
+        return (getTickCount() - start) * 1000. / getTickFrequency() / numFrames;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 1 ? atoi(argv[1]) : 100;
+    const Size sizes[] = { Size(1280, 720), Size(1920, 1080) };
+    const float rescales[] = { 1.f, 0.5f };
+    
+    printf("%-10s %8s %14s %14s %14s %14s %10s\n", "frame", "rescale", "nv12 bgr", "nv12 y", "yuyv bgr", "yuyv packed", "max diff");
+    
+    for (const Size& size : sizes)
+    {
+        const Mat luma = syntheticLuma(size);
+        
+        // Neutral chroma, the luma is what the tracker sees
+        Mat nv12(size.height * 3 / 2, size.width, CV_8UC1, Scalar(128));
+        luma.copyTo(nv12.rowRange(0, size.height));
+        
+        Mat yuyv;
+        std::vector<Mat> planes(2);
+        planes[0] = luma;
+        planes[1] = Mat(size, CV_8UC1, Scalar(128));
+        merge(planes, yuyv);
+        
+        for (float rescale : rescales)
+        {
+            PatternTracker tracker;
+            tracker.rescale = rescale;
+            FrameData frame;
+            Mat bgr;
+            
+            const double nv12Bgr = meanMs(numFrames, [&]{
+                cvtColor(nv12, bgr, CV_YUV2BGR_NV12);
+                tracker.prepare(bgr, frame);
+            });
+            const double nv12Y = meanMs(numFrames, [&]{
+                tracker.prepare(wrapPixels(nv12.data, size.width, size.height, nv12.step, PIXEL_FORMAT_Y), frame, PIXEL_FORMAT_Y);
+            });
+            Mat yPath = frame.grayImg.clone();
+            
+            const double yuyvBgr = meanMs(numFrames, [&]{
+                cvtColor(yuyv, bgr, CV_YUV2BGR_YUY2);
+                tracker.prepare(bgr, frame);
+            });
+            const double yuyvPacked = meanMs(numFrames, [&]{
+                tracker.prepare(wrapPixels(yuyv.data, size.width, size.height, yuyv.step, PIXEL_FORMAT_YUYV), frame, PIXEL_FORMAT_YUYV);
+            });
+            
+            Mat diff;
+            double maxDiff = 0;
+            absdiff(yPath, frame.grayImg, diff);
+            minMaxLoc(diff, 0, &maxDiff);
+            
+            char name[16];
+            snprintf(name, sizeof(name), "%dx%d", size.width, size.height);
+            printf("%-10s %8.2f %11.3f ms %11.3f ms %11.3f ms %11.3f ms %10.0f\n", name, rescale, nv12Bgr, nv12Y, yuyvBgr, yuyvPacked, maxDiff);
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,149 @@
+//
+//  kernels.cpp
+//
+//  The fixed point kernels of the ARM builds against the generic OpenCV paths they replace :
+//  cvtColor & resize of the frames, bicubic warpPerspective of the refinement. Every supported
+//  implementation is timed and checked pixel for pixel against the scalar one, the gray levels
+//  at scale 1 against cv::cvtColor() as well. Returns 1 if any differs, e.g. when cross compiled
+//  for ARM and run under qemu-user. The Hamming kernels are checked by the hamming bench.
+//
+//  usage : kernels [runs = 20]
+//
+
+#include "FixedPointKernel.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cv;
+
+namespace {
+    
+    template <typename Function>
+    double averageMs(int runs, Function function)
+    {
+        const int64 start = getTickCount();
+        for (int i = 0; i < runs; i++)
+            function();
+        return (getTickCount() - start) * 1000. / getTickFrequency() / runs;
+    }
+    
+    double maxDifference(const Mat& a, const Mat& b)
+    {
+        if (a.size() != b.size())
+            return 255;
+        return norm(a, b, NORM_INF);
+    }
+    
+    Mat syntheticFrame(Size size, int type, RNG& rng)
+    {
+        Mat frame(size, type);
+        rng.fill(frame, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+        GaussianBlur(frame, frame, Size(5, 5), 1.5);
+        return frame;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int runs = argc > 1 ? atoi(argv[1]) : 20;
+    const fixedpoint::Implementation implementations[] = { fixedpoint::IMPL_SCALAR, fixedpoint::IMPL_NEON };
+    const Size frameSizes[] = { Size(640, 480), Size(1280, 720) };
+    const int types[] = { CV_8UC3, CV_8UC4 };
+    const double scales[] = { 1, 0.5, 0.75 };
+    
+    RNG rng(0x5eed);
+    int numMismatches = 0;
+    
+    printf("best implementation : %s\n\n", fixedpoint::getImplementationName(fixedpoint::getBestImplementation()));
+    printf("%-22s %-10s %12s %10s %12s\n", "gray & rescale", "kernel", "time (ms)", "speedup", "max diff");
+    
+    for (Size frameSize : frameSizes)
+    {
+        for (int type : types)
+        {
+            const Mat frame = syntheticFrame(frameSize, type, rng);
+            for (double scale : scales)
+            {
+                // The path of PatternTracker::prepare() without the fixed point kernels
+                Mat resized, expected;
+                const double referenceMs = averageMs(runs, [&]{
+                    if (scale == 1)
+                        resized = frame;
+                    else
+                        resize(frame, resized, Size(scale * frame.cols, scale * frame.rows));
+                    cvtColor(resized, expected, type == CV_8UC3 ? CV_BGR2GRAY : CV_BGRA2GRAY);
+                });
+                
+                char name[32];
+                snprintf(name, sizeof(name), "%dx%d %s x%.2f", frameSize.width, frameSize.height, type == CV_8UC3 ? "bgr" : "bgra", scale);
+                printf("%-22s %-10s %12.3f %10.2f %12.0f\n", name, "opencv", referenceMs, 1., 0.);
+                
+                Mat scalar;
+                for (auto implementation : implementations)
+                {
+                    fixedpoint::setImplementation(implementation);
+                    if (fixedpoint::getImplementation() != implementation)
+                        continue; // not built here
+                    
+                    Mat gray;
+                    const double ms = averageMs(runs, [&]{ fixedpoint::convertToGray(frame, scale, gray); });
+                    if (implementation == fixedpoint::IMPL_SCALAR)
+                        scalar = gray.clone();
+                    
+                    // The scalar kernel against OpenCV, bit exact at scale 1 only since the bilinear filters round differently,
+                    // the others against the scalar kernel
+                    const double difference = maxDifference(gray, implementation == fixedpoint::IMPL_SCALAR ? expected : scalar);
+                    numMismatches += (scale == 1 || implementation != fixedpoint::IMPL_SCALAR) && difference > 0;
+                    printf("%-22s %-10s %12.3f %10.2f %12.0f\n", "", fixedpoint::getImplementationName(implementation), ms, referenceMs / ms, difference);
+                }
+            }
+        }
+    }
+    
+    // Frame warped to a 640x480 pattern, as by the warp refinement
+    printf("\n%-22s %-10s %12s %10s %12s\n", "warp", "kernel", "time (ms)", "speedup", "max diff");
+    for (Size frameSize : frameSizes)
+    {
+        const Mat frame = syntheticFrame(frameSize, CV_8UC1, rng);
+        const Size patternSize(640, 480);
+        std::vector<Point2f> corners(4), quad(4);
+        corners[0] = Point2f(0, 0); corners[1] = Point2f(patternSize.width, 0);
+        corners[2] = Point2f(patternSize.width, patternSize.height); corners[3] = Point2f(0, patternSize.height);
+        for (int i = 0; i < 4; i++)
+            quad[i] = Point2f(frameSize.width * (0.2f + 0.6f * (i == 1 || i == 2)), frameSize.height * (0.2f + 0.6f * (i >= 2)))
+                    + Point2f(rng.uniform(-20.f, 20.f), rng.uniform(-20.f, 20.f));
+        const Mat homography = getPerspectiveTransform(corners, quad);
+        
+        Mat cubic, linear;
+        const double cubicMs = averageMs(runs, [&]{ warpPerspective(frame, cubic, homography, patternSize, WARP_INVERSE_MAP | INTER_CUBIC); });
+        const double linearMs = averageMs(runs, [&]{ warpPerspective(frame, linear, homography, patternSize, WARP_INVERSE_MAP | INTER_LINEAR); });
+        
+        char name[32];
+        snprintf(name, sizeof(name), "%dx%d", frameSize.width, frameSize.height);
+        printf("%-22s %-10s %12.3f %10.2f %12.0f\n", name, "cubic", cubicMs, 1., 0.);
+        printf("%-22s %-10s %12.3f %10.2f %12.0f\n", "", "linear", linearMs, cubicMs / linearMs, maxDifference(linear, cubic));
+        
+        Mat scalar;
+        for (auto implementation : implementations)
+        {
+            fixedpoint::setImplementation(implementation);
+            if (fixedpoint::getImplementation() != implementation)
+                continue;
+            
+            Mat warped;
+            const double ms = averageMs(runs, [&]{ fixedpoint::warpPerspective(frame, warped, homography, patternSize); });
+            if (implementation == fixedpoint::IMPL_SCALAR)
+                scalar = warped.clone();
+            
+            // The scalar kernel against OpenCV's bilinear warp, which rounds the positions differently, the others against the scalar kernel
+            const double difference = maxDifference(warped, implementation == fixedpoint::IMPL_SCALAR ? linear : scalar);
+            numMismatches += implementation != fixedpoint::IMPL_SCALAR && difference > 0;
+            printf("%-22s %-10s %12.3f %10.2f %12.0f\n", "", fixedpoint::getImplementationName(implementation), ms, cubicMs / ms, difference);
+        }
+    }
+    
+    fixedpoint::setImplementation(fixedpoint::getBestImplementation());
+    printf("\n%d mismatches\n", numMismatches);
+    return numMismatches ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+//
+//  matchers.cpp
+//
+//  Compare recall & per-frame matching time of the descriptor matcher backends
+//  on synthetic 256 bits descriptors, for growing numbers of train descriptors.
+//
+//  Each frame has 500 query descriptors: half of them are noisy copies of train
+//  descriptors, the other half are random. The recall is the proportion of the
+//  exact (brute force) ratio test survivors that are also reported by the backend,
+//  the false survivors those reported by the backend that the exact ratio test rejects.
+//
+//  usage : matchers [noise bits = 30] [frames = 20]
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+using namespace cv;
+
+namespace {
+    
+    const int numQueries = 500;
+    const int descriptorsPerPattern = 500;
+    
+    void randomDescriptors(Mat& descriptors, int rows, RNG& rng)
+    {
+        descriptors.create(rows, 32, CV_8U);
+        for (int i = 0; i < rows; i++)
+            for (int j = 0; j < 32; j++)
+                descriptors.at<uchar>(i, j) = (uchar)rng.uniform(0, 256);
+    }
+    
+    // Same ratio test as PatternTracker::getMatches()
+    void ratioTest(const std::vector< std::vector<DMatch> >& knnMatches, std::map<int, DMatch>& survivors)
+    {
+        survivors.clear();
+        for (size_t i = 0; i < knnMatches.size(); i++)
+        {
+            if (knnMatches[i].size() < 2)
+                continue;
+            if (knnMatches[i][0].distance / knnMatches[i][1].distance < 1.f / 1.5f)
+                survivors[knnMatches[i][0].queryIdx] = knnMatches[i][0];
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int noiseBits = argc > 1 ? atoi(argv[1]) : 30;
+    const int numFrames = argc > 2 ? atoi(argv[2]) : 20;
+    const int trainSizes[] = { 500, 5000, 50000 };
+    const MatcherType matcherTypes[] = { MATCHER_BRUTEFORCE, MATCHER_PACKED_HAMMING, MATCHER_FLANN_LSH, MATCHER_MULTI_INDEX_HASH };
+    const char* matcherNames[] = { "bruteforce", "packed_hamming", "flann_lsh", "multi_index_hash" };
+    const int numMatchers = sizeof(matcherTypes) / sizeof(matcherTypes[0]);
+    
+    RNG rng(0x5eed);
+    
+    printf("noise=%d bits, %d queries/frame, %d frames\n", noiseBits, numQueries, numFrames);
+    printf("%-18s %8s %12s %12s %8s %8s\n", "matcher", "train", "train (ms)", "frame (ms)", "recall", "false");
+    
+    for (int trainSize : trainSizes)
+    {
+        // Train descriptors, split in patterns like PatternDatabase does
+        std::vector<Mat> train;
+        for (int n = 0; n < trainSize; n += descriptorsPerPattern)
+        {
+            train.push_back(Mat());
+            randomDescriptors(train.back(), std::min(descriptorsPerPattern, trainSize - n), rng);
+        }
+        
+        // Query frames
+        std::vector<Mat> frames(numFrames);
+        for (auto & frame : frames)
+        {
+            randomDescriptors(frame, numQueries, rng);
+            for (int i = 0; i < numQueries / 2; i++)
+            {
+                const Mat& pattern = train[rng.uniform(0, (int)train.size())];
+                pattern.row(rng.uniform(0, pattern.rows)).copyTo(frame.row(i));
+                for (int b = 0; b < noiseBits; b++)
+                {
+                    int bit = rng.uniform(0, 256);
+                    frame.at<uchar>(i, bit / 8) ^= 1 << (bit % 8);
+                }
+            }
+        }
+        
+        // Ground truth
+        std::vector< std::map<int, DMatch> > expected(numFrames);
+        {
+            Ptr<DescriptorMatcher> matcher = PatternTracker::createMatcher(MATCHER_BRUTEFORCE);
+            matcher->add(train);
+            matcher->train();
+            std::vector< std::vector<DMatch> > knnMatches;
+            for (int f = 0; f < numFrames; f++)
+            {
+                matcher->knnMatch(frames[f], knnMatches, 2);
+                ratioTest(knnMatches, expected[f]);
+            }
+        }
+        
+        for (int m = 0; m < numMatchers; m++)
+        {
+            Ptr<DescriptorMatcher> matcher = PatternTracker::createMatcher(matcherTypes[m]);
+            
+            int64 t0 = getTickCount();
+            matcher->add(train);
+            matcher->train();
+            double trainMs = (getTickCount() - t0) * 1000. / getTickFrequency();
+            
+            std::vector< std::vector<DMatch> > knnMatches;
+            std::map<int, DMatch> survivors;
+            int numExpected = 0, numFound = 0, numSurvivors = 0, numFalse = 0;
+            
+            int64 matchTicks = 0;
+            for (int f = 0; f < numFrames; f++)
+            {
+                t0 = getTickCount();
+                matcher->knnMatch(frames[f], knnMatches, 2);
+                matchTicks += getTickCount() - t0;
+                
+                ratioTest(knnMatches, survivors);
+                
+                for (auto & e : expected[f])
+                {
+                    numExpected++;
+                    auto it = survivors.find(e.first);
+                    if (it != survivors.end() && it->second.imgIdx == e.second.imgIdx && it->second.trainIdx == e.second.trainIdx)
+                        numFound++;
+                }
+                
+                // Accepted by the backend, ambiguous or another match for the exact search
+                for (auto & s : survivors)
+                {
+                    numSurvivors++;
+                    auto it = expected[f].find(s.first);
+                    if (it == expected[f].end() || it->second.imgIdx != s.second.imgIdx || it->second.trainIdx != s.second.trainIdx)
+                        numFalse++;
+                }
+            }
+            double frameMs = matchTicks * 1000. / getTickFrequency() / numFrames;
+            
+            printf("%-18s %8d %12.2f %12.3f %8.3f %8.3f\n", matcherNames[m], trainSize, trainMs, frameMs,
+                   numExpected ? (float)numFound / numExpected : 0.f, numSurvivors ? (float)numFalse / numSurvivors : 0.f);
+        }
+    }
+    
+    return 0;
+}
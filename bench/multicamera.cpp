@@ -0,0 +1,124 @@
+//
+//  multicamera.cpp
+//
+//  Throughput & latency of MultiCameraTracker on synchronized cameras, every camera
+//  receiving a frame at once, matching the frames one by one or batched together.
+//  The patterns are synthetic & the cameras see the first one drifting, each with
+//  its own phase.
+//
+//  usage : multicamera [cameras = 4] [workers = 4] [patterns = 20] [frames = 200]
+//
+
+#include "MultiCameraTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+
+using namespace cv;
+
+namespace {
+    
+    Mat syntheticPattern(Size size, uint64 seed)
+    {
+        RNG rng(seed);
+        Mat pattern(size, CV_8UC1);
+        randu(pattern, Scalar(0), Scalar(256));
+        GaussianBlur(pattern, pattern, Size(5, 5), 2);
+        for (int i = 0; i < 200; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(pattern, Rect(p.x, p.y, rng.uniform(10, 60), rng.uniform(10, 60)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return pattern;
+    }
+    
+    Mat driftingHomography(float t, Size patternSize, Size frameSize)
+    {
+        const float w = patternSize.width, h = patternSize.height;
+        const float scale = 0.5f * std::min(frameSize.width / w, frameSize.height / h);
+        const Point2f center(frameSize.width * (0.5f + 0.1f * std::sin(t)), frameSize.height * (0.5f + 0.1f * std::cos(0.7f * t)));
+        
+        std::vector<Point2f> src(4), dst(4);
+        src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+        for (int i = 0; i < 4; i++)
+            dst[i] = center + (src[i] - Point2f(w * 0.5f, h * 0.5f)) * scale * (1 + 0.05f * std::sin(t + i));
+        return getPerspectiveTransform(src, dst);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numCameras = argc > 1 ? atoi(argv[1]) : 4;
+    const int numWorkers = argc > 2 ? atoi(argv[2]) : 4;
+    const int numPatterns = argc > 3 ? atoi(argv[3]) : 20;
+    const int numFrames = argc > 4 ? atoi(argv[4]) : 200;
+    const Size frameSize(1280, 720);
+    const double latencyTarget = 33;
+    
+    std::vector<Mat> patterns(numPatterns);
+    for (int i = 0; i < numPatterns; i++)
+        patterns[i] = syntheticPattern(Size(640, 480), 0x5eed + i);
+    
+    // A short loop of frames per camera, replayed to reach numFrames
+    const int numDistinctFrames = 30;
+    std::vector< std::vector<Mat> > frames(numCameras, std::vector<Mat>(numDistinctFrames));
+    for (int c = 0; c < numCameras; c++)
+        for (int f = 0; f < numDistinctFrames; f++)
+            warpPerspective(patterns[0], frames[c][f], driftingHomography(f * 0.05f + c, patterns[0].size(), frameSize),
+                            frameSize, INTER_LINEAR, BORDER_CONSTANT, Scalar(127));
+    
+    printf("%d cameras, %d workers, %d patterns, %d frames per camera, %.0f ms latency target\n\n",
+           numCameras, numWorkers, numPatterns, numFrames, latencyTarget);
+    printf("%-10s %10s %8s %12s %12s %12s %10s\n", "batch", "fps/cam", "found", "matching", "latency p50", "latency p99", "misses");
+    
+    const int batchSizes[] = { 1, 2, numCameras };
+    for (int batchSize : batchSizes)
+    {
+        MultiCameraTracker tracker;
+        tracker.setup(MATCHER_PACKED_HAMMING);
+        for (const Mat& pattern : patterns)
+            tracker.add(pattern);
+        
+        const Mat cameraMatrix = (Mat_<double>(3, 3) << 1000, 0, 640, 0, 1000, 360, 0, 0, 1);
+        for (int c = 0; c < numCameras; c++)
+            tracker.addCamera(cameraMatrix, Mat(), latencyTarget);
+        tracker.maxBatchSize = batchSize;
+        
+        std::atomic<int> numFound(0);
+        tracker.setCallback([&](int, PatternTracker&, const MultiCameraTracker::Result& result) {
+            numFound += result.found;
+        });
+        tracker.start(numWorkers);
+        
+        // Every camera sends its frame at once, then waits for the results like a synchronized rig
+        const int64 start = getTickCount();
+        for (int f = 0; f < numFrames; f++)
+        {
+            for (int c = 0; c < numCameras; c++)
+                tracker.push(c, frames[c][f % numDistinctFrames]);
+            tracker.flush();
+        }
+        const double seconds = (getTickCount() - start) / getTickFrequency();
+        
+        double matching = 0, p50 = 0, p99 = 0;
+        unsigned long long misses = 0;
+        for (int c = 0; c < numCameras; c++)
+        {
+            TrackerProfiler::Summary summary;
+            tracker.getProfiler(c).getSummary(summary);
+            matching += summary.stages[TrackerProfiler::STAGE_MATCHING].mean / 1000 / numCameras;
+            p50 += summary.stages[TrackerProfiler::STAGE_TOTAL].p50 / 1000 / numCameras;
+            p99 = std::max(p99, summary.stages[TrackerProfiler::STAGE_TOTAL].p99 / 1000.);
+            misses += tracker.getNumDeadlineMisses(c);
+        }
+        tracker.stop();
+        
+        char name[16];
+        snprintf(name, sizeof(name), "%d", batchSize);
+        printf("%-10s %10.1f %7.0f%% %9.2f ms %9.2f ms %9.2f ms %10llu\n", name, numFrames / seconds,
+               100. * numFound / (numFrames * numCameras), matching, p50, p99, misses);
+    }
+    
+    return 0;
+}
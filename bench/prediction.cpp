@@ -0,0 +1,301 @@
+//
+//  prediction.cpp
+//
+//  Motion-to-photon latency & error of the rendered pose, with & without cv::PosePredictor. A pattern moves
+//  along a smooth 6 dof trajectory in front of a simulated camera : each frame is rendered from the true pose
+//  at its capture time, reaches the tracker after the capture latency and is tracked by PatternTracker, the
+//  tracker dropping the frames it has no time for. The time spent tracking & solving the pose is measured,
+//  the rest of the timeline is simulated. A display refreshing faster than the camera shows, at each refresh,
+//  either the last pose or the pose predicted for the time the refresh reaches the screen.
+//
+//  Reports the motion-to-photon latency of the rendered poses (capture of their frame to photons), the distance
+//  between the corners they project & those of the true pose when the photons are out, and the refreshes that
+//  repeat the previous pose. Then the cost of a prediction, alone & while another thread keeps updating.
+//
+//  usage : prediction [seconds = 10] [camera fps = 30] [display Hz = 60] [capture latency ms = 20] [display latency ms = 10]
+//
+
+#include "PatternTracker.h"
+#include "PosePredictor.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace cv;
+
+namespace {
+    
+    const Size frameSize(640, 480), patternSize(640, 480);
+    const Matx33d cameraMatrix(700, 0, 320, 0, 700, 240, 0, 0, 1);
+    
+    Mat texture(Size size, uint64 seed)
+    {
+        RNG rng(seed);
+        Mat image(size, CV_8UC1);
+        randu(image, Scalar(0), Scalar(256));
+        GaussianBlur(image, image, Size(5, 5), 2);
+        for (int i = 0; i < size.area() / 2000; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(image, Rect(p.x, p.y, rng.uniform(10, 80), rng.uniform(10, 80)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return image;
+    }
+    
+    /**
+     * True pose at t seconds, in the normalized pattern coordinates of PatternTracker, a head moving about
+     */
+    void trajectory(double t, Matx33d& rotation, Vec3d& translation)
+    {
+        const Vec3d rvec(0.25 * std::sin(1.3 * t), 0.35 * std::sin(0.9 * t + 0.5), 0.3 * std::sin(0.7 * t));
+        Rodrigues(rvec, rotation);
+        translation = Vec3d(0.4 * std::sin(0.8 * t), 0.25 * std::sin(1.1 * t + 1), 4 + 0.6 * std::sin(0.5 * t));
+    }
+    
+    /**
+     * Corners of the pattern seen with a pose
+     */
+    void project(const Matx33d& rotation, const Vec3d& translation, Point2f corners[4])
+    {
+        const float maxSize = std::max(patternSize.width, patternSize.height);
+        const float w = patternSize.width / maxSize, h = patternSize.height / maxSize;
+        const Vec3d points[4] = { Vec3d(-w, -h, 0), Vec3d(w, -h, 0), Vec3d(w, h, 0), Vec3d(-w, h, 0) };
+        for (int i = 0; i < 4; i++)
+        {
+            const Vec3d p = cameraMatrix * (rotation * points[i] + translation);
+            corners[i] = Point2f(p[0] / p[2], p[1] / p[2]);
+        }
+    }
+    
+    float cornerError(const Matx33d& rotation, const Vec3d& translation, const Matx33d& trueRotation, const Vec3d& trueTranslation)
+    {
+        Point2f corners[4], trueCorners[4];
+        project(rotation, translation, corners);
+        project(trueRotation, trueTranslation, trueCorners);
+        float error = 0;
+        for (int i = 0; i < 4; i++)
+            error += norm(corners[i] - trueCorners[i]) / 4;
+        return error;
+    }
+    
+    Mat render(const Mat& pattern, const Mat& background, const Matx33d& rotation, const Vec3d& translation)
+    {
+        // Pattern pixels to the normalized plane, then to the frame
+        const double maxSize = std::max(pattern.cols, pattern.rows);
+        const Matx33d toPlane(2 / maxSize, 0, -pattern.cols / maxSize, 0, 2 / maxSize, -pattern.rows / maxSize, 0, 0, 1);
+        const Matx33d plane(rotation(0, 0), rotation(0, 1), translation[0],
+                            rotation(1, 0), rotation(1, 1), translation[1],
+                            rotation(2, 0), rotation(2, 1), translation[2]);
+        const Matx33d homography = cameraMatrix * plane * toPlane;
+        
+        Mat frame = background.clone();
+        warpPerspective(pattern, frame, Mat(homography), frameSize, INTER_LINEAR, BORDER_TRANSPARENT);
+        Mat noise(frameSize, CV_16SC1);
+        randn(noise, Scalar(0), Scalar(3));
+        add(frame, noise, frame, noArray(), CV_8U);
+        return frame;
+    }
+    
+    int64 toTicks(double seconds)
+    {
+        return (int64)(seconds * getTickFrequency());
+    }
+    
+    /**
+     * A pose as it comes out of the tracker
+     */
+    struct Sample
+    {
+        double captureTime;
+        double availableTime;
+        Pose pose;
+        Matx33d rotation;
+        Vec3d translation;
+    };
+    
+    /**
+     * Rendered poses of one strategy
+     */
+    struct Rendering
+    {
+        Rendering() : numRepeats(0), hasLast(false) {}
+        
+        void add(double latency, float error, const Matx33d& rotation, const Vec3d& translation)
+        {
+            latencies.push_back(latency * 1000);
+            errors.push_back(error);
+            numRepeats += hasLast && rotation == lastRotation && translation == lastTranslation;
+            lastRotation = rotation;
+            lastTranslation = translation;
+            hasLast = true;
+        }
+        
+        std::vector<float> latencies, errors;
+        int numRepeats;
+        bool hasLast;
+        Matx33d lastRotation;
+        Vec3d lastTranslation;
+    };
+    
+    float percentile(std::vector<float> values, double p)
+    {
+        if (values.empty())
+            return 0;
+        
+        const size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const double duration = argc > 1 ? atof(argv[1]) : 10;
+    const double cameraFps = argc > 2 ? atof(argv[2]) : 30;
+    const double displayHz = argc > 3 ? atof(argv[3]) : 60;
+    const double captureLatency = (argc > 4 ? atof(argv[4]) : 20) / 1000;
+    const double displayLatency = (argc > 5 ? atof(argv[5]) : 10) / 1000;
+    
+    const Mat pattern = texture(patternSize, 0x5eed);
+    const Mat background = texture(frameSize, 0xbac6);
+    
+    PatternTracker tracker;
+    tracker.setup(MATCHER_PACKED_HAMMING);
+    tracker.add(pattern);
+    tracker.getDatabase().train();
+    
+    // Tracking timeline : the tracker takes the newest frame that reached it once it's done with the previous one
+    std::vector<Sample> samples;
+    std::vector<float> trackingTimes;
+    const int numFrames = duration * cameraFps;
+    double trackerFree = 0;
+    int numDropped = 0, numFound = 0;
+    for (int f = 0; f < numFrames; f++)
+    {
+        const double captureTime = f / cameraFps;
+        const double start = std::max(trackerFree, captureTime + captureLatency);
+        if (f + 1 < numFrames && (f + 1) / cameraFps + captureLatency <= start)
+        {
+            numDropped++;
+            continue;
+        }
+        
+        Sample sample;
+        sample.captureTime = captureTime;
+        Matx33d rotation;
+        Vec3d translation;
+        trajectory(captureTime, rotation, translation);
+        const Mat frame = render(pattern, background, rotation, translation);
+        
+        const int64 trackingStart = getTickCount();
+        tracker.find(frame, PIXEL_FORMAT_AUTO, toTicks(captureTime));
+        sample.pose = tracker.getPose(Mat(cameraMatrix), Mat());
+        const double trackingTime = (getTickCount() - trackingStart) / getTickFrequency();
+        
+        trackingTimes.push_back(trackingTime * 1000);
+        sample.availableTime = trackerFree = start + trackingTime;
+        if (sample.pose.found)
+        {
+            Mat rvec, tvec;
+            sample.pose.rvec.convertTo(rvec, CV_64F);
+            sample.pose.tvec.convertTo(tvec, CV_64F);
+            Rodrigues(rvec, sample.rotation);
+            sample.translation = Vec3d(tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2));
+            numFound++;
+        }
+        samples.push_back(sample);
+    }
+    
+    printf("%.0f s, camera %.0f fps, display %.0f Hz, capture latency %.0f ms, display latency %.0f ms\n",
+           duration, cameraFps, displayHz, captureLatency * 1000, displayLatency * 1000);
+    printf("%d frames tracked, %d dropped, %d found, tracking p50 %.1f ms, p99 %.1f ms\n\n", (int)samples.size(), numDropped, numFound,
+           percentile(trackingTimes, 0.5), percentile(trackingTimes, 0.99));
+    
+    // Display timeline : each refresh shows the poses available when it starts, its photons are out displayLatency later
+    PosePredictor velocity, acceleration;
+    acceleration.motionModel = PosePredictor::MOTION_CONSTANT_ACCELERATION;
+    Rendering last, predicted, predictedAcceleration;
+    const Sample* lastFound = 0;
+    size_t nextSample = 0;
+    for (int r = 0; r / displayHz < duration; r++)
+    {
+        const double refreshTime = r / displayHz, photonTime = refreshTime + displayLatency;
+        for (; nextSample < samples.size() && samples[nextSample].availableTime <= refreshTime; nextSample++)
+        {
+            const Sample& sample = samples[nextSample];
+            velocity.update(sample.pose);
+            acceleration.update(sample.pose);
+            if (sample.pose.found)
+                lastFound = &sample;
+        }
+        if (!lastFound)
+            continue;
+        
+        Matx33d trueRotation;
+        Vec3d trueTranslation;
+        trajectory(photonTime, trueRotation, trueTranslation);
+        const double latency = photonTime - lastFound->captureTime;
+        last.add(latency, cornerError(lastFound->rotation, lastFound->translation, trueRotation, trueTranslation),
+                 lastFound->rotation, lastFound->translation);
+        
+        // The last pose while the pattern is lost
+        PosePredictor* predictors[] = { &velocity, &acceleration };
+        Rendering* renderings[] = { &predicted, &predictedAcceleration };
+        for (int p = 0; p < 2; p++)
+        {
+            Matx33d rotation = lastFound->rotation;
+            Vec3d translation = lastFound->translation;
+            predictors[p]->predict(toTicks(photonTime), rotation, translation);
+            renderings[p]->add(latency, cornerError(rotation, translation, trueRotation, trueTranslation), rotation, translation);
+        }
+    }
+    
+    printf("%-22s %10s %10s %12s %12s %12s %10s\n", "rendered pose", "m2p p50", "m2p p99", "error p50", "error p99", "error max", "repeats");
+    const char* names[] = { "last", "predicted velocity", "predicted accel" };
+    const Rendering* renderings[] = { &last, &predicted, &predictedAcceleration };
+    for (int p = 0; p < 3; p++)
+    {
+        const Rendering& rendering = *renderings[p];
+        printf("%-22s %8.1fms %8.1fms %10.2fpx %10.2fpx %10.2fpx %9.0f%%\n", names[p],
+               percentile(rendering.latencies, 0.5), percentile(rendering.latencies, 0.99),
+               percentile(rendering.errors, 0.5), percentile(rendering.errors, 0.99), percentile(rendering.errors, 1),
+               100. * rendering.numRepeats / std::max<size_t>(1, rendering.errors.size()));
+    }
+    
+    // Cost of a prediction, alone & while another thread updates the predictor as fast as it can
+    const int numPredictions = 1000000;
+    std::vector<Pose> poses;
+    for (const auto & sample : samples)
+        if (sample.pose.found)
+            poses.push_back(sample.pose);
+    if (poses.empty())
+        return 0;
+    
+    PosePredictor predictor;
+    predictor.update(poses[0]);
+    Matx33d rotation;
+    Vec3d translation;
+    int64 start = getTickCount();
+    for (int i = 0; i < numPredictions; i++)
+        predictor.predict(poses[0].ticks + i, rotation, translation);
+    const double aloneNs = (getTickCount() - start) * 1e9 / getTickFrequency() / numPredictions;
+    
+    std::atomic<bool> stop(false);
+    std::thread updater([&]
+    {
+        for (size_t i = 0; !stop.load(std::memory_order_relaxed); i++)
+            predictor.update(poses[i % poses.size()]);
+    });
+    start = getTickCount();
+    for (int i = 0; i < numPredictions; i++)
+        predictor.predict(poses[0].ticks + i, rotation, translation);
+    const double contendedNs = (getTickCount() - start) * 1e9 / getTickFrequency() / numPredictions;
+    stop = true;
+    updater.join();
+    
+    printf("\nprediction %.0f ns, %.0f ns while updated %llu times\n", aloneNs, contendedNs, predictor.getNumUpdates());
+    return 0;
+}
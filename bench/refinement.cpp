@@ -0,0 +1,124 @@
+//
+//  refinement.cpp
+//
+//  Accuracy & per-stage cost of the homography refinement methods, on frames
+//  showing a pattern under known random homographies.
+//
+//  usage : refinement [pattern image path] [frames = 50]
+//  Without image, a synthetic textured pattern is used.
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cv;
+
+namespace {
+    
+    Mat syntheticPattern(Size size)
+    {
+        RNG rng(0x5eed);
+        Mat pattern(size, CV_8UC1);
+        randu(pattern, Scalar(0), Scalar(256));
+        GaussianBlur(pattern, pattern, Size(5, 5), 2);
+        for (int i = 0; i < 200; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(pattern, Rect(p.x, p.y, rng.uniform(10, 60), rng.uniform(10, 60)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return pattern;
+    }
+    
+    // Pattern seen from a random viewpoint, roughly centered in the frame
+    Mat randomHomography(RNG& rng, Size patternSize, Size frameSize)
+    {
+        const float w = patternSize.width, h = patternSize.height;
+        const float scale = 0.5f * std::min(frameSize.width / w, frameSize.height / h);
+        const Point2f center(frameSize.width * 0.5f, frameSize.height * 0.5f);
+        
+        std::vector<Point2f> src(4), dst(4);
+        src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+        for (int i = 0; i < 4; i++)
+        {
+            Point2f jitter(rng.uniform(-0.1f, 0.1f) * w * scale, rng.uniform(-0.1f, 0.1f) * h * scale);
+            dst[i] = center + (src[i] - Point2f(w * 0.5f, h * 0.5f)) * scale + jitter;
+        }
+        return getPerspectiveTransform(src, dst);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 2 ? atoi(argv[2]) : 50;
+    const Size frameSize(1280, 720);
+    
+    Mat pattern;
+    if (argc > 1)
+        pattern = imread(argv[1], IMREAD_GRAYSCALE);
+    if (pattern.empty())
+        pattern = syntheticPattern(Size(640, 480));
+    
+    // The same frames for every method
+    RNG rng(42);
+    std::vector<Mat> frames(numFrames), homographies(numFrames);
+    for (int f = 0; f < numFrames; f++)
+    {
+        homographies[f] = randomHomography(rng, pattern.size(), frameSize);
+        warpPerspective(pattern, frames[f], homographies[f], frameSize, INTER_LINEAR, BORDER_CONSTANT, Scalar(127));
+        Mat noise(frameSize, CV_16SC1);
+        randn(noise, Scalar(0), Scalar(4));
+        add(frames[f], noise, frames[f], noArray(), CV_8U);
+    }
+    
+    std::vector<Point2f> corners(4), expected;
+    corners[0] = Point2f(0, 0);
+    corners[1] = Point2f(pattern.cols, 0);
+    corners[2] = Point2f(pattern.cols, pattern.rows);
+    corners[3] = Point2f(0, pattern.rows);
+    
+    const char* names[] = { "none", "warp", "inliers lm", "patch" };
+    
+    printf("%-12s %6s %12s %10s %10s %10s %10s %10s\n", "refinement", "found", "error (px)", "extract", "match", "ransac", "refine", "total");
+    
+    for (int method = -1; method <= REFINEMENT_PATCH_ALIGNMENT; method++)
+    {
+        PatternTracker tracker;
+        tracker.setup();
+        tracker.add(pattern);
+        tracker.enableHomographyRefinement = method >= 0;
+        if (method >= 0)
+            tracker.refinementMethod = (RefinementMethod)method;
+        
+        tracker.find(frames[0]); // warm up & train the matcher
+        
+        int numFound = 0;
+        double error = 0;
+        StageTimings sum;
+        for (int f = 0; f < numFrames; f++)
+        {
+            if (tracker.find(frames[f]))
+            {
+                perspectiveTransform(corners, expected, homographies[f]);
+                for (int i = 0; i < 4; i++)
+                    error += norm(tracker.getQuad()[i] - expected[i]) / 4;
+                numFound++;
+            }
+            
+            const StageTimings& t = tracker.getTimings();
+            sum.detection  += t.detection + t.description;
+            sum.matching   += t.matching;
+            sum.estimation += t.estimation;
+            sum.refinement += t.refinement;
+            sum.total      += t.total;
+        }
+        
+        printf("%-12s %6d %12.3f %10.2f %10.2f %10.2f %10.2f %10.2f\n", names[method + 1], numFound,
+               numFound ? error / numFound : 0.,
+               sum.detection / numFrames, sum.matching / numFrames, sum.estimation / numFrames,
+               sum.refinement / numFrames, sum.total / numFrames);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,581 @@
+//
+//  replay.cpp
+//
+//  Headless replay of a frame sequence through PatternTracker, reporting throughput,
+//  per-stage latency percentiles, detection rate & corner error as JSON.
+//
+//  usage : replay --pattern <image> [--pattern <image> ...] [source] [options]
+//
+//  sources :
+//  --synthetic <frames>  the patterns warped on a textured background along a smooth
+//                        trajectory, one after the other, with known quads (default, 300 frames)
+//  --video <file>        any file or device cv::VideoCapture can open
+//  --images <directory>  the images of a directory, in name order
+//  --truth <file>        ground truth of a video or images, one line per frame :
+//                        "<frame from 0> <pattern index or -1> x0 y0 x1 y1 x2 y2 x3 y3"
+//
+//  options :
+//  --size <w>x<h>        synthetic frame size (1280x720)
+//  --frames <n>          stop after n frames
+//  --rescale <f>         PatternTracker::rescale
+//  --no-ratio-test       disable PatternTracker::enableRatioTest
+//  --refinement <none|warp|lm|patch>
+//  --matcher <bruteforce|packed|lsh|mih>
+//  --backend <name>      feature backend of the registry, see FeatureBackend::getNames() (orb)
+//  --estimator <ransac|prosac>  PatternTracker::homographyMethod
+//  --flow                enable the optical flow tracking
+//  --roi                 enable the search window prediction
+//  --threads <n>         feature extraction threads
+//  --pipeline <workers>  run the frames through a PipelinedTracker, the total stage being
+//                        the latency from push to integration
+//  --budget <ms>         adapt the operating point with a QualityController to hold the
+//                        p95 frame time under the budget, without --pipeline
+//  --json <file>         write the report there instead of stdout
+//  --trace <file>        record the frames into a trace for the replayTrace tool, without --pipeline
+//
+
+#include "PatternTracker.h"
+#include "PipelinedTracker.h"
+#include "QualityController.h"
+#include "TrackerTrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+using namespace cv;
+
+namespace {
+    
+    /**
+     * Expected location of a pattern in a frame, patternIdx is -1 when there's none
+     */
+    struct GroundTruth
+    {
+        GroundTruth() : patternIdx(-1) {}
+        int patternIdx;
+        std::vector<Point2f> quad;
+    };
+    
+    class FrameSource
+    {
+    public:
+        virtual ~FrameSource() {}
+        virtual bool next(Mat& frame, GroundTruth& truth) = 0;
+        virtual bool hasTruth() const = 0;
+    };
+    
+    Mat texture(Size size, uint64 seed)
+    {
+        RNG rng(seed);
+        Mat image(size, CV_8UC1);
+        randu(image, Scalar(0), Scalar(256));
+        GaussianBlur(image, image, Size(5, 5), 2);
+        for (int i = 0; i < size.area() / 2000; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(image, Rect(p.x, p.y, rng.uniform(10, 80), rng.uniform(10, 80)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return image;
+    }
+    
+    /**
+     * Each pattern in turn for 120 frames, moving smoothly, followed by 20 frames without any
+     */
+    class SyntheticSource : public FrameSource
+    {
+    public:
+        SyntheticSource(const std::vector<Mat>& patterns, Size size, int numFrames)
+        : m_patterns(patterns), m_size(size), m_numFrames(numFrames), m_frame(0)
+        {
+            m_background = texture(size, 0xbac6);
+        }
+        
+        bool next(Mat& frame, GroundTruth& truth)
+        {
+            if (m_frame >= m_numFrames)
+                return false;
+            
+            const int segment = 140, visible = 120;
+            const int index = m_frame++;
+            const int f = index % segment;
+            
+            m_background.copyTo(frame);
+            truth = GroundTruth();
+            
+            if (f < visible)
+            {
+                truth.patternIdx = (index / segment) % m_patterns.size();
+                const Mat& pattern = m_patterns[truth.patternIdx];
+                
+                // Smooth trajectory : the pattern drifts around the center, zooms & tilts
+                const float t = f / (float)visible * 2 * CV_PI;
+                const float w = pattern.cols, h = pattern.rows;
+                const float scale = (0.45f + 0.1f * std::sin(t * 1.5f)) * std::min(m_size.width / w, m_size.height / h);
+                const Point2f center(m_size.width * (0.5f + 0.15f * std::sin(t)), m_size.height * (0.5f + 0.1f * std::sin(2 * t)));
+                const float angle = 0.3f * std::sin(t * 0.7f);
+                const float tilt = 0.15f * std::sin(t * 1.3f);
+                
+                std::vector<Point2f> src(4), dst(4);
+                src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+                for (int i = 0; i < 4; i++)
+                {
+                    Point2f p = (src[i] - Point2f(w * 0.5f, h * 0.5f)) * scale;
+                    p.x *= 1 + (i == 1 || i == 2 ? tilt : -tilt);   // keystone
+                    dst[i] = center + Point2f(p.x * std::cos(angle) - p.y * std::sin(angle), p.x * std::sin(angle) + p.y * std::cos(angle));
+                }
+                truth.quad = dst;
+                
+                Mat gray;
+                if (pattern.channels() == 3)
+                    cvtColor(pattern, gray, CV_BGR2GRAY);
+                else
+                    gray = pattern;
+                warpPerspective(gray, frame, getPerspectiveTransform(src, dst), m_size, INTER_LINEAR, BORDER_TRANSPARENT);
+            }
+            
+            Mat noise(m_size, CV_16SC1);
+            randn(noise, Scalar(0), Scalar(4));
+            add(frame, noise, frame, noArray(), CV_8U);
+            return true;
+        }
+        
+        bool hasTruth() const { return true; }
+    
+    private:
+        std::vector<Mat> m_patterns;
+        Size m_size;
+        int m_numFrames;
+        int m_frame;
+        Mat m_background;
+    };
+    
+    /**
+     * Video file, device or directory of images, with an optional ground truth file
+     */
+    class RecordedSource : public FrameSource
+    {
+    public:
+        RecordedSource() : m_frame(0) {}
+        
+        bool openVideo(const std::string& path) { return m_capture.open(path); }
+        
+        bool openImages(const std::string& directory)
+        {
+            glob(directory + "/*", m_files);
+            std::sort(m_files.begin(), m_files.end());
+            return !m_files.empty();
+        }
+        
+        bool openTruth(const std::string& path)
+        {
+            std::ifstream file(path.c_str());
+            if (!file)
+                return false;
+            
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream fields(line);
+                int frame;
+                GroundTruth truth;
+                if (!(fields >> frame >> truth.patternIdx))
+                    continue;
+                if (truth.patternIdx >= 0)
+                {
+                    truth.quad.resize(4);
+                    for (auto & p : truth.quad)
+                        fields >> p.x >> p.y;
+                }
+                m_truth[frame] = truth;
+            }
+            return true;
+        }
+        
+        bool next(Mat& frame, GroundTruth& truth)
+        {
+            if (m_capture.isOpened())
+            {
+                if (!m_capture.read(frame))
+                    return false;
+            }
+            else
+            {
+                if (m_frame >= (int)m_files.size())
+                    return false;
+                frame = imread(m_files[m_frame]);
+            }
+            
+            auto it = m_truth.find(m_frame++);
+            truth = it != m_truth.end() ? it->second : GroundTruth();
+            return !frame.empty();
+        }
+        
+        bool hasTruth() const { return !m_truth.empty(); }
+    
+    private:
+        VideoCapture m_capture;
+        std::vector<std::string> m_files;
+        std::map<int, GroundTruth> m_truth;
+        int m_frame;
+    };
+    
+    /**
+     * Tracking paths, detection rate & corner error of the replayed frames
+     */
+    struct Evaluation
+    {
+        Evaluation()
+        : numFrames(0), numExpected(0), numDetected(0), numWrongPattern(0), numFalsePositives(0)
+        , numDetectionPath(0), numFlowPath(0) {}
+        
+        void add(const PatternTracker& tracker, const GroundTruth& truth, bool hasTruth)
+        {
+            numFrames++;
+            if (tracker.getLastPath() == TRACKING_PATH_OPTICAL_FLOW)
+                numFlowPath++;
+            else
+                numDetectionPath++;
+            
+            if (!hasTruth)
+                return;
+            
+            const bool found = tracker.getFrame().found;
+            if (truth.patternIdx < 0)
+            {
+                numFalsePositives += found;
+                return;
+            }
+            
+            numExpected++;
+            if (!found)
+                return;
+            
+            if (tracker.getInfo().patternIdx != truth.patternIdx)
+            {
+                numWrongPattern++;
+                return;
+            }
+            
+            numDetected++;
+            float error = 0;
+            for (int i = 0; i < 4; i++)
+                error += norm(tracker.getQuad()[i] - truth.quad[i]) / 4;
+            cornerErrors.push_back(error);
+        }
+        
+        int numFrames, numExpected, numDetected, numWrongPattern, numFalsePositives;
+        int numDetectionPath, numFlowPath;
+        std::vector<float> cornerErrors;
+    };
+    
+    void printPercentiles(FILE* out, const char* indent, const char* name, const TrackerProfiler::Percentiles& p, bool last)
+    {
+        fprintf(out, "%s\"%s\": { \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f }%s\n",
+                indent, name, p.mean, p.p50, p.p90, p.p99, p.max, last ? "" : ",");
+    }
+    
+    void usage(const char* name)
+    {
+        fprintf(stderr, "usage : %s --pattern <image> [--pattern <image> ...] [--synthetic <frames> | --video <file> | --images <directory>]\n"
+                        "       [--truth <file>] [--size <w>x<h>] [--frames <n>] [--rescale <f>] [--no-ratio-test]\n"
+                        "       [--refinement none|warp|lm|patch] [--matcher bruteforce|packed|lsh|mih] [--backend <name>]\n"
+                        "       [--estimator ransac|prosac] [--flow] [--roi] [--threads <n>] [--pipeline <workers> | --budget <ms>] [--json <file>]\n"
+                        "       [--trace <file>]\n", name);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> patternFiles;
+    std::string video, images, truthFile, jsonFile, traceFile;
+    int syntheticFrames = 300, maxFrames = -1, numThreads = 1, numWorkers = 0;
+    Size size(1280, 720);
+    float rescale = 1;
+    double budget = 0;
+    bool ratioTest = true, flow = false, roi = false;
+    std::string refinement = "warp", matcher = "packed", backend = "orb", estimator = "ransac";
+    
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--pattern" && hasValue) patternFiles.push_back(argv[++i]);
+        else if (arg == "--synthetic" && hasValue) syntheticFrames = atoi(argv[++i]);
+        else if (arg == "--video" && hasValue) video = argv[++i];
+        else if (arg == "--images" && hasValue) images = argv[++i];
+        else if (arg == "--truth" && hasValue) truthFile = argv[++i];
+        else if (arg == "--size" && hasValue) sscanf(argv[++i], "%dx%d", &size.width, &size.height);
+        else if (arg == "--frames" && hasValue) maxFrames = atoi(argv[++i]);
+        else if (arg == "--rescale" && hasValue) rescale = atof(argv[++i]);
+        else if (arg == "--no-ratio-test") ratioTest = false;
+        else if (arg == "--refinement" && hasValue) refinement = argv[++i];
+        else if (arg == "--matcher" && hasValue) matcher = argv[++i];
+        else if (arg == "--backend" && hasValue) backend = argv[++i];
+        else if (arg == "--estimator" && hasValue) estimator = argv[++i];
+        else if (arg == "--flow") flow = true;
+        else if (arg == "--roi") roi = true;
+        else if (arg == "--threads" && hasValue) numThreads = atoi(argv[++i]);
+        else if (arg == "--pipeline" && hasValue) numWorkers = atoi(argv[++i]);
+        else if (arg == "--budget" && hasValue) budget = atof(argv[++i]);
+        else if (arg == "--json" && hasValue) jsonFile = argv[++i];
+        else if (arg == "--trace" && hasValue) traceFile = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (patternFiles.empty() || (budget > 0 && numWorkers > 0) || (!traceFile.empty() && numWorkers > 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    MatcherType matcherType = MATCHER_PACKED_HAMMING;
+    if (matcher == "bruteforce") matcherType = MATCHER_BRUTEFORCE;
+    else if (matcher == "lsh") matcherType = MATCHER_FLANN_LSH;
+    else if (matcher == "mih") matcherType = MATCHER_MULTI_INDEX_HASH;
+    
+    // Without --pipeline, the tracker is driven directly with find()
+    PipelinedTracker pipeline;
+    PatternTracker& tracker = pipeline.getTracker();
+    if (!tracker.setFeatureBackend(backend))
+    {
+        fprintf(stderr, "unknown feature backend %s\n", backend.c_str());
+        return 1;
+    }
+    tracker.setup(matcherType);
+    tracker.rescale = rescale;
+    tracker.enableRatioTest = ratioTest;
+    tracker.enableHomographyRefinement = refinement != "none";
+    tracker.refinementMethod = refinement == "lm" ? REFINEMENT_INLIERS_LM : refinement == "patch" ? REFINEMENT_PATCH_ALIGNMENT : REFINEMENT_WARP;
+    tracker.homographyMethod = estimator == "prosac" ? HOMOGRAPHY_PROSAC : HOMOGRAPHY_RANSAC;
+    tracker.enableOpticalFlowTracking = flow;
+    tracker.enableRoiPrediction = roi;
+    tracker.numExtractionThreads = numThreads;
+    
+    std::vector<Mat> patterns;
+    for (const std::string& file : patternFiles)
+    {
+        Mat pattern = imread(file);
+        if (pattern.empty())
+        {
+            fprintf(stderr, "couldn't read %s\n", file.c_str());
+            return 1;
+        }
+        patterns.push_back(pattern);
+        tracker.add(pattern, file);
+    }
+    
+    std::unique_ptr<FrameSource> source;
+    std::string sourceName;
+    if (!video.empty() || !images.empty())
+    {
+        RecordedSource* recorded = new RecordedSource();
+        source.reset(recorded);
+        sourceName = video.empty() ? images : video;
+        if (video.empty() ? !recorded->openImages(images) : !recorded->openVideo(video))
+        {
+            fprintf(stderr, "couldn't open %s\n", sourceName.c_str());
+            return 1;
+        }
+        if (!truthFile.empty() && !recorded->openTruth(truthFile))
+        {
+            fprintf(stderr, "couldn't read %s\n", truthFile.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        source.reset(new SyntheticSource(patterns, size, syntheticFrames));
+        sourceName = "synthetic";
+    }
+    
+    // Percentiles over the whole replay, up to 65536 frames
+    TrackerProfiler profiler(1 << 16);
+    
+    Evaluation evaluation;
+    int64 trackingTicks = 0;
+    
+    // Frames run at each point of the ladder & exact percentile of the frame times with --budget
+    QualityController quality;
+    std::vector<int> framesPerLevel;
+    std::vector<float> frameTimes;
+    if (budget > 0)
+    {
+        quality.setup(tracker, budget);
+        framesPerLevel.resize(quality.ladder.size());
+    }
+    
+    // Lossless frames, so that the replay of the trace gives the same results
+    TraceWriter trace;
+    TraceWriter::Options traceOptions;
+    traceOptions.encoding = TraceWriter::FRAMES_RAW;
+    if (!traceFile.empty() && !trace.open(traceFile, tracker, traceOptions))
+    {
+        fprintf(stderr, "couldn't write %s\n", traceFile.c_str());
+        return 1;
+    }
+    
+    Mat frame;
+    GroundTruth truth;
+    if (numWorkers > 0)
+    {
+        // The truths wait for their frame to come out of the pipeline
+        std::map<long long, GroundTruth> truths;
+        std::mutex truthsMutex;
+        
+        pipeline.dropOldestFrames = false;
+        pipeline.setCallback([&](PatternTracker& t)
+        {
+            profiler.record(t.getTimings(), t.getCounters());
+            
+            std::lock_guard<std::mutex> lock(truthsMutex);
+            auto it = truths.find(t.getFrame().index);
+            evaluation.add(t, it->second, source->hasTruth());
+            truths.erase(it);
+        });
+        pipeline.start(numWorkers);
+        
+        int numPushed = 0;
+        const int64 start = getTickCount();
+        while ((maxFrames < 0 || numPushed < maxFrames) && source->next(frame, truth))
+        {
+            // Only this thread pushes, the frames are indexed in push order from 0
+            {
+                std::lock_guard<std::mutex> lock(truthsMutex);
+                truths[numPushed] = truth;
+            }
+            pipeline.push(frame);
+            numPushed++;
+        }
+        pipeline.flush();
+        trackingTicks = getTickCount() - start;
+        pipeline.stop();
+    }
+    else
+    {
+        while ((maxFrames < 0 || evaluation.numFrames < maxFrames) && source->next(frame, truth))
+        {
+            const int64 start = getTickCount();
+            tracker.find(frame);
+            const int64 ticks = getTickCount() - start;
+            trackingTicks += ticks;
+            
+            profiler.record(tracker.getTimings(), tracker.getCounters());
+            trace.record(tracker, frame);
+            if (budget > 0)
+            {
+                framesPerLevel[quality.getLevel()]++;
+                frameTimes.push_back(ticks * 1000. / getTickFrequency());
+                quality.update(tracker, frameTimes.back());
+            }
+            evaluation.add(tracker, truth, source->hasTruth());
+        }
+    }
+    
+    const int numFrames = evaluation.numFrames;
+    if (numFrames == 0)
+    {
+        fprintf(stderr, "no frame to replay\n");
+        return 1;
+    }
+    
+    TrackerProfiler::Summary summary;
+    profiler.getSummary(summary);
+    
+    TrackerProfiler::Percentiles errors;
+    if (!evaluation.cornerErrors.empty())
+    {
+        std::vector<float>& cornerErrors = evaluation.cornerErrors;
+        std::sort(cornerErrors.begin(), cornerErrors.end());
+        double sum = 0;
+        for (float e : cornerErrors)
+            sum += e;
+        const size_t last = cornerErrors.size() - 1;
+        errors.mean = sum / cornerErrors.size();
+        errors.p50 = cornerErrors[last * 50 / 100];
+        errors.p90 = cornerErrors[last * 90 / 100];
+        errors.p99 = cornerErrors[last * 99 / 100];
+        errors.max = cornerErrors[last];
+    }
+    
+    const double trackingSeconds = trackingTicks / getTickFrequency();
+    
+    FILE* out = jsonFile.empty() ? stdout : fopen(jsonFile.c_str(), "w");
+    if (!out)
+    {
+        fprintf(stderr, "couldn't write %s\n", jsonFile.c_str());
+        return 1;
+    }
+    
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": {\n");
+    fprintf(out, "    \"source\": \"%s\",\n", sourceName.c_str());
+    fprintf(out, "    \"patterns\": %d,\n", (int)patterns.size());
+    fprintf(out, "    \"rescale\": %g,\n", rescale);
+    fprintf(out, "    \"ratioTest\": %s,\n", ratioTest ? "true" : "false");
+    fprintf(out, "    \"refinement\": \"%s\",\n", refinement.c_str());
+    fprintf(out, "    \"matcher\": \"%s\",\n", matcher.c_str());
+    fprintf(out, "    \"backend\": \"%s\",\n", backend.c_str());
+    fprintf(out, "    \"estimator\": \"%s\",\n", estimator.c_str());
+    fprintf(out, "    \"opticalFlow\": %s,\n", flow ? "true" : "false");
+    fprintf(out, "    \"roi\": %s,\n", roi ? "true" : "false");
+    fprintf(out, "    \"threads\": %d,\n", numThreads);
+    fprintf(out, "    \"pipelineWorkers\": %d,\n", numWorkers);
+    fprintf(out, "    \"budgetMs\": %g\n", budget);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"frames\": %d,\n", numFrames);
+    fprintf(out, "  \"fps\": %.2f,\n", numFrames / trackingSeconds);
+    fprintf(out, "  \"paths\": { \"detection\": %d, \"opticalFlow\": %d },\n", evaluation.numDetectionPath, evaluation.numFlowPath);
+    if (budget > 0)
+    {
+        std::sort(frameTimes.begin(), frameTimes.end());
+        const OperatingPoint& point = quality.getOperatingPoint();
+        fprintf(out, "  \"quality\": {\n");
+        fprintf(out, "    \"p95Ms\": %.2f,\n", frameTimes[(frameTimes.size() - 1) * 95 / 100]);
+        fprintf(out, "    \"changes\": %llu,\n", quality.getNumChanges());
+        fprintf(out, "    \"ladder\": [\n");
+        for (size_t l = 0; l < quality.ladder.size(); l++)
+        {
+            const OperatingPoint& p = quality.ladder[l];
+            fprintf(out, "      { \"features\": %d, \"levels\": %d, \"rescale\": %g, \"refinement\": %s, \"frames\": %d }%s\n",
+                    p.numFeatures, p.numLevels, p.rescale, p.refinement ? "true" : "false", framesPerLevel[l],
+                    l + 1 < quality.ladder.size() ? "," : "");
+        }
+        fprintf(out, "    ],\n");
+        fprintf(out, "    \"final\": { \"features\": %d, \"levels\": %d, \"rescale\": %g, \"refinement\": %s }\n",
+                point.numFeatures, point.numLevels, point.rescale, point.refinement ? "true" : "false");
+        fprintf(out, "  },\n");
+    }
+    if (source->hasTruth())
+    {
+        fprintf(out, "  \"detection\": { \"expected\": %d, \"detected\": %d, \"rate\": %.4f, \"wrongPattern\": %d, \"falsePositives\": %d },\n",
+                evaluation.numExpected, evaluation.numDetected,
+                evaluation.numExpected ? (float)evaluation.numDetected / evaluation.numExpected : 0.f,
+                evaluation.numWrongPattern, evaluation.numFalsePositives);
+        printPercentiles(out, "  ", "cornerErrorPx", errors, false);
+    }
+    fprintf(out, "  \"stagesUs\": {\n");
+    for (int s = 0; s < TrackerProfiler::NUM_STAGES; s++)
+        printPercentiles(out, "    ", TrackerProfiler::getStageName(s), summary.stages[s], s == TrackerProfiler::NUM_STAGES - 1);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"counters\": {\n");
+    for (int c = 0; c < TrackerProfiler::NUM_COUNTERS; c++)
+        printPercentiles(out, "    ", TrackerProfiler::getCounterName(c), summary.counters[c], c == TrackerProfiler::NUM_COUNTERS - 1);
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+    
+    if (out != stdout)
+        fclose(out);
+    
+    return 0;
+}
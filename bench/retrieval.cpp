@@ -0,0 +1,196 @@
+//
+//  retrieval.cpp
+//
+//  Recognition latency & rate of PatternTracker::match() for catalogs of 100 to 10,000 patterns,
+//  matching the frames with the whole database or with the shortlist retrieved with a vocabulary,
+//  and the share of the frames whose pattern is in the shortlist (recall@k).
+//
+//  The descriptors are synthetic : those of the patterns are noisy copies of a pool of shared
+//  structures, so that the patterns have visual words in common like real images. A frame shows
+//  part of a pattern through a random homography, its descriptors being noisy copies of the
+//  pattern's, among descriptors of the background.
+//
+//  usage : retrieval [frames = 20] [keypoints per pattern = 300] [shortlist size = 10]
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cv;
+
+namespace {
+    
+    const int descriptorSize = 32;
+    const Size patternSize(640, 480), frameSize(1280, 720);
+    
+    // Copy of a descriptor with each bit flipped with probability p
+    void flipBits(const uchar* src, uchar* dst, float p, RNG& rng)
+    {
+        for (int i = 0; i < descriptorSize; i++)
+        {
+            uchar value = src[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if (rng.uniform(0.f, 1.f) < p)
+                    value ^= 1 << bit;
+            }
+            dst[i] = value;
+        }
+    }
+    
+    Mat randomHomography(RNG& rng)
+    {
+        const float w = patternSize.width, h = patternSize.height;
+        const float scale = 0.6f * std::min(frameSize.width / w, frameSize.height / h);
+        const Point2f center(frameSize.width * 0.5f, frameSize.height * 0.5f);
+        
+        std::vector<Point2f> src(4), dst(4);
+        src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+        for (int i = 0; i < 4; i++)
+        {
+            Point2f jitter(rng.uniform(-0.1f, 0.1f) * w * scale, rng.uniform(-0.1f, 0.1f) * h * scale);
+            dst[i] = center + (src[i] - Point2f(w * 0.5f, h * 0.5f)) * scale + jitter;
+        }
+        return getPerspectiveTransform(src, dst);
+    }
+    
+    Pattern makePattern(const Mat& pool, int numKeypoints, RNG& rng)
+    {
+        Pattern pattern;
+        pattern.size = patternSize;
+        pattern.frame = Mat::zeros(patternSize, CV_8UC1);
+        pattern.descriptors.create(numKeypoints, descriptorSize, CV_8UC1);
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            pattern.keypoints.push_back(KeyPoint(rng.uniform(0.f, (float)patternSize.width), rng.uniform(0.f, (float)patternSize.height), 31));
+            flipBits(pool.ptr(rng.uniform(0, pool.rows)), pattern.descriptors.ptr(i), 0.15f, rng);
+        }
+        
+        const float w = patternSize.width, h = patternSize.height;
+        pattern.points2d.push_back(Point2f(0, 0));
+        pattern.points2d.push_back(Point2f(w, 0));
+        pattern.points2d.push_back(Point2f(w, h));
+        pattern.points2d.push_back(Point2f(0, h));
+        const float maxSize = std::max(w, h);
+        for (const Point2f& p : pattern.points2d)
+            pattern.points3d.push_back(Point3f((p.x - w / 2) / maxSize, (p.y - h / 2) / maxSize, 0));
+        return pattern;
+    }
+    
+    // Frame showing 60% of the keypoints of a pattern, among as many background keypoints
+    FrameData makeFrame(const Pattern& pattern, const Mat& pool, RNG& rng)
+    {
+        FrameData frame;
+        frame.imageSize = frameSize;
+        
+        const Mat H = randomHomography(rng);
+        std::vector<Point2f> src, dst;
+        std::vector<int> rows;
+        for (int i = 0; i < pattern.descriptors.rows; i++)
+        {
+            if (rng.uniform(0.f, 1.f) < 0.6f)
+            {
+                src.push_back(pattern.keypoints[i].pt);
+                rows.push_back(i);
+            }
+        }
+        if (!src.empty())
+            perspectiveTransform(src, dst, H);
+        
+        const int numBackground = rows.size();
+        frame.queryDescriptors.create(rows.size() + numBackground, descriptorSize, CV_8UC1);
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            frame.queryKeypoints.push_back(KeyPoint(dst[i] + Point2f((float)rng.gaussian(0.7), (float)rng.gaussian(0.7)), 31));
+            flipBits(pattern.descriptors.ptr(rows[i]), frame.queryDescriptors.ptr(i), 0.06f, rng);
+        }
+        for (int i = 0; i < numBackground; i++)
+        {
+            frame.queryKeypoints.push_back(KeyPoint(rng.uniform(0.f, (float)frameSize.width), rng.uniform(0.f, (float)frameSize.height), 31));
+            flipBits(pool.ptr(rng.uniform(0, pool.rows)), frame.queryDescriptors.ptr(rows.size() + i), 0.15f, rng);
+        }
+        return frame;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 1 ? atoi(argv[1]) : 20;
+    const int numKeypoints = argc > 2 ? atoi(argv[2]) : 300;
+    const int shortlistSize = argc > 3 ? atoi(argv[3]) : 10;
+    const int catalogSizes[] = { 100, 1000, 10000 };
+    
+    // Structures shared by the patterns
+    RNG rng(42);
+    Mat pool(4096, descriptorSize, CV_8UC1);
+    randu(pool, Scalar(0), Scalar(256));
+    
+    printf("%8s %8s %10s %14s %10s %14s %10s %12s\n", "patterns", "words", "train (s)",
+           "exhaustive ms", "found", "retrieval ms", "found", "recall@k");
+    
+    for (int numPatterns : catalogSizes)
+    {
+        PatternTracker retrieval;
+        retrieval.setup(MATCHER_PACKED_HAMMING);
+        retrieval.enableHomographyRefinement = false;   // no images to warp
+        retrieval.retrievalShortlistSize = shortlistSize;
+        
+        PatternDatabase& database = retrieval.getDatabase();
+        for (int p = 0; p < numPatterns; p++)
+            database.add(makePattern(pool, numKeypoints, rng));
+        database.setFeatureBackend("orb");
+        
+        // Offline vocabulary, trained on up to 200k descriptors of the catalog
+        Mat samples;
+        for (int p = 0; p < numPatterns && samples.rows < 200000; p++)
+            samples.push_back(database.getPattern(p).descriptors);
+        
+        const int64 trainStart = getTickCount();
+        Ptr<BinaryVocabulary> vocabulary = new BinaryVocabulary();
+        vocabulary->train(samples, 10, 5);
+        vocabulary->setFeatureBackend("orb");
+        const double trainSeconds = (getTickCount() - trainStart) / getTickFrequency();
+        
+        database.setVocabulary(vocabulary);
+        database.train();
+        
+        // Same database, searched whole
+        PatternTracker exhaustive;
+        exhaustive.setup(retrieval);
+        exhaustive.enableHomographyRefinement = false;
+        exhaustive.retrievalShortlistSize = 0;
+        
+        std::vector<FrameData> frames;
+        std::vector<int> targets;
+        for (int f = 0; f < numFrames; f++)
+        {
+            targets.push_back(rng.uniform(0, numPatterns));
+            frames.push_back(makeFrame(database.getPattern(targets.back()), pool, rng));
+        }
+        
+        double ms[2] = {};
+        int numFound[2] = {}, numRetrieved = 0;
+        PatternTracker* trackers[2] = { &exhaustive, &retrieval };
+        for (int t = 0; t < 2; t++)
+        {
+            for (int f = 0; f < numFrames; f++)
+            {
+                FrameData& frame = frames[f];
+                const int64 start = getTickCount();
+                trackers[t]->match(frame);
+                ms[t] += (getTickCount() - start) * 1000. / getTickFrequency();
+                
+                numFound[t] += frame.found && frame.results[0].patternIdx == targets[f];
+                if (t == 1)
+                    numRetrieved += std::find(frame.shortlist.begin(), frame.shortlist.end(), targets[f]) != frame.shortlist.end();
+            }
+        }
+        
+        printf("%8d %8d %10.1f %14.2f %4d / %-3d %14.2f %4d / %-3d %6d / %-3d\n", numPatterns, vocabulary->getNumWords(), trainSeconds,
+               ms[0] / numFrames, numFound[0], numFrames, ms[1] / numFrames, numFound[1], numFrames, numRetrieved, numFrames);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,160 @@
+//
+//  updates.cpp
+//
+//  Frame time of PatternTracker::find() while the catalog changes : the patterns added
+//  by the tracking thread itself between two frames, as before, against the patterns
+//  described by a PatternUpdater and swapped in between two frames. A pattern is added,
+//  replaced or removed every few frames while the tracker follows the first one, the removals
+//  alternating with replacements, with the packed matcher and with brute force.
+//
+//  usage : updates [frames = 300] [patterns at start = 20] [edit every n frames = 10]
+//
+
+#include "PatternUpdater.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace cv;
+
+namespace {
+    
+    Mat syntheticPattern(Size size, uint64 seed)
+    {
+        RNG rng(seed);
+        Mat pattern(size, CV_8UC1);
+        randu(pattern, Scalar(0), Scalar(256));
+        GaussianBlur(pattern, pattern, Size(5, 5), 2);
+        for (int i = 0; i < 200; i++)
+        {
+            Point p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            rectangle(pattern, Rect(p.x, p.y, rng.uniform(10, 60), rng.uniform(10, 60)), Scalar(rng.uniform(0, 256)), -1);
+        }
+        return pattern;
+    }
+    
+    Mat driftingHomography(float t, Size patternSize, Size frameSize)
+    {
+        const float w = patternSize.width, h = patternSize.height;
+        const float scale = 0.5f * std::min(frameSize.width / w, frameSize.height / h);
+        const Point2f center(frameSize.width * (0.5f + 0.1f * std::sin(t)), frameSize.height * (0.5f + 0.1f * std::cos(0.7f * t)));
+        
+        std::vector<Point2f> src(4), dst(4);
+        src[0] = Point2f(0, 0); src[1] = Point2f(w, 0); src[2] = Point2f(w, h); src[3] = Point2f(0, h);
+        for (int i = 0; i < 4; i++)
+            dst[i] = center + (src[i] - Point2f(w * 0.5f, h * 0.5f)) * scale * (1 + 0.05f * std::sin(t + i));
+        return getPerspectiveTransform(src, dst);
+    }
+    
+    double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+            return 0;
+        
+        const size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+    
+    enum Edit { EDIT_BLOCKING_ADD, EDIT_ADD, EDIT_REPLACE, EDIT_REMOVE };
+    
+    struct Mode
+    {
+        const char* name;
+        MatcherType matcher;
+        Edit edit;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    const int numFrames = argc > 1 ? atoi(argv[1]) : 300;
+    const int numPatterns = std::max(2, argc > 2 ? atoi(argv[2]) : 20);
+    const int editInterval = std::max(1, argc > 3 ? atoi(argv[3]) : 10);
+    const Size patternSize(640, 480), frameSize(1280, 720);
+    
+    std::vector<Mat> patterns(numPatterns + numFrames / editInterval + 1);
+    for (size_t i = 0; i < patterns.size(); i++)
+        patterns[i] = syntheticPattern(patternSize, 0x5eed + i);
+    
+    const int numDistinctFrames = 30;
+    std::vector<Mat> frames(numDistinctFrames);
+    for (int f = 0; f < numDistinctFrames; f++)
+        warpPerspective(patterns[0], frames[f], driftingHomography(f * 0.05f, patternSize, frameSize),
+                        frameSize, INTER_LINEAR, BORDER_CONSTANT, Scalar(127));
+    
+    printf("%d frames, %d patterns at start, an edit every %d frames\n\n", numFrames, numPatterns, editInterval);
+    printf("%-16s %10s %10s %10s %10s %8s %10s %12s\n", "edits", "p50 ms", "p99 ms", "max ms", "max edit", "found", "patterns", "build ms");
+    
+    const Mode modes[] = {
+        { "blocking add",       MATCHER_PACKED_HAMMING, EDIT_BLOCKING_ADD },
+        { "updater add",        MATCHER_PACKED_HAMMING, EDIT_ADD },
+        { "updater replace",    MATCHER_PACKED_HAMMING, EDIT_REPLACE },
+        { "updater remove",     MATCHER_PACKED_HAMMING, EDIT_REMOVE },
+        { "bf replace",         MATCHER_BRUTEFORCE,     EDIT_REPLACE },
+        { "bf remove",          MATCHER_BRUTEFORCE,     EDIT_REMOVE },
+    };
+    for (const Mode& mode : modes)
+    {
+        PatternTracker tracker;
+        tracker.setup(mode.matcher);
+        for (int i = 0; i < numPatterns; i++)
+            tracker.add(patterns[i]);
+        tracker.getDatabase().train();
+        
+        PatternUpdater updater;
+        unsigned long long version = 0;
+        Ptr<PatternDatabase> database;
+        if (mode.edit != EDIT_BLOCKING_ADD)
+            updater.start(tracker);
+        
+        // The frame time includes the edits made on the tracking thread & the swaps
+        std::vector<double> frameTimes, editTimes;
+        int numFound = 0, nextPattern = numPatterns, numEdits = 0;
+        for (int f = 0; f < numFrames; f++)
+        {
+            const int64 start = getTickCount();
+            if (f % editInterval == editInterval - 1)
+            {
+                // The removed slots are filled again by the next replacements
+                const int index = 1 + numEdits / 2 % (numPatterns - 1);
+                const Mat& image = patterns[nextPattern++];
+                if (mode.edit == EDIT_BLOCKING_ADD)
+                    tracker.add(image);
+                else if (mode.edit == EDIT_ADD)
+                    updater.add(image);
+                else if (mode.edit == EDIT_REMOVE && numEdits % 2 == 0)
+                    updater.remove(index);
+                else
+                    updater.replace(mode.edit == EDIT_REMOVE ? index : 1 + nextPattern % (numPatterns - 1), image);
+                editTimes.push_back((getTickCount() - start) * 1000. / getTickFrequency());
+                numEdits++;
+            }
+            if (mode.edit != EDIT_BLOCKING_ADD && updater.poll(version, database))
+                tracker.setDatabase(database);
+            
+            numFound += tracker.find(frames[f % numDistinctFrames]);
+            frameTimes.push_back((getTickCount() - start) * 1000. / getTickFrequency());
+        }
+        
+        double buildTime = 0;
+        if (mode.edit != EDIT_BLOCKING_ADD)
+        {
+            updater.flush();
+            if (updater.poll(version, database))
+                tracker.setDatabase(database);
+            buildTime = updater.getLastBuildTime();
+            updater.stop();
+        }
+        
+        double editTime = 0;
+        for (double t : editTimes)
+            editTime = std::max(editTime, t);
+        
+        printf("%-16s %10.2f %10.2f %10.2f %10.2f %7.0f%% %10d %12.1f\n", mode.name, percentile(frameTimes, 0.5), percentile(frameTimes, 0.99),
+               percentile(frameTimes, 1), editTime, 100. * numFound / numFrames, (int)tracker.getDatabase().size(), buildTime);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,319 @@
+//
+//  BinaryVocabulary.cpp
+//
+//  Vocabulary tree of binary descriptors, trained with k-majority, quantizing descriptors to visual words.
+//
+
+#include "BinaryVocabulary.h"
+#include "HammingKernel.h"
+
+#include <fstream>
+#include <cstring>
+#include <climits>
+#include <stdint.h>
+
+namespace cv {
+    
+    namespace {
+        
+        const char magic[8] = { 'O', 'F', 'X', 'C', 'V', 'V', 'O', 'C' };
+        const uint32_t version = 1;
+        
+        struct FileHeader
+        {
+            char     magic[8];
+            uint32_t version;
+            int32_t  branching, depth, descriptorSize;
+            uint32_t numNodes, numWords;
+            char     featureBackend[32];    // zero terminated
+        };
+        
+        struct FileNode
+        {
+            int32_t  firstChild, numChildren, word;
+        };
+    }
+    
+    BinaryVocabulary::BinaryVocabulary()
+    : m_branching(0)
+    , m_depth(0)
+    , m_descriptorSize(0)
+    , m_numWords(0)
+    {
+    }
+    
+    void BinaryVocabulary::train(const cv::Mat& descriptors, int branching, int depth, int iterations)
+    {
+        CV_Assert(descriptors.type() == CV_8UC1 && branching >= 2 && depth >= 1 && iterations >= 1);
+        
+        m_branching = branching;
+        m_depth = depth;
+        m_descriptorSize = descriptors.cols;
+        m_numWords = 0;
+        
+        Node root = { 0, 0, -1 };
+        m_nodes.assign(1, root);
+        m_centers.assign(m_descriptorSize, 0);
+        
+        if (descriptors.empty())
+            return;
+        
+        std::vector<int> indices(descriptors.rows);
+        for (int i = 0; i < descriptors.rows; i++)
+            indices[i] = i;
+        
+        cv::RNG rng(0x5eed);
+        split(descriptors, indices, 0, 0, iterations, rng);
+    }
+    
+    void BinaryVocabulary::split(const cv::Mat& descriptors, std::vector<int>& indices, int node, int level, int iterations, cv::RNG& rng)
+    {
+        // Nodes too deep or with too few descriptors to split are words
+        if (level >= m_depth || (int)indices.size() <= m_branching)
+        {
+            m_nodes[node].word = m_numWords++;
+            return;
+        }
+        
+        const int k = m_branching, size = m_descriptorSize, bits = size * 8;
+        std::vector<unsigned char> centers;
+        seedCenters(descriptors, indices, k, rng, centers);
+        
+        std::vector<int> assignment(indices.size(), -1);
+        std::vector<int> counts((size_t)k * bits);
+        std::vector<int> clusterSizes(k);
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            bool changed = false;
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                const unsigned char* d = descriptors.ptr(indices[i]);
+                int best = 0, bestDistance = INT_MAX;
+                for (int c = 0; c < k; c++)
+                {
+                    const int distance = hamming::distance(d, &centers[(size_t)c * size], size);
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = c;
+                    }
+                }
+                changed |= assignment[i] != best;
+                assignment[i] = best;
+            }
+            
+            // The assignment stays the one of the final centers
+            if (!changed || iteration == iterations - 1)
+                break;
+            
+            // Each center becomes the bitwise majority of its descriptors
+            std::fill(counts.begin(), counts.end(), 0);
+            std::fill(clusterSizes.begin(), clusterSizes.end(), 0);
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                const unsigned char* d = descriptors.ptr(indices[i]);
+                int* count = &counts[(size_t)assignment[i] * bits];
+                for (int b = 0; b < bits; b++)
+                    count[b] += (d[b >> 3] >> (b & 7)) & 1;
+                clusterSizes[assignment[i]]++;
+            }
+            for (int c = 0; c < k; c++)
+            {
+                if (clusterSizes[c] == 0)
+                    continue;
+                
+                const int* count = &counts[(size_t)c * bits];
+                for (int byte = 0; byte < size; byte++)
+                {
+                    unsigned char value = 0;
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        if (2 * count[byte * 8 + bit] > clusterSizes[c])
+                            value |= 1 << bit;
+                    }
+                    centers[(size_t)c * size + byte] = value;
+                }
+            }
+        }
+        
+        // The empty clusters are dropped, e.g. those of duplicated centers
+        std::vector< std::vector<int> > clusters(k);
+        for (size_t i = 0; i < indices.size(); i++)
+            clusters[assignment[i]].push_back(indices[i]);
+        
+        std::vector<int> nonEmpty;
+        for (int c = 0; c < k; c++)
+        {
+            if (!clusters[c].empty())
+                nonEmpty.push_back(c);
+        }
+        if (nonEmpty.size() < 2)
+        {
+            m_nodes[node].word = m_numWords++;
+            return;
+        }
+        
+        indices.clear();
+        indices.shrink_to_fit();
+        
+        const int firstChild = m_nodes.size();
+        m_nodes[node].firstChild = firstChild;
+        m_nodes[node].numChildren = nonEmpty.size();
+        for (int c : nonEmpty)
+        {
+            Node child = { 0, 0, -1 };
+            m_nodes.push_back(child);
+            m_centers.insert(m_centers.end(), centers.begin() + (size_t)c * size, centers.begin() + (size_t)(c + 1) * size);
+        }
+        
+        for (size_t i = 0; i < nonEmpty.size(); i++)
+            split(descriptors, clusters[nonEmpty[i]], firstChild + i, level + 1, iterations, rng);
+    }
+    
+    void BinaryVocabulary::seedCenters(const cv::Mat& descriptors, const std::vector<int>& indices, int k, cv::RNG& rng, std::vector<unsigned char>& centers) const
+    {
+        const int size = m_descriptorSize;
+        centers.resize((size_t)k * size);
+        
+        // Each center is drawn with a probability proportional to its squared distance to the closest center so far
+        std::vector<int> closest(indices.size(), INT_MAX);
+        int chosen = rng.uniform(0, (int)indices.size());
+        for (int c = 0; c < k; c++)
+        {
+            memcpy(&centers[(size_t)c * size], descriptors.ptr(indices[chosen]), size);
+            if (c == k - 1)
+                break;
+            
+            double total = 0;
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                closest[i] = std::min(closest[i], hamming::distance(descriptors.ptr(indices[i]), &centers[(size_t)c * size], size));
+                total += (double)closest[i] * closest[i];
+            }
+            
+            // Only duplicates left, their clusters will be empty
+            if (total == 0)
+            {
+                chosen = rng.uniform(0, (int)indices.size());
+                continue;
+            }
+            
+            double r = rng.uniform(0., total);
+            chosen = indices.size() - 1;
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                r -= (double)closest[i] * closest[i];
+                if (r <= 0)
+                {
+                    chosen = i;
+                    break;
+                }
+            }
+        }
+    }
+    
+    int BinaryVocabulary::transform(const unsigned char* descriptor) const
+    {
+        // Descend to the closest child at each level
+        int node = 0;
+        while (m_nodes[node].numChildren)
+        {
+            const Node& parent = m_nodes[node];
+            int best = parent.firstChild, bestDistance = INT_MAX;
+            for (int child = parent.firstChild; child < parent.firstChild + parent.numChildren; child++)
+            {
+                const int distance = hamming::distance(descriptor, center(child), m_descriptorSize);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = child;
+                }
+            }
+            node = best;
+        }
+        return m_nodes[node].word;
+    }
+    
+    void BinaryVocabulary::transform(const cv::Mat& descriptors, std::vector<int>& words) const
+    {
+        CV_Assert(descriptors.empty() || descriptors.cols == m_descriptorSize);
+        
+        words.resize(descriptors.rows);
+        for (int i = 0; i < descriptors.rows; i++)
+            words[i] = transform(descriptors.ptr(i));
+    }
+    
+    bool BinaryVocabulary::save(const std::string& path) const
+    {
+        FileHeader header;
+        memset(&header, 0, sizeof(header));
+        if (empty() || m_featureBackend.size() >= sizeof(header.featureBackend))
+            return false;
+        
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.branching = m_branching;
+        header.depth = m_depth;
+        header.descriptorSize = m_descriptorSize;
+        header.numNodes = m_nodes.size();
+        header.numWords = m_numWords;
+        memcpy(header.featureBackend, m_featureBackend.data(), m_featureBackend.size());
+        
+        std::vector<FileNode> nodes(m_nodes.size());
+        for (size_t i = 0; i < m_nodes.size(); i++)
+        {
+            nodes[i].firstChild = m_nodes[i].firstChild;
+            nodes[i].numChildren = m_nodes[i].numChildren;
+            nodes[i].word = m_nodes[i].word;
+        }
+        
+        std::ofstream file(path.c_str(), std::ios::binary);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)&nodes[0], nodes.size() * sizeof(FileNode));
+        file.write((const char*)&m_centers[0], m_centers.size());
+        return file.good();
+    }
+    
+    bool BinaryVocabulary::load(const std::string& path)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        FileHeader header;
+        if (!file.read((char*)&header, sizeof(header)))
+            return false;
+        if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version
+            || header.numNodes == 0 || header.numWords == 0 || header.descriptorSize <= 0 || header.branching < 2)
+            return false;
+        header.featureBackend[sizeof(header.featureBackend) - 1] = 0;
+        
+        std::vector<FileNode> nodes(header.numNodes);
+        std::vector<unsigned char> centers((size_t)header.numNodes * header.descriptorSize);
+        if (!file.read((char*)&nodes[0], nodes.size() * sizeof(FileNode)) || !file.read((char*)&centers[0], centers.size()))
+            return false;
+        
+        // Children come after their parent and the leaves are words, so that transform() always ends
+        std::vector<Node> loaded(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            const FileNode& n = nodes[i];
+            if (n.numChildren < 0 || n.numChildren > header.branching)
+                return false;
+            if (n.numChildren && (n.firstChild <= (int64_t)i || (int64_t)n.firstChild + n.numChildren > header.numNodes))
+                return false;
+            if (!n.numChildren && (n.word < 0 || n.word >= (int64_t)header.numWords))
+                return false;
+            
+            Node node = { n.firstChild, n.numChildren, n.numChildren ? -1 : n.word };
+            loaded[i] = node;
+        }
+        
+        m_nodes.swap(loaded);
+        m_centers.swap(centers);
+        m_branching = header.branching;
+        m_depth = header.depth;
+        m_descriptorSize = header.descriptorSize;
+        m_numWords = header.numWords;
+        m_featureBackend = header.featureBackend;
+        return true;
+    }
+    
+}
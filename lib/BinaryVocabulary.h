@@ -0,0 +1,85 @@
+//
+//  BinaryVocabulary.h
+//
+//  Vocabulary tree of binary descriptors, trained with k-majority, quantizing descriptors to visual words.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * Vocabulary tree of binary descriptors : each level splits the descriptors of a node in branching
+     * clusters with k-majority (k-means under the Hamming distance, the centers being the bitwise majority
+     * of their descriptors), down to depth levels. The leaves are the visual words.
+     *
+     * It is trained offline on the descriptors of a pattern catalog (see tools/buildVocabulary.cpp),
+     * transform() then costs branching * depth distances per descriptor, whatever the size of the catalog.
+     * Once trained or loaded, it's only read and can be shared by several threads.
+     */
+    class BinaryVocabulary
+    {
+    public:
+        BinaryVocabulary();
+        
+        /**
+         * Train on one descriptor per row, up to branching ^ depth words.
+         * The clustering is seeded with k-means++ from a fixed seed, the same descriptors give the same vocabulary.
+         */
+        void train(const cv::Mat& descriptors, int branching = 10, int depth = 5, int iterations = 10);
+        
+        /**
+         * Word of a descriptor of getDescriptorSize() bytes, and words of one descriptor per row
+         */
+        int transform(const unsigned char* descriptor) const;
+        void transform(const cv::Mat& descriptors, std::vector<int>& words) const;
+        
+        /**
+         * Binary file, with the name of the feature backend of the descriptors, up to 31 characters
+         */
+        bool save(const std::string& path) const;
+        bool load(const std::string& path);
+        
+        bool empty() const { return m_numWords == 0; }
+        int getNumWords() const { return m_numWords; }
+        int getDescriptorSize() const { return m_descriptorSize; }
+        int getBranching() const { return m_branching; }
+        int getDepth() const { return m_depth; }
+        
+        const std::string& getFeatureBackend() const { return m_featureBackend; }
+        void setFeatureBackend(const std::string& name) { m_featureBackend = name; }
+    
+    protected:
+        
+        /**
+         * Split the descriptors of node in its children, recursively until the leaves
+         */
+        void split(const cv::Mat& descriptors, std::vector<int>& indices, int node, int level, int iterations, cv::RNG& rng);
+        
+        /**
+         * k-means++ seeding of k centers among the descriptors of indices
+         */
+        void seedCenters(const cv::Mat& descriptors, const std::vector<int>& indices, int k, cv::RNG& rng, std::vector<unsigned char>& centers) const;
+        
+        const unsigned char* center(int node) const { return &m_centers[(size_t)node * m_descriptorSize]; }
+    
+    private:
+        struct Node
+        {
+            int                   firstChild;       // children are stored next to each other
+            int                   numChildren;      // 0 for the leaves
+            int                   word;             // -1 for the inner nodes
+        };
+        
+        std::vector<Node>             m_nodes;          // the root first
+        std::vector<unsigned char>    m_centers;        // of each node, the root's being unused
+        int                           m_branching;
+        int                           m_depth;
+        int                           m_descriptorSize;
+        int                           m_numWords;
+        std::string                   m_featureBackend;
+    };
+    
+}
@@ -0,0 +1,309 @@
+//
+//  FeatureBackend.cpp
+//
+//  Keypoint detectors & binary descriptors of PatternTracker, created by name from a registry.
+//
+
+#include "FeatureBackend.h"
+
+#include <map>
+#include <mutex>
+
+namespace cv {
+    
+    namespace {
+        
+        // rBRIEF patch of the default ORB, which keeps its keypoints this far from the border
+        const int orbPatchSize = 31;
+        const int orbHalfPatch = 15;
+        const int orbEdgeThreshold = 31;
+        
+        struct Registry
+        {
+            std::mutex                                  mutex;
+            std::map<std::string, FeatureBackend::Factory> factories;
+        };
+        
+        // Built on first use, so that backends can be registered from static initializers
+        Registry& registry()
+        {
+            static Registry* instance = 0;
+            static std::once_flag once;
+            std::call_once(once, [] {
+                instance = new Registry();
+                instance->factories["orb"] = [] { return cv::Ptr<FeatureBackend>(new OrbBackend()); };
+                instance->factories["fast-brief"] = [] { return cv::Ptr<FeatureBackend>(new FastBriefBackend()); };
+                instance->factories["fast-grid"] = [] { return cv::Ptr<FeatureBackend>(new FastGridBackend()); };
+#if CV_MAJOR_VERSION >= 3
+                instance->factories["akaze"] = [] { return cv::Ptr<FeatureBackend>(new AkazeBackend()); };
+#endif
+            });
+            return *instance;
+        }
+        
+        // Half widths of the rows of a circular patch, symmetric like ORB's
+        void circularPatch(int halfPatch, std::vector<int>& umax)
+        {
+            umax.assign(halfPatch + 2, 0);
+            const int vmax = cvFloor(halfPatch * std::sqrt(2.f) / 2 + 1);
+            const int vmin = cvCeil(halfPatch * std::sqrt(2.f) / 2);
+            for (int v = 0; v <= vmax; v++)
+                umax[v] = cvRound(std::sqrt((double)halfPatch * halfPatch - v * v));
+            for (int v = halfPatch, v0 = 0; v >= vmin; v--)
+            {
+                while (umax[v0] == umax[v0 + 1])
+                    v0++;
+                umax[v] = v0;
+                v0++;
+            }
+        }
+        
+        // Orientation of the intensity centroid of the patch around pt, in degrees
+        float intensityCentroidAngle(const cv::Mat& image, const cv::Point2f& pt, const std::vector<int>& umax, int halfPatch)
+        {
+            const uchar* center = image.ptr<uchar>(cvRound(pt.y)) + cvRound(pt.x);
+            const int step = (int)image.step;
+            
+            int m01 = 0, m10 = 0;
+            for (int u = -halfPatch; u <= halfPatch; u++)
+                m10 += u * center[u];
+            
+            // Rows above & below the center at once
+            for (int v = 1; v <= halfPatch; v++)
+            {
+                int vSum = 0;
+                const int d = umax[v];
+                for (int u = -d; u <= d; u++)
+                {
+                    const int above = center[u + v * step], below = center[u - v * step];
+                    vSum += above - below;
+                    m10 += u * (above + below);
+                }
+                m01 += v * vSum;
+            }
+            
+            return cv::fastAtan2((float)m01, (float)m10);
+        }
+    }
+    
+    void FeatureBackend::detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        detect(image, keypoints);
+        if (keypoints.empty())
+        {
+            descriptors.release();
+            return;
+        }
+        compute(image, keypoints, descriptors);
+    }
+    
+    void FeatureBackend::registerBackend(const std::string& name, const Factory& factory)
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.factories[name] = factory;
+    }
+    
+    cv::Ptr<FeatureBackend> FeatureBackend::create(const std::string& name)
+    {
+        Registry& r = registry();
+        Factory factory;
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            auto it = r.factories.find(name);
+            if (it == r.factories.end())
+                return cv::Ptr<FeatureBackend>();
+            factory = it->second;
+        }
+        return factory();
+    }
+    
+    std::vector<std::string> FeatureBackend::getNames()
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<std::string> names;
+        for (auto& entry : r.factories)
+            names.push_back(entry.first);
+        return names;
+    }
+
+#pragma mark - ORB
+    
+    OrbBackend::OrbBackend(const OrbParams& params)
+    : m_params(params)
+    , m_orb(new ORB(params.numFeatures, params.scaleFactor, params.numLevels, params.edgeThreshold, 0, 2, params.scoreType, params.patchSize))
+    {
+    }
+    
+    cv::Ptr<FeatureBackend> OrbBackend::withBudget(int numFeatures, int numLevels) const
+    {
+        OrbParams params = m_params;
+        params.numFeatures = numFeatures;
+        params.numLevels = std::max(1, numLevels);
+        return new OrbBackend(params);
+    }
+    
+    void OrbBackend::detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const
+    {
+        (*m_orb)(image, cv::Mat(), keypoints);
+    }
+    
+    void OrbBackend::compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        (*m_orb)(image, cv::Mat(), keypoints, descriptors, true);
+    }
+    
+    void OrbBackend::detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        (*m_orb)(image, cv::Mat(), keypoints, descriptors);
+    }
+
+#pragma mark - FAST & BRIEF
+    
+    FastBriefBackend::FastBriefBackend(const FastBriefParams& params)
+    : m_params(params)
+    , m_brief(new cv::BriefDescriptorExtractor(params.descriptorBytes))
+    {
+    }
+    
+    cv::Ptr<FeatureBackend> FastBriefBackend::withBudget(int numFeatures, int /*numLevels*/) const
+    {
+        FastBriefParams params = m_params;
+        params.numFeatures = numFeatures;
+        return new FastBriefBackend(params);
+    }
+    
+    void FastBriefBackend::detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const
+    {
+        cv::FAST(image, keypoints, m_params.threshold, m_params.nonmaxSuppression);
+        
+        // BRIEF smoothes & samples a 48 pixels patch, the corners closer to the border can't be described
+        cv::KeyPointsFilter::runByImageBorder(keypoints, image.size(), 28);
+        cv::KeyPointsFilter::retainBest(keypoints, m_params.numFeatures);
+    }
+    
+    void FastBriefBackend::compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        m_brief->compute(image, keypoints, descriptors);
+    }
+
+#pragma mark - FAST on a grid & rBRIEF
+    
+    FastGridBackend::FastGridBackend(const FastGridParams& params)
+    : m_params(params)
+    , m_orb(new ORB(params.numFeatures, 1.2f, 1))
+    {
+        circularPatch(orbHalfPatch, m_umax);
+    }
+    
+    cv::Ptr<FeatureBackend> FastGridBackend::withBudget(int numFeatures, int /*numLevels*/) const
+    {
+        FastGridParams params = m_params;
+        params.numFeatures = numFeatures;
+        return new FastGridBackend(params);
+    }
+    
+    void FastGridBackend::detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const
+    {
+        std::vector<cv::KeyPoint> corners;
+        cv::FAST(image, corners, m_params.threshold, true);
+        
+        // rBRIEF reads the circular patch around the corner, rotated
+        cv::KeyPointsFilter::runByImageBorder(corners, image.size(), orbEdgeThreshold);
+        
+        // The strongest corners of each cell
+        const int gridW = std::max(1, m_params.grid.width);
+        const int gridH = std::max(1, m_params.grid.height);
+        const int numCells = gridW * gridH;
+        const int perCell = (m_params.numFeatures + numCells - 1) / numCells;
+        
+        std::vector< std::vector<cv::KeyPoint> > cells(numCells);
+        for (const cv::KeyPoint& kp : corners)
+        {
+            const int cx = std::min(gridW - 1, (int)(kp.pt.x * gridW / image.cols));
+            const int cy = std::min(gridH - 1, (int)(kp.pt.y * gridH / image.rows));
+            cells[cy * gridW + cx].push_back(kp);
+        }
+        
+        keypoints.clear();
+        for (std::vector<cv::KeyPoint>& cell : cells)
+        {
+            cv::KeyPointsFilter::retainBest(cell, perCell);
+            for (cv::KeyPoint kp : cell)
+            {
+                kp.size = orbPatchSize;
+                kp.octave = 0;
+                kp.angle = intensityCentroidAngle(image, kp.pt, m_umax, orbHalfPatch);
+                keypoints.push_back(kp);
+            }
+        }
+    }
+    
+    void FastGridBackend::compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        // ORB keeps the orientation of the provided keypoints
+        (*m_orb)(image, cv::Mat(), keypoints, descriptors, true);
+    }
+
+#if CV_MAJOR_VERSION >= 3
+#pragma mark - AKAZE
+    
+    AkazeBackend::AkazeBackend(const AkazeParams& params)
+    : m_params(params)
+    , m_akaze(AKAZE::create(AKAZE::DESCRIPTOR_MLDB, params.descriptorBits, 3, params.threshold, params.numOctaves, params.numOctaveLayers))
+    {
+    }
+    
+    int AkazeBackend::descriptorSize() const
+    {
+        return m_akaze->descriptorSize();
+    }
+    
+    cv::Ptr<FeatureBackend> AkazeBackend::withBudget(int numFeatures, int numLevels) const
+    {
+        AkazeParams params = m_params;
+        params.numFeatures = numFeatures;
+        params.numOctaves = std::max(1, numLevels);
+        return new AkazeBackend(params);
+    }
+    
+    void AkazeBackend::detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const
+    {
+        m_akaze->detect(image, keypoints);
+        cv::KeyPointsFilter::retainBest(keypoints, m_params.numFeatures);
+    }
+    
+    void AkazeBackend::compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        m_akaze->compute(image, keypoints, descriptors);
+    }
+    
+    void AkazeBackend::detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    {
+        // The nonlinear scale space is the costly part, only built once
+        m_akaze->detectAndCompute(image, cv::noArray(), keypoints, descriptors);
+        if ((int)keypoints.size() <= m_params.numFeatures)
+            return;
+        
+        // Keep the descriptors of the strongest keypoints
+        std::vector<int> order(keypoints.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::partial_sort(order.begin(), order.begin() + m_params.numFeatures, order.end(), [&](int a, int b) {
+            return keypoints[a].response > keypoints[b].response;
+        });
+        
+        std::vector<cv::KeyPoint> kept(m_params.numFeatures);
+        cv::Mat keptDescriptors(m_params.numFeatures, descriptors.cols, descriptors.type());
+        for (int i = 0; i < m_params.numFeatures; i++)
+        {
+            kept[i] = keypoints[order[i]];
+            descriptors.row(order[i]).copyTo(keptDescriptors.row(i));
+        }
+        keypoints.swap(kept);
+        descriptors = keptDescriptors;
+    }
+#endif
+    
+}
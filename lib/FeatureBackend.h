@@ -0,0 +1,222 @@
+//
+//  FeatureBackend.h
+//
+//  Keypoint detectors & binary descriptors of PatternTracker, created by name from a registry.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include <functional>
+
+namespace cv {
+    
+    /**
+     * Keypoint detector & binary descriptor used by PatternTracker, matched with the Hamming distance.
+     *
+     * The backends are created by name from a registry, e.g. FeatureBackend::create("fast-brief"),
+     * or constructed with their parameters. Detection & description only read the backend,
+     * so that a backend can describe the tiles of a frame from several threads at once.
+     */
+    class FeatureBackend
+    {
+    public:
+        typedef std::function<cv::Ptr<FeatureBackend>()> Factory;
+        
+        virtual ~FeatureBackend() {}
+        
+        /**
+         * Name in the registry, recorded by the pattern databases & files built with the backend
+         */
+        virtual std::string getName() const = 0;
+        
+        /**
+         * Size of the descriptors in bytes
+         */
+        virtual int descriptorSize() const = 0;
+        
+        /**
+         * Keypoints kept per image & scale levels searched, 1 for the single scale backends
+         */
+        virtual int getNumFeatures() const = 0;
+        virtual int getNumLevels() const = 0;
+        
+        /**
+         * Same backend with another keypoint budget & number of levels, its descriptors staying comparable
+         */
+        virtual cv::Ptr<FeatureBackend> withBudget(int numFeatures, int numLevels) const = 0;
+        
+        virtual void detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const = 0;
+        
+        /**
+         * Describe the keypoints found by detect(), dropping the ones that can't be described
+         */
+        virtual void compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const = 0;
+        
+        /**
+         * detect() & compute() at once, sharing the pyramid when the backend has one
+         */
+        virtual void detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        
+        /**
+         * Add a backend to the registry, replacing any backend of the same name
+         */
+        static void registerBackend(const std::string& name, const Factory& factory);
+        
+        /**
+         * Backend of the registry with its default parameters, empty if there's none of this name
+         */
+        static cv::Ptr<FeatureBackend> create(const std::string& name);
+        static std::vector<std::string> getNames();
+    };
+    
+    /**
+     * ORB : oriented FAST keypoints ranked by Harris score over a scale pyramid, described with rBRIEF
+     */
+    struct OrbParams
+    {
+        OrbParams() : numFeatures(500), scaleFactor(1.2f), numLevels(8), edgeThreshold(31), scoreType(ORB::HARRIS_SCORE), patchSize(31) {}
+        
+        int                       numFeatures;
+        float                     scaleFactor;
+        int                       numLevels;
+        int                       edgeThreshold;    // border without keypoints, at least patchSize
+        int                       scoreType;        // ORB::HARRIS_SCORE or the cheaper ORB::FAST_SCORE
+        int                       patchSize;
+    };
+    
+    class OrbBackend : public FeatureBackend
+    {
+    public:
+        OrbBackend(const OrbParams& params = OrbParams());
+        
+        std::string getName() const { return "orb"; }
+        int descriptorSize() const { return ORB::kBytes; }
+        int getNumFeatures() const { return m_params.numFeatures; }
+        int getNumLevels() const { return m_params.numLevels; }
+        cv::Ptr<FeatureBackend> withBudget(int numFeatures, int numLevels) const;
+        
+        void detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const;
+        void compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        void detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        
+        const OrbParams& getParams() const { return m_params; }
+    
+    private:
+        OrbParams       m_params;
+        cv::Ptr<ORB>    m_orb;
+    };
+    
+    /**
+     * FAST corners described with BRIEF : single scale & not rotation invariant, but much cheaper than ORB
+     */
+    struct FastBriefParams
+    {
+        FastBriefParams() : numFeatures(500), threshold(20), nonmaxSuppression(true), descriptorBytes(32) {}
+        
+        int                       numFeatures;      // strongest corners kept
+        int                       threshold;        // FAST intensity threshold
+        bool                      nonmaxSuppression;
+        int                       descriptorBytes;  // 16, 32 or 64
+    };
+    
+    class FastBriefBackend : public FeatureBackend
+    {
+    public:
+        FastBriefBackend(const FastBriefParams& params = FastBriefParams());
+        
+        std::string getName() const { return "fast-brief"; }
+        int descriptorSize() const { return m_params.descriptorBytes; }
+        int getNumFeatures() const { return m_params.numFeatures; }
+        int getNumLevels() const { return 1; }
+        cv::Ptr<FeatureBackend> withBudget(int numFeatures, int numLevels) const;
+        
+        void detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const;
+        void compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        
+        const FastBriefParams& getParams() const { return m_params; }
+    
+    private:
+        FastBriefParams                         m_params;
+        cv::Ptr<cv::BriefDescriptorExtractor>   m_brief;
+    };
+    
+    /**
+     * Fast path for low power devices : FAST corners without any pyramid or Harris ranking, the
+     * strongest ones of each cell of a grid so that they cover the image, oriented by intensity
+     * centroid & described with rBRIEF. Its descriptors are those of ORB at a single scale :
+     * rotation invariant, but the patterns have to be seen at about the size they were trained at.
+     */
+    struct FastGridParams
+    {
+        FastGridParams() : numFeatures(500), threshold(20), grid(8, 6) {}
+        
+        int                       numFeatures;
+        int                       threshold;        // FAST intensity threshold
+        cv::Size                  grid;             // cells sharing the keypoints
+    };
+    
+    class FastGridBackend : public FeatureBackend
+    {
+    public:
+        FastGridBackend(const FastGridParams& params = FastGridParams());
+        
+        std::string getName() const { return "fast-grid"; }
+        int descriptorSize() const { return ORB::kBytes; }
+        int getNumFeatures() const { return m_params.numFeatures; }
+        int getNumLevels() const { return 1; }
+        cv::Ptr<FeatureBackend> withBudget(int numFeatures, int numLevels) const;
+        
+        void detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const;
+        void compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        
+        const FastGridParams& getParams() const { return m_params; }
+    
+    private:
+        FastGridParams      m_params;
+        cv::Ptr<ORB>        m_orb;              // single level, only describes
+        std::vector<int>    m_umax;             // half widths of the circular patch rows
+    };
+
+#if CV_MAJOR_VERSION >= 3
+    /**
+     * AKAZE : nonlinear scale space keypoints described with M-LDB, slower but more robust to scale & blur.
+     * Only registered with OpenCV 3 and later.
+     */
+    struct AkazeParams
+    {
+        AkazeParams() : numFeatures(500), descriptorBits(256), threshold(0.001f), numOctaves(4), numOctaveLayers(4) {}
+        
+        int                       numFeatures;      // strongest keypoints kept
+        int                       descriptorBits;   // 256 keeps the descriptors the size of ORB's, 0 for the full 486 bits
+        float                     threshold;        // detector response threshold
+        int                       numOctaves;
+        int                       numOctaveLayers;
+    };
+    
+    class AkazeBackend : public FeatureBackend
+    {
+    public:
+        AkazeBackend(const AkazeParams& params = AkazeParams());
+        
+        std::string getName() const { return "akaze"; }
+        int descriptorSize() const;
+        int getNumFeatures() const { return m_params.numFeatures; }
+        int getNumLevels() const { return m_params.numOctaves; }
+        cv::Ptr<FeatureBackend> withBudget(int numFeatures, int numLevels) const;
+        
+        void detect(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints) const;
+        void compute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        void detectAndCompute(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        
+        const AkazeParams& getParams() const { return m_params; }
+    
+    private:
+        AkazeParams         m_params;
+        cv::Ptr<AKAZE>      m_akaze;
+    };
+#endif
+    
+}
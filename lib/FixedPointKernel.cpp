@@ -0,0 +1,387 @@
+//
+//  FixedPointKernel.cpp
+//
+//  Fixed point gray conversion, rescale & bilinear warp of the frames, with a NEON path for the ARM boards.
+//
+
+#include "FixedPointKernel.h"
+
+#include <climits>
+
+// ARMv8 always has NEON, ARMv7 only when built with -mfpu=neon
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define FIXEDPOINT_HAS_NEON 1
+#endif
+
+namespace cv {
+    
+    namespace fixedpoint {
+        
+        namespace {
+            
+            // Weights of B, G & R in 1/16384, those of cv::cvtColor()
+            const int grayBits = 14;
+            const int blueWeight = 1868;
+            const int greenWeight = 9617;
+            const int redWeight = 4899;
+            
+            // Bilinear weights in 8 bits for the rescale, in 5 bits for the warp like cv::remap()
+            const int weightBits = 8;
+            const int weightOne = 1 << weightBits;
+            const int warpBits = 5;
+            const int warpOne = 1 << warpBits;
+            
+            void grayRowScalar(const uchar* src, int channels, int width, uchar* dst)
+            {
+                for (int x = 0; x < width; x++, src += channels)
+                    dst[x] = (uchar)((src[0] * blueWeight + src[1] * greenWeight + src[2] * redWeight + (1 << (grayBits - 1))) >> grayBits);
+            }
+            
+            // Horizontal blends of a source row, in 1/256
+            void blendColumns(const uchar* src, const int* x0, const int* x1, const int* wx, int width, ushort* dst)
+            {
+                for (int x = 0; x < width; x++)
+                    dst[x] = (ushort)(src[x0[x]] * (weightOne - wx[x]) + src[x1[x]] * wx[x]);
+            }
+            
+            // Vertical blend of two rows of horizontal blends, back to 8 bits
+            void blendRowsScalar(const ushort* top, const ushort* bottom, int wy, int width, uchar* dst)
+            {
+                for (int x = 0; x < width; x++)
+                    dst[x] = (uchar)((top[x] * (weightOne - wy) + bottom[x] * wy + (1 << (2 * weightBits - 1))) >> (2 * weightBits));
+            }
+            
+            // The 4 source pixels & the weights of each destination pixel of a warped row
+            void blendWarpScalar(const uchar* p00, const uchar* p01, const uchar* p10, const uchar* p11,
+                                 const uchar* wx, const uchar* wy, int width, uchar* dst)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    const int top = p00[x] * (warpOne - wx[x]) + p01[x] * wx[x];
+                    const int bottom = p10[x] * (warpOne - wx[x]) + p11[x] * wx[x];
+                    dst[x] = (uchar)((top * (warpOne - wy[x]) + bottom * wy[x] + (1 << (2 * warpBits - 1))) >> (2 * warpBits));
+                }
+            }
+            
+#ifdef FIXEDPOINT_HAS_NEON
+            
+            void grayRowNeon(const uchar* src, int channels, int width, uchar* dst)
+            {
+                int x = 0;
+                for (; x + 8 <= width; x += 8)
+                {
+                    uint8x8_t b, g, r;
+                    if (channels == 3)
+                    {
+                        const uint8x8x3_t p = vld3_u8(src + 3 * x);
+                        b = p.val[0]; g = p.val[1]; r = p.val[2];
+                    }
+                    else
+                    {
+                        const uint8x8x4_t p = vld4_u8(src + 4 * x);
+                        b = p.val[0]; g = p.val[1]; r = p.val[2];
+                    }
+                    
+                    const uint16x8_t b16 = vmovl_u8(b), g16 = vmovl_u8(g), r16 = vmovl_u8(r);
+                    uint32x4_t lo = vmull_n_u16(vget_low_u16(b16), blueWeight);
+                    lo = vmlal_n_u16(lo, vget_low_u16(g16), greenWeight);
+                    lo = vmlal_n_u16(lo, vget_low_u16(r16), redWeight);
+                    uint32x4_t hi = vmull_n_u16(vget_high_u16(b16), blueWeight);
+                    hi = vmlal_n_u16(hi, vget_high_u16(g16), greenWeight);
+                    hi = vmlal_n_u16(hi, vget_high_u16(r16), redWeight);
+                    
+                    // Rounding shifts, the weights summing to 1 so that the levels fit 8 bits
+                    vst1_u8(dst + x, vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, grayBits), vrshrn_n_u32(hi, grayBits))));
+                }
+                
+                grayRowScalar(src + channels * x, channels, width - x, dst + x);
+            }
+            
+            void blendRowsNeon(const ushort* top, const ushort* bottom, int wy, int width, uchar* dst)
+            {
+                const uint16x4_t topWeight = vdup_n_u16((ushort)(weightOne - wy));
+                const uint16x4_t bottomWeight = vdup_n_u16((ushort)wy);
+                
+                int x = 0;
+                for (; x + 8 <= width; x += 8)
+                {
+                    const uint16x8_t t = vld1q_u16(top + x);
+                    const uint16x8_t b = vld1q_u16(bottom + x);
+                    const uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(t), topWeight), vget_low_u16(b), bottomWeight);
+                    const uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(t), topWeight), vget_high_u16(b), bottomWeight);
+                    vst1_u8(dst + x, vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, 2 * weightBits), vrshrn_n_u32(hi, 2 * weightBits))));
+                }
+                
+                blendRowsScalar(top + x, bottom + x, wy, width - x, dst + x);
+            }
+            
+            void blendWarpNeon(const uchar* p00, const uchar* p01, const uchar* p10, const uchar* p11,
+                               const uchar* wx, const uchar* wy, int width, uchar* dst)
+            {
+                const uint8x8_t one = vdup_n_u8(warpOne);
+                
+                int x = 0;
+                for (; x + 8 <= width; x += 8)
+                {
+                    const uint8x8_t fx = vld1_u8(wx + x), gx = vsub_u8(one, fx);
+                    const uint16x8_t fy = vmovl_u8(vld1_u8(wy + x)), gy = vmovl_u8(vsub_u8(one, vld1_u8(wy + x)));
+                    
+                    // Horizontal blends fit 16 bits, the vertical ones 32
+                    const uint16x8_t top = vmlal_u8(vmull_u8(vld1_u8(p00 + x), gx), vld1_u8(p01 + x), fx);
+                    const uint16x8_t bottom = vmlal_u8(vmull_u8(vld1_u8(p10 + x), gx), vld1_u8(p11 + x), fx);
+                    const uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(top), vget_low_u16(gy)), vget_low_u16(bottom), vget_low_u16(fy));
+                    const uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(top), vget_high_u16(gy)), vget_high_u16(bottom), vget_high_u16(fy));
+                    vst1_u8(dst + x, vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, 2 * warpBits), vrshrn_n_u32(hi, 2 * warpBits))));
+                }
+                
+                blendWarpScalar(p00 + x, p01 + x, p10 + x, p11 + x, wx + x, wy + x, width - x, dst + x);
+            }
+            
+#endif
+            
+            bool isSupported(Implementation implementation)
+            {
+                switch (implementation)
+                {
+#ifdef FIXEDPOINT_HAS_NEON
+                    case IMPL_NEON:
+                        return true;
+#endif
+                    case IMPL_SCALAR:
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+            
+            Implementation& currentImplementation()
+            {
+                static Implementation implementation = getBestImplementation();
+                return implementation;
+            }
+            
+            inline void grayRow(Implementation implementation, const uchar* src, int channels, int width, uchar* dst)
+            {
+#ifdef FIXEDPOINT_HAS_NEON
+                if (implementation == IMPL_NEON)
+                {
+                    grayRowNeon(src, channels, width, dst);
+                    return;
+                }
+#else
+                (void)implementation;
+#endif
+                grayRowScalar(src, channels, width, dst);
+            }
+            
+            inline void blendRows(Implementation implementation, const ushort* top, const ushort* bottom, int wy, int width, uchar* dst)
+            {
+#ifdef FIXEDPOINT_HAS_NEON
+                if (implementation == IMPL_NEON)
+                {
+                    blendRowsNeon(top, bottom, wy, width, dst);
+                    return;
+                }
+#else
+                (void)implementation;
+#endif
+                blendRowsScalar(top, bottom, wy, width, dst);
+            }
+            
+            inline void blendWarp(Implementation implementation, const uchar* p00, const uchar* p01, const uchar* p10, const uchar* p11,
+                                  const uchar* wx, const uchar* wy, int width, uchar* dst)
+            {
+#ifdef FIXEDPOINT_HAS_NEON
+                if (implementation == IMPL_NEON)
+                {
+                    blendWarpNeon(p00, p01, p10, p11, wx, wy, width, dst);
+                    return;
+                }
+#else
+                (void)implementation;
+#endif
+                blendWarpScalar(p00, p01, p10, p11, wx, wy, width, dst);
+            }
+            
+            inline uchar pixelOrZero(const cv::Mat& src, int x, int y)
+            {
+                return (unsigned)x < (unsigned)src.cols && (unsigned)y < (unsigned)src.rows ? src.ptr(y)[x] : 0;
+            }
+            
+            // Position in 1/32 pixel, saturated like cv::saturate_cast<int>()
+            inline int warpPosition(double v)
+            {
+                return cvRound(std::min(std::max(v * warpOne, (double)INT_MIN), (double)INT_MAX));
+            }
+        }
+        
+        Implementation getBestImplementation()
+        {
+            if (isSupported(IMPL_NEON))
+                return IMPL_NEON;
+            return IMPL_SCALAR;
+        }
+        
+        Implementation getImplementation()
+        {
+            return currentImplementation();
+        }
+        
+        void setImplementation(Implementation implementation)
+        {
+            currentImplementation() = isSupported(implementation) ? implementation : getBestImplementation();
+        }
+        
+        const char* getImplementationName(Implementation implementation)
+        {
+            switch (implementation)
+            {
+                case IMPL_NEON:             return "neon";
+                case IMPL_SCALAR:
+                default:                    return "scalar";
+            }
+        }
+        
+        void bilinearTap(int dst, double inverseScale, int size, int& i0, int& i1, int& weight)
+        {
+            const double src = (dst + 0.5) * inverseScale - 0.5;
+            const int i = cvFloor(src);
+            weight = cvRound((src - i) * weightOne);
+            i0 = std::min(std::max(i, 0), size - 1);
+            i1 = std::min(std::max(i + 1, 0), size - 1);
+        }
+        
+        void convertToGray(const cv::Mat& image, double scale, cv::Mat& gray)
+        {
+            const int channels = image.channels();
+            CV_Assert(image.depth() == CV_8U && (channels == 1 || channels == 3 || channels == 4));
+            const Implementation implementation = currentImplementation();
+            
+            if (scale == 1)
+            {
+                if (channels == 1)
+                {
+                    gray = image;
+                    return;
+                }
+                
+                gray.create(image.rows, image.cols, CV_8UC1);
+                for (int y = 0; y < image.rows; y++)
+                    grayRow(implementation, image.ptr(y), channels, image.cols, gray.ptr(y));
+                return;
+            }
+            
+            const cv::Size size(scale * image.cols, scale * image.rows);
+            gray.create(size, CV_8UC1);
+            const double inverseScale = 1. / scale;
+            
+            cv::AutoBuffer<int> xTaps(3 * size.width);
+            int* x0 = xTaps;
+            int* x1 = x0 + size.width;
+            int* wx = x1 + size.width;
+            for (int x = 0; x < size.width; x++)
+                bilinearTap(x, inverseScale, image.cols, x0[x], x1[x], wx[x]);
+            
+            // The source rows are converted to gray & blended horizontally once, each of the 2 slots
+            // keeping its row for the next destination rows, so that the full size gray image is never written
+            cv::AutoBuffer<uchar> grayRowBuffer(image.cols);
+            cv::AutoBuffer<ushort> blended(2 * size.width);
+            int cachedRows[2] = { -1, -1 };
+            
+            for (int y = 0; y < size.height; y++)
+            {
+                int rows[2], wy;
+                bilinearTap(y, inverseScale, image.rows, rows[0], rows[1], wy);
+                
+                int slots[2] = { -1, -1 };
+                for (int k = 0; k < 2; k++)
+                {
+                    for (int s = 0; s < 2; s++)
+                    {
+                        if (cachedRows[s] == rows[k])
+                            slots[k] = s;
+                    }
+                }
+                
+                for (int k = 0; k < 2; k++)
+                {
+                    if (slots[k] >= 0)
+                        continue;
+                    
+                    const int s = slots[1 - k] == 0 ? 1 : 0;
+                    const uchar* src = image.ptr(rows[k]);
+                    if (channels != 1)
+                    {
+                        grayRow(implementation, src, channels, image.cols, grayRowBuffer);
+                        src = grayRowBuffer;
+                    }
+                    blendColumns(src, x0, x1, wx, size.width, blended + s * size.width);
+                    
+                    cachedRows[s] = rows[k];
+                    slots[k] = s;
+                    if (rows[1 - k] == rows[k])
+                        slots[1 - k] = s;
+                }
+                
+                blendRows(implementation, blended + slots[0] * size.width, blended + slots[1] * size.width, wy, size.width, gray.ptr(y));
+            }
+        }
+        
+        void warpPerspective(const cv::Mat& src, cv::Mat& dst, const cv::Mat& homography, cv::Size size)
+        {
+            CV_Assert(src.type() == CV_8UC1 && homography.rows == 3 && homography.cols == 3);
+            const Implementation implementation = currentImplementation();
+            
+            cv::Mat_<double> H;
+            homography.convertTo(H, CV_64F);
+            dst.create(size, CV_8UC1);
+            
+            // Gathered row by row, then blended
+            cv::AutoBuffer<uchar> taps(6 * size.width);
+            uchar* p00 = taps;
+            uchar* p01 = p00 + size.width;
+            uchar* p10 = p01 + size.width;
+            uchar* p11 = p10 + size.width;
+            uchar* wx = p11 + size.width;
+            uchar* wy = wx + size.width;
+            
+            for (int y = 0; y < size.height; y++)
+            {
+                const double rowX = H(0, 1) * y + H(0, 2);
+                const double rowY = H(1, 1) * y + H(1, 2);
+                const double rowW = H(2, 1) * y + H(2, 2);
+                
+                for (int x = 0; x < size.width; x++)
+                {
+                    double w = H(2, 0) * x + rowW;
+                    w = w ? 1. / w : 0;
+                    const int px = warpPosition((H(0, 0) * x + rowX) * w);
+                    const int py = warpPosition((H(1, 0) * x + rowY) * w);
+                    const int sx = px >> warpBits, sy = py >> warpBits;
+                    wx[x] = (uchar)(px & (warpOne - 1));
+                    wy[x] = (uchar)(py & (warpOne - 1));
+                    
+                    if (sx >= 0 && sy >= 0 && sx + 1 < src.cols && sy + 1 < src.rows)
+                    {
+                        const uchar* top = src.ptr(sy) + sx;
+                        const uchar* bottom = src.ptr(sy + 1) + sx;
+                        p00[x] = top[0]; p01[x] = top[1];
+                        p10[x] = bottom[0]; p11[x] = bottom[1];
+                    }
+                    else
+                    {
+                        p00[x] = pixelOrZero(src, sx, sy);
+                        p01[x] = pixelOrZero(src, sx + 1, sy);
+                        p10[x] = pixelOrZero(src, sx, sy + 1);
+                        p11[x] = pixelOrZero(src, sx + 1, sy + 1);
+                    }
+                }
+                
+                blendWarp(implementation, p00, p01, p10, p11, wx, wy, size.width, dst.ptr(y));
+            }
+        }
+        
+    }
+    
+}
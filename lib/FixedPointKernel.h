@@ -0,0 +1,55 @@
+//
+//  FixedPointKernel.h
+//
+//  Fixed point gray conversion, rescale & bilinear warp of the frames, with a NEON path for the ARM boards.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * Fixed point image kernels for the ARM boards, on which the generic paths of OpenCV are slow :
+     * the gray conversion & rescale of the frames in a single pass, and the bilinear warp of the
+     * refinement. The NEON implementation returns exactly the pixels of the scalar one.
+     */
+    namespace fixedpoint {
+        
+        enum Implementation
+        {
+            IMPL_SCALAR,            // portable integer arithmetic
+            IMPL_NEON               // same arithmetic 8 pixels at a time (ARM, when built with NEON)
+        };
+        
+        /**
+         * Best implementation supported by the build, NEON being always available when it's compiled in.
+         * setImplementation() falls back to the best one if the requested one isn't supported.
+         */
+        Implementation getBestImplementation();
+        Implementation getImplementation();
+        void setImplementation(Implementation implementation);
+        const char* getImplementationName(Implementation implementation);
+        
+        /**
+         * Source pixels i0 & i1 of the destination pixel dst of a bilinear rescale, with the mapping
+         * of cv::resize(), weight being the share of i1 in 1/256.
+         */
+        void bilinearTap(int dst, double inverseScale, int size, int& i0, int& i1, int& weight);
+        
+        /**
+         * Gray levels of a gray, BGR or BGRA image, scaled by scale with a bilinear filter in the same pass.
+         * The gray levels are those of cv::cvtColor(), and gray shares the data of a gray image at scale 1.
+         */
+        void convertToGray(const cv::Mat& image, double scale, cv::Mat& gray);
+        
+        /**
+         * Bilinear warp of a gray image, like cv::warpPerspective() with cv::WARP_INVERSE_MAP : homography maps
+         * the pixels of dst to those of src. The positions are rounded to 1/32 pixel and the pixels out of src are 0.
+         */
+        void warpPerspective(const cv::Mat& src, cv::Mat& dst, const cv::Mat& homography, cv::Size size);
+        
+    }
+    
+}
@@ -0,0 +1,286 @@
+//
+//  HammingKernel.cpp
+//
+//  Hamming distance kernels of the binary descriptors, dispatched at runtime on the CPU features.
+//
+
+#include "HammingKernel.h"
+
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define HAMMING_HAS_AVX2 1
+    // __builtin_cpu_supports("avx512vpopcntdq") & the intrinsics need a recent compiler
+    #if (defined(__clang__) && __clang_major__ >= 7) || (!defined(__clang__) && __GNUC__ >= 8)
+        #define HAMMING_HAS_AVX512 1
+    #endif
+#endif
+
+// ARMv8 always has NEON, ARMv7 only when built with -mfpu=neon
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define HAMMING_HAS_NEON 1
+#endif
+
+namespace cv {
+    
+    namespace hamming {
+        
+        namespace {
+            
+            inline int popcount64(uint64 v)
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                return __builtin_popcountll(v);
+#else
+                v = v - ((v >> 1) & 0x5555555555555555ULL);
+                v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+                v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+                return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+            }
+            
+            inline uint64 load64(const uchar* p)
+            {
+                uint64 v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            
+            void distancesScalar(const uchar* query, const uchar* train, int count, int stride, int* out)
+            {
+                for (int i = 0; i < count; i++, train += stride)
+                {
+                    int d = 0;
+                    for (int j = 0; j < stride; j += 8)
+                        d += popcount64(load64(query + j) ^ load64(train + j));
+                    out[i] = d;
+                }
+            }
+            
+#ifdef HAMMING_HAS_AVX2
+            
+            // Popcount of each byte of v (Mula's nibble lookup) summed in 4 64 bits lanes
+            __attribute__((target("avx2")))
+            inline __m256i popcountAvx2(__m256i v)
+            {
+                const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+                const __m256i lowMask = _mm256_set1_epi8(0x0f);
+                const __m256i lo = _mm256_and_si256(v, lowMask);
+                const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+                const __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+                return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+            }
+            
+            __attribute__((target("avx2")))
+            inline __m256i distanceLanesAvx2(const uchar* query, const uchar* train, int stride)
+            {
+                __m256i sum = _mm256_setzero_si256();
+                for (int j = 0; j < stride; j += 32)
+                {
+                    const __m256i q = _mm256_loadu_si256((const __m256i*)(query + j));
+                    const __m256i t = _mm256_loadu_si256((const __m256i*)(train + j));
+                    sum = _mm256_add_epi64(sum, popcountAvx2(_mm256_xor_si256(q, t)));
+                }
+                return sum;
+            }
+            
+            __attribute__((target("avx2")))
+            void distancesAvx2(const uchar* query, const uchar* train, int count, int stride, int* out)
+            {
+                int i = 0;
+                
+                // 4 descriptors at a time, so that the horizontal sums are shared
+                for (; i + 4 <= count; i += 4, train += 4 * stride)
+                {
+                    const __m256i a = distanceLanesAvx2(query, train, stride);
+                    const __m256i b = distanceLanesAvx2(query, train + stride, stride);
+                    const __m256i c = distanceLanesAvx2(query, train + 2 * stride, stride);
+                    const __m256i d = distanceLanesAvx2(query, train + 3 * stride, stride);
+                    
+                    // lanes sums fit in 32 bits: pack a|b and c|d in each 64 bits lane
+                    const __m256i ab = _mm256_or_si256(a, _mm256_slli_epi64(b, 32));
+                    const __m256i cd = _mm256_or_si256(c, _mm256_slli_epi64(d, 32));
+                    
+                    // [a0 b0 c0 d0 | a2 b2 c2 d2] + [a1 b1 c1 d1 | a3 b3 c3 d3]
+                    const __m256i s = _mm256_add_epi32(_mm256_unpacklo_epi64(ab, cd), _mm256_unpackhi_epi64(ab, cd));
+                    const __m128i r = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+                    _mm_storeu_si128((__m128i*)(out + i), r);
+                }
+                
+                distancesScalar(query, train, count - i, stride, out + i);
+            }
+            
+#endif
+            
+#ifdef HAMMING_HAS_AVX512
+            
+            __attribute__((target("avx512f,avx512vpopcntdq")))
+            void distancesAvx512(const uchar* query, const uchar* train, int count, int stride, int* out)
+            {
+                int i = 0;
+                
+                if (stride == 32)
+                {
+                    // 2 descriptors per register
+                    const __m256i q = _mm256_loadu_si256((const __m256i*)query);
+                    const __m512i q2 = _mm512_inserti64x4(_mm512_castsi256_si512(q), q, 1);
+                    
+                    for (; i + 2 <= count; i += 2, train += 64)
+                    {
+                        const __m512i t = _mm512_loadu_si512((const void*)train);
+                        const __m512i counts = _mm512_popcnt_epi64(_mm512_xor_si512(q2, t));
+                        out[i]     = (int)_mm512_mask_reduce_add_epi64(0x0F, counts);
+                        out[i + 1] = (int)_mm512_mask_reduce_add_epi64(0xF0, counts);
+                    }
+                }
+                else
+                {
+                    for (; i < count; i++, train += stride)
+                    {
+                        __m512i sum = _mm512_setzero_si512();
+                        int j = 0;
+                        for (; j + 64 <= stride; j += 64)
+                        {
+                            const __m512i q = _mm512_loadu_si512((const void*)(query + j));
+                            const __m512i t = _mm512_loadu_si512((const void*)(train + j));
+                            sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_xor_si512(q, t)));
+                        }
+                        int d = (int)_mm512_reduce_add_epi64(sum);
+                        for (; j < stride; j += 8)
+                            d += popcount64(load64(query + j) ^ load64(train + j));
+                        out[i] = d;
+                    }
+                }
+                
+                distancesScalar(query, train, count - i, stride, out + i);
+            }
+            
+#endif
+            
+#ifdef HAMMING_HAS_NEON
+            
+            // Byte popcounts summed pairwise in 8 16 bits lanes, which can't overflow below 64k bytes
+            void distancesNeon(const uchar* query, const uchar* train, int count, int stride, int* out)
+            {
+                for (int i = 0; i < count; i++, train += stride)
+                {
+                    uint16x8_t sum = vdupq_n_u16(0);
+                    for (int j = 0; j < stride; j += 16)
+                    {
+                        const uint8x16_t x = veorq_u8(vld1q_u8(query + j), vld1q_u8(train + j));
+                        sum = vpadalq_u8(sum, vcntq_u8(x));
+                    }
+                    const uint64x2_t total = vpaddlq_u32(vpaddlq_u16(sum));
+                    out[i] = (int)(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+                }
+            }
+            
+#endif
+            
+            bool isSupported(Implementation implementation)
+            {
+                switch (implementation)
+                {
+#ifdef HAMMING_HAS_AVX2
+                    case IMPL_AVX2:
+                        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef HAMMING_HAS_AVX512
+                    case IMPL_AVX512_VPOPCNTQ:
+                        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+#ifdef HAMMING_HAS_NEON
+                    case IMPL_NEON:
+                        return true;
+#endif
+                    case IMPL_SCALAR:
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+            
+            Implementation& currentImplementation()
+            {
+                static Implementation implementation = getBestImplementation();
+                return implementation;
+            }
+        }
+        
+        Implementation getBestImplementation()
+        {
+            if (isSupported(IMPL_AVX512_VPOPCNTQ))
+                return IMPL_AVX512_VPOPCNTQ;
+            if (isSupported(IMPL_AVX2))
+                return IMPL_AVX2;
+            if (isSupported(IMPL_NEON))
+                return IMPL_NEON;
+            return IMPL_SCALAR;
+        }
+        
+        Implementation getImplementation()
+        {
+            return currentImplementation();
+        }
+        
+        void setImplementation(Implementation implementation)
+        {
+            currentImplementation() = isSupported(implementation) ? implementation : getBestImplementation();
+        }
+        
+        const char* getImplementationName(Implementation implementation)
+        {
+            switch (implementation)
+            {
+                case IMPL_AVX2:             return "avx2";
+                case IMPL_AVX512_VPOPCNTQ:  return "avx512_vpopcntq";
+                case IMPL_NEON:             return "neon";
+                case IMPL_SCALAR:
+                default:                    return "scalar";
+            }
+        }
+        
+        int distance(const uchar* a, const uchar* b, int size)
+        {
+            int d = 0;
+            int j = 0;
+            for (; j + 8 <= size; j += 8)
+                d += popcount64(load64(a + j) ^ load64(b + j));
+            for (; j < size; j++)
+                d += popcount64(a[j] ^ b[j]);
+            return d;
+        }
+        
+        void distances(const uchar* query, const uchar* train, int count, int stride, int* out)
+        {
+            CV_Assert(stride % 32 == 0);
+            
+            switch (currentImplementation())
+            {
+#ifdef HAMMING_HAS_AVX512
+                case IMPL_AVX512_VPOPCNTQ:
+                    distancesAvx512(query, train, count, stride, out);
+                    break;
+#endif
+#ifdef HAMMING_HAS_AVX2
+                case IMPL_AVX2:
+                    distancesAvx2(query, train, count, stride, out);
+                    break;
+#endif
+#ifdef HAMMING_HAS_NEON
+                case IMPL_NEON:
+                    distancesNeon(query, train, count, stride, out);
+                    break;
+#endif
+                default:
+                    distancesScalar(query, train, count, stride, out);
+                    break;
+            }
+        }
+        
+    }
+    
+}
@@ -0,0 +1,53 @@
+//
+//  HammingKernel.h
+//
+//  Hamming distance kernels of the binary descriptors, dispatched at runtime on the CPU features.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * Hamming distance kernels for binary descriptors, dispatched at runtime
+     * to the best implementation supported by the CPU.
+     */
+    namespace hamming {
+        
+        enum Implementation
+        {
+            IMPL_SCALAR,            // portable 64 bits popcount
+            IMPL_AVX2,              // nibble lookup popcount (x86)
+            IMPL_AVX512_VPOPCNTQ,   // AVX-512 VPOPCNTDQ (x86)
+            IMPL_NEON               // byte popcount VCNT (ARM, when built with NEON)
+        };
+        
+        /**
+         * Best implementation supported by the CPU (and the compiler)
+         */
+        Implementation getBestImplementation();
+        
+        /**
+         * Implementation currently used, the best one by default.
+         * setImplementation() falls back to the best one if the requested one isn't supported.
+         */
+        Implementation getImplementation();
+        void setImplementation(Implementation implementation);
+        const char* getImplementationName(Implementation implementation);
+        
+        /**
+         * Distance between two descriptors of size bytes
+         */
+        int distance(const uchar* a, const uchar* b, int size);
+        
+        /**
+         * Distances between query and count descriptors stored every stride bytes from train.
+         * stride must be a multiple of 32 and the query must be zero padded up to stride bytes.
+         */
+        void distances(const uchar* query, const uchar* train, int count, int stride, int* out);
+        
+    }
+    
+}
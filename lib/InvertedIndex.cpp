@@ -0,0 +1,118 @@
+//
+//  InvertedIndex.cpp
+//
+//  Inverted index of the visual words of the patterns, shortlisting the patterns a frame is matched with.
+//
+
+#include "InvertedIndex.h"
+
+namespace cv {
+    
+    void InvertedIndex::build(const std::vector< std::vector<int> >& patternWords, int numWords)
+    {
+        clear();
+        m_numWords = numWords;
+        m_numPatterns = patternWords.size();
+        m_postings.resize(numWords);
+        
+        // Words seen in every pattern don't tell them apart, their idf is 0
+        std::vector<int> frequency(numWords, 0), last(numWords, -1);
+        for (int p = 0; p < m_numPatterns; p++)
+        {
+            for (int w : patternWords[p])
+            {
+                if (last[w] != p)
+                    frequency[w]++;
+                last[w] = p;
+            }
+        }
+        m_idf.resize(numWords);
+        for (int w = 0; w < numWords; w++)
+            m_idf[w] = frequency[w] ? std::log((float)m_numPatterns / frequency[w]) : 0.f;
+        
+        std::vector<int> counts(numWords, 0), touched;
+        for (int p = 0; p < m_numPatterns; p++)
+        {
+            touched.clear();
+            for (int w : patternWords[p])
+            {
+                if (counts[w]++ == 0)
+                    touched.push_back(w);
+            }
+            
+            float total = 0;
+            for (int w : touched)
+                total += counts[w] * m_idf[w];
+            
+            for (int w : touched)
+            {
+                if (total > 0 && m_idf[w] > 0)
+                {
+                    Posting posting = { p, counts[w] * m_idf[w] / total };
+                    m_postings[w].push_back(posting);
+                }
+                counts[w] = 0;
+            }
+        }
+    }
+    
+    void InvertedIndex::clear()
+    {
+        m_postings.clear();
+        m_idf.clear();
+        m_numWords = 0;
+        m_numPatterns = 0;
+    }
+    
+    void InvertedIndex::query(const std::vector<int>& words, int k, std::vector<int>& patterns, RetrievalScratch& scratch) const
+    {
+        patterns.clear();
+        if (empty() || k <= 0)
+            return;
+        
+        // The weights & scores are reset after each query, only the touched entries being visited
+        if (scratch.query.size() != (size_t)m_numWords)
+            scratch.query.assign(m_numWords, 0.f);
+        if (scratch.scores.size() != (size_t)m_numPatterns)
+            scratch.scores.assign(m_numPatterns, 0.f);
+        
+        std::vector<float>& query = scratch.query;
+        std::vector<int>& touchedWords = scratch.touchedWords;
+        touchedWords.clear();
+        float total = 0;
+        for (int w : words)
+        {
+            if (w < 0 || w >= m_numWords || m_idf[w] == 0)
+                continue;
+            if (query[w] == 0)
+                touchedWords.push_back(w);
+            query[w] += m_idf[w];
+            total += m_idf[w];
+        }
+        
+        std::vector<float>& scores = scratch.scores;
+        std::vector<int>& touchedPatterns = scratch.touchedPatterns;
+        touchedPatterns.clear();
+        for (int w : touchedWords)
+        {
+            const float q = query[w] / total;
+            for (const Posting& posting : m_postings[w])
+            {
+                if (scores[posting.pattern] == 0)
+                    touchedPatterns.push_back(posting.pattern);
+                scores[posting.pattern] += std::min(q, posting.weight);
+            }
+            query[w] = 0;
+        }
+        
+        const size_t n = std::min((size_t)k, touchedPatterns.size());
+        std::partial_sort(touchedPatterns.begin(), touchedPatterns.begin() + n, touchedPatterns.end(), [&scores](int a, int b) {
+            return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+        });
+        patterns.assign(touchedPatterns.begin(), touchedPatterns.begin() + n);
+        
+        for (int p : touchedPatterns)
+            scores[p] = 0;
+    }
+    
+}
@@ -0,0 +1,67 @@
+//
+//  InvertedIndex.h
+//
+//  Inverted index of the visual words of the patterns, shortlisting the patterns a frame is matched with.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * Scratch buffers of InvertedIndex::query() & of the matching of a shortlist,
+     * one per thread querying the same index
+     */
+    struct RetrievalScratch
+    {
+        std::vector<int>          words;        // of the query descriptors
+        std::vector<float>        query;        // tf-idf weight per word, sparse in touchedWords
+        std::vector<int>          touchedWords;
+        std::vector<float>        scores;       // per pattern, sparse in touchedPatterns
+        std::vector<int>          touchedPatterns;
+        std::vector<int>          distances;
+    };
+    
+    /**
+     * Inverted file of the visual words of the patterns, for a bag of words retrieval of the patterns
+     * a frame may show before any descriptor matching.
+     *
+     * The patterns & frames are tf-idf weighted, L1 normalized histograms of their words, scored with
+     * sum over the shared words of min(query weight, pattern weight), 1 for identical histograms.
+     * A query only visits the posting lists of the words of the frame.
+     */
+    class InvertedIndex
+    {
+    public:
+        InvertedIndex() : m_numWords(0), m_numPatterns(0) {}
+        
+        /**
+         * Index the words of each pattern, ids below numWords
+         */
+        void build(const std::vector< std::vector<int> >& patternWords, int numWords);
+        void clear();
+        
+        /**
+         * Up to k patterns sharing words with the query, best score first
+         */
+        void query(const std::vector<int>& words, int k, std::vector<int>& patterns, RetrievalScratch& scratch) const;
+        
+        bool empty() const { return m_numWords == 0; }
+        int getNumPatterns() const { return m_numPatterns; }
+    
+    private:
+        struct Posting
+        {
+            int                   pattern;
+            float                 weight;
+        };
+        
+        std::vector< std::vector<Posting> > m_postings;   // per word
+        std::vector<float>        m_idf;
+        int                       m_numWords;
+        int                       m_numPatterns;
+    };
+    
+}
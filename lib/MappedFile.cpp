@@ -0,0 +1,91 @@
+//
+//  MappedFile.cpp
+//
+//  Read-only memory mapping of a whole file, read in memory where mmap isn't available.
+//
+
+#include "MappedFile.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define MAPPED_FILE_HAS_MMAP 1
+#endif
+
+namespace cv {
+    
+    MappedFile::MappedFile()
+    : m_data(0)
+    , m_size(0)
+    , m_mapped(false)
+    {
+    }
+    
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+    
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+        
+#ifdef MAPPED_FILE_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = (const unsigned char*)data;
+                m_size = st.st_size;
+                m_mapped = true;
+            }
+        }
+        ::close(fd);
+        
+        if (m_mapped)
+            return true;
+#endif
+        
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+        
+        file.seekg(0, std::ios::end);
+        m_buffer.resize((size_t)file.tellg());
+        file.seekg(0, std::ios::beg);
+        if (!m_buffer.empty())
+            file.read((char*)&m_buffer[0], m_buffer.size());
+        if (!file)
+        {
+            m_buffer.clear();
+            return false;
+        }
+        
+        m_data = m_buffer.empty() ? 0 : &m_buffer[0];
+        m_size = m_buffer.size();
+        return true;
+    }
+    
+    void MappedFile::close()
+    {
+#ifdef MAPPED_FILE_HAS_MMAP
+        if (m_mapped)
+            munmap((void*)m_data, m_size);
+#endif
+        m_buffer.clear();
+        m_data = 0;
+        m_size = 0;
+        m_mapped = false;
+    }
+    
+}
@@ -0,0 +1,41 @@
+//
+//  MappedFile.h
+//
+//  Read-only memory mapping of a whole file, read in memory where mmap isn't available.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace cv {
+
+    /**
+     * Read-only memory mapping of a whole file.
+     * Falls back to reading the file in memory where mmap isn't available.
+     */
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+        
+        bool open(const std::string& path);
+        void close();
+        
+        const unsigned char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+        
+        const unsigned char*       m_data;
+        size_t                     m_size;
+        bool                       m_mapped;
+        std::vector<unsigned char> m_buffer;
+    };
+    
+}
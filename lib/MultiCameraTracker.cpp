@@ -0,0 +1,455 @@
+//
+//  MultiCameraTracker.cpp
+//
+//  Tracking of the same patterns in the frames of several cameras with a single pool of workers.
+//
+
+#include "MultiCameraTracker.h"
+
+#include <algorithm>
+
+namespace cv {
+    
+    namespace {
+        
+        double elapsedMs(int64 start)
+        {
+            return (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+        }
+    }
+    
+    MultiCameraTracker::Camera::Camera()
+    : latencyTarget(0)
+    , spare(new FrameData())
+    , input(new FrameData())
+    , working(new FrameData())
+    , hasInput(false)
+    , state(CAMERA_IDLE)
+    , inputDeadline(0)
+    , deadline(0)
+    , nextIndex(0)
+    , profiler(new TrackerProfiler())
+    , numProcessed(0)
+    , numDropped(0)
+    , numDeadlineMisses(0)
+    {
+    }
+    
+    MultiCameraTracker::MultiCameraTracker()
+    : maxBatchSize(8)
+    , m_numWorkers(0)
+    , m_paused(false)
+    , m_stop(false)
+    {
+    }
+    
+    MultiCameraTracker::~MultiCameraTracker()
+    {
+        stop();
+    }
+    
+    void MultiCameraTracker::setup(MatcherType matcherType)
+    {
+        m_patterns.setup(matcherType);
+    }
+    
+    bool MultiCameraTracker::setFeatureBackend(const std::string& name)
+    {
+        CV_Assert(m_cameras.empty());
+        return m_patterns.setFeatureBackend(name);
+    }
+    
+    int MultiCameraTracker::addCamera(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, double latencyTarget)
+    {
+        CV_Assert(!isRunning());
+        
+        std::unique_ptr<Camera> camera(new Camera());
+        camera->tracker.setup(m_patterns);
+        cameraMatrix.copyTo(camera->cameraMatrix);
+        distCoeffs.copyTo(camera->distCoeffs);
+        camera->latencyTarget = (int64)(latencyTarget * cv::getTickFrequency() / 1000.);
+        
+        m_cameras.push_back(std::move(camera));
+        return m_cameras.size() - 1;
+    }
+    
+    void MultiCameraTracker::start(int numWorkers)
+    {
+        stop();
+        
+        // Matching from several workers is only safe on a trained database
+        m_patterns.getDatabase().train();
+        
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_numWorkers = std::max(1, numWorkers);
+            m_stop = false;
+        }
+        
+        for (size_t i = 0; i < m_numWorkers; i++)
+            m_workers.push_back(std::thread(&MultiCameraTracker::work, this));
+    }
+    
+    void MultiCameraTracker::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_numWorkers = 0;
+        }
+        m_workReady.notify_all();
+        m_progress.notify_all();
+        
+        for (auto & worker : m_workers)
+            worker.join();
+        m_workers.clear();
+        
+        // Frames still in the pipeline are dropped
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto & camera : m_cameras)
+        {
+            camera->numDropped += camera->hasInput + (camera->state != CAMERA_IDLE);
+            camera->hasInput = false;
+            camera->state = CAMERA_IDLE;
+        }
+    }
+    
+    long long MultiCameraTracker::push(int cameraId, const cv::Mat& image, PixelFormat format)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Camera& camera = *m_cameras[cameraId];
+        std::unique_ptr<FrameData> frame(std::move(camera.spare));
+        if (!frame)
+            frame.reset(new FrameData());
+        const int64 ticks = cv::getTickCount();
+        
+        // Nobody else knows about this frame yet, copy the image out of the lock
+        lock.unlock();
+        image.copyTo(frame->image);
+        frame->imageFormat = format;
+        lock.lock();
+        
+        frame->index = camera.nextIndex++;
+        frame->ticks = ticks;
+        
+        // The frame waiting for a worker is outdated
+        if (camera.hasInput)
+            camera.numDropped++;
+        else
+            camera.inputDeadline = ticks + camera.latencyTarget;
+        std::swap(camera.input, frame);
+        camera.spare = std::move(frame);
+        camera.hasInput = true;
+        m_workReady.notify_one();
+        
+        return camera.input->index;
+    }
+    
+    void MultiCameraTracker::flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_progress.wait(lock, [this]{
+            if (m_numWorkers == 0)
+                return true;
+            for (const auto & camera : m_cameras)
+            {
+                if (camera->hasInput || camera->state != CAMERA_IDLE)
+                    return false;
+            }
+            return true;
+        });
+    }
+    
+    int MultiCameraTracker::add(const cv::Mat& image, const std::string& name)
+    {
+        pause();
+        int index = m_patterns.add(image, name);
+        resume();
+        return index;
+    }
+    
+    int MultiCameraTracker::load(const std::string& path)
+    {
+        pause();
+        int numLoaded = m_patterns.load(path);
+        resume();
+        return numLoaded;
+    }
+    
+    bool MultiCameraTracker::loadVocabulary(const std::string& path)
+    {
+        pause();
+        bool loaded = m_patterns.loadVocabulary(path);
+        resume();
+        return loaded;
+    }
+    
+    bool MultiCameraTracker::getResult(int camera, Result& result) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        result = m_cameras[camera]->result;
+        return result.frameIndex >= 0;
+    }
+    
+    unsigned long long MultiCameraTracker::getNumProcessed(int camera) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cameras[camera]->numProcessed;
+    }
+    
+    unsigned long long MultiCameraTracker::getNumDropped(int camera) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cameras[camera]->numDropped;
+    }
+    
+    unsigned long long MultiCameraTracker::getNumDeadlineMisses(int camera) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cameras[camera]->numDeadlineMisses;
+    }
+
+#pragma mark - Protected
+    
+    void MultiCameraTracker::work()
+    {
+        // Scratch buffers of the batched matching, kept from one batch to the next
+        cv::Mat descriptors;
+        std::vector< std::vector<cv::DMatch> > knnMatches;
+        std::vector<int> patterns;
+        std::vector<Camera*> batch;
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            size_t index = 0;
+            CameraState state = CAMERA_IDLE;
+            m_workReady.wait(lock, [&]{ return m_stop || nextTask(index, state); });
+            if (m_stop)
+                return;
+            
+            Camera& camera = *m_cameras[index];
+            if (state == CAMERA_IDLE)
+            {
+                std::swap(camera.working, camera.input);
+                camera.hasInput = false;
+                camera.deadline = camera.inputDeadline;
+                camera.state = CAMERA_EXTRACTING;
+                FrameData& frame = *camera.working;
+                
+                lock.unlock();
+                camera.tracker.prepare(frame.image, frame, frame.imageFormat);
+                camera.tracker.extract(frame, cv::Rect(0, 0, frame.image.cols, frame.image.rows));
+                lock.lock();
+                
+                camera.state = CAMERA_EXTRACTED;
+                m_workReady.notify_all();
+            }
+            else if (state == CAMERA_EXTRACTED)
+            {
+                // Every frame extracted by now goes along, the most urgent first
+                batch.clear();
+                for (auto & other : m_cameras)
+                {
+                    if (other->state == CAMERA_EXTRACTED)
+                        batch.push_back(other.get());
+                }
+                std::sort(batch.begin(), batch.end(), [](const Camera* a, const Camera* b) {
+                    return a->deadline < b->deadline;
+                });
+                batch.resize(std::min(batch.size(), (size_t)std::max(1, maxBatchSize)));
+                for (Camera* c : batch)
+                    c->state = CAMERA_MATCHING;
+                
+                lock.unlock();
+                matchBatch(batch, descriptors, knnMatches, patterns);
+                lock.lock();
+                
+                for (Camera* c : batch)
+                    c->state = CAMERA_MATCHED;
+                m_workReady.notify_all();
+            }
+            else
+            {
+                camera.state = CAMERA_VERIFYING;
+                
+                lock.unlock();
+                Result result;
+                verify(index, result);
+                lock.lock();
+                
+                camera.result = result;
+                camera.numProcessed++;
+                camera.numDeadlineMisses += result.deadlineMissed;
+                camera.state = CAMERA_IDLE;
+                
+                m_workReady.notify_all();
+                m_progress.notify_all();
+            }
+        }
+    }
+    
+    bool MultiCameraTracker::nextTask(size_t& camera, CameraState& state) const
+    {
+        bool found = false;
+        int64 earliest = 0;
+        
+        for (size_t i = 0; i < m_cameras.size(); i++)
+        {
+            const Camera& c = *m_cameras[i];
+            int64 deadline;
+            if (c.state == CAMERA_IDLE && c.hasInput && !m_paused)
+                deadline = c.inputDeadline;
+            else if (c.state == CAMERA_EXTRACTED || c.state == CAMERA_MATCHED)
+                deadline = c.deadline;
+            else
+                continue;
+            
+            // Earliest deadline first, then the frame the furthest down the pipeline
+            if (!found || deadline < earliest || (deadline == earliest && c.state > state))
+            {
+                found = true;
+                earliest = deadline;
+                camera = i;
+                state = c.state;
+            }
+        }
+        return found;
+    }
+    
+    void MultiCameraTracker::matchBatch(const std::vector<Camera*>& batch, cv::Mat& descriptors, std::vector< std::vector<cv::DMatch> >& knnMatches,
+                                        std::vector<int>& patterns)
+    {
+        const int64 start = cv::getTickCount();
+        
+        // Stack the descriptors of the frames, one pass over the patterns matches them all
+        int numRows = 0, cols = 0, type = CV_8U;
+        for (const Camera* camera : batch)
+        {
+            const FrameData& frame = *camera->working;
+            if (frame.queryKeypoints.empty())
+                continue;
+            numRows += frame.queryDescriptors.rows;
+            cols = frame.queryDescriptors.cols;
+            type = frame.queryDescriptors.type();
+        }
+        
+        knnMatches.clear();
+        if (numRows > 0)
+        {
+            descriptors.create(numRows, cols, type);
+            int row = 0;
+            for (const Camera* camera : batch)
+            {
+                const FrameData& frame = *camera->working;
+                if (frame.queryKeypoints.empty())
+                    continue;
+                frame.queryDescriptors.copyTo(descriptors.rowRange(row, row + frame.queryDescriptors.rows));
+                row += frame.queryDescriptors.rows;
+            }
+            
+            // With a vocabulary, the batch is matched with the patterns retrieved for any of its frames
+            bool retrieval = false;
+            patterns.clear();
+            for (Camera* camera : batch)
+            {
+                FrameData& frame = *camera->working;
+                if (frame.queryKeypoints.empty() || !camera->tracker.retrieve(frame, frame.queryDescriptors))
+                    continue;
+                patterns.insert(patterns.end(), frame.shortlist.begin(), frame.shortlist.end());
+                retrieval = true;
+            }
+            
+            if (retrieval)
+            {
+                std::sort(patterns.begin(), patterns.end());
+                patterns.erase(std::unique(patterns.begin(), patterns.end()), patterns.end());
+                m_patterns.getDatabase().knnMatch(descriptors, knnMatches, 2, patterns, batch[0]->working->retrieval);
+            }
+            else
+                m_patterns.getDatabase().knnMatch(descriptors, knnMatches, 2);
+        }
+        knnMatches.resize(numRows);
+        
+        // Hand each frame its rows, swapping the buffers to keep them allocated
+        const double matching = elapsedMs(start) / batch.size();
+        int row = 0;
+        for (Camera* camera : batch)
+        {
+            FrameData& frame = *camera->working;
+            const int n = frame.queryKeypoints.empty() ? 0 : frame.queryDescriptors.rows;
+            frame.knnMatches.resize(n);
+            for (int i = 0; i < n; i++, row++)
+            {
+                frame.knnMatches[i].swap(knnMatches[row]);
+                for (auto & m : frame.knnMatches[i])
+                    m.queryIdx = i;
+            }
+            frame.timings.matching = matching;
+        }
+    }
+    
+    void MultiCameraTracker::verify(int cameraId, Result& result)
+    {
+        Camera& camera = *m_cameras[cameraId];
+        PatternTracker& tracker = camera.tracker;
+        FrameData& frame = *camera.working;
+        
+        tracker.matchPrecomputed(frame);
+        frame.timings.total = elapsedMs(frame.ticks);
+        tracker.integrate(frame);
+        
+        // frame now holds the buffers of the previously integrated frame
+        const FrameData& integrated = tracker.getFrame();
+        result.frameIndex = integrated.index;
+        result.frameTicks = integrated.ticks;
+        result.found = integrated.found;
+        result.patternIdx = tracker.getInfo().patternIdx;
+        result.path = integrated.path;
+        
+        // Solved for lost frames too, so that the pose filter restarts
+        const std::vector<Pose>& poses = tracker.getPoses(camera.cameraMatrix, camera.distCoeffs);
+        result.results = tracker.getResults();
+        result.poses = poses;
+        if (result.found)
+        {
+            result.quad = tracker.getQuad();
+            result.rvec = poses[0].rvec;
+            result.tvec = poses[0].tvec;
+        }
+        result.timings = tracker.getTimings();
+        result.counters = tracker.getCounters();
+        result.deadlineMissed = cv::getTickCount() > integrated.ticks + camera.latencyTarget;
+        camera.profiler->record(result.timings, result.counters);
+        
+        if (m_callback)
+            m_callback(cameraId, tracker, result);
+    }
+    
+    void MultiCameraTracker::pause()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_paused = true;
+        m_progress.wait(lock, [this]{
+            if (m_numWorkers == 0)
+                return true;
+            for (const auto & camera : m_cameras)
+            {
+                if (camera->state != CAMERA_IDLE)
+                    return false;
+            }
+            return true;
+        });
+    }
+    
+    void MultiCameraTracker::resume()
+    {
+        // Still paused, no worker touches the database
+        m_patterns.getDatabase().train();
+        
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_paused = false;
+        m_workReady.notify_all();
+    }
+    
+}
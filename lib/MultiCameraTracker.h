@@ -0,0 +1,211 @@
+//
+//  MultiCameraTracker.h
+//
+//  Tracking of the same patterns in the frames of several cameras with a single pool of workers.
+//
+
+#pragma once
+
+#include "PatternTracker.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+
+namespace cv {
+    
+    /**
+     * Tracks the same patterns in the frames of several cameras with a single pool of workers.
+     *
+     * The cameras share one pattern database & matcher index, each one keeping its own PatternTracker
+     * state, intrinsics & latency target. A camera has at most one frame in flight : a frame pushed
+     * while the previous one waits is replaced, so that the latency stays bounded. The workers run the
+     * stages of the cameras earliest deadline first, the deadline of a frame being the time it was
+     * pushed plus the latency target of its camera :
+     *
+     *   push(camera) -> resize, gray, detect & describe -> knn matching, batched with the frames of the
+     *                   other cameras ready at the same time -> ratio test, RANSAC & refinement
+     *                -> integrate, pose & callback
+     */
+    class MultiCameraTracker
+    {
+    public:
+        /**
+         * Tracking result of the last frame of a camera
+         */
+        struct Result
+        {
+            Result() : frameIndex(-1), frameTicks(0), found(false), patternIdx(-1), path(TRACKING_PATH_NONE), deadlineMissed(false) {}
+            
+            long long                 frameIndex;
+            int64                     frameTicks;   // cv::getTickCount() when the frame was pushed
+            bool                      found;
+            int                       patternIdx;
+            std::vector<cv::Point2f>  quad;
+            cv::Mat                   rvec;         // pose in the camera frame, when found
+            cv::Mat                   tvec;
+            std::vector<TrackingInfo> results;      // every pattern found in the frame, the best first
+            std::vector<Pose>         poses;        // of each result
+            TrackingPath              path;
+            StageTimings              timings;      // total is the latency from push() to the integration
+            FrameCounters             counters;
+            bool                      deadlineMissed;
+        };
+        
+        /**
+         * Called after each integrated frame with the tracker of its camera, see PatternTracker::getFrame().
+         * It runs on a worker, in frame order for a camera, concurrently for different cameras.
+         */
+        typedef std::function<void(int camera, PatternTracker& tracker, const Result& result)> Callback;
+        
+        MultiCameraTracker();
+        ~MultiCameraTracker();
+        
+        void setup(MatcherType matcherType = MATCHER_PACKED_HAMMING);
+        
+        /**
+         * Add a camera before start() and return its id. latencyTarget is in ms.
+         */
+        int addCamera(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, double latencyTarget = 33);
+        
+        /**
+         * Feature backend of the patterns & of every camera, see PatternTracker::setFeatureBackend().
+         * Set it before adding cameras & patterns.
+         */
+        bool setFeatureBackend(const std::string& name);
+        size_t getNumCameras() const { return m_cameras.size(); }
+        
+        /**
+         * Configure the tracker of a camera before start()
+         */
+        PatternTracker& getTracker(int camera) { return m_cameras[camera]->tracker; }
+        PatternDatabase& getDatabase() { return m_patterns.getDatabase(); }
+        void setCallback(const Callback& callback) { m_callback = callback; }
+        
+        void start(int numWorkers);
+        void stop();
+        bool isRunning() const { return !m_workers.empty(); }
+        
+        /**
+         * Queue a copy of the image for a camera and return its frame index. A frame of the same camera
+         * still waiting for a worker is dropped. Push the frames of a camera from one thread at a time.
+         * Only the luma plane of YUV frames needs to be pushed, see PatternTracker::find().
+         */
+        long long push(int camera, const cv::Mat& image, PixelFormat format = PIXEL_FORMAT_AUTO);
+        
+        /**
+         * Wait until every queued frame went through the pipeline
+         */
+        void flush();
+        
+        /**
+         * Wait for the frames in flight, then add patterns or a vocabulary (see PatternTracker::loadVocabulary()) to the shared database.
+         * Don't call them from several threads at once.
+         */
+        int add(const cv::Mat& image, const std::string& name = "");
+        int load(const std::string& path);
+        bool loadVocabulary(const std::string& path);
+        
+        /**
+         * Copy the result of the last integrated frame of a camera, false if there's none yet
+         */
+        bool getResult(int camera, Result& result) const;
+        
+        /**
+         * Statistics of the last frames of a camera, recorded from the workers
+         */
+        const TrackerProfiler& getProfiler(int camera) const { return *m_cameras[camera]->profiler; }
+        
+        unsigned long long getNumProcessed(int camera) const;
+        unsigned long long getNumDropped(int camera) const;
+        unsigned long long getNumDeadlineMisses(int camera) const;
+        
+        /**
+         * Most frames matched together, 1 to match every frame on its own
+         */
+        int maxBatchSize;
+    
+    protected:
+        enum CameraState
+        {
+            CAMERA_IDLE,            // nothing in flight
+            CAMERA_EXTRACTING,
+            CAMERA_EXTRACTED,       // waiting to be matched
+            CAMERA_MATCHING,
+            CAMERA_MATCHED,         // knn matches ready, waiting to be verified
+            CAMERA_VERIFYING        // verification, integration & callback
+        };
+        
+        struct Camera
+        {
+            Camera();
+            
+            PatternTracker              tracker;
+            cv::Mat                     cameraMatrix;
+            cv::Mat                     distCoeffs;
+            int64                       latencyTarget;  // in ticks
+            
+            // The frame being copied by push(), the queued frame & the frame in flight
+            std::unique_ptr<FrameData>  spare;
+            std::unique_ptr<FrameData>  input;
+            std::unique_ptr<FrameData>  working;
+            bool                        hasInput;
+            CameraState                 state;
+            
+            // The queued frame inherits the deadline of the frames it replaced, so that a camera
+            // pushing faster than it's served isn't starved by the others
+            int64                       inputDeadline;
+            int64                       deadline;       // of the frame in flight
+            long long                   nextIndex;
+            
+            Result                      result;
+            cv::Ptr<TrackerProfiler>    profiler;
+            unsigned long long          numProcessed;
+            unsigned long long          numDropped;
+            unsigned long long          numDeadlineMisses;
+        };
+        
+        void work();
+        
+        /**
+         * Camera & state of the most urgent task, false if there's none. Called with the lock held.
+         */
+        bool nextTask(size_t& camera, CameraState& state) const;
+        
+        /**
+         * Match the descriptors of the extracted frames of the cameras at once.
+         * descriptors, knnMatches & patterns are scratch buffers of the worker.
+         */
+        void matchBatch(const std::vector<Camera*>& batch, cv::Mat& descriptors, std::vector< std::vector<cv::DMatch> >& knnMatches,
+                        std::vector<int>& patterns);
+        
+        /**
+         * Ratio test, verification, integration, pose & callback of the matched frame of a camera
+         */
+        void verify(int camera, Result& result);
+        
+        /**
+         * Keep new frames out of the pipeline and wait until it's empty, the lock is released on return.
+         * resume() retrains the database and lets the frames in again.
+         */
+        void pause();
+        void resume();
+    
+    private:
+        PatternTracker                          m_patterns;     // owns the database shared by the cameras
+        std::vector< std::unique_ptr<Camera> >  m_cameras;
+        Callback                                m_callback;
+        
+        std::vector<std::thread>                m_workers;
+        size_t                                  m_numWorkers;
+        bool                                    m_paused;
+        bool                                    m_stop;
+        
+        mutable std::mutex                      m_mutex;
+        std::condition_variable                 m_workReady;
+        std::condition_variable                 m_progress;
+    };
+    
+}
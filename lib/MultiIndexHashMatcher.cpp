@@ -0,0 +1,371 @@
+//
+//  MultiIndexHashMatcher.cpp
+//
+//  Descriptor matcher of binary descriptors based on multi-index hashing.
+//
+
+#include "MultiIndexHashMatcher.h"
+#include "HammingKernel.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace cv {
+    
+    namespace {
+        
+        const int numBuckets = 1 << 16;
+        
+        /**
+         * Visited flags of the train descriptors, per thread as a matcher is shared by the pipeline workers.
+         * Each query marks them with a new stamp, so that they're only cleared when the stamps wrap around.
+         */
+        struct VisitedFlags
+        {
+            VisitedFlags() : stamp(0) {}
+            
+            unsigned next(size_t size)
+            {
+                if (flags.size() < size)
+                    flags.resize(size, 0);
+                if (++stamp == 0)
+                {
+                    std::fill(flags.begin(), flags.end(), 0);
+                    stamp = 1;
+                }
+                return stamp;
+            }
+            
+            std::vector<unsigned> flags;
+            unsigned stamp;
+        };
+        
+        VisitedFlags& visitedFlags()
+        {
+            static thread_local VisitedFlags visited;
+            return visited;
+        }
+        
+        // Insert a match in a list sorted by distance, keeping at most k entries
+        inline void insertMatch(std::vector<cv::DMatch>& best, const cv::DMatch& match, int k)
+        {
+            if (best.size() == (size_t)k && match.distance >= best.back().distance)
+                return;
+            
+            std::vector<cv::DMatch>::iterator it = best.begin();
+            while (it != best.end() && it->distance <= match.distance)
+                ++it;
+            best.insert(it, match);
+            
+            if (best.size() > (size_t)k)
+                best.pop_back();
+        }
+        
+        // All 16 bits masks with at most radius bits set
+        const std::vector<unsigned short>& getProbes(int radius)
+        {
+            static std::vector<unsigned short> probes[3];
+            std::vector<unsigned short>& p = probes[radius];
+            if (p.empty())
+            {
+                p.push_back(0);
+                for (int i = 0; i < 16 && radius > 0; i++)
+                    p.push_back(1 << i);
+                for (int i = 0; i < 16 && radius > 1; i++)
+                    for (int j = i + 1; j < 16; j++)
+                        p.push_back((1 << i) | (1 << j));
+            }
+            return p;
+        }
+    }
+    
+    MultiIndexHashMatcher::MultiIndexHashMatcher(int searchRadius)
+    : m_searchRadius(std::max(0, std::min(searchRadius, 2)))
+    , m_numTables(0)
+    , m_needsTraining(false)
+    {
+        // build the probes table outside of the matching threads
+        getProbes(m_searchRadius);
+    }
+    
+    void MultiIndexHashMatcher::add(const std::vector<cv::Mat>& descriptors)
+    {
+        cv::DescriptorMatcher::add(descriptors);
+        m_needsTraining = true;
+    }
+    
+    void MultiIndexHashMatcher::clear()
+    {
+        cv::DescriptorMatcher::clear();
+        m_descriptors.release();
+        m_imgIdx.clear();
+        m_trainIdx.clear();
+        m_bucketOffsets.clear();
+        m_bucketEntries.clear();
+        m_numTables = 0;
+        m_needsTraining = false;
+    }
+    
+    void MultiIndexHashMatcher::gatherDescriptors()
+    {
+        // Gather all the train descriptors in a single matrix
+        int numDescriptors = 0;
+        int descriptorSize = 0;
+        for (size_t i = 0; i < trainDescCollection.size(); i++)
+        {
+            const cv::Mat& descriptors = trainDescCollection[i];
+            if (descriptors.empty())
+                continue;
+            CV_Assert(descriptors.depth() == CV_8U && descriptors.cols % 2 == 0);
+            CV_Assert(descriptorSize == 0 || descriptorSize == descriptors.cols);
+            descriptorSize = descriptors.cols;
+            numDescriptors += descriptors.rows;
+        }
+        
+        m_descriptors.create(numDescriptors, descriptorSize, CV_8U);
+        m_imgIdx.resize(numDescriptors);
+        m_trainIdx.resize(numDescriptors);
+        
+        int row = 0;
+        for (size_t i = 0; i < trainDescCollection.size(); i++)
+        {
+            const cv::Mat& descriptors = trainDescCollection[i];
+            if (descriptors.empty())
+                continue;
+            descriptors.copyTo(m_descriptors.rowRange(row, row + descriptors.rows));
+            for (int j = 0; j < descriptors.rows; j++, row++)
+            {
+                m_imgIdx[row] = i;
+                m_trainIdx[row] = j;
+            }
+        }
+        
+        m_numTables = descriptorSize / 2;
+    }
+    
+    void MultiIndexHashMatcher::train()
+    {
+        if (!m_needsTraining)
+            return;
+        m_needsTraining = false;
+        
+        gatherDescriptors();
+        const int numDescriptors = m_descriptors.rows;
+        
+        // Build the tables with a counting sort of the descriptors on each substring
+        m_bucketOffsets.assign(m_numTables * (numBuckets + 1), 0);
+        m_bucketEntries.resize(m_numTables * numDescriptors);
+        
+        std::vector<int> cursors(numBuckets);
+        for (int t = 0; t < m_numTables; t++)
+        {
+            int* offsets = &m_bucketOffsets[t * (numBuckets + 1)];
+            
+            for (int i = 0; i < numDescriptors; i++)
+                offsets[getSubstring(m_descriptors.ptr(i), t) + 1]++;
+            
+            offsets[0] = t * numDescriptors;
+            for (int b = 0; b < numBuckets; b++)
+                offsets[b + 1] += offsets[b];
+            
+            std::copy(offsets, offsets + numBuckets, cursors.begin());
+            for (int i = 0; i < numDescriptors; i++)
+                m_bucketEntries[cursors[getSubstring(m_descriptors.ptr(i), t)]++] = i;
+        }
+    }
+    
+    void MultiIndexHashMatcher::saveIndex(std::vector<unsigned char>& data)
+    {
+        train();
+        
+        // numTables, numDescriptors, descriptorSize, then the tables
+        const int header[3] = { m_numTables, m_descriptors.rows, m_descriptors.cols };
+        data.resize(sizeof(header) + (m_bucketOffsets.size() + m_bucketEntries.size()) * sizeof(int));
+        
+        unsigned char* out = &data[0];
+        memcpy(out, header, sizeof(header));
+        out += sizeof(header);
+        if (!m_bucketOffsets.empty())
+            memcpy(out, &m_bucketOffsets[0], m_bucketOffsets.size() * sizeof(int));
+        out += m_bucketOffsets.size() * sizeof(int);
+        if (!m_bucketEntries.empty())
+            memcpy(out, &m_bucketEntries[0], m_bucketEntries.size() * sizeof(int));
+    }
+    
+    bool MultiIndexHashMatcher::loadIndex(const unsigned char* data, size_t size)
+    {
+        int header[3];
+        if (size < sizeof(header))
+            return false;
+        memcpy(header, data, sizeof(header));
+        
+        gatherDescriptors();
+        
+        const size_t numOffsets = m_numTables * (numBuckets + 1);
+        const size_t numEntries = m_numTables * m_descriptors.rows;
+        if (header[0] != m_numTables || header[1] != m_descriptors.rows || header[2] != m_descriptors.cols
+            || size != sizeof(header) + (numOffsets + numEntries) * sizeof(int))
+            return false;
+        
+        const int* tables = (const int*)(data + sizeof(header));
+        
+        // A corrupted index would read out of the tables or of the descriptors, it's retrained instead
+        const int numDescriptors = m_descriptors.rows;
+        for (int t = 0; t < m_numTables; t++)
+        {
+            const int* offsets = tables + t * (numBuckets + 1);
+            if (offsets[0] != t * numDescriptors || offsets[numBuckets] != (t + 1) * numDescriptors)
+                return false;
+            for (int b = 0; b < numBuckets; b++)
+                if (offsets[b + 1] < offsets[b])
+                    return false;
+        }
+        for (size_t i = 0; i < numEntries; i++)
+        {
+            const int entry = tables[numOffsets + i];
+            if (entry < 0 || entry >= numDescriptors)
+                return false;
+        }
+        
+        m_bucketOffsets.assign(tables, tables + numOffsets);
+        m_bucketEntries.assign(tables + numOffsets, tables + numOffsets + numEntries);
+        
+        m_needsTraining = false;
+        return true;
+    }
+    
+    cv::Ptr<cv::DescriptorMatcher> MultiIndexHashMatcher::clone(bool emptyTrainData) const
+    {
+        MultiIndexHashMatcher* matcher = new MultiIndexHashMatcher(m_searchRadius);
+        if (!emptyTrainData)
+        {
+            std::vector<cv::Mat> descriptors(trainDescCollection.size());
+            for (size_t i = 0; i < descriptors.size(); i++)
+                descriptors[i] = trainDescCollection[i].clone();
+            matcher->add(descriptors);
+        }
+        return matcher;
+    }
+    
+    inline unsigned short MultiIndexHashMatcher::getSubstring(const uchar* descriptor, int table) const
+    {
+        return descriptor[2 * table] | (descriptor[2 * table + 1] << 8);
+    }
+    
+    template <typename Visitor>
+    void MultiIndexHashMatcher::forEachCandidate(const uchar* query, std::vector<unsigned>& visited, unsigned stamp, Visitor visit) const
+    {
+        const std::vector<unsigned short>& probes = getProbes(m_searchRadius);
+        
+        for (int t = 0; t < m_numTables; t++)
+        {
+            const int* offsets = &m_bucketOffsets[t * (numBuckets + 1)];
+            const unsigned short key = getSubstring(query, t);
+            
+            for (size_t p = 0; p < probes.size(); p++)
+            {
+                const unsigned short bucket = key ^ probes[p];
+                for (int e = offsets[bucket]; e < offsets[bucket + 1]; e++)
+                {
+                    const int idx = m_bucketEntries[e];
+                    if (visited[idx] == stamp)
+                        continue;
+                    visited[idx] = stamp;
+                    visit(idx);
+                }
+            }
+        }
+    }
+    
+    void MultiIndexHashMatcher::knnMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k,
+                                             const std::vector<cv::Mat>& /*masks*/, bool compactResult)
+    {
+        knnMatchInPlace(queryDescriptors, matches, k);
+        
+        if (compactResult)
+        {
+            matches.erase(std::remove_if(matches.begin(), matches.end(), [](const std::vector<cv::DMatch>& m) {
+                return m.empty();
+            }), matches.end());
+        }
+    }
+    
+    void MultiIndexHashMatcher::knnMatchInPlace(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k) const
+    {
+        if (m_descriptors.empty() || queryDescriptors.empty())
+        {
+            matches.clear();
+            return;
+        }
+        CV_Assert(queryDescriptors.type() == m_descriptors.type() && queryDescriptors.cols == m_descriptors.cols);
+        
+        matches.resize(queryDescriptors.rows);
+        
+        const int descriptorSize = m_descriptors.cols;
+        const float guaranteedDistance = getGuaranteedDistance();
+        VisitedFlags& visited = visitedFlags();
+        
+        for (int q = 0; q < queryDescriptors.rows; q++)
+        {
+            const uchar* query = queryDescriptors.ptr(q);
+            std::vector<cv::DMatch>& best = matches[q];
+            best.clear();
+            best.reserve(k + 1);
+            
+            const unsigned stamp = visited.next(m_descriptors.rows);
+            forEachCandidate(query, visited.flags, stamp, [&](int idx) {
+                float distance = hamming::distance(query, m_descriptors.ptr(idx), descriptorSize);
+                insertMatch(best, cv::DMatch(q, m_trainIdx[idx], m_imgIdx[idx], distance), k);
+            });
+            
+            if (best.empty())
+                continue;
+            
+            // Descriptors that weren't visited are at least that far : beyond, a visited neighbour may not be the
+            // nearest one, only the bound is known
+            for (auto & match : best)
+            {
+                if (match.distance > guaranteedDistance)
+                    match = cv::DMatch(q, -1, -1, guaranteedDistance);
+            }
+            while (best.size() < (size_t)k)
+                best.push_back(cv::DMatch(q, -1, -1, guaranteedDistance));
+        }
+    }
+    
+    void MultiIndexHashMatcher::radiusMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, float maxDistance,
+                                                const std::vector<cv::Mat>& /*masks*/, bool compactResult)
+    {
+        matches.clear();
+        matches.reserve(queryDescriptors.rows);
+        
+        if (m_descriptors.empty())
+            return;
+        CV_Assert(queryDescriptors.type() == m_descriptors.type() && queryDescriptors.cols == m_descriptors.cols);
+        
+        const int descriptorSize = m_descriptors.cols;
+        VisitedFlags& visited = visitedFlags();
+        std::vector<cv::DMatch> found;
+        
+        for (int q = 0; q < queryDescriptors.rows; q++)
+        {
+            const uchar* query = queryDescriptors.ptr(q);
+            found.clear();
+            
+            // Only exact below the guaranteed distance
+            const unsigned stamp = visited.next(m_descriptors.rows);
+            forEachCandidate(query, visited.flags, stamp, [&](int idx) {
+                float distance = hamming::distance(query, m_descriptors.ptr(idx), descriptorSize);
+                if (distance <= maxDistance)
+                    found.push_back(cv::DMatch(q, m_trainIdx[idx], m_imgIdx[idx], distance));
+            });
+            
+            if (found.empty() && compactResult)
+                continue;
+            
+            std::sort(found.begin(), found.end());
+            matches.push_back(found);
+        }
+    }
+    
+}
@@ -0,0 +1,89 @@
+//
+//  MultiIndexHashMatcher.h
+//
+//  Descriptor matcher of binary descriptors based on multi-index hashing.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace cv {
+
+    /**
+     * Descriptor matcher for binary descriptors (ORB, BRIEF, FREAK...) based on multi-index hashing.
+     *
+     * Each train descriptor is split in 16 bits substrings, each indexing its own direct-addressed table.
+     * A query only compares itself with the descriptors sharing at least one substring with it,
+     * up to searchRadius differing bits. By the pigeonhole principle, every train descriptor closer
+     * than getGuaranteedDistance() is found: the search is exact below that distance.
+     *
+     * When fewer than k neighbours are found for a query which has at least one, the result is padded
+     * with matches having trainIdx = imgIdx = -1 and the guaranteed distance, which is a lower bound
+     * of the distance of the descriptors that were not found. The neighbours found beyond that distance
+     * are replaced the same way, a descriptor that wasn't visited may be closer. This keeps the ratio test
+     * meaningful : it never passes a match whose second neighbour wasn't bounded.
+     */
+    class MultiIndexHashMatcher : public cv::DescriptorMatcher
+    {
+    public:
+        MultiIndexHashMatcher(int searchRadius = 1);
+        
+        virtual void add(const std::vector<cv::Mat>& descriptors);
+        virtual void clear();
+        virtual void train();
+        virtual bool isMaskSupported() const { return false; }
+        virtual cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const;
+        
+        int getGuaranteedDistance() const { return m_numTables * (m_searchRadius + 1); }
+        
+        /**
+         * knnMatch() on the trained matcher, one entry per query, keeping the buffers of matches
+         * from the previous call : cv::DescriptorMatcher::knnMatch() clears them.
+         * The visited flags of the train descriptors are kept per thread, so that nothing is allocated once warmed up.
+         */
+        void knnMatchInPlace(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k) const;
+        
+        /**
+         * Serialized tables, to skip training when the same train descriptors are added again.
+         * loadIndex() must be called after add() and fails if the index doesn't fit the train descriptors or is corrupted.
+         */
+        static const unsigned indexType = 0x3148494d; // "MIH1"
+        void saveIndex(std::vector<unsigned char>& data);
+        bool loadIndex(const unsigned char* data, size_t size);
+        
+    protected:
+        virtual void knnMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k,
+                                  const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(), bool compactResult = false);
+        virtual void radiusMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, float maxDistance,
+                                     const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(), bool compactResult = false);
+        
+        /**
+         * Call visit(globalIdx) once for every train descriptor sharing a substring with the query
+         */
+        template <typename Visitor>
+        void forEachCandidate(const uchar* query, std::vector<unsigned>& visited, unsigned stamp, Visitor visit) const;
+        
+        unsigned short getSubstring(const uchar* descriptor, int table) const;
+        
+        /**
+         * Copy all the train descriptors in m_descriptors
+         */
+        void gatherDescriptors();
+        
+    private:
+        int                       m_searchRadius;
+        int                       m_numTables;
+        bool                      m_needsTraining;
+        
+        cv::Mat                   m_descriptors;   // all train descriptors, one per row
+        std::vector<int>          m_imgIdx;        // image of each row
+        std::vector<int>          m_trainIdx;      // index of each row in its image
+        
+        // one table per substring, stored as buckets offsets (65537 per table) & descriptors indices
+        std::vector<int>          m_bucketOffsets;
+        std::vector<int>          m_bucketEntries;
+    };
+    
+}
@@ -0,0 +1,236 @@
+//
+//  PackedHammingMatcher.cpp
+//
+//  Exact brute force matcher of binary descriptors packed in a single cache aligned block.
+//
+
+#include "PackedHammingMatcher.h"
+#include "HammingKernel.h"
+
+#include <cstring>
+
+namespace cv {
+    
+    namespace {
+        
+        const int cacheLine = 64;
+        
+        // distances are computed by blocks small enough to stay in L1
+        const int blockSize = 256;
+        
+        // padded queries up to this size stay on the stack, ORB descriptors take 32 bytes
+        const int maxStackStride = 128;
+        
+        // Insert a match in a list sorted by distance, keeping at most k entries.
+        // Matches are visited in train order so equal distances keep the first one.
+        inline void insertMatch(std::vector<cv::DMatch>& best, const cv::DMatch& match, int k)
+        {
+            if (best.size() == (size_t)k && match.distance >= best.back().distance)
+                return;
+            
+            std::vector<cv::DMatch>::iterator it = best.begin();
+            while (it != best.end() && it->distance <= match.distance)
+                ++it;
+            best.insert(it, match);
+            
+            if (best.size() > (size_t)k)
+                best.pop_back();
+        }
+    }
+    
+    PackedHammingMatcher::PackedHammingMatcher()
+    : m_needsTraining(false)
+    , m_descriptorSize(0)
+    , m_stride(0)
+    , m_count(0)
+    , m_block(0)
+    {
+    }
+    
+    void PackedHammingMatcher::add(const std::vector<cv::Mat>& descriptors)
+    {
+        cv::DescriptorMatcher::add(descriptors);
+        m_needsTraining = true;
+    }
+    
+    void PackedHammingMatcher::clear()
+    {
+        cv::DescriptorMatcher::clear();
+        m_storage.clear();
+        m_block = 0;
+        m_imgIdx.clear();
+        m_trainIdx.clear();
+        m_descriptorSize = m_stride = m_count = 0;
+        m_needsTraining = false;
+    }
+    
+    void PackedHammingMatcher::train()
+    {
+        if (!m_needsTraining)
+            return;
+        m_needsTraining = false;
+        
+        m_descriptorSize = 0;
+        m_count = 0;
+        for (size_t i = 0; i < trainDescCollection.size(); i++)
+        {
+            const cv::Mat& descriptors = trainDescCollection[i];
+            if (descriptors.empty())
+                continue;
+            CV_Assert(descriptors.depth() == CV_8U);
+            CV_Assert(m_descriptorSize == 0 || m_descriptorSize == descriptors.cols);
+            m_descriptorSize = descriptors.cols;
+            m_count += descriptors.rows;
+        }
+        
+        // Pack the descriptors, zero padding doesn't change the distances
+        m_stride = (m_descriptorSize + 31) / 32 * 32;
+        m_storage.assign(m_count * m_stride + cacheLine, 0);
+        m_block = (uchar*)(((size_t)&m_storage[0] + cacheLine - 1) & ~(size_t)(cacheLine - 1));
+        m_imgIdx.resize(m_count);
+        m_trainIdx.resize(m_count);
+        
+        int n = 0;
+        for (size_t i = 0; i < trainDescCollection.size(); i++)
+        {
+            const cv::Mat& descriptors = trainDescCollection[i];
+            for (int j = 0; j < descriptors.rows; j++, n++)
+            {
+                memcpy(m_block + n * m_stride, descriptors.ptr(j), m_descriptorSize);
+                m_imgIdx[n] = i;
+                m_trainIdx[n] = j;
+            }
+        }
+    }
+    
+    cv::Ptr<cv::DescriptorMatcher> PackedHammingMatcher::clone(bool emptyTrainData) const
+    {
+        PackedHammingMatcher* matcher = new PackedHammingMatcher();
+        if (!emptyTrainData)
+        {
+            std::vector<cv::Mat> descriptors(trainDescCollection.size());
+            for (size_t i = 0; i < descriptors.size(); i++)
+                descriptors[i] = trainDescCollection[i].clone();
+            matcher->add(descriptors);
+        }
+        return matcher;
+    }
+    
+    template <typename Visitor>
+    void PackedHammingMatcher::forEachDistance(const cv::Mat& queryDescriptors, int row, uchar* paddedQuery,
+                                               int* distances, Visitor visit) const
+    {
+        memcpy(paddedQuery, queryDescriptors.ptr(row), m_descriptorSize);
+        
+        for (int start = 0; start < m_count; start += blockSize)
+        {
+            const int n = std::min(blockSize, m_count - start);
+            hamming::distances(paddedQuery, m_block + start * m_stride, n, m_stride, distances);
+            for (int i = 0; i < n; i++)
+                visit(start + i, distances[i]);
+        }
+    }
+    
+    void PackedHammingMatcher::knnMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k,
+                                            const std::vector<cv::Mat>& /*masks*/, bool compactResult)
+    {
+        knnMatchInPlace(queryDescriptors, matches, k);
+        
+        if (compactResult)
+        {
+            matches.erase(std::remove_if(matches.begin(), matches.end(), [](const std::vector<cv::DMatch>& m) {
+                return m.empty();
+            }), matches.end());
+        }
+    }
+    
+    void PackedHammingMatcher::knnMatchInPlace(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k) const
+    {
+        if (m_count == 0 || queryDescriptors.empty())
+        {
+            matches.clear();
+            return;
+        }
+        CV_Assert(queryDescriptors.depth() == CV_8U && queryDescriptors.cols == m_descriptorSize);
+        
+        matches.resize(queryDescriptors.rows);
+        for (auto & best : matches)
+        {
+            best.clear();
+            best.reserve(k + 1);
+        }
+        
+        // Queries already as wide as the packed descriptors are read in place, the others padded
+        const bool padQueries = m_stride != m_descriptorSize;
+        uchar stackQuery[maxStackStride] = {0};
+        std::vector<uchar> heapQuery;
+        uchar* paddedQuery = stackQuery;
+        if (m_stride > maxStackStride)
+        {
+            heapQuery.assign(m_stride, 0);
+            paddedQuery = &heapQuery[0];
+        }
+        int distances[blockSize];
+        
+        // Block major : each block of train descriptors stays in cache while all the queries
+        // are compared to it, which pays off on the large batches of several frames at once.
+        // Every query still sees the train descriptors in order, the ties are unchanged.
+        for (int start = 0; start < m_count; start += blockSize)
+        {
+            const int n = std::min(blockSize, m_count - start);
+            const uchar* block = m_block + start * m_stride;
+            
+            for (int q = 0; q < queryDescriptors.rows; q++)
+            {
+                const uchar* query = queryDescriptors.ptr(q);
+                if (padQueries)
+                {
+                    memcpy(paddedQuery, query, m_descriptorSize);
+                    query = paddedQuery;
+                }
+                hamming::distances(query, block, n, m_stride, distances);
+                
+                std::vector<cv::DMatch>& best = matches[q];
+                for (int i = 0; i < n; i++)
+                {
+                    if (best.size() < (size_t)k || distances[i] < best.back().distance)
+                        insertMatch(best, cv::DMatch(q, m_trainIdx[start + i], m_imgIdx[start + i], distances[i]), k);
+                }
+            }
+        }
+    }
+    
+    void PackedHammingMatcher::radiusMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, float maxDistance,
+                                               const std::vector<cv::Mat>& /*masks*/, bool compactResult)
+    {
+        matches.clear();
+        if (m_count == 0)
+            return;
+        CV_Assert(queryDescriptors.depth() == CV_8U && queryDescriptors.cols == m_descriptorSize);
+        
+        matches.resize(queryDescriptors.rows);
+        
+        std::vector<uchar> paddedQuery(m_stride, 0);
+        std::vector<int> distances(blockSize);
+        
+        for (int q = 0; q < queryDescriptors.rows; q++)
+        {
+            std::vector<cv::DMatch>& found = matches[q];
+            
+            forEachDistance(queryDescriptors, q, &paddedQuery[0], &distances[0], [&](int idx, int distance) {
+                if (distance <= maxDistance)
+                    found.push_back(cv::DMatch(q, m_trainIdx[idx], m_imgIdx[idx], distance));
+            });
+            
+            std::stable_sort(found.begin(), found.end());
+        }
+        
+        if (compactResult)
+        {
+            matches.erase(std::remove_if(matches.begin(), matches.end(), [](const std::vector<cv::DMatch>& m) {
+                return m.empty();
+            }), matches.end());
+        }
+    }
+    
+}
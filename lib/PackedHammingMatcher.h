@@ -0,0 +1,65 @@
+//
+//  PackedHammingMatcher.h
+//
+//  Exact brute force matcher of binary descriptors packed in a single cache aligned block.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace cv {
+
+    /**
+     * Exact brute force matcher for binary descriptors.
+     *
+     * Train descriptors of all the images are packed in a single cache aligned block,
+     * each one zero padded to a multiple of 32 bytes, and the distances are computed
+     * with the SIMD kernels of HammingKernel.h.
+     * Returns the same neighbours as cv::BruteForceMatcher<cv::HammingLUT>, ties being
+     * resolved in favor of the first image & train descriptor.
+     */
+    class PackedHammingMatcher : public cv::DescriptorMatcher
+    {
+    public:
+        PackedHammingMatcher();
+        
+        virtual void add(const std::vector<cv::Mat>& descriptors);
+        virtual void clear();
+        virtual void train();
+        virtual bool isMaskSupported() const { return false; }
+        virtual cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const;
+        
+        /**
+         * knnMatch() on the trained matcher, one entry per query, keeping the buffers of matches
+         * from the previous call : cv::DescriptorMatcher::knnMatch() clears them.
+         */
+        void knnMatchInPlace(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k) const;
+        
+    protected:
+        virtual void knnMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k,
+                                  const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(), bool compactResult = false);
+        virtual void radiusMatchImpl(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, float maxDistance,
+                                     const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(), bool compactResult = false);
+        
+        /**
+         * Compute the distances of a query to the train descriptors, block by block,
+         * calling visit(globalIdx, distance) in train order.
+         */
+        template <typename Visitor>
+        void forEachDistance(const cv::Mat& queryDescriptors, int row, uchar* paddedQuery, int* distances, Visitor visit) const;
+        
+    private:
+        bool                      m_needsTraining;
+        int                       m_descriptorSize;
+        int                       m_stride;
+        int                       m_count;
+        
+        std::vector<uchar>        m_storage;
+        uchar*                    m_block;         // 64 bytes aligned in m_storage
+        std::vector<int>          m_imgIdx;        // image of each packed descriptor
+        std::vector<int>          m_trainIdx;      // index of each packed descriptor in its image
+    };
+    
+}
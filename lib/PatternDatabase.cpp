@@ -0,0 +1,317 @@
+//
+//  PatternDatabase.cpp
+//
+//  Patterns tracked by PatternTracker, along with their matcher & vocabulary index.
+//
+
+#include "PatternDatabase.h"
+#include "MultiIndexHashMatcher.h"
+#include "PackedHammingMatcher.h"
+#include "HammingKernel.h"
+
+#include <atomic>
+#include <algorithm>
+
+namespace cv {
+    
+    namespace {
+        
+        std::atomic<unsigned long long> nextRevision(1);
+    }
+
+    PatternDatabase::PatternDatabase()
+    : m_needsTraining(false)
+    , m_needsRebuild(false)
+    , m_needsIndexing(false)
+    {
+    }
+    
+    void PatternDatabase::setup(const cv::Ptr<cv::DescriptorMatcher>& matcher)
+    {
+        m_matcher = matcher;
+        
+        // Carry over the patterns already added
+        m_matcherPatterns.clear();
+        addToMatcher(0);
+        m_needsRebuild = false;
+    }
+    
+    int PatternDatabase::add(const Pattern& pattern)
+    {
+        m_patterns.push_back(pattern);
+        m_revisions.push_back(nextRevision++);
+        addToMatcher(m_patterns.size() - 1);
+        
+        if (hasVocabulary())
+        {
+            m_patternWords.push_back(std::vector<int>());
+            m_vocabulary->transform(pattern.descriptors, m_patternWords.back());
+            m_needsIndexing = true;
+        }
+        
+        return m_patterns.size() - 1;
+    }
+    
+    int PatternDatabase::add(const std::vector<Pattern>& patterns, unsigned indexType, const unsigned char* indexData, size_t indexSize)
+    {
+        const bool wasEmpty = m_patterns.empty();
+        const int first = m_patterns.size();
+        
+        m_patterns.insert(m_patterns.end(), patterns.begin(), patterns.end());
+        for (size_t i = 0; i < patterns.size(); i++)
+            m_revisions.push_back(nextRevision++);
+        addToMatcher(first);
+        
+        if (hasVocabulary())
+        {
+            m_patternWords.resize(m_patterns.size());
+            for (size_t i = first; i < m_patterns.size(); i++)
+                m_vocabulary->transform(m_patterns[i].descriptors, m_patternWords[i]);
+            m_needsIndexing = true;
+        }
+        
+        // Reuse the prebuilt index if it was built for exactly these train descriptors
+        cv::MultiIndexHashMatcher* mih = dynamic_cast<cv::MultiIndexHashMatcher*>((cv::DescriptorMatcher*)m_matcher);
+        if (wasEmpty && mih && indexType == cv::MultiIndexHashMatcher::indexType && mih->loadIndex(indexData, indexSize))
+            m_needsTraining = false;
+        
+        return first;
+    }
+    
+    bool PatternDatabase::getIndex(unsigned& indexType, std::vector<unsigned char>& indexData)
+    {
+        cv::MultiIndexHashMatcher* mih = dynamic_cast<cv::MultiIndexHashMatcher*>((cv::DescriptorMatcher*)m_matcher);
+        if (!mih)
+            return false;
+        
+        train();
+        indexType = cv::MultiIndexHashMatcher::indexType;
+        mih->saveIndex(indexData);
+        return true;
+    }
+    
+    void PatternDatabase::clear()
+    {
+        m_patterns.clear();
+        m_revisions.clear();
+        m_matcher->clear();
+        m_matcherPatterns.clear();
+        m_needsTraining = false;
+        m_needsRebuild = false;
+        m_featureBackend.clear();
+        
+        // The vocabulary is kept for the next patterns
+        m_patternWords.clear();
+        m_index.clear();
+        m_needsIndexing = false;
+    }
+    
+    bool PatternDatabase::remove(int index)
+    {
+        return replace(index, Pattern());
+    }
+    
+    bool PatternDatabase::replace(int index, const Pattern& pattern)
+    {
+        if (index < 0 || index >= (int)m_patterns.size())
+            return false;
+        
+        m_patterns[index] = pattern;
+        m_revisions[index] = nextRevision++;
+        
+        if (hasVocabulary())
+        {
+            m_vocabulary->transform(pattern.descriptors, m_patternWords[index]);
+            m_needsIndexing = true;
+        }
+        
+        // The matcher can't replace the descriptors of a train image, it's rebuilt from the patterns
+        m_needsRebuild = true;
+        m_needsTraining = true;
+        return true;
+    }
+    
+    cv::Ptr<PatternDatabase> PatternDatabase::clone() const
+    {
+        cv::Ptr<PatternDatabase> copy = new PatternDatabase();
+        copy->m_patterns = m_patterns;
+        copy->m_revisions = m_revisions;
+        copy->m_featureBackend = m_featureBackend;
+        copy->m_vocabulary = m_vocabulary;
+        copy->m_patternWords = m_patternWords;
+        copy->m_needsIndexing = hasVocabulary();
+        
+        copy->m_matcher = m_matcher->clone(true);
+        copy->m_needsRebuild = true;
+        copy->m_needsTraining = true;
+        return copy;
+    }
+    
+    bool PatternDatabase::setVocabulary(const cv::Ptr<BinaryVocabulary>& vocabulary)
+    {
+        if (vocabulary.empty() || vocabulary->empty())
+            return false;
+        
+        // Words of descriptors of another backend would be meaningless
+        if (!m_featureBackend.empty() && !vocabulary->getFeatureBackend().empty() && vocabulary->getFeatureBackend() != m_featureBackend)
+            return false;
+        for (const auto & pattern : m_patterns)
+        {
+            if (!pattern.descriptors.empty() && pattern.descriptors.cols != vocabulary->getDescriptorSize())
+                return false;
+        }
+        
+        m_vocabulary = vocabulary;
+        m_patternWords.resize(m_patterns.size());
+        for (size_t i = 0; i < m_patterns.size(); i++)
+            m_vocabulary->transform(m_patterns[i].descriptors, m_patternWords[i]);
+        m_needsIndexing = true;
+        return true;
+    }
+    
+    void PatternDatabase::knnMatch(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k)
+    {
+        train();
+        
+        // Our matchers reuse the buffers of the previous matches
+        cv::DescriptorMatcher* matcher = m_matcher;
+        if (cv::PackedHammingMatcher* packed = dynamic_cast<cv::PackedHammingMatcher*>(matcher))
+            packed->knnMatchInPlace(queryDescriptors, matches, k);
+        else if (cv::MultiIndexHashMatcher* mih = dynamic_cast<cv::MultiIndexHashMatcher*>(matcher))
+            mih->knnMatchInPlace(queryDescriptors, matches, k);
+        else
+            m_matcher->knnMatch(queryDescriptors, matches, k);
+        
+        // Back to the indices of the patterns when some slots are empty
+        if (m_matcherPatterns.size() != m_patterns.size())
+        {
+            for (auto & neighbours : matches)
+            {
+                for (auto & m : neighbours)
+                    toPattern(m);
+            }
+        }
+    }
+    
+    void PatternDatabase::match(const cv::Mat& queryDescriptors, std::vector<cv::DMatch>& matches)
+    {
+        train();
+        m_matcher->match(queryDescriptors, matches);
+        
+        // Approximate matchers return placeholders for the queries whose nearest neighbour isn't known
+        matches.erase(std::remove_if(matches.begin(), matches.end(), [](const cv::DMatch& m) {
+            return m.trainIdx < 0 || m.imgIdx < 0;
+        }), matches.end());
+        
+        if (m_matcherPatterns.size() != m_patterns.size())
+        {
+            for (auto & m : matches)
+                toPattern(m);
+        }
+    }
+    
+    void PatternDatabase::addToMatcher(size_t first)
+    {
+        // One descriptors matrix per pattern, shared with it, so that the search covers all of them at once.
+        // The empty slots of removed patterns stay out of the matcher, which may not accept empty train images :
+        // its imgIdx are mapped back to the indices of the patterns.
+        std::vector<cv::Mat> descriptors;
+        for (size_t i = first; i < m_patterns.size(); i++)
+        {
+            if (m_patterns[i].descriptors.empty())
+                continue;
+            descriptors.push_back(m_patterns[i].descriptors);
+            m_matcherPatterns.push_back(i);
+        }
+        if (!descriptors.empty())
+            m_matcher->add(descriptors);
+        
+        // Training is deferred so that adding many patterns only trains once
+        m_needsTraining = true;
+    }
+    
+    void PatternDatabase::shortlist(const cv::Mat& queryDescriptors, int k, std::vector<int>& patterns, RetrievalScratch& scratch) const
+    {
+        CV_Assert(hasVocabulary() && !m_needsIndexing);
+        
+        m_vocabulary->transform(queryDescriptors, scratch.words);
+        m_index.query(scratch.words, k, patterns, scratch);
+    }
+    
+    void PatternDatabase::knnMatch(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k,
+                                   const std::vector<int>& patterns, RetrievalScratch& scratch) const
+    {
+        const int size = queryDescriptors.cols;
+        
+        // Like our matchers, keep the buffers of the previous matches
+        matches.resize(queryDescriptors.rows);
+        for (auto & neighbours : matches)
+            neighbours.clear();
+        
+        for (int patternIdx : patterns)
+        {
+            const cv::Mat& train = m_patterns[patternIdx].descriptors;
+            if (train.empty())
+                continue;
+            CV_Assert(train.cols == size && train.type() == queryDescriptors.type());
+            
+            // The packed kernel reads the descriptors in place when they're as wide as its stride
+            const bool packed = size % 32 == 0 && train.isContinuous();
+            std::vector<int>& distances = scratch.distances;
+            distances.resize(train.rows);
+            
+            for (int q = 0; q < queryDescriptors.rows; q++)
+            {
+                const uchar* query = queryDescriptors.ptr(q);
+                if (packed)
+                    hamming::distances(query, train.ptr(), train.rows, size, &distances[0]);
+                else
+                {
+                    for (int t = 0; t < train.rows; t++)
+                        distances[t] = hamming::distance(query, train.ptr(t), size);
+                }
+        
+                // Insert the closer descriptors in the sorted neighbours
+                std::vector<cv::DMatch>& neighbours = matches[q];
+                for (int t = 0; t < train.rows; t++)
+                {
+                    const float distance = distances[t];
+                    if ((int)neighbours.size() == k && distance >= neighbours.back().distance)
+                        continue;
+                    
+                    if ((int)neighbours.size() == k)
+                        neighbours.pop_back();
+                    size_t i = neighbours.size();
+                    neighbours.push_back(cv::DMatch(q, t, patternIdx, distance));
+                    for (; i > 0 && neighbours[i - 1].distance > distance; i--)
+                        std::swap(neighbours[i], neighbours[i - 1]);
+                }
+            }
+        }
+    }
+    
+    void PatternDatabase::train()
+    {
+        if (m_needsRebuild)
+        {
+            // Train descriptors shared with the patterns, whose storage keeps the mapped ones alive
+            m_matcher->clear();
+            m_matcherPatterns.clear();
+            addToMatcher(0);
+            m_needsRebuild = false;
+        }
+        
+        if (m_needsTraining)
+        {
+            m_matcher->train();
+            m_needsTraining = false;
+        }
+        
+        if (m_needsIndexing)
+        {
+            m_index.build(m_patternWords, m_vocabulary->getNumWords());
+            m_needsIndexing = false;
+        }
+    }
+    
+}
@@ -0,0 +1,158 @@
+//
+//  PatternDatabase.h
+//
+//  Patterns tracked by PatternTracker, along with their matcher & vocabulary index.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include "MappedFile.h"
+#include "BinaryVocabulary.h"
+#include "InvertedIndex.h"
+
+namespace cv {
+
+    /**
+     * Store the image data and computed descriptors of target pattern
+     */
+    struct Pattern
+    {
+        std::string               name;
+        cv::Size                  size;
+        cv::Mat                   frame;
+        cv::Mat                   grayImg;
+        
+        std::vector<cv::KeyPoint> keypoints;
+        cv::Mat                   descriptors;
+        
+        std::vector<cv::Point2f>  points2d;
+        std::vector<cv::Point3f>  points3d;
+        
+        // keeps the memory mapped data alive when loaded from a pattern file
+        cv::Ptr<cv::MappedFile>   storage;
+    };
+    
+    /**
+     * Indexed set of patterns sharing a single trained matcher.
+     * Each pattern's descriptors are added to the matcher as a separate train image,
+     * the imgIdx of the returned cv::DMatch being mapped to the index of the matched pattern.
+     *
+     * With a vocabulary, large catalogs are searched coarse to fine : shortlist() retrieves the patterns
+     * sharing the most visual words with the frame, and only their descriptors are matched.
+     *
+     * A database read by a tracker can be edited without stopping it by editing a clone(), training it and
+     * swapping it in between two frames (see PatternUpdater). The indices of the patterns never change :
+     * removed patterns leave an empty slot, and each slot has a revision telling the patterns apart.
+     */
+    class PatternDatabase
+    {
+    public:
+        PatternDatabase();
+        
+        void setup(const cv::Ptr<cv::DescriptorMatcher>& matcher);
+        
+        /**
+         * Append a pattern and return its index.
+         * The matcher is retrained lazily on the next match.
+         */
+        int add(const Pattern& pattern);
+        
+        /**
+         * Append several patterns and return the index of the first one.
+         * When the database is empty, a matcher index previously returned by getIndex()
+         * for the same patterns is used instead of training the matcher.
+         */
+        int add(const std::vector<Pattern>& patterns, unsigned indexType = 0, const unsigned char* indexData = 0, size_t indexSize = 0);
+        
+        /**
+         * Serialized index of the trained matcher, returns false if the matcher doesn't support it
+         */
+        bool getIndex(unsigned& indexType, std::vector<unsigned char>& indexData);
+        
+        void clear();
+        
+        /**
+         * Empty the slot of a pattern, or replace it with another one, keeping the indices of the others.
+         * The matcher is rebuilt on the next train(). False if there's no such pattern.
+         */
+        bool remove(int index);
+        bool replace(int index, const Pattern& pattern);
+        
+        /**
+         * Untrained copy of the database with a matcher of the same type. The copy shares the images &
+         * descriptors of the patterns, which are never written in place, and the vocabulary.
+         */
+        cv::Ptr<PatternDatabase> clone() const;
+        
+        /**
+         * Changes each time a pattern is added, replaced or removed at this index,
+         * unique across the databases so that a pattern of a clone can be told from another one
+         */
+        unsigned long long getRevision(int index) const { return m_revisions[index]; }
+        
+        /**
+         * Name of the FeatureBackend that described the patterns, recorded with the first pattern
+         */
+        const std::string& getFeatureBackend() const { return m_featureBackend; }
+        void setFeatureBackend(const std::string& name) { m_featureBackend = name; }
+        
+        /**
+         * Vocabulary of the descriptors of the patterns, enabling shortlist(). Returns false, leaving the database
+         * unchanged, if it was trained on descriptors of another size or feature backend.
+         * The words of the patterns are computed here & by add(), their index is rebuilt on the next train().
+         */
+        bool setVocabulary(const cv::Ptr<BinaryVocabulary>& vocabulary);
+        const cv::Ptr<BinaryVocabulary>& getVocabulary() const { return m_vocabulary; }
+        bool hasVocabulary() const { return !m_vocabulary.empty(); }
+        
+        size_t size() const { return m_patterns.size(); }
+        bool empty() const { return m_patterns.empty(); }
+        const Pattern& getPattern(int index) const { return m_patterns[index]; }
+        const std::vector<Pattern>& getPatterns() const { return m_patterns; }
+        
+        /**
+         * Train the matcher now rather than on the next match. Until the database changes,
+         * matching from several threads at once is then safe.
+         */
+        void train();
+        
+        void knnMatch(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k);
+        void match(const cv::Mat& queryDescriptors, std::vector<cv::DMatch>& matches);
+        
+        /**
+         * Up to k patterns the query descriptors most likely come from, best first.
+         * Needs a vocabulary & a trained database, it's then safe from several threads like matching.
+         */
+        void shortlist(const cv::Mat& queryDescriptors, int k, std::vector<int>& patterns, RetrievalScratch& scratch) const;
+        
+        /**
+         * knnMatch() against the descriptors of some patterns only, by brute force, so that its cost
+         * depends on the patterns searched rather than on the size of the database. Doesn't need training.
+         */
+        void knnMatch(const cv::Mat& queryDescriptors, std::vector< std::vector<cv::DMatch> >& matches, int k,
+                      const std::vector<int>& patterns, RetrievalScratch& scratch) const;
+        
+    private:
+        /**
+         * Add the descriptors of the patterns from first on to the matcher, skipping the empty slots
+         */
+        void addToMatcher(size_t first);
+        void toPattern(cv::DMatch& match) const { if (match.imgIdx >= 0) match.imgIdx = m_matcherPatterns[match.imgIdx]; }
+        
+        std::vector<Pattern>           m_patterns;
+        std::vector<unsigned long long> m_revisions;     // of each pattern
+        cv::Ptr<cv::DescriptorMatcher> m_matcher;
+        std::vector<int>               m_matcherPatterns;   // pattern of each train image of the matcher
+        bool                           m_needsTraining;
+        bool                           m_needsRebuild;  // a pattern was removed or replaced
+        std::string                    m_featureBackend;
+        
+        cv::Ptr<BinaryVocabulary>      m_vocabulary;
+        std::vector< std::vector<int> > m_patternWords;  // words of the descriptors of each pattern
+        InvertedIndex                  m_index;
+        bool                           m_needsIndexing;
+    };
+    
+}
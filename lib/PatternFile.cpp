@@ -0,0 +1,240 @@
+//
+//  PatternFile.cpp
+//
+//  Binary file of trained patterns, loaded without running any detection.
+//
+
+#include "PatternFile.h"
+
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+
+namespace cv {
+    
+    namespace {
+        
+        const char magic[8] = { 'O', 'F', 'X', 'C', 'V', 'P', 'A', 'T' };
+        const size_t alignment = 64;
+        
+        enum
+        {
+            FLAG_GRAY_IMAGES = 1 << 0,
+            FLAG_INDEX       = 1 << 1
+        };
+        
+        struct FileHeader
+        {
+            char     magic[8];
+            uint32_t version;
+            uint32_t numPatterns;
+            uint32_t flags;
+            uint32_t indexType;
+            uint64_t indexOffset;
+            uint64_t indexSize;
+            uint64_t patternsOffset;
+            char     featureBackend[32];    // zero terminated
+            uint8_t  reserved[48];      // up to a 64 bytes boundary
+        };
+        
+        struct FilePattern
+        {
+            int32_t  width, height;
+            uint32_t numKeypoints;
+            uint32_t numPoints;
+            int32_t  descriptorRows, descriptorCols, descriptorType;
+            uint32_t nameLength;
+            uint64_t nameOffset;
+            uint64_t keypointsOffset;
+            uint64_t descriptorsOffset;
+            uint64_t pointsOffset;
+            uint64_t grayOffset;
+        };
+        
+        struct FileKeyPoint
+        {
+            float    x, y, size, angle, response;
+            int32_t  octave, classId;
+        };
+        
+        // Append a section to the buffer, aligned, and return its offset
+        uint64_t appendSection(std::vector<unsigned char>& buffer, const void* data, size_t size)
+        {
+            buffer.resize((buffer.size() + alignment - 1) / alignment * alignment, 0);
+            uint64_t offset = buffer.size();
+            if (size)
+                buffer.insert(buffer.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+            return offset;
+        }
+        
+        bool inFile(const MappedFile& file, uint64_t offset, uint64_t size)
+        {
+            return offset <= file.size() && size <= file.size() - offset;
+        }
+    }
+    
+    bool PatternFile::write(const std::string& path, const std::vector<Pattern>& patterns, const std::string& featureBackend,
+                            bool withGrayImages, unsigned indexType, const std::vector<unsigned char>& indexData)
+    {
+        if (featureBackend.size() >= sizeof(FileHeader().featureBackend))
+            return false;
+        
+        std::vector<unsigned char> buffer(sizeof(FileHeader) + patterns.size() * sizeof(FilePattern), 0);
+        std::vector<FilePattern> table(patterns.size());
+        
+        for (size_t i = 0; i < patterns.size(); i++)
+        {
+            const Pattern& pattern = patterns[i];
+            FilePattern& entry = table[i];
+            memset(&entry, 0, sizeof(entry));
+            
+            entry.width = pattern.size.width;
+            entry.height = pattern.size.height;
+            
+            entry.nameLength = pattern.name.size();
+            entry.nameOffset = appendSection(buffer, pattern.name.data(), pattern.name.size());
+            
+            std::vector<FileKeyPoint> keypoints(pattern.keypoints.size());
+            for (size_t k = 0; k < keypoints.size(); k++)
+            {
+                const cv::KeyPoint& kp = pattern.keypoints[k];
+                FileKeyPoint& fkp = keypoints[k];
+                fkp.x = kp.pt.x;
+                fkp.y = kp.pt.y;
+                fkp.size = kp.size;
+                fkp.angle = kp.angle;
+                fkp.response = kp.response;
+                fkp.octave = kp.octave;
+                fkp.classId = kp.class_id;
+            }
+            entry.numKeypoints = keypoints.size();
+            entry.keypointsOffset = appendSection(buffer, keypoints.empty() ? 0 : &keypoints[0], keypoints.size() * sizeof(FileKeyPoint));
+            
+            const cv::Mat descriptors = pattern.descriptors.isContinuous() ? pattern.descriptors : pattern.descriptors.clone();
+            entry.descriptorRows = descriptors.rows;
+            entry.descriptorCols = descriptors.cols;
+            entry.descriptorType = descriptors.type();
+            entry.descriptorsOffset = appendSection(buffer, descriptors.data, descriptors.total() * descriptors.elemSize());
+            
+            // 2d contour followed by the 3d one
+            CV_Assert(pattern.points2d.size() == pattern.points3d.size());
+            entry.numPoints = pattern.points2d.size();
+            entry.pointsOffset = appendSection(buffer, entry.numPoints ? &pattern.points2d[0] : 0, entry.numPoints * sizeof(cv::Point2f));
+            appendSection(buffer, entry.numPoints ? &pattern.points3d[0] : 0, entry.numPoints * sizeof(cv::Point3f));
+            
+            if (withGrayImages && !pattern.grayImg.empty())
+            {
+                const cv::Mat gray = pattern.grayImg.isContinuous() ? pattern.grayImg : pattern.grayImg.clone();
+                CV_Assert(gray.type() == CV_8UC1 && gray.size() == pattern.size);
+                entry.grayOffset = appendSection(buffer, gray.data, gray.total());
+            }
+        }
+        
+        FileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.numPatterns = patterns.size();
+        header.flags = withGrayImages ? FLAG_GRAY_IMAGES : 0;
+        header.patternsOffset = sizeof(FileHeader);
+        memcpy(header.featureBackend, featureBackend.data(), featureBackend.size());
+        
+        if (indexType && !indexData.empty())
+        {
+            header.flags |= FLAG_INDEX;
+            header.indexType = indexType;
+            header.indexSize = indexData.size();
+            header.indexOffset = appendSection(buffer, &indexData[0], indexData.size());
+        }
+        
+        memcpy(&buffer[0], &header, sizeof(header));
+        if (!table.empty())
+            memcpy(&buffer[sizeof(header)], &table[0], table.size() * sizeof(FilePattern));
+        
+        std::ofstream file(path.c_str(), std::ios::binary);
+        file.write((const char*)&buffer[0], buffer.size());
+        return file.good();
+    }
+    
+    bool PatternFile::read(const std::string& path, std::vector<Pattern>& patterns, Index* index, std::string* featureBackend)
+    {
+        cv::Ptr<MappedFile> file = new MappedFile();
+        if (!file->open(path) || file->size() < sizeof(FileHeader))
+            return false;
+        
+        FileHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+            return false;
+        header.featureBackend[sizeof(header.featureBackend) - 1] = 0;
+        if (!inFile(*file, header.patternsOffset, (uint64_t)header.numPatterns * sizeof(FilePattern)))
+            return false;
+        
+        std::vector<Pattern> loaded(header.numPatterns);
+        
+        for (size_t i = 0; i < loaded.size(); i++)
+        {
+            FilePattern entry;
+            memcpy(&entry, file->data() + header.patternsOffset + i * sizeof(FilePattern), sizeof(entry));
+            
+            const uint64_t descriptorsSize = (uint64_t)entry.descriptorRows * entry.descriptorCols * CV_ELEM_SIZE(entry.descriptorType);
+            const uint64_t pointsSize = (uint64_t)entry.numPoints * sizeof(cv::Point2f);
+            const uint64_t points3dOffset = (entry.pointsOffset + pointsSize + alignment - 1) / alignment * alignment;
+            
+            if (!inFile(*file, entry.nameOffset, entry.nameLength)
+                || !inFile(*file, entry.keypointsOffset, (uint64_t)entry.numKeypoints * sizeof(FileKeyPoint))
+                || !inFile(*file, entry.descriptorsOffset, descriptorsSize)
+                || !inFile(*file, entry.pointsOffset, pointsSize)
+                || !inFile(*file, points3dOffset, (uint64_t)entry.numPoints * sizeof(cv::Point3f))
+                || (entry.grayOffset && !inFile(*file, entry.grayOffset, (uint64_t)entry.width * entry.height)))
+                return false;
+            
+            Pattern& pattern = loaded[i];
+            pattern.storage = file;
+            pattern.size = cv::Size(entry.width, entry.height);
+            pattern.name.assign((const char*)file->data() + entry.nameOffset, entry.nameLength);
+            
+            pattern.keypoints.resize(entry.numKeypoints);
+            const unsigned char* keypoints = file->data() + entry.keypointsOffset;
+            for (size_t k = 0; k < pattern.keypoints.size(); k++)
+            {
+                FileKeyPoint fkp;
+                memcpy(&fkp, keypoints + k * sizeof(FileKeyPoint), sizeof(fkp));
+                pattern.keypoints[k] = cv::KeyPoint(fkp.x, fkp.y, fkp.size, fkp.angle, fkp.response, fkp.octave, fkp.classId);
+            }
+            
+            // Descriptors & gray image are used in place, read only
+            pattern.descriptors = cv::Mat(entry.descriptorRows, entry.descriptorCols, entry.descriptorType,
+                                          (void*)(file->data() + entry.descriptorsOffset));
+            if (entry.grayOffset)
+                pattern.grayImg = cv::Mat(pattern.size, CV_8UC1, (void*)(file->data() + entry.grayOffset));
+            
+            pattern.points2d.resize(entry.numPoints);
+            pattern.points3d.resize(entry.numPoints);
+            if (entry.numPoints)
+            {
+                memcpy(&pattern.points2d[0], file->data() + entry.pointsOffset, pointsSize);
+                memcpy(&pattern.points3d[0], file->data() + points3dOffset, entry.numPoints * sizeof(cv::Point3f));
+            }
+        }
+        
+        if (index)
+        {
+            *index = Index();
+            if ((header.flags & FLAG_INDEX) && inFile(*file, header.indexOffset, header.indexSize))
+            {
+                index->type = header.indexType;
+                index->data = file->data() + header.indexOffset;
+                index->size = header.indexSize;
+                index->storage = file;
+            }
+        }
+        
+        if (featureBackend)
+            *featureBackend = header.featureBackend;
+        
+        patterns.insert(patterns.end(), loaded.begin(), loaded.end());
+        return true;
+    }
+    
+}
@@ -0,0 +1,51 @@
+//
+//  PatternFile.h
+//
+//  Binary file of trained patterns, loaded without running any detection.
+//
+
+#pragma once
+
+#include "PatternDatabase.h"
+
+namespace cv {
+
+    /**
+     * Binary file of trained patterns, loaded without running any detection.
+     *
+     * Little endian layout, every section starting on a 64 bytes boundary :
+     *   header (with the name of the feature backend) | patterns table | for each pattern : name, keypoints, descriptors, contours, gray image (optional) | matcher index (optional)
+     *
+     * The file is memory mapped, the descriptors of the loaded patterns pointing directly into the mapping.
+     * The version is bumped whenever the layout changes, older files are then rejected.
+     */
+    class PatternFile
+    {
+    public:
+        static const unsigned version = 2;
+        
+        /**
+         * Prebuilt matcher index, as written by the matcher identified by type.
+         * data points into the mapping kept alive by storage.
+         */
+        struct Index
+        {
+            Index() : type(0), data(0), size(0) {}
+            
+            unsigned                 type;
+            const unsigned char*     data;
+            size_t                   size;
+            cv::Ptr<cv::MappedFile>  storage;
+        };
+        
+        /**
+         * featureBackend is the name of the FeatureBackend that described the patterns, up to 31 characters
+         */
+        static bool write(const std::string& path, const std::vector<Pattern>& patterns, const std::string& featureBackend,
+                          bool withGrayImages = false, unsigned indexType = 0,
+                          const std::vector<unsigned char>& indexData = std::vector<unsigned char>());
+        
+        static bool read(const std::string& path, std::vector<Pattern>& patterns, Index* index = 0, std::string* featureBackend = 0);
+    };
+    
+}
@@ -13,127 +13,1282 @@
 #include "PatternTracker.h"
 
 namespace cv {
-
+    
+    namespace {
+        
+        double elapsedMs(int64 start)
+        {
+            return (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+        }
+        
+#if defined(__arm__) || defined(__aarch64__)
+        const bool fixedPointByDefault = true;
+#else
+        const bool fixedPointByDefault = false;
+#endif
+        
+        // Whether two small matrices, e.g. camera intrinsics, hold the same values
+        bool sameValues(const cv::Mat& a, const cv::Mat& b)
+        {
+            if (a.empty() || b.empty())
+                return a.empty() && b.empty();
+            return a.size() == b.size() && a.type() == b.type() && cv::norm(a, b, cv::NORM_INF) == 0;
+        }
+        
+        // Offset of the extremum of the parabola going through (-1, l), (0, c) & (1, r)
+        float subPixelOffset(float l, float c, float r)
+        {
+            const float d = l - 2 * c + r;
+            return std::abs(d) > 1e-6f ? 0.5f * (l - r) / d : 0.f;
+        }
+        
+        // diag(s, s, 1) * H, the homography to an image scaled by s, reusing the buffer of scaled
+        void scaleHomography(const cv::Mat& H, double s, cv::Mat& scaled)
+        {
+            H.copyTo(scaled);
+            cv::Mat rows = scaled.rowRange(0, 2);
+            rows *= s;
+        }
+        
+        // Backend & buffers of the tiles of extractFeaturesTiled(), kept per thread as the pipelined trackers extract
+        // from several threads at once. The backend is rebuilt when the budget changes, the one it derives from is
+        // held so that another backend can't be mistaken for it.
+        struct TileExtraction
+        {
+            TileExtraction() : numFeatures(0), numLevels(0) {}
+            
+            cv::Ptr<FeatureBackend>   source;
+            cv::Ptr<FeatureBackend>   backend;
+            int                       numFeatures;
+            int                       numLevels;
+            std::vector< std::vector<cv::KeyPoint> > keypoints;
+            std::vector<cv::Mat>      descriptors;
+        };
+        
+        TileExtraction& tileExtraction(const cv::Ptr<FeatureBackend>& source, int numFeatures, int numLevels)
+        {
+            static thread_local TileExtraction tiles;
+            if ((const FeatureBackend*)tiles.source != (const FeatureBackend*)source || tiles.numFeatures != numFeatures || tiles.numLevels != numLevels)
+            {
+                tiles.source = source;
+                tiles.backend = source->withBudget(numFeatures, numLevels);
+                tiles.numFeatures = numFeatures;
+                tiles.numLevels = numLevels;
+            }
+            return tiles;
+        }
+        
+        // Seed of the homography between the frame warped to a pattern & the pattern
+        const cv::Mat& identityHomography()
+        {
+            static const cv::Mat identity = cv::Mat::eye(3, 3, CV_64F);
+            return identity;
+        }
+    }
+    
     PatternTracker::PatternTracker()
     : enableRatioTest(true)
     , enableHomographyRefinement(true)
     , homographyReprojectionThreshold(3)
     , minNumberMatchesAllowed(6)
     , rescale(1)
+    , enableFixedPointKernels(fixedPointByDefault)
+    , homographyMethod(HOMOGRAPHY_RANSAC)
+    , refinementMethod(REFINEMENT_WARP)
+    , refinementReprojectionThreshold(1.5f)
+    , refinementPatchRadius(8)
+    , refinementSearchRadius(3)
+    , refinementMaxPoints(64)
+    , maxPatternsPerFrame(1)
+    , maxCandidatesPerFrame(4)
+    , retrievalShortlistSize(10)
+    , numExtractionThreads(1)
+    , extractionGrid(4, 3)
+    , enableRoiPrediction(false)
+    , roiPadding(0.25f)
+    , enableOpticalFlowTracking(false)
+    , minTrackedPointsAllowed(10)
+    , maxTrackingReprojectionError(2)
+    , searchInterval(5)
+    , enablePoseFilter(false)
+    , m_database(new PatternDatabase())
+    , m_matcherType(MATCHER_PACKED_HAMMING)
+    , m_isTracking(false)
+    , m_nextIndex(0)
+    , m_lastSearch(0)
+    , m_numCommits(0)
+    , m_poseCommit(0)
+    , m_posesCommit(0)
+    , m_backend(new OrbBackend())
+    , m_patternBackend(m_backend)
     {
     }
-
-    void PatternTracker::setup(){
-        m_detector = new cv::OrbFeatureDetector(500); // cv::ORB(1000);
-        m_extractor = new cv::OrbDescriptorExtractor(); // cv::FREAK(false, false)
-        m_matcher = new cv::BruteForceMatcher< cv::HammingLUT >(); // cv::BFMatcher(cv::NORM_HAMMING, true)
+    
+    void PatternTracker::setup(MatcherType matcherType){
+        setupExtraction();
+        m_matcherType = matcherType;
+        m_database->setup(createMatcher(matcherType));
     }
     
-    void PatternTracker::add(const cv::Mat& image)
+    void PatternTracker::setup(PatternTracker& shared)
     {
-        // Store the pattern object
-        m_pattern = buildPatternFromImage(image);
+        setupExtraction();
+        m_database = shared.m_database;
+        m_matcherType = shared.m_matcherType;
         
-        // API of cv::DescriptorMatcher is somewhat tricky
-        // First we clear old train data:
-        m_matcher->clear();
+        // The frames have to be described like the shared patterns
+        m_patternBackend = m_backend = shared.m_patternBackend;
+    }
+    
+    bool PatternTracker::setFeatureBackend(const std::string& name)
+    {
+        cv::Ptr<FeatureBackend> backend = FeatureBackend::create(name);
+        if (backend.empty())
+            return false;
         
-        // Then we add vector of descriptors (each descriptors matrix describe one image).
-        // This allows us to perform search across multiple images:
-        std::vector<cv::Mat> descriptors(1);
-        descriptors[0] = m_pattern.descriptors.clone();
-        m_matcher->add(descriptors);
+        setFeatureBackend(backend);
+        return true;
+    }
+    
+    void PatternTracker::setFeatureBackend(const cv::Ptr<FeatureBackend>& backend)
+    {
+        m_patternBackend = m_backend = backend;
+    }
+    
+    int PatternTracker::add(const cv::Mat& image, const std::string& name)
+    {
+        const std::string backend = m_patternBackend->getName();
+        if (!m_database->empty() && m_database->getFeatureBackend() != backend)
+            return -1;
         
-        // After adding train data perform actual train:
-        m_matcher->train();
+        // Append the pattern to the database, its matcher is retrained on the next find()
+        const int index = m_database->add(buildPatternFromImage(image, name));
+        m_database->setFeatureBackend(backend);
+        return index;
     }
-
-    bool PatternTracker::find(const cv::Mat& image)
+    
+    bool PatternTracker::replace(int index, const cv::Mat& image, const std::string& name)
+    {
+        if (index < 0 || index >= (int)m_database->size() || m_database->getFeatureBackend() != m_patternBackend->getName())
+            return false;
+        
+        return m_database->replace(index, buildPatternFromImage(image, name));
+    }
+    
+    bool PatternTracker::remove(int index)
+    {
+        return m_database->remove(index);
+    }
+    
+    void PatternTracker::setDatabase(const cv::Ptr<PatternDatabase>& database)
+    {
+        const cv::Ptr<PatternDatabase> previous = m_database;
+        m_database = database;
+        
+        // Patterns whose slot was emptied or holds another pattern, or which aren't in the new database
+        auto changed = [&previous, &database](int patternIdx) {
+            return patternIdx >= (int)database->size() || database->getRevision(patternIdx) != previous->getRevision(patternIdx);
+        };
+        auto changedResult = [&changed](const TrackingInfo& info) { return changed(info.patternIdx); };
+        
+        m_targets.erase(std::remove_if(m_targets.begin(), m_targets.end(), [&changed](const TrackedTarget& target) {
+            return changed(target.patternIdx);
+        }), m_targets.end());
+        m_targetPoses.erase(std::remove_if(m_targetPoses.begin(), m_targetPoses.end(), [&changed](const TargetPose& pose) {
+            return changed(pose.patternIdx);
+        }), m_targetPoses.end());
+        m_lastResults.erase(std::remove_if(m_lastResults.begin(), m_lastResults.end(), changedResult), m_lastResults.end());
+        m_prevResults.erase(std::remove_if(m_prevResults.begin(), m_prevResults.end(), changedResult), m_prevResults.end());
+        m_isTracking = !m_targets.empty();
+        
+        // The last frame is only kept if all its patterns are unchanged, so that its pose can still be solved
+        if (m_frame.found && std::any_of(m_frame.results.begin(), m_frame.results.end(), changedResult))
+        {
+            m_frame.found = false;
+            m_frame.results.clear();
+            m_frame.matches.clear();
+            m_frame.numFollowed = 0;
+            m_numCommits++;
+        }
+        if (m_info.patternIdx >= 0 && changed(m_info.patternIdx))
+            m_info = TrackingInfo();
+    }
+    
+    bool PatternTracker::save(const std::string& path, bool withGrayImages)
+    {
+        unsigned indexType = 0;
+        std::vector<unsigned char> indexData;
+        m_database->getIndex(indexType, indexData);
+        
+        const std::string& backend = m_database->empty() ? m_patternBackend->getName() : m_database->getFeatureBackend();
+        return PatternFile::write(path, m_database->getPatterns(), backend, withGrayImages, indexType, indexData);
+    }
+    
+    int PatternTracker::load(const std::string& path)
+    {
+        std::vector<Pattern> patterns;
+        PatternFile::Index index;
+        std::string backend;
+        if (!PatternFile::read(path, patterns, &index, &backend))
+            return -1;
+        
+        // The frames couldn't be matched with patterns described by another backend
+        if (backend != m_patternBackend->getName() || (!m_database->empty() && m_database->getFeatureBackend() != backend))
+            return -1;
+        
+        m_database->add(patterns, index.type, index.data, index.size);
+        m_database->setFeatureBackend(backend);
+        return patterns.size();
+    }
+    
+    bool PatternTracker::loadVocabulary(const std::string& path)
+    {
+        cv::Ptr<BinaryVocabulary> vocabulary = new BinaryVocabulary();
+        if (!vocabulary->load(path))
+            return false;
+        
+        // The database may still be empty, the vocabulary then has to fit the frames
+        if (!vocabulary->getFeatureBackend().empty() && vocabulary->getFeatureBackend() != m_patternBackend->getName())
+            return false;
+        
+        return m_database->setVocabulary(vocabulary);
+    }
+    
+    bool PatternTracker::find(const cv::Mat& image, PixelFormat format, int64 ticks)
+    {
+        FrameData& frame = m_frame;
+        const int64 start = cv::getTickCount();
+        frame.index = m_nextIndex++;
+        frame.ticks = ticks ? ticks : start;
+        
+        prepare(image, frame, format);
+        if (homographyMethod == HOMOGRAPHY_PROSAC)
+            frame.seedResults = m_lastResults;
+        
+        // Follow the patterns from the previous frame if we can
+        bool followed = false;
+        if (enableOpticalFlowTracking && m_isTracking)
+        {
+            const int64 trackingStart = cv::getTickCount();
+            followed = findByOpticalFlow(frame);
+            frame.timings.tracking = elapsedMs(trackingStart);
+        }
+        
+        const cv::Rect full(0, 0, image.cols, image.rows);
+        if (followed)
+        {
+            // Search the rest of the frame for the other patterns from time to time,
+            // the followed ones being neither detected nor verified again
+            if (m_flowResults.size() < (size_t)maxPatternsPerFrame && m_flowResults.size() < m_database->size()
+                && frame.index - m_lastSearch >= searchInterval)
+            {
+                for (const auto & info : m_flowResults)
+                    frame.excludedPatterns.push_back(info.patternIdx);
+                
+                extract(frame, full);
+                maskFound(frame, m_flowResults);
+                match(frame);
+                m_lastSearch = frame.index;
+            }
+            
+            mergeFollowed(frame);
+        }
+        else
+        {
+            // Otherwise fall back to the full detection pipeline,
+            // looking where the patterns are expected first, then everywhere
+            if (enableRoiPrediction && predictSearchWindow(full.size(), frame.searchWindow))
+                detect(frame, frame.searchWindow);
+            
+            if (!frame.found)
+            {
+                frame.searchWindow = full;
+                detect(frame, full);
+                m_lastSearch = frame.index;
+            }
+            else if (frame.results.size() < (size_t)maxPatternsPerFrame && frame.results.size() < m_database->size()
+                     && frame.index - m_lastSearch >= searchInterval)
+            {
+                // The patterns outside the window are searched from time to time too
+                searchOutsideWindow(frame, full);
+                m_lastSearch = frame.index;
+            }
+        }
+        
+        commit(frame);
+        
+        frame.timings.total = elapsedMs(start);
+        return frame.found;
+    }
+    
+    void PatternTracker::prepare(const cv::Mat& image, FrameData& frame, PixelFormat format) const
     {
+        frame.imageSize = image.size();
+        frame.searchWindow = cv::Rect(0, 0, image.cols, image.rows);
+        frame.queryKeypoints.clear();
+        frame.matches.clear();
+        frame.seedResults.clear();
+        frame.shortlist.clear();
+        frame.numFollowed = 0;
+        frame.excludedPatterns.clear();
+        frame.found = false;
+        frame.path = TRACKING_PATH_NONE;
+        frame.timings = StageTimings();
+        frame.counters = FrameCounters();
+        
+        // The luma of YUV frames is read & rescaled in a single pass, timed as the gray conversion
+        if (format != PIXEL_FORMAT_AUTO)
+        {
+            const int64 start = cv::getTickCount();
+            if (enableFixedPointKernels && format == PIXEL_FORMAT_Y)
+                fixedpoint::convertToGray(image, rescale, frame.grayImg);
+            else
+                extractLuma(image, format, rescale, frame.grayImg);
+            frame.img = frame.grayImg;
+            frame.timings.gray = elapsedMs(start);
+            return;
+        }
+        
+        // Same for the BGR(A) frames, the full size gray image being never written
+        if (enableFixedPointKernels)
+        {
+            const int64 start = cv::getTickCount();
+            fixedpoint::convertToGray(image, rescale, frame.grayImg);
+            frame.img = frame.grayImg;
+            frame.timings.gray = elapsedMs(start);
+            return;
+        }
+        
+        const int64 start = cv::getTickCount();
         if(rescale == 1) {
-            m_img = image;
+            frame.img = image;
         } else {
-            resize(image, m_img, cv::Size(rescale * image.cols, rescale * image.rows));
+            resize(image, frame.img, cv::Size(rescale * image.cols, rescale * image.rows));
         }
+        frame.timings.resize = elapsedMs(start);
         
         // Convert input image to gray
-        getGray(m_img, m_grayImg);
+        const int64 grayStart = cv::getTickCount();
+        getGray(frame.img, frame.grayImg);
+        frame.timings.gray = elapsedMs(grayStart);
+    }
+    
+    bool PatternTracker::detect(FrameData& frame, const cv::Rect& window)
+    {
+        extract(frame, window);
+        return match(frame);
+    }
+    
+    void PatternTracker::extract(FrameData& frame, const cv::Rect& window) const
+    {
+        frame.queryKeypoints.clear();
+        
+        // Search window in gray image coordinates
+        const cv::Rect grayWindow = cv::Rect(window.x * rescale, window.y * rescale, window.width * rescale, window.height * rescale)
+                                  & cv::Rect(0, 0, frame.grayImg.cols, frame.grayImg.rows);
+        if (m_database->empty() || grayWindow.area() == 0)
+            return;
         
         // Extract feature points from input gray image
-        extractFeatures(m_grayImg, m_queryKeypoints, m_queryDescriptors);
+        extractFeatures(frame.grayImg(grayWindow), frame.queryKeypoints, frame.queryDescriptors, &frame.timings);
+        frame.counters.keypoints = frame.queryKeypoints.size();
+        
+        // Move points set back to input image coordinates
+        if(rescale != 1 || grayWindow.x || grayWindow.y){
+            for (auto & p : frame.queryKeypoints) {
+                p.pt.x = (p.pt.x + grayWindow.x) / rescale;
+                p.pt.y = (p.pt.y + grayWindow.y) / rescale;
+            }
+        }
+    }
+    
+    bool PatternTracker::match(FrameData& frame)
+    {
+        // Get matches against all the patterns at once
+        if (!frame.queryKeypoints.empty())
+        {
+            const int64 start = cv::getTickCount();
+            getMatches(frame, frame.queryDescriptors, frame.matches);
+            frame.timings.matching += elapsedMs(start);
+        }
         
-        // Rescale points set
-        if(rescale != 1){
-            for (auto & p : m_queryKeypoints) {
-                p.pt.x /= rescale;
-                p.pt.y /= rescale;
+        return verify(frame);
+    }
+    
+    bool PatternTracker::matchPrecomputed(FrameData& frame)
+    {
+        const int64 start = cv::getTickCount();
+        selectMatches(frame.knnMatches, frame.matches);
+        frame.timings.matching += elapsedMs(start);
+        
+        return verify(frame);
+    }
+    
+    bool PatternTracker::verify(FrameData& frame)
+    {
+        frame.path = TRACKING_PATH_DETECTION;
+        frame.found = false;
+        
+        if (frame.queryKeypoints.empty())
+        {
+            frame.results.clear();
+            return false;
+        }
+        
+        frame.counters.rawMatches = enableRatioTest ? frame.knnMatches.size() : frame.matches.size();
+        frame.counters.ratioTestMatches = frame.matches.size();
+        
+        // Group matches by pattern
+        std::vector< std::vector<cv::DMatch> >& candidateMatches = frame.candidateMatches;
+        candidateMatches.resize(m_database->size());
+        for (auto & matches : candidateMatches)
+            matches.clear();
+        for (const auto & m : frame.matches)
+        {
+            if (m.imgIdx >= 0 && m.imgIdx < (int)candidateMatches.size())
+                candidateMatches[m.imgIdx].push_back(m);
+        }
+        
+        // Patterns with enough matches are candidates, best supported first.
+        // The patterns followed by optical flow are already found.
+        const std::vector<int>& excluded = frame.excludedPatterns;
+        frame.candidates.clear();
+        for (size_t i = 0; i < candidateMatches.size(); i++)
+        {
+            if (candidateMatches[i].size() >= minNumberMatchesAllowed
+                && std::find(excluded.begin(), excluded.end(), (int)i) == excluded.end())
+                frame.candidates.push_back(i);
+        }
+        std::sort(frame.candidates.begin(), frame.candidates.end(), [&candidateMatches](int a, int b) {
+            return candidateMatches[a].size() > candidateMatches[b].size();
+        });
+        if (frame.candidates.size() > maxCandidatesPerFrame)
+            frame.candidates.resize(maxCandidatesPerFrame);
+        
+        // Only verify the geometry of the best candidates, so that the cost of
+        // this step doesn't depend on the size of the database.
+        // The results of the previous frame are overwritten so that their buffers are reused.
+        const size_t maxResults = std::max(maxPatternsPerFrame - (int)excluded.size(), 0);
+        frame.matches.clear();
+        frame.claimed.assign(frame.queryKeypoints.size(), 0);
+        size_t numResults = 0;
+        for (int patternIdx : frame.candidates)
+        {
+            if (numResults >= maxResults)
+                break;
+            
+            // A keypoint belongs to one pattern only : drop the matches of the inliers of the patterns found so far
+            std::vector<cv::DMatch>& matches = candidateMatches[patternIdx];
+            if (numResults > 0)
+            {
+                const std::vector<unsigned char>& claimed = frame.claimed;
+                matches.erase(std::remove_if(matches.begin(), matches.end(), [&claimed](const cv::DMatch& m) {
+                    return claimed[m.queryIdx] != 0;
+                }), matches.end());
             }
+            
+            if (frame.results.size() == numResults)
+                frame.results.resize(numResults + 1);
+            if (!verifyCandidate(frame, patternIdx, matches, frame.results[numResults]))
+                continue;
+            
+            for (const auto & m : matches)
+                frame.claimed[m.queryIdx] = 1;
+            
+            if (frame.resultInliers.size() == numResults)
+                frame.resultInliers.resize(numResults + 1);
+            frame.resultInliers[numResults].swap(matches);
+            numResults++;
         }
+        frame.results.resize(numResults);
         
-        // Get matches with current pattern
-        getMatches(m_queryDescriptors, m_matches);
+        // Keep the inliers of the best pattern
+        if (numResults > 0)
+            frame.matches = frame.resultInliers[0];
+        
+        frame.found = numResults > 0;
+        return frame.found;
+    }
+    
+    bool PatternTracker::integrate(FrameData& frame)
+    {
+        // Following the patterns is still preferred to the detection that ran meanwhile,
+        // which only adds the patterns that aren't followed
+        if (enableOpticalFlowTracking && m_isTracking)
+        {
+            const int64 start = cv::getTickCount();
+            if (findByOpticalFlow(frame))
+                mergeFollowed(frame);
+            frame.timings.tracking = elapsedMs(start);
+        }
+        
+        commit(frame);
+        
+        std::swap(m_frame, frame);
+        return m_frame.found;
+    }
+    
+    bool PatternTracker::verifyCandidate(FrameData& frame, int patternIdx, std::vector<cv::DMatch>& matches, TrackingInfo& info)
+    {
+        const Pattern& pattern = m_database->getPattern(patternIdx);
+        
+        const bool refine = enableHomographyRefinement;
+        if (refine && refinementMethod == REFINEMENT_INLIERS_LM)
+            frame.refinementMatches = matches;
+        
+        // The pattern should still be about where it was in the previous frame
+        const cv::Mat* seed = 0;
+        for (const auto & last : frame.seedResults)
+        {
+            if (last.patternIdx == patternIdx)
+                seed = &last.homography;
+        }
         
         // Find homography transformation and detect good matches
-        bool homographyFound = refineMatchesWithHomography(m_queryKeypoints,
-                                                           m_pattern.keypoints,
+        int64 start = cv::getTickCount();
+        bool homographyFound = refineMatchesWithHomography(frame,
+                                                           frame.queryKeypoints,
+                                                           pattern.keypoints,
                                                            homographyReprojectionThreshold,
-                                                           m_matches,
-                                                           m_roughHomography);
+                                                           matches,
+                                                           frame.roughHomography,
+                                                           seed ? *seed : cv::Mat());
+        frame.timings.estimation += elapsedMs(start);
+        
+        if (!homographyFound)
+            return false;
+        
+        info.patternIdx = patternIdx;
+        
+        // If homography refinement enabled improve found transformation
+        start = cv::getTickCount();
+        if (!refine)
+            info.homography = frame.roughHomography.clone();
+        else if (refinementMethod == REFINEMENT_INLIERS_LM)
+            homographyFound = refineByInliers(frame, pattern, matches, info.homography);
+        else if (refinementMethod == REFINEMENT_PATCH_ALIGNMENT)
+            homographyFound = refineByPatchAlignment(frame, pattern, matches, info.homography);
+        else
+            homographyFound = refineByWarping(frame, pattern, patternIdx, info.homography);
+        frame.timings.refinement += elapsedMs(start);
         
+        // Transform contour with the final homography
         if (homographyFound)
         {
-            // If homography refinement enabled improve found transformation
-            if (enableHomographyRefinement)
+            cv::perspectiveTransform(pattern.points2d, info.points2d, info.homography);
+            info.numInliers = matches.size();
+        }
+        
+        return homographyFound;
+    }
+    
+    bool PatternTracker::refineByWarping(FrameData& frame, const Pattern& pattern, int patternIdx, cv::Mat& homography)
+    {
+        // Warp image using found homography, the gray image being rescaled from the input image
+        scaleHomography(frame.roughHomography, rescale, frame.scaledHomography);
+        if (enableFixedPointKernels)
+            fixedpoint::warpPerspective(frame.grayImg, frame.warpedImg, frame.scaledHomography, pattern.size);
+        else
+            cv::warpPerspective(frame.grayImg, frame.warpedImg, frame.scaledHomography, pattern.size, cv::WARP_INVERSE_MAP | cv::INTER_CUBIC);
+        
+        // Detect features on warped image
+        extractFeatures(frame.warpedImg, frame.warpedKeypoints, frame.queryDescriptors);
+        
+        // Match with the database, keeping the matches of the candidate pattern
+        std::vector<cv::DMatch>& refinedMatches = frame.warpedMatches;
+        getMatches(frame, frame.queryDescriptors, refinedMatches, patternIdx);
+        refinedMatches.erase(std::remove_if(refinedMatches.begin(), refinedMatches.end(), [patternIdx](const cv::DMatch& m) {
+            return m.imgIdx != patternIdx;
+        }), refinedMatches.end());
+        
+        // Estimate new refinement homography
+        const bool homographyFound = refineMatchesWithHomography(frame,
+                                                                 frame.warpedKeypoints,
+                                                                 pattern.keypoints,
+                                                                 homographyReprojectionThreshold,
+                                                                 refinedMatches,
+                                                                 frame.refinedHomography,
+                                                                 identityHomography());
+        
+        // Get a result homography as result of matrix product of refined and rough homographies,
+        // in a new matrix since the previous one may be shared with the last results
+        homography = cv::Mat(frame.roughHomography * frame.refinedHomography);
+        return homographyFound;
+    }
+    
+    bool PatternTracker::refineByInliers(FrameData& frame, const Pattern& pattern, std::vector<cv::DMatch>& matches, cv::Mat& homography)
+    {
+        homography = frame.roughHomography.clone();
+        
+        // Pattern points of all the candidate matches, RANSAC may have dropped good ones
+        frame.refinementSrc.resize(frame.refinementMatches.size());
+        for (size_t i = 0; i < frame.refinementMatches.size(); i++)
+            frame.refinementSrc[i] = pattern.keypoints[frame.refinementMatches[i].trainIdx].pt;
+        
+        const float maxError = refinementReprojectionThreshold * refinementReprojectionThreshold;
+        std::vector<cv::Point2f>& src = frame.fitSrc;
+        std::vector<cv::Point2f>& dst = frame.fitDst;
+        size_t numInliers = 0;
+        
+        for (int iteration = 0; iteration < 3; iteration++)
+        {
+            // Gather the matches consistent with the current estimate
+            cv::perspectiveTransform(frame.refinementSrc, frame.refinementProjected, homography);
+            
+            src.clear();
+            dst.clear();
+            for (size_t i = 0; i < frame.refinementMatches.size(); i++)
             {
-                // Warp image using found homography
-                cv::warpPerspective(m_grayImg, m_warpedImg, m_roughHomography, m_pattern.size, cv::WARP_INVERSE_MAP | cv::INTER_CUBIC);
-                
-                // Get refined matches:
-                std::vector<cv::KeyPoint> warpedKeypoints;
-                std::vector<cv::DMatch> refinedMatches;
-                
-                // Detect features on warped image
-                extractFeatures(m_warpedImg, warpedKeypoints, m_queryDescriptors);
-                
-                // Match with pattern
-                getMatches(m_queryDescriptors, refinedMatches);
+                const cv::Point2f d = frame.refinementProjected[i] - frame.queryKeypoints[frame.refinementMatches[i].queryIdx].pt;
+                if (d.dot(d) > maxError)
+                    continue;
+                src.push_back(frame.refinementSrc[i]);
+                dst.push_back(frame.queryKeypoints[frame.refinementMatches[i].queryIdx].pt);
+            }
+            
+            if (src.size() < minNumberMatchesAllowed || src.size() == numInliers)
+                break;
+            numInliers = src.size();
+            
+            // Least squares fit on the inliers only, polished by findHomography with Levenberg-Marquardt
+            cv::Mat refined = cv::findHomography(src, dst, 0);
+            if (refined.empty())
+                break;
+            homography = refined;
+        }
+        
+        // Keep the final inliers as matches
+        cv::perspectiveTransform(frame.refinementSrc, frame.refinementProjected, homography);
+        matches.clear();
+        for (size_t i = 0; i < frame.refinementMatches.size(); i++)
+        {
+            const cv::Point2f d = frame.refinementProjected[i] - frame.queryKeypoints[frame.refinementMatches[i].queryIdx].pt;
+            if (d.dot(d) <= maxError)
+                matches.push_back(frame.refinementMatches[i]);
+        }
+        
+        return matches.size() > minNumberMatchesAllowed;
+    }
+    
+    bool PatternTracker::refineByPatchAlignment(FrameData& frame, const Pattern& pattern, const std::vector<cv::DMatch>& matches, cv::Mat& homography)
+    {
+        homography = frame.roughHomography.clone();
+        
+        // Patterns loaded without their gray images
+        if (pattern.grayImg.empty())
+            return true;
+        
+        const int r = refinementPatchRadius;
+        const int s = refinementSearchRadius;
+        const cv::Rect bounds(0, 0, pattern.grayImg.cols, pattern.grayImg.rows);
+        
+        // Align the patches of the strongest inliers only
+        frame.refinementMatches = matches;
+        if (frame.refinementMatches.size() > refinementMaxPoints)
+        {
+            std::nth_element(frame.refinementMatches.begin(), frame.refinementMatches.begin() + refinementMaxPoints, frame.refinementMatches.end(),
+                             [](const cv::DMatch& a, const cv::DMatch& b) { return a.distance < b.distance; });
+            frame.refinementMatches.resize(refinementMaxPoints);
+        }
+        
+        // Homography from the pattern to the gray image
+        scaleHomography(frame.roughHomography, rescale, frame.scaledHomography);
+        const double* h = frame.scaledHomography.ptr<double>();
+        
+        frame.refinementSrc.clear();
+        frame.refinementDst.clear();
+        for (const auto & m : frame.refinementMatches)
+        {
+            const cv::Point2f& pt = pattern.keypoints[m.trainIdx].pt;
+            const cv::Rect templRect(cvRound(pt.x) - r, cvRound(pt.y) - r, 2 * r + 1, 2 * r + 1);
+            if ((templRect & bounds) != templRect)
+                continue;
+            
+            // Local affine approximation of the homography around the patch center
+            const double x = templRect.x + r, y = templRect.y + r;
+            const double w = h[6] * x + h[7] * y + h[8];
+            const double X = (h[0] * x + h[1] * y + h[2]) / w;
+            const double Y = (h[3] * x + h[4] * y + h[5]) / w;
+            const double j00 = (h[0] - X * h[6]) / w, j01 = (h[1] - X * h[7]) / w;
+            const double j10 = (h[3] - Y * h[6]) / w, j11 = (h[4] - Y * h[7]) / w;
+            
+            // Sample the frame around the expected location in pattern space, with a search margin
+            const double c = r + s;
+            const cv::Matx23d affine(j00, j01, X - j00 * c - j01 * c,
+                                     j10, j11, Y - j10 * c - j11 * c);
+            cv::warpAffine(frame.grayImg, frame.patch, affine, cv::Size(2 * c + 1, 2 * c + 1), cv::WARP_INVERSE_MAP | cv::INTER_LINEAR);
+            
+            // Best offset of the pattern patch in the sampled one
+            cv::matchTemplate(frame.patch, pattern.grayImg(templRect), frame.patchScores, cv::TM_CCOEFF_NORMED);
+            double score;
+            cv::Point loc;
+            cv::minMaxLoc(frame.patchScores, 0, &score, 0, &loc);
+            if (score < 0.8)
+                continue;
+            
+            cv::Point2f offset(loc.x - s, loc.y - s);
+            if (loc.x > 0 && loc.x < frame.patchScores.cols - 1)
+                offset.x += subPixelOffset(frame.patchScores.at<float>(loc.y, loc.x - 1), score, frame.patchScores.at<float>(loc.y, loc.x + 1));
+            if (loc.y > 0 && loc.y < frame.patchScores.rows - 1)
+                offset.y += subPixelOffset(frame.patchScores.at<float>(loc.y - 1, loc.x), score, frame.patchScores.at<float>(loc.y + 1, loc.x));
+            
+            // The patch center lies at center + offset in the pattern space of the rough homography
+            frame.refinementSrc.push_back(cv::Point2f(x, y));
+            frame.refinementDst.push_back(cv::Point2f(x, y) + offset);
+        }
+        
+        if (frame.refinementSrc.size() < minNumberMatchesAllowed)
+            return true;
+        
+        // Aligned locations in input image coordinates
+        cv::perspectiveTransform(frame.refinementDst, frame.refinementProjected, frame.roughHomography);
+        
+        cv::Mat refined = cv::findHomography(frame.refinementSrc, frame.refinementProjected, CV_FM_RANSAC, refinementReprojectionThreshold);
+        if (!refined.empty())
+            homography = refined;
+        
+        return true;
+    }
+    
+    bool PatternTracker::findByOpticalFlow(FrameData& frame)
+    {
+        if (m_prevGrayImg.size() != frame.grayImg.size())
+            m_targets.clear();
+        if (m_targets.empty())
+            return false;
+        
+        // Follow the points of all the targets from the previous frame at once, sharing the pyramids
+        m_flowPrevPoints.clear();
+        for (const auto & target : m_targets)
+            m_flowPrevPoints.insert(m_flowPrevPoints.end(), target.points.begin(), target.points.end());
+        cv::calcOpticalFlowPyrLK(m_prevGrayImg, frame.grayImg, m_flowPrevPoints, m_flowPoints, m_flowStatus, m_flowError);
+        
+        // Tracked points of all the targets, exposed as query keypoints matched with their pattern keypoints
+        // so that the counters & drawing helpers keep working on this path
+        m_flowKeypoints.clear();
+        
+        size_t numTargets = 0, numResults = 0, offset = 0;
+        for (size_t t = 0; t < m_targets.size(); t++)
+        {
+            TrackedTarget& target = m_targets[t];
+            const size_t numPoints = target.points.size();
+            const size_t first = offset;
+            offset += numPoints;
+            
+            // Keep the points that were successfully followed
+            size_t numTracked = 0;
+            for (size_t i = 0; i < numPoints; i++)
+            {
+                if (!m_flowStatus[first + i])
+                    continue;
+                target.points[numTracked] = m_flowPoints[first + i];
+                target.trainIdx[numTracked] = target.trainIdx[i];
+                numTracked++;
+            }
+            target.points.resize(numTracked);
+            target.trainIdx.resize(numTracked);
+            
+            if (numTracked < minTrackedPointsAllowed)
+                continue;
+            
+            const size_t base = m_flowKeypoints.size();
+            m_flowMatches.resize(numTracked);
+            for (size_t i = 0; i < numTracked; i++)
+            {
+                m_flowKeypoints.push_back(cv::KeyPoint(target.points[i] * (1.f / rescale), 1.f));
+                m_flowMatches[i] = cv::DMatch(base + i, target.trainIdx[i], 0.f);
+            }
+            
+            // Fit the pattern to the new point locations directly, rather than chaining
+            // frame-to-frame transforms, so that errors don't accumulate over time
+            const Pattern& pattern = m_database->getPattern(target.patternIdx);
+            cv::Mat homography;
+            if (!refineMatchesWithHomography(frame,
+                                             m_flowKeypoints,
+                                             pattern.keypoints,
+                                             homographyReprojectionThreshold,
+                                             m_flowMatches,
+                                             homography,
+                                             target.homography)
+                || m_flowMatches.size() < minTrackedPointsAllowed)
+            {
+                m_flowKeypoints.resize(base);
+                continue;
+            }
+            
+            // Check the quality of the fit on the remaining inliers
+            m_flowPatternPoints.resize(m_flowMatches.size());
+            for (size_t i = 0; i < m_flowMatches.size(); i++)
+                m_flowPatternPoints[i] = pattern.keypoints[m_flowMatches[i].trainIdx].pt;
+            
+            cv::perspectiveTransform(m_flowPatternPoints, m_flowProjected, homography);
+            
+            float reprojectionError = 0;
+            for (size_t i = 0; i < m_flowMatches.size(); i++)
+                reprojectionError += cv::norm(m_flowProjected[i] - m_flowKeypoints[m_flowMatches[i].queryIdx].pt);
+            reprojectionError /= m_flowMatches.size();
+            
+            if (reprojectionError > maxTrackingReprojectionError)
+            {
+                m_flowKeypoints.resize(base);
+                continue;
+            }
+            
+            // Only keep following the inliers, which stay in order
+            for (size_t i = 0; i < m_flowMatches.size(); i++)
+            {
+                target.points[i] = target.points[m_flowMatches[i].queryIdx - base];
+                target.trainIdx[i] = m_flowMatches[i].trainIdx;
+            }
+            target.points.resize(m_flowMatches.size());
+            target.trainIdx.resize(m_flowMatches.size());
+            target.homography = homography;
+            
+            if (m_flowResults.size() == numResults)
+            {
+                m_flowResults.resize(numResults + 1);
+                m_flowInliers.resize(numResults + 1);
+            }
+            TrackingInfo& info = m_flowResults[numResults];
+            info.patternIdx = target.patternIdx;
+            info.homography = homography;
+            info.numInliers = m_flowMatches.size();
+            cv::perspectiveTransform(pattern.points2d, info.points2d, info.homography);
+            m_flowInliers[numResults].swap(m_flowMatches);
+            numResults++;
+            
+            // The targets that are lost are dropped
+            if (numTargets != t)
+                std::swap(m_targets[numTargets], target);
+            numTargets++;
+        }
+        m_targets.resize(numTargets);
+        m_flowResults.resize(numResults);
+        
+        return numResults > 0;
+    }
+    
+    void PatternTracker::maskFound(FrameData& frame, const std::vector<TrackingInfo>& found) const
+    {
+        // The descriptor rows are compacted along with the keypoints
+        size_t numKept = 0;
+        for (size_t i = 0; i < frame.queryKeypoints.size(); i++)
+        {
+            const cv::Point2f& pt = frame.queryKeypoints[i].pt;
+            bool inside = false;
+            for (const auto & info : found)
+                inside = inside || cv::pointPolygonTest(info.points2d, pt, false) >= 0;
+            if (inside)
+                continue;
+            
+            if (numKept != i)
+            {
+                frame.queryKeypoints[numKept] = frame.queryKeypoints[i];
+                frame.queryDescriptors.row(i).copyTo(frame.queryDescriptors.row(numKept));
+            }
+            numKept++;
+        }
+        
+        if (numKept < frame.queryKeypoints.size())
+        {
+            frame.queryDescriptors.pop_back(frame.queryKeypoints.size() - numKept);
+            frame.queryKeypoints.resize(numKept);
+        }
+    }
+    
+    void PatternTracker::mergeFollowed(FrameData& frame)
+    {
+        const size_t numFollowed = m_flowResults.size();
+        const size_t maxDetected = std::max(maxPatternsPerFrame - (int)numFollowed, 0);
+        
+        // Keep the detected patterns that aren't followed, the detection may not have run on this frame
+        size_t numDetected = 0;
+        const size_t numResults = frame.found ? frame.results.size() : 0;
+        for (size_t r = 0; r < numResults && numDetected < maxDetected; r++)
+        {
+            bool isFollowed = false;
+            for (const auto & info : m_flowResults)
+                isFollowed = isFollowed || info.patternIdx == frame.results[r].patternIdx;
+            if (isFollowed)
+                continue;
+            
+            if (numDetected != r)
+            {
+                std::swap(frame.results[numDetected], frame.results[r]);
+                frame.resultInliers[numDetected].swap(frame.resultInliers[r]);
+            }
+            numDetected++;
+        }
+        
+        // Move the detected patterns behind the followed ones, reusing the buffers in between
+        const size_t total = numFollowed + numDetected;
+        frame.results.resize(total);
+        if (frame.resultInliers.size() < total)
+            frame.resultInliers.resize(total);
+        std::rotate(frame.results.begin(), frame.results.begin() + numDetected, frame.results.begin() + total);
+        std::rotate(frame.resultInliers.begin(), frame.resultInliers.begin() + numDetected, frame.resultInliers.begin() + total);
+        
+        // The tracked points come after the detected keypoints
+        const int offset = frame.queryKeypoints.size();
+        frame.queryKeypoints.insert(frame.queryKeypoints.end(), m_flowKeypoints.begin(), m_flowKeypoints.end());
+        for (size_t r = 0; r < numFollowed; r++)
+        {
+            frame.results[r] = m_flowResults[r];
+            frame.resultInliers[r] = m_flowInliers[r];
+            for (auto & m : frame.resultInliers[r])
+                m.queryIdx += offset;
+        }
+        
+        frame.matches = frame.resultInliers[0];
+        frame.numFollowed = numFollowed;
+        frame.counters.keypoints += m_flowKeypoints.size();
+        frame.path = numDetected > 0 ? TRACKING_PATH_DETECTION : TRACKING_PATH_OPTICAL_FLOW;
+        frame.found = true;
+    }
+    
+    void PatternTracker::searchOutsideWindow(FrameData& frame, const cv::Rect& full)
+    {
+        // The detection overwrites the results of the frame : the ones of the window are put aside
+        const size_t numWindow = frame.results.size();
+        m_windowResults.swap(frame.results);
+        m_windowInliers.swap(frame.resultInliers);
+        m_windowKeypoints.swap(frame.queryKeypoints);
+        
+        frame.excludedPatterns.clear();
+        for (const auto & info : m_windowResults)
+            frame.excludedPatterns.push_back(info.patternIdx);
+        
+        frame.searchWindow = full;
+        extract(frame, full);
+        maskFound(frame, m_windowResults);
+        match(frame);
+        
+        // Move the detected patterns behind the ones of the window, reusing the buffers in between
+        const size_t numDetected = frame.found ? frame.results.size() : 0;
+        const size_t total = numWindow + numDetected;
+        frame.results.resize(total);
+        if (frame.resultInliers.size() < total)
+            frame.resultInliers.resize(total);
+        std::rotate(frame.results.begin(), frame.results.begin() + numDetected, frame.results.begin() + total);
+        std::rotate(frame.resultInliers.begin(), frame.resultInliers.begin() + numDetected, frame.resultInliers.begin() + total);
+        
+        // The keypoints of the window come after the ones of the whole frame
+        const int offset = frame.queryKeypoints.size();
+        frame.queryKeypoints.insert(frame.queryKeypoints.end(), m_windowKeypoints.begin(), m_windowKeypoints.end());
+        for (size_t r = 0; r < numWindow; r++)
+        {
+            std::swap(frame.results[r], m_windowResults[r]);
+            frame.resultInliers[r].swap(m_windowInliers[r]);
+            for (auto & m : frame.resultInliers[r])
+                m.queryIdx += offset;
+        }
+        
+        frame.matches = frame.resultInliers[0];
+        frame.counters.keypoints += m_windowKeypoints.size();
+        frame.path = TRACKING_PATH_DETECTION;
+        frame.found = true;
+    }
+    
+    bool PatternTracker::predictSearchWindow(const cv::Size& imageSize, cv::Rect& window) const
+    {
+        if (m_lastResults.empty())
+            return false;
+        
+        // Constant velocity : each corner should move as much as it did between the last two frames
+        cv::Point2f minCorner(FLT_MAX, FLT_MAX), maxCorner(-FLT_MAX, -FLT_MAX);
+        for (const auto & last : m_lastResults)
+        {
+            const TrackingInfo* prev = 0;
+            for (const auto & info : m_prevResults)
+            {
+                if (info.patternIdx == last.patternIdx)
+                    prev = &info;
+            }
+            
+            for (size_t i = 0; i < last.points2d.size(); i++)
+            {
+                cv::Point2f p = last.points2d[i];
+                if (prev)
+                    p += last.points2d[i] - prev->points2d[i];
+                minCorner.x = std::min(minCorner.x, p.x);
+                minCorner.y = std::min(minCorner.y, p.y);
+                maxCorner.x = std::max(maxCorner.x, p.x);
+                maxCorner.y = std::max(maxCorner.y, p.y);
+            }
+        }
+        
+        // Same box as cv::boundingRect() of the corners
+        const cv::Point topLeft(cvFloor(minCorner.x), cvFloor(minCorner.y));
+        const cv::Rect box(topLeft, cv::Point(cvFloor(maxCorner.x) + 1, cvFloor(maxCorner.y) + 1));
+        const int padX = box.width * roiPadding;
+        const int padY = box.height * roiPadding;
+        window = cv::Rect(box.x - padX, box.y - padY, box.width + 2 * padX, box.height + 2 * padY)
+               & cv::Rect(0, 0, imageSize.width, imageSize.height);
+        
+        // A window covering most of the frame would only cost a second detection on failure
+        return window.area() > 0 && window.area() < 0.75 * imageSize.area();
+    }
+    
+    void PatternTracker::commit(FrameData& frame)
+    {
+        if (frame.found)
+            m_info = frame.results.front();
+        
+        // Update the motion model
+        if (frame.found)
+        {
+            m_prevResults.swap(m_lastResults);
+            m_lastResults = frame.results;
+        }
+        else
+        {
+            m_prevResults.clear();
+            m_lastResults.clear();
+        }
+        
+        if (frame.found && enableOpticalFlowTracking)
+            startTracking(frame);
+        else
+            m_targets.clear();
+        
+        m_isTracking = !m_targets.empty();
+        
+        // Keep our own copy since the gray image may share the caller's buffer
+        if (m_isTracking)
+            frame.grayImg.copyTo(m_prevGrayImg);
+        
+        frame.counters.inliers = frame.found ? frame.matches.size() : 0;
+        m_numCommits++;
+    }
+    
+    void PatternTracker::startTracking(const FrameData& frame)
+    {
+        // The followed targets are the first results, in the same order
+        m_targets.resize(frame.numFollowed);
+        
+        // Seed the others with the inliers of their rough homography
+        for (size_t r = frame.numFollowed; r < frame.results.size(); r++)
+        {
+            const std::vector<cv::DMatch>& inliers = frame.resultInliers[r];
+            m_targets.resize(m_targets.size() + 1);
+            
+            TrackedTarget& target = m_targets.back();
+            target.patternIdx = frame.results[r].patternIdx;
+            target.homography = frame.results[r].homography;
+            target.points.resize(inliers.size());
+            target.trainIdx.resize(inliers.size());
+            for (size_t i = 0; i < inliers.size(); i++)
+            {
+                target.points[i] = frame.queryKeypoints[inliers[i].queryIdx].pt * rescale;
+                target.trainIdx[i] = inliers[i].trainIdx;
+            }
+        }
+    }
+    
+    const Pose& PatternTracker::getPose(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs)
+    {
+        const bool sameCamera = sameValues(cameraMatrix, m_poseCameraMatrix) && sameValues(distCoeffs, m_poseDistCoeffs);
+        if (sameCamera && m_poseCommit == m_numCommits)
+            return m_pose;
+        
+        const int64 start = cv::getTickCount();
+        const Pose previous = m_pose;
+        
+        Pose& pose = m_pose;
+        pose = Pose();
+        pose.frameIndex = m_frame.index;
+        pose.ticks = m_frame.ticks;
+        
+        if (m_frame.found)
+        {
+            pose.found = true;
+            pose.patternIdx = m_info.patternIdx;
+            
+            // Start from the pose of the previous frame while the same pattern is followed
+            const bool continuous = sameCamera && previous.found && previous.patternIdx == pose.patternIdx
+                                 && m_poseCommit + 1 == m_numCommits;
+            solvePnP(m_database->getPattern(pose.patternIdx).points3d, m_info.points2d, cameraMatrix, distCoeffs,
+                     m_rawRvec, m_rawTvec, continuous);
+            
+            if (enablePoseFilter)
+            {
+                if (!continuous)
+                    poseFilter.reset();
                 
-                // Estimate new refinement homography
-                homographyFound = refineMatchesWithHomography(warpedKeypoints,
-                                                              m_pattern.keypoints,
-                                                              homographyReprojectionThreshold,
-                                                              refinedMatches,
-                                                              m_refinedHomography);
-
-                // Get a result homography as result of matrix product of refined and rough homographies:
-                m_info.homography = m_roughHomography * m_refinedHomography;
+                // Frame times rather than call times, 30 fps when the caller doesn't set them
+                double dt = 1. / 30;
+                if (continuous && pose.ticks > previous.ticks && previous.ticks > 0)
+                    dt = (pose.ticks - previous.ticks) / cv::getTickFrequency();
                 
-                // Transform contour with precise homography
-                cv::perspectiveTransform(m_pattern.points2d, m_info.points2d, m_info.homography);
+                poseFilter.filter(m_rawRvec, m_rawTvec, dt, pose.rvec, pose.tvec);
+                pose.filtered = true;
             }
             else
             {
-                m_info.homography = m_roughHomography;
-                
-                // Transform contour with rough homography
-                cv::perspectiveTransform(m_pattern.points2d, m_info.points2d, m_roughHomography);
+                pose.rvec = m_rawRvec.clone();
+                pose.tvec = m_rawTvec.clone();
             }
         }
+        else
+        {
+            poseFilter.reset();
+        }
         
-        return homographyFound;
+        if (!sameCamera)
+        {
+            cameraMatrix.copyTo(m_poseCameraMatrix);
+            distCoeffs.copyTo(m_poseDistCoeffs);
+        }
+        m_poseCommit = m_numCommits;
+        m_frame.timings.pose = elapsedMs(start);
+        return pose;
     }
     
     void PatternTracker::getPose(const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, cv::Mat &rvec, cv::Mat &tvec){
-        solvePnP(m_pattern.points3d, m_info.points2d, cameraMatrix, distCoeffs, rvec, tvec);
+        const Pose& pose = getPose(cameraMatrix, distCoeffs);
+        pose.rvec.copyTo(rvec);
+        pose.tvec.copyTo(tvec);
     }
     
+    const std::vector<Pose>& PatternTracker::getPoses(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs)
+    {
+        // The best pattern keeps the pose & filter of getPose()
+        const Pose& best = getPose(cameraMatrix, distCoeffs);
+        
+        const bool sameCamera = sameValues(cameraMatrix, m_posesCameraMatrix) && sameValues(distCoeffs, m_posesDistCoeffs);
+        if (sameCamera && m_posesCommit == m_numCommits)
+            return m_poses;
+        
+        const int64 start = cv::getTickCount();
+        const bool consecutive = sameCamera && m_posesCommit + 1 == m_numCommits;
+        
+        m_poses.resize(m_frame.found ? m_frame.results.size() : 0);
+        m_nextTargetPoses.clear();
+        for (size_t r = 0; r < m_poses.size(); r++)
+        {
+            if (r == 0)
+            {
+                m_poses[0] = best;
+                continue;
+            }
+            
+            const TrackingInfo& info = m_frame.results[r];
+            Pose& pose = m_poses[r];
+            pose = Pose();
+            pose.found = true;
+            pose.frameIndex = m_frame.index;
+            pose.ticks = m_frame.ticks;
+            pose.patternIdx = info.patternIdx;
+            
+            // Start from the pose of the previous frame while the same pattern is found
+            const TargetPose* previous = 0;
+            if (consecutive)
+            {
+                for (const auto & target : m_targetPoses)
+                {
+                    if (target.patternIdx == info.patternIdx)
+                        previous = &target;
+                }
+            }
+            
+            m_nextTargetPoses.push_back(previous ? *previous : TargetPose());
+            TargetPose& target = m_nextTargetPoses.back();
+            if (!previous)
+            {
+                target.patternIdx = info.patternIdx;
+                target.ticks = 0;
+                target.filter = poseFilter;
+                target.filter.reset();
+            }
+            
+            const bool continuous = previous != 0;
+            solvePnP(m_database->getPattern(info.patternIdx).points3d, info.points2d, cameraMatrix, distCoeffs,
+                     target.rvec, target.tvec, continuous);
+            
+            if (enablePoseFilter)
+            {
+                double dt = 1. / 30;
+                if (continuous && pose.ticks > target.ticks && target.ticks > 0)
+                    dt = (pose.ticks - target.ticks) / cv::getTickFrequency();
+                
+                target.filter.filter(target.rvec, target.tvec, dt, pose.rvec, pose.tvec);
+                pose.filtered = true;
+            }
+            else
+            {
+                pose.rvec = target.rvec.clone();
+                pose.tvec = target.tvec.clone();
+            }
+            target.ticks = pose.ticks;
+        }
+        m_targetPoses.swap(m_nextTargetPoses);
+        
+        if (!sameCamera)
+        {
+            cameraMatrix.copyTo(m_posesCameraMatrix);
+            distCoeffs.copyTo(m_posesDistCoeffs);
+        }
+        m_posesCommit = m_numCommits;
+        m_frame.timings.pose += elapsedMs(start);
+        return m_poses;
+    }
+    
+    OperatingPoint PatternTracker::getOperatingPoint() const
+    {
+        return OperatingPoint(m_backend->getNumFeatures(), m_backend->getNumLevels(), rescale, enableHomographyRefinement);
+    }
     
+    void PatternTracker::setOperatingPoint(const OperatingPoint& point)
+    {
+        rescale = point.rescale;
+        enableHomographyRefinement = point.refinement;
+        if (point.numFeatures == m_backend->getNumFeatures() && point.numLevels == m_backend->getNumLevels())
+            return;
+        
+        // The backends only keep their settings, creating another one is cheap
+        m_backend = m_patternBackend->withBudget(point.numFeatures, point.numLevels);
+    }
+    
+    cv::Ptr<cv::DescriptorMatcher> PatternTracker::createMatcher(MatcherType matcherType)
+    {
+        switch (matcherType)
+        {
+            case MATCHER_FLANN_LSH:
+                // 12 tables, 20 bits keys, multi-probe level 2
+                return new cv::FlannBasedMatcher(new cv::flann::LshIndexParams(12, 20, 2));
+            case MATCHER_MULTI_INDEX_HASH:
+                return new cv::MultiIndexHashMatcher();
+            case MATCHER_PACKED_HAMMING:
+                return new cv::PackedHammingMatcher();
+            case MATCHER_BRUTEFORCE:
+            default:
+                return new cv::BruteForceMatcher< cv::HammingLUT >(); // cv::BFMatcher(cv::NORM_HAMMING, true)
+        }
+    }
+    
+    const std::vector<cv::KeyPoint>& PatternTracker::getPatternKeyPoints() const
+    {
+        static const std::vector<cv::KeyPoint> noKeyPoints;
+        
+        if (m_info.patternIdx < 0)
+            return m_database->empty() ? noKeyPoints : m_database->getPattern(0).keypoints;
+        
+        return m_database->getPattern(m_info.patternIdx).keypoints;
+    }
+
+
 #pragma mark - Private
     
     
-    Pattern PatternTracker::buildPatternFromImage(const cv::Mat& image) const
+    void PatternTracker::setupExtraction()
+    {
+        m_pool = new cv::ThreadPool();
+    }
+    
+    Pattern PatternTracker::buildPatternFromImage(const cv::Mat& image, const std::string& name) const
     {
         Pattern pattern;
+        pattern.name = name;
         
         // Store original image in pattern structure
         pattern.size = cv::Size(image.cols, image.rows);
@@ -163,11 +1318,11 @@ namespace cv {
         pattern.points3d[2] = cv::Point3f( unitW,  unitH, 0);
         pattern.points3d[3] = cv::Point3f(-unitW,  unitH, 0);
         
-        extractFeatures(pattern.grayImg, pattern.keypoints, pattern.descriptors);
+        extractFeatures(pattern.grayImg, pattern.keypoints, pattern.descriptors, 0, true);
         
         return pattern;
     }
-
+    
     void PatternTracker::getGray(const cv::Mat& image, cv::Mat& gray)
     {
         if (image.channels()  == 3)
@@ -177,72 +1332,216 @@ namespace cv {
         else if (image.channels() == 1)
             gray = image;
     }
-
-    bool PatternTracker::extractFeatures(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
+    
+    bool PatternTracker::extractFeatures(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors, StageTimings* timings, bool isPattern) const
     {
         assert(!image.empty());
         assert(image.channels() == 1);
         
-        m_detector->detect(image, keypoints);
+        const cv::Ptr<FeatureBackend>& source = isPattern ? m_patternBackend : m_backend;
+        const FeatureBackend& backend = *source;
+        int64 start = cv::getTickCount();
+        
+        if (numExtractionThreads > 1)
+        {
+            const bool extracted = extractFeaturesTiled(image, source, keypoints, descriptors);
+            if (timings)
+                timings->detection += elapsedMs(start);
+            return extracted;
+        }
+        
+        backend.detect(image, keypoints);
+        if (timings)
+            timings->detection += elapsedMs(start);
         if (keypoints.empty())
             return false;
         
-        m_extractor->compute(image, keypoints, descriptors);
+        start = cv::getTickCount();
+        backend.compute(image, keypoints, descriptors);
+        if (timings)
+            timings->description += elapsedMs(start);
         if (keypoints.empty())
             return false;
         
         return true;
     }
     
-    void PatternTracker::getMatches(const cv::Mat& queryDescriptors, std::vector<cv::DMatch>& matches)
+    bool PatternTracker::extractFeaturesTiled(const cv::Mat& image, const cv::Ptr<FeatureBackend>& backend, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const
     {
-        matches.clear();
+        const int gridW = std::max(1, extractionGrid.width);
+        const int gridH = std::max(1, extractionGrid.height);
+        const int numTiles = gridW * gridH;
         
-        if (enableRatioTest)
-        {
-            // To avoid NaN's when best match has zero distance we will use inversed ratio.
-            const float minRatio = 1.f / 1.5f;
+        // Each tile keeps its share of the keypoints
+        TileExtraction& tiles = tileExtraction(backend, (backend->getNumFeatures() + numTiles - 1) / numTiles, backend->getNumLevels());
+        const cv::Ptr<FeatureBackend>& tileBackend = tiles.backend;
+        
+        // The backends drop the keypoints too close to the border of the tile to be described,
+        // tiles overlap by this margin so that those are found by their neighbour.
+        // Keypoints of the coarsest levels lying on a seam can still be missed.
+        const int margin = 32;
+        const cv::Rect imageRect(0, 0, image.cols, image.rows);
+        
+        std::vector< std::vector<cv::KeyPoint> >& tileKeypoints = tiles.keypoints;
+        std::vector<cv::Mat>& tileDescriptors = tiles.descriptors;
+        tileKeypoints.resize(numTiles);
+        tileDescriptors.resize(numTiles);
+        
+        m_pool->setNumThreads(numExtractionThreads);
+        m_pool->parallelFor(numTiles, [&](int t) {
+            const int tx = t % gridW;
+            const int ty = t / gridW;
+            const cv::Rect core(tx * image.cols / gridW,
+                                ty * image.rows / gridH,
+                                (tx + 1) * image.cols / gridW - tx * image.cols / gridW,
+                                (ty + 1) * image.rows / gridH - ty * image.rows / gridH);
+            const cv::Rect padded = cv::Rect(core.x - margin, core.y - margin, core.width + 2 * margin, core.height + 2 * margin) & imageRect;
             
-            // KNN match will return 2 nearest matches for each query descriptor
-            m_matcher->knnMatch(queryDescriptors, m_knnMatches, 2);
+            std::vector<cv::KeyPoint>& kps = tileKeypoints[t];
+            cv::Mat desc;
+            tileBackend->detectAndCompute(image(padded), kps, desc);
             
-            for (size_t i=0; i<m_knnMatches.size(); i++)
+            // Only keep the keypoints of the tile itself, the overlap belongs to the neighbours
+            cv::Mat& kept = tileDescriptors[t];
+            kept.create(kps.size(), desc.cols, desc.type());
+            size_t n = 0;
+            for (size_t i = 0; i < kps.size(); i++)
             {
-                const cv::DMatch& bestMatch   = m_knnMatches[i][0];
-                const cv::DMatch& betterMatch = m_knnMatches[i][1];
-                
-                float distanceRatio = bestMatch.distance / betterMatch.distance;
-                
-                // Pass only matches where distance ratio between
-                // nearest matches is greater than 1.5 (distinct criteria)
-                if (distanceRatio < minRatio)
-                {
-                    matches.push_back(bestMatch);
-                }
+                cv::KeyPoint kp = kps[i];
+                kp.pt.x += padded.x;
+                kp.pt.y += padded.y;
+                if (!core.contains(cv::Point(kp.pt.x, kp.pt.y)))
+                    continue;
+                kps[n] = kp;
+                desc.row(i).copyTo(kept.row(n));
+                n++;
             }
+            kps.resize(n);
+            kept = kept.rowRange(0, n);
+        });
+        
+        // Merge the tiles
+        keypoints.clear();
+        descriptors.release();
+        for (int t = 0; t < numTiles; t++)
+        {
+            if (tileKeypoints[t].empty())
+                continue;
+            keypoints.insert(keypoints.end(), tileKeypoints[t].begin(), tileKeypoints[t].end());
+            descriptors.push_back(tileDescriptors[t]);
+        }
+        
+        return !keypoints.empty();
+    }
+    
+    bool PatternTracker::retrieve(FrameData& frame, const cv::Mat& queryDescriptors) const
+    {
+        frame.shortlist.clear();
+        if (!usesRetrieval())
+            return false;
+        
+        m_database->shortlist(queryDescriptors, retrievalShortlistSize, frame.shortlist, frame.retrieval);
+        return true;
+    }
+    
+    bool PatternTracker::usesRetrieval() const
+    {
+        return m_database->hasVocabulary() && retrievalShortlistSize > 0 && m_database->size() > (size_t)retrievalShortlistSize;
+    }
+    
+    void PatternTracker::getMatches(FrameData& frame, const cv::Mat& queryDescriptors, std::vector<cv::DMatch>& matches, int patternIdx)
+    {
+        // Coarse to fine : large catalogs are only matched with the patterns retrieved for the frame
+        m_database->train();
+        const std::vector<int>* patterns = 0;
+        if (patternIdx >= 0 && usesRetrieval())
+        {
+            frame.refinementPatterns.assign(1, patternIdx);
+            patterns = &frame.refinementPatterns;
+        }
+        else if (patternIdx < 0 && retrieve(frame, queryDescriptors))
+            patterns = &frame.shortlist;
+        
+        if (patterns)
+        {
+            m_database->knnMatch(queryDescriptors, frame.knnMatches, enableRatioTest ? 2 : 1, *patterns, frame.retrieval);
+            selectMatches(frame.knnMatches, matches);
         }
         else
         {
-            // Perform regular match
-            m_matcher->match(queryDescriptors, matches);
+            // KNN match will return 2 nearest matches for each query descriptor with the ratio test,
+            // the nearest one otherwise, selectMatches() skipping the placeholders of approximate matchers
+            m_database->knnMatch(queryDescriptors, frame.knnMatches, enableRatioTest ? 2 : 1);
+            selectMatches(frame.knnMatches, matches);
         }
     }
-
+    
+    void PatternTracker::selectMatches(const std::vector< std::vector<cv::DMatch> >& knnMatches, std::vector<cv::DMatch>& matches) const
+    {
+        matches.clear();
+        
+        if (!enableRatioTest)
+        {
+            // Nearest neighbours only, skipping the placeholders of approximate matchers
+            for (const auto & neighbours : knnMatches)
+            {
+                if (!neighbours.empty() && neighbours[0].trainIdx >= 0)
+                    matches.push_back(neighbours[0]);
+            }
+            return;
+        }
+        
+        // To avoid NaN's when best match has zero distance we will use inversed ratio.
+        const float minRatio = 1.f / 1.5f;
+        
+        for (size_t i=0; i<knnMatches.size(); i++)
+        {
+            // Approximate matchers may not find 2 neighbours
+            if (knnMatches[i].size() < 2)
+                continue;
+            
+            const cv::DMatch& bestMatch   = knnMatches[i][0];
+            const cv::DMatch& betterMatch = knnMatches[i][1];
+            
+            float distanceRatio = bestMatch.distance / betterMatch.distance;
+            
+            // Pass only matches where distance ratio between
+            // nearest matches is greater than 1.5 (distinct criteria)
+            if (distanceRatio < minRatio)
+            {
+                matches.push_back(bestMatch);
+            }
+        }
+    }
+    
     bool PatternTracker::refineMatchesWithHomography
     (
+     FrameData& frame,
      const std::vector<cv::KeyPoint>& queryKeypoints,
      const std::vector<cv::KeyPoint>& trainKeypoints,
      float reprojectionThreshold,
      std::vector<cv::DMatch>& matches,
-     cv::Mat& homography
+     cv::Mat& homography,
+     const cv::Mat& seed
      )
     {
         if (matches.size() < minNumberMatchesAllowed)
             return false;
         
+        // PROSAC draws its first samples from the closest matches
+        const bool prosac = homographyMethod == HOMOGRAPHY_PROSAC;
+        if (prosac)
+        {
+            std::sort(matches.begin(), matches.end(), [](const cv::DMatch& a, const cv::DMatch& b) {
+                return a.distance < b.distance || (a.distance == b.distance && a.queryIdx < b.queryIdx);
+            });
+        }
+        
         // Prepare data for cv::findHomography
-        std::vector<cv::Point2f> srcPoints(matches.size());
-        std::vector<cv::Point2f> dstPoints(matches.size());
+        std::vector<cv::Point2f>& srcPoints = frame.fitSrc;
+        std::vector<cv::Point2f>& dstPoints = frame.fitDst;
+        srcPoints.resize(matches.size());
+        dstPoints.resize(matches.size());
         
         for (size_t i = 0; i < matches.size(); i++)
         {
@@ -251,22 +1550,32 @@ namespace cv {
         }
         
         // Find homography matrix and get inliers mask
-        std::vector<unsigned char> inliersMask(srcPoints.size());
-        homography = cv::findHomography(srcPoints, 
-                                        dstPoints, 
-                                        CV_FM_RANSAC, 
-                                        reprojectionThreshold, 
-                                        inliersMask);
-        
-        std::vector<cv::DMatch> inliers;
+        std::vector<unsigned char>& inliersMask = frame.fitMask;
+        inliersMask.assign(srcPoints.size(), 0);
+        if (prosac)
+        {
+            frame.estimator.estimate(srcPoints, dstPoints, reprojectionThreshold, homographyParams, homography, inliersMask, seed);
+            frame.counters.hypotheses += frame.estimator.getNumHypotheses();
+        }
+        else
+        {
+            homography = cv::findHomography(srcPoints, 
+                                            dstPoints, 
+                                            CV_FM_RANSAC, 
+                                            reprojectionThreshold, 
+                                            inliersMask);
+        }
+        
+        // Keep the inliers, in place
+        size_t numInliers = 0;
         for (size_t i=0; i<inliersMask.size(); i++)
         {
             if (inliersMask[i])
-                inliers.push_back(matches[i]);
+                matches[numInliers++] = matches[i];
         }
         
-        matches.swap(inliers);
+        matches.resize(numInliers);
         return matches.size() > minNumberMatchesAllowed;
     }
-
+    
 }
\ No newline at end of file
@@ -13,32 +13,160 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d/features2d.hpp>
+#include "PatternDatabase.h"
+#include "FeatureBackend.h"
+#include "PatternFile.h"
+#include "PixelFormat.h"
+#include "FixedPointKernel.h"
+#include "PoseFilter.h"
+#include "RobustHomography.h"
+#include "MultiIndexHashMatcher.h"
+#include "PackedHammingMatcher.h"
+#include "ThreadPool.h"
+#include "TrackerProfiler.h"
 
 namespace cv {
-
+    
+    /**
+     * Intermediate pattern tracking info structure, one per pattern found in a frame
+     */
+    struct TrackingInfo
+    {
+        TrackingInfo() : patternIdx(-1), numInliers(0) {}
+        
+        int                       patternIdx;
+        cv::Mat                   homography;
+        std::vector<cv::Point2f>  points2d;
+        int                       numInliers;   // matches or tracked points consistent with the homography
+    };
+    
+    /**
+     * Path taken by the last call to PatternTracker::find()
+     */
+    enum TrackingPath
+    {
+        TRACKING_PATH_NONE,         // nothing ran yet
+        TRACKING_PATH_DETECTION,    // full detection, matching & homography estimation
+        TRACKING_PATH_OPTICAL_FLOW  // frame-to-frame tracking of the previous inliers
+    };
+    
+    /**
+     * Ways of refining the rough homography of a candidate pattern
+     */
+    enum RefinementMethod
+    {
+        REFINEMENT_WARP,            // warp the frame to the pattern, detect & match again
+        REFINEMENT_INLIERS_LM,      // gather the matches consistent with the homography & refit them with Levenberg-Marquardt
+        REFINEMENT_PATCH_ALIGNMENT  // align small pattern patches around the inliers in the frame
+    };
+    
+    /**
+     * Robust estimators of the homographies of the matches
+     */
+    enum HomographyMethod
+    {
+        HOMOGRAPHY_RANSAC,          // cv::findHomography(), uniform sampling
+        HOMOGRAPHY_PROSAC           // RobustHomography, best matches first, SPRT & seeded with the previous frame
+    };
+    
     /**
-     * Store the image data and computed descriptors of target pattern
+     * Everything computed for one frame by PatternTracker::find().
+     * Frames only share the tracker state in PatternTracker::integrate(),
+     * so that the other stages can run concurrently on different frames.
      */
-    struct Pattern
+    struct FrameData
     {
-        cv::Size                  size;
-        cv::Mat                   frame;
+        FrameData() : index(0), ticks(0), imageFormat(PIXEL_FORMAT_AUTO), numFollowed(0), found(false), path(TRACKING_PATH_NONE) {}
+        
+        long long                 index;        // set by the caller
+        int64                     ticks;        // cv::getTickCount() when the frame was received, set by the caller
+        cv::Mat                   image;        // copy of the input, for callers queueing frames
+        PixelFormat               imageFormat;
+        cv::Size                  imageSize;
+        cv::Mat                   img;
         cv::Mat                   grayImg;
+        cv::Rect                  searchWindow;
         
-        std::vector<cv::KeyPoint> keypoints;
-        cv::Mat                   descriptors;
+        std::vector<cv::KeyPoint> queryKeypoints;
+        cv::Mat                   queryDescriptors;
+        std::vector<cv::DMatch>   matches;
+        std::vector<TrackingInfo> results;      // reused by match(), the homographies are replaced, never written in place
+        std::vector< std::vector<cv::DMatch> > resultInliers; // of each result, at least as many as results
+        size_t                    numFollowed;  // first results, followed by optical flow
+        bool                      found;
+        TrackingPath              path;
+        StageTimings              timings;
+        FrameCounters             counters;
         
-        std::vector<cv::Point2f>  points2d;
-        std::vector<cv::Point3f>  points3d;
+        // scratch buffers, kept allocated from one frame to the next
+        std::vector< std::vector<cv::DMatch> > knnMatches;  // inner vectors reused by our matchers
+        std::vector< std::vector<cv::DMatch> > candidateMatches;  // ratio test survivors, per pattern
+        std::vector<int>          candidates;
+        std::vector<unsigned char> claimed;           // query keypoints already inliers of a verified pattern
+        std::vector<int>          excludedPatterns;   // followed by optical flow, not verified again, set by find()
+        std::vector<cv::Point2f>  fitSrc;             // points handed to findHomography
+        std::vector<cv::Point2f>  fitDst;
+        std::vector<unsigned char> fitMask;
+        cv::Mat                   warpedImg;
+        std::vector<cv::KeyPoint> warpedKeypoints;
+        std::vector<cv::DMatch>   warpedMatches;
+        cv::Mat                   roughHomography;
+        cv::Mat                   scaledHomography;   // rough homography to the gray image
+        cv::Mat                   refinedHomography;
+        std::vector<cv::DMatch>   refinementMatches;  // candidate matches before RANSAC
+        std::vector<cv::Point2f>  refinementSrc;
+        std::vector<cv::Point2f>  refinementDst;
+        std::vector<cv::Point2f>  refinementProjected;
+        cv::Mat                   patch;
+        cv::Mat                   patchScores;
+        RobustHomography          estimator;
+        std::vector<TrackingInfo> seedResults;        // results of the previous frame seeding the estimator, set by find()
+        std::vector<int>          shortlist;          // patterns retrieved for the frame with the vocabulary, best first
+        std::vector<int>          refinementPatterns; // the pattern matched again by REFINEMENT_WARP
+        RetrievalScratch          retrieval;
     };
     
     /**
-     * Intermediate pattern tracking info structure
+     * Pose of a pattern in a frame, solved once per frame by PatternTracker::getPose() & getPoses().
+     * Its matrices are never written in place, so that a pose can be kept while the tracker moves on.
      */
-    struct TrackingInfo
+    struct Pose
     {
-        cv::Mat                   homography;
-        std::vector<cv::Point2f>  points2d;
+        Pose() : found(false), frameIndex(-1), ticks(0), patternIdx(-1), filtered(false) {}
+        
+        bool                      found;
+        long long                 frameIndex;   // FrameData::index & ticks of the frame the pose comes from
+        int64                     ticks;
+        int                       patternIdx;
+        cv::Mat                   rvec;
+        cv::Mat                   tvec;
+        bool                      filtered;     // smoothed by the pose filter
+    };
+    
+    /**
+     * Descriptor matcher backends
+     */
+    enum MatcherType
+    {
+        MATCHER_BRUTEFORCE,         // exact, linear in the number of train descriptors
+        MATCHER_PACKED_HAMMING,     // same as MATCHER_BRUTEFORCE, using SIMD kernels on packed descriptors
+        MATCHER_FLANN_LSH,          // approximate, locality sensitive hashing
+        MATCHER_MULTI_INDEX_HASH    // exact up to a bounded distance, see MultiIndexHashMatcher
+    };
+    
+    /**
+     * Settings of PatternTracker trading the quality of the detection for time, see QualityController
+     */
+    struct OperatingPoint
+    {
+        OperatingPoint() : numFeatures(500), numLevels(8), rescale(1), refinement(true) {}
+        OperatingPoint(int numFeatures, int numLevels, float rescale, bool refinement)
+        : numFeatures(numFeatures), numLevels(numLevels), rescale(rescale), refinement(refinement) {}
+        
+        int                       numFeatures;  // keypoints kept per frame
+        int                       numLevels;    // pyramid levels of the feature backend
+        float                     rescale;      // PatternTracker::rescale
+        bool                      refinement;   // PatternTracker::enableHomographyRefinement
     };
     
     /**
@@ -50,40 +178,311 @@ namespace cv {
         PatternTracker();
         virtual ~PatternTracker(){ std::cout << "Destroying Pattern Tracker" << std::endl; };
         
-        void setup();
-        void add(const cv::Mat& image);
-        bool find(const cv::Mat& image);
+        void setup(MatcherType matcherType = MATCHER_PACKED_HAMMING);
+        
+        /**
+         * Setup with the pattern database & matcher index of another tracker, e.g. one tracker per camera.
+         * Patterns added to either tracker are seen by both, each one keeps its own tracking state.
+         */
+        void setup(PatternTracker& shared);
+        MatcherType getMatcherType() const { return m_matcherType; }
+        
+        /**
+         * Detector & descriptor of the patterns & frames, ORB by default. Set it before adding patterns,
+         * the trackers setup with another one using its backend. The name is looked up in the
+         * FeatureBackend registry, false if there's no such backend.
+         */
+        bool setFeatureBackend(const std::string& name);
+        void setFeatureBackend(const cv::Ptr<FeatureBackend>& backend);
+        const FeatureBackend& getFeatureBackend() const { return *m_patternBackend; }
+        
+        /**
+         * Add a pattern & return its index, -1 if the database holds patterns of another feature backend
+         */
+        int add(const cv::Mat& image, const std::string& name = "");
+        
+        /**
+         * Replace or remove the pattern at index, the indices of the other patterns don't change.
+         * False if there's no such pattern, or if the new one would be described by another feature backend.
+         * They edit the database in place : see PatternUpdater to edit it while tracking.
+         */
+        bool replace(int index, const cv::Mat& image, const std::string& name = "");
+        bool remove(int index);
+        
+        /**
+         * Track the patterns of another database from the next frame, e.g. an edited clone of the current one
+         * published by a PatternUpdater. The tracking state of the patterns that were removed or replaced is
+         * dropped, the other patterns keep being followed. Call it between two frames : not while the stages
+         * of other frames run, and the trackers setup with this one keep the previous database.
+         */
+        void setDatabase(const cv::Ptr<PatternDatabase>& database);
+        
+        /**
+         * Save the patterns to a file loadable without any detection,
+         * along with the matcher index when the matcher supports it
+         */
+        bool save(const std::string& path, bool withGrayImages = false);
+        
+        /**
+         * Append the patterns of a file written by save() or the compilePatterns tool, returns the number
+         * of loaded patterns or -1 if the file couldn't be read or was built with another feature backend
+         */
+        int load(const std::string& path);
+        
+        /**
+         * Load a vocabulary built by the buildVocabulary tool for the patterns of the database, see
+         * retrievalShortlistSize. False if it can't be read or was built for another feature backend.
+         */
+        bool loadVocabulary(const std::string& path);
+        
+        /**
+         * Track the patterns in a frame. The YUV formats are read in place, only their luma
+         * being tracked, see wrapPixels() to pass a camera buffer without copying it.
+         * ticks is when the frame was received, cv::getTickCount() if 0 : the pose filter runs
+         * on it, e.g. with the capture time of the frame or the recorded one of a replay.
+         */
+        bool find(const cv::Mat& image, PixelFormat format = PIXEL_FORMAT_AUTO, int64 ticks = 0);
+        
+        /**
+         * Pose of the best pattern in the last frame, solved on the first call for a frame & camera only.
+         * While the same pattern is found in consecutive frames, solvePnP starts from the previous pose.
+         */
+        const Pose& getPose(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs);
         void getPose(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, cv::Mat& rvec, cv::Mat& tvec);
         
+        /**
+         * Poses of all the patterns of the last frame, in the order of getResults(), the first one being getPose().
+         * Solved on the first call for a frame & camera, each pattern starting from its own previous pose
+         * and having its own pose filter while it's found in consecutive frames.
+         */
+        const std::vector<Pose>& getPoses(const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs);
+        
+        /**
+         * Create a descriptor matcher for binary descriptors
+         */
+        static cv::Ptr<cv::DescriptorMatcher> createMatcher(MatcherType matcherType);
+        
+        /**
+         * Stages of find(), for running several frames at once (see PipelinedTracker).
+         * Once the database is trained, prepare(), extract() & match() only read the tracker and
+         * can run concurrently on different frames. integrate() follows the patterns with the optical
+         * flow if enabled, adding the detected patterns that aren't followed, and updates the tracker state :
+         * it must be called in frame order. The tracker then exposes the integrated frame, its
+         * previous frame being handed back in frame so that its buffers are reused.
+         * The search window prediction is only used by find().
+         */
+        void prepare(const cv::Mat& image, FrameData& frame, PixelFormat format = PIXEL_FORMAT_AUTO) const;
+        void extract(FrameData& frame, const cv::Rect& window) const;
+        bool match(FrameData& frame);
+        bool integrate(FrameData& frame);
+        
+        /**
+         * match() for a frame whose frame.knnMatches (k = 2) were computed with the database beforehand,
+         * e.g. together with the frames of other trackers sharing it (see MultiCameraTracker)
+         */
+        bool matchPrecomputed(FrameData& frame);
+        
+        /**
+         * Retrieve the patterns the query descriptors of the frame should be matched with in frame.shortlist,
+         * false when the whole database is searched : without vocabulary or with too few patterns.
+         * Like match(), it needs a trained database to run concurrently.
+         */
+        bool retrieve(FrameData& frame, const cv::Mat& queryDescriptors) const;
+        
+        const FrameData& getFrame() const { return m_frame; }
+        
+        /**
+         * Keypoint budget, pyramid, rescale & refinement of the frames, applied from the next find().
+         * The patterns keep being described with the settings of the feature backend.
+         * Not while the stages of other frames run, e.g. in a PipelinedTracker.
+         */
+        OperatingPoint getOperatingPoint() const;
+        void setOperatingPoint(const OperatingPoint& point);
+        
         int minNumberMatchesAllowed;
         bool enableRatioTest;
         bool enableHomographyRefinement;
         float homographyReprojectionThreshold;
         float rescale;
         
-        const std::vector<cv::KeyPoint>&    getPatternKeyPoints() const { return m_pattern.keypoints; }
-        const std::vector<cv::KeyPoint>&    getQueryKeyPoints() const { return m_queryKeypoints; }
-        const std::vector<cv::DMatch>&      getMatches() const { return m_matches; }
+        // gray conversion, rescale & warp refinement with the kernels of cv::fixedpoint, NEON when built for it.
+        // Much faster than the generic paths of OpenCV on ARM boards, the warp being bilinear rather than bicubic.
+        // On by default in the ARM builds.
+        bool enableFixedPointKernels;
+        
+        // estimator of the rough & warp refinement homographies, and of the optical flow fit.
+        // HOMOGRAPHY_PROSAC spends far fewer hypotheses on noisy matches, and find() seeds it
+        // with the homographies of the previous frame.
+        HomographyMethod homographyMethod;
+        RobustHomographyParams homographyParams;
+        
+        // strategy used when enableHomographyRefinement is on, REFINEMENT_WARP doubles the cost of
+        // the detection while the others only reuse the matches. The patch alignment needs the
+        // gray images of the patterns and keeps the rough homography without them.
+        RefinementMethod refinementMethod;
+        float refinementReprojectionThreshold;
+        int refinementPatchRadius;
+        int refinementSearchRadius;
+        int refinementMaxPoints;
+        
+        // number of patterns that can be recognized in a single frame,
+        // and number of candidate patterns verified to find them
+        int maxPatternsPerFrame;
+        int maxCandidatesPerFrame;
+        
+        // with a vocabulary (see loadVocabulary()), the frame descriptors are only matched with the
+        // patterns sharing the most visual words with the frame, so that the cost of the matching
+        // stays about the same whatever the size of the catalog. 0 always searches the whole database.
+        int retrievalShortlistSize;
+        
+        // with more than 1 thread, features are extracted in parallel on a grid of overlapping tiles,
+        // each tile keeping its share of the keypoints so that they're spread over the whole image
+        int numExtractionThreads;
+        cv::Size extractionGrid;
+        
+        // once found, only detect features in a window around the quads predicted with a constant
+        // velocity model, padded by a fraction of their size. The detection is run again on the
+        // whole frame if nothing is found in the window. While fewer than maxPatternsPerFrame are
+        // found there, the rest of the frame is searched for the others every searchInterval frames.
+        bool enableRoiPrediction;
+        float roiPadding;
+        
+        // once found, follow the inliers with pyramidal Lucas-Kanade instead of
+        // running the full detection pipeline until the tracking degrades.
+        // Each pattern found is followed on its own, in a single optical flow pass for all of them.
+        // While fewer than maxPatternsPerFrame are followed, the rest of the frame is searched for
+        // the others every searchInterval frames, the followed patterns being masked out.
+        bool enableOpticalFlowTracking;
+        int minTrackedPointsAllowed;
+        float maxTrackingReprojectionError;
+        int searchInterval;
+        
+        // smooth the poses returned by getPose() over the consecutive frames of a pattern,
+        // see PoseFilter for its parameters. Off by default.
+        bool enablePoseFilter;
+        PoseFilter poseFilter;
+        
+        TrackingPath getLastPath() const { return m_frame.path; }
+        const cv::Rect& getSearchWindow() const { return m_frame.searchWindow; }
+        const StageTimings& getTimings() const { return m_frame.timings; }
+        const FrameCounters& getCounters() const { return m_frame.counters; }
+        bool isTracking() const { return m_isTracking; }
+        
+        const std::vector<cv::KeyPoint>&    getPatternKeyPoints() const;
+        const std::vector<cv::KeyPoint>&    getQueryKeyPoints() const { return m_frame.queryKeypoints; }
+        const std::vector<cv::DMatch>&      getMatches() const { return m_frame.matches; }
         const std::vector<cv::Point2f>&     getQuad() const { return m_info.points2d; }
         
+        // the best recognized pattern, and all the patterns recognized by the last find()
+        const TrackingInfo&                 getInfo() const { return m_info; }
+        const std::vector<TrackingInfo>&    getResults() const { return m_frame.results; }
+        
+        const PatternDatabase&              getDatabase() const { return *m_database; }
+        PatternDatabase&                    getDatabase() { return *m_database; }
+    
     protected:
         
+        /**
+         * Create the extraction pool of the tracker
+         */
+        void setupExtraction();
         
         /**
          * Initialize Pattern structure from the input image.
          * This function finds the feature points and extract descriptors for them.
          */
-        Pattern buildPatternFromImage(const cv::Mat& image) const;
+        Pattern buildPatternFromImage(const cv::Mat& image, const std::string& name = "") const;
+        
+        /**
+         * Detect & describe the features of image, adding the time spent to timings if any.
+         * Frames use the operating point of the tracker, patterns the settings of the feature backend.
+         */
+        bool extractFeatures(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors, StageTimings* timings = 0, bool isPattern = false) const;
+        
+        /**
+         * Parallel version of extractFeatures(), processing the tiles of extractionGrid on m_pool
+         */
+        bool extractFeaturesTiled(const cv::Mat& image, const cv::Ptr<FeatureBackend>& backend, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        
+        /**
+         * Whether the frames are matched with a shortlist of patterns rather than with the whole database
+         */
+        bool usesRetrieval() const;
+        
+        /**
+         * Matches of the query descriptors with the patterns retrieved for them, see retrieve().
+         * A patternIdx only matches that pattern when the database is searched through its vocabulary.
+         */
+        void getMatches(FrameData& frame, const cv::Mat& queryDescriptors, std::vector<cv::DMatch>& matches, int patternIdx = -1);
+        
+        /**
+         * Ratio test of the knn matches, or their nearest neighbours if it's disabled
+         */
+        void selectMatches(const std::vector< std::vector<cv::DMatch> >& knnMatches, std::vector<cv::DMatch>& matches) const;
+        
+        /**
+         * Geometric verification of the candidate patterns of the frame matches
+         */
+        bool verify(FrameData& frame);
+        
+        /**
+         * extract() & match() the window of the frame (in input image coordinates)
+         */
+        bool detect(FrameData& frame, const cv::Rect& window);
+        
+        /**
+         * Window where the patterns found in the last frames should be, false if there's none
+         */
+        bool predictSearchWindow(const cv::Size& imageSize, cv::Rect& window) const;
+        
+        /**
+         * Estimate the homography of a candidate pattern from its matches, refining it if enabled.
+         * On success, matches only contains the inliers of the rough homography.
+         */
+        bool verifyCandidate(FrameData& frame, int patternIdx, std::vector<cv::DMatch>& matches, TrackingInfo& info);
+        
+        /**
+         * Refinements of frame.roughHomography, see RefinementMethod.
+         * The matches are the inliers of the rough homography, updated when the method finds better ones.
+         */
+        bool refineByWarping(FrameData& frame, const Pattern& pattern, int patternIdx, cv::Mat& homography);
+        bool refineByInliers(FrameData& frame, const Pattern& pattern, std::vector<cv::DMatch>& matches, cv::Mat& homography);
+        bool refineByPatchAlignment(FrameData& frame, const Pattern& pattern, const std::vector<cv::DMatch>& matches, cv::Mat& homography);
+        
+        /**
+         * Follow the tracked points of each target from m_prevGrayImg to frame.grayImg and update the
+         * homographies from their new locations, dropping the targets with too few points or a poor fit.
+         * The frame is left untouched : the followed targets are kept in m_flowResults, see mergeFollowed().
+         * Returns false when no target is left.
+         */
+        bool findByOpticalFlow(FrameData& frame);
+        
+        /**
+         * Drop the query keypoints & descriptors lying in the quads of patterns already found
+         */
+        void maskFound(FrameData& frame, const std::vector<TrackingInfo>& found) const;
+        
+        /**
+         * Put the followed targets first in the results of the frame, followed by the patterns detected
+         * in the frame which aren't followed. Their tracked points are appended to the query keypoints.
+         */
+        void mergeFollowed(FrameData& frame);
         
         /**
-         *
+         * Search the whole frame for the patterns that weren't found in the search window, the keypoints
+         * in their quads being masked out, and put them behind the patterns found in the window.
          */
-        bool extractFeatures(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+        void searchOutsideWindow(FrameData& frame, const cv::Rect& full);
         
         /**
-         *
+         * Update the tracking state & motion model with a processed frame
          */
-        void getMatches(const cv::Mat& queryDescriptors, std::vector<cv::DMatch>& matches);
+        void commit(FrameData& frame);
+        
+        /**
+         * Keep following the targets followed in the frame, and start following the ones it detected
+         */
+        void startTracking(const FrameData& frame);
         
         /**
          * Get the gray image from the input image.
@@ -93,32 +492,89 @@ namespace cv {
         static void getGray(const cv::Mat& image, cv::Mat& gray);
         
         /**
-         *
+         * Robust homography of the matches, keeping the inliers only.
+         * The points are gathered in the scratch buffers of the frame. With HOMOGRAPHY_PROSAC, the matches
+         * are sorted by distance and seed, if any, is verified first.
          */
-        bool refineMatchesWithHomography(const std::vector<cv::KeyPoint>& queryKeypoints,
+        bool refineMatchesWithHomography(FrameData& frame,
+                                        const std::vector<cv::KeyPoint>& queryKeypoints,
                                         const std::vector<cv::KeyPoint>& trainKeypoints,
                                         float reprojectionThreshold,
                                         std::vector<cv::DMatch>& matches,
-                                        cv::Mat& homography);
-        
+                                        cv::Mat& homography,
+                                        const cv::Mat& seed = cv::Mat());
+    
     private:
-        std::vector<cv::KeyPoint> m_queryKeypoints;
-        cv::Mat                   m_queryDescriptors;
-        std::vector<cv::DMatch>   m_matches;
-        std::vector< std::vector<cv::DMatch> > m_knnMatches;
-        
-        cv::Mat                   m_img;
-        cv::Mat                   m_grayImg;
-        cv::Mat                   m_warpedImg;
-        cv::Mat                   m_roughHomography;
-        cv::Mat                   m_refinedHomography;
-        
-        Pattern                   m_pattern;
+        /**
+         * Points followed by optical flow for a pattern, in gray image coordinates
+         */
+        struct TrackedTarget
+        {
+            int                       patternIdx;
+            cv::Mat                   homography;
+            std::vector<cv::Point2f>  points;
+            std::vector<int>          trainIdx;     // pattern keypoint of each point
+        };
+        
+        /**
+         * Pose state of a pattern across frames, see getPoses()
+         */
+        struct TargetPose
+        {
+            int                       patternIdx;
+            int64                     ticks;
+            cv::Mat                   rvec;         // unfiltered, seeds the next solvePnP
+            cv::Mat                   tvec;
+            PoseFilter                filter;
+        };
+        
+        FrameData                 m_frame;              // last processed frame
+        
+        cv::Ptr<PatternDatabase>  m_database;           // shared by the trackers setup with each other
+        MatcherType               m_matcherType;        // of the database
         TrackingInfo              m_info;
+        std::vector<TrackingInfo> m_lastResults;        // results of the previous two frames, for the motion model
+        std::vector<TrackingInfo> m_prevResults;
+        
+        cv::Mat                   m_prevGrayImg;
+        std::vector<TrackedTarget> m_targets;
+        std::vector<cv::Point2f>  m_flowPrevPoints;     // of all the targets
+        std::vector<cv::Point2f>  m_flowPoints;
+        std::vector<unsigned char> m_flowStatus;
+        std::vector<float>        m_flowError;
+        std::vector<cv::KeyPoint> m_flowKeypoints;
+        std::vector<cv::DMatch>   m_flowMatches;
+        std::vector<cv::Point2f>  m_flowPatternPoints;
+        std::vector<cv::Point2f>  m_flowProjected;
+        std::vector<TrackingInfo> m_flowResults;        // targets followed in the last frame
+        std::vector< std::vector<cv::DMatch> > m_flowInliers;
+        bool                      m_isTracking;
+        long long                 m_nextIndex;          // of the frames of find()
+        long long                 m_lastSearch;         // frame index of the last detection on the whole frame
+        std::vector<TrackingInfo> m_windowResults;      // patterns found in the search window, see searchOutsideWindow()
+        std::vector< std::vector<cv::DMatch> > m_windowInliers;
+        std::vector<cv::KeyPoint> m_windowKeypoints;
+        unsigned long long        m_numCommits;
+        
+        // pose of the last committed frame, see getPose()
+        Pose                      m_pose;
+        unsigned long long        m_poseCommit;         // m_numCommits when it was solved
+        cv::Mat                   m_poseCameraMatrix;
+        cv::Mat                   m_poseDistCoeffs;
+        cv::Mat                   m_rawRvec;            // unfiltered, seeds the next solvePnP
+        cv::Mat                   m_rawTvec;
+        
+        // poses of all the patterns of the last committed frame, see getPoses()
+        std::vector<Pose>         m_poses;
+        std::vector<TargetPose>   m_targetPoses;
+        std::vector<TargetPose>   m_nextTargetPoses;
+        unsigned long long        m_posesCommit;
+        cv::Mat                   m_posesCameraMatrix;
+        cv::Mat                   m_posesDistCoeffs;
         
-        cv::Ptr<cv::FeatureDetector>     m_detector;
-        cv::Ptr<cv::DescriptorExtractor> m_extractor;
-        cv::Ptr<cv::DescriptorMatcher>   m_matcher;
+        cv::Ptr<cv::ThreadPool>          m_pool;
+        cv::Ptr<FeatureBackend>          m_backend;            // frames, at the operating point
+        cv::Ptr<FeatureBackend>          m_patternBackend;
     };
     
 }
\ No newline at end of file
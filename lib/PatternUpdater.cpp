@@ -0,0 +1,187 @@
+//
+//  PatternUpdater.cpp
+//
+//  Edits of the patterns of a tracker applied on a background thread while it keeps tracking.
+//
+
+#include "PatternUpdater.h"
+
+namespace cv {
+    
+    PatternUpdater::PatternUpdater()
+    : m_isPublished(false)
+    , m_numBuilding(0)
+    , m_version(0)
+    , m_numFailed(0)
+    , m_lastBuildTime(0)
+    , m_stop(true)
+    {
+    }
+    
+    PatternUpdater::~PatternUpdater()
+    {
+        stop();
+    }
+    
+    void PatternUpdater::start(const PatternTracker& tracker)
+    {
+        stop();
+        
+        // The builder has its own copy of the backend, the tracker keeps extracting the frames with its own
+        const FeatureBackend& backend = tracker.getFeatureBackend();
+        m_builder.setFeatureBackend(backend.withBudget(backend.getNumFeatures(), backend.getNumLevels()));
+        cv::Ptr<PatternDatabase> base = tracker.getDatabase().clone();
+        
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_latest = base;
+            m_isPublished = false;
+            m_stop = false;
+        }
+        m_worker = std::thread(&PatternUpdater::work, this);
+    }
+    
+    void PatternUpdater::stop()
+    {
+        if (!m_worker.joinable())
+            return;
+        
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        
+        // flush() doesn't wait for the edits left in the queue
+        m_editReady.notify_all();
+        m_progress.notify_all();
+        m_worker.join();
+    }
+    
+    void PatternUpdater::add(const cv::Mat& image, const std::string& name)
+    {
+        Edit edit = { Edit::ADD, -1, image.clone(), name };
+        push(edit);
+    }
+    
+    void PatternUpdater::replace(int index, const cv::Mat& image, const std::string& name)
+    {
+        Edit edit = { Edit::REPLACE, index, image.clone(), name };
+        push(edit);
+    }
+    
+    void PatternUpdater::remove(int index)
+    {
+        Edit edit = { Edit::REMOVE, index, cv::Mat(), "" };
+        push(edit);
+    }
+    
+    void PatternUpdater::load(const std::string& path)
+    {
+        Edit edit = { Edit::LOAD, -1, cv::Mat(), path };
+        push(edit);
+    }
+    
+    bool PatternUpdater::poll(unsigned long long& version, cv::Ptr<PatternDatabase>& database) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_version == version)
+            return false;
+        
+        version = m_version;
+        database = m_latest;
+        return true;
+    }
+    
+    void PatternUpdater::flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_progress.wait(lock, [this]{ return (m_edits.empty() && m_numBuilding == 0) || m_stop; });
+    }
+    
+    size_t PatternUpdater::getNumPending() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_edits.size() + m_numBuilding;
+    }
+    
+    unsigned long long PatternUpdater::getNumFailed() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numFailed;
+    }
+    
+    double PatternUpdater::getLastBuildTime() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lastBuildTime;
+    }
+
+#pragma mark - Private
+    
+    
+    void PatternUpdater::push(const Edit& edit)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_edits.push_back(edit);
+        m_editReady.notify_one();
+    }
+    
+    void PatternUpdater::work()
+    {
+        std::vector<Edit> batch;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_editReady.wait(lock, [this]{ return m_stop || !m_edits.empty(); });
+                if (m_stop)
+                    return;
+                
+                batch.assign(m_edits.begin(), m_edits.end());
+                m_edits.clear();
+                m_numBuilding = batch.size();
+            }
+            
+            // The trackers may be matching the published database, the edits go to a clone of it.
+            // The clone of the tracker's database isn't shared until it's published.
+            const int64 start = cv::getTickCount();
+            cv::Ptr<PatternDatabase> next = m_isPublished ? m_latest->clone() : m_latest;
+            m_builder.setDatabase(next);
+            
+            unsigned long long numFailed = 0;
+            for (const auto & edit : batch)
+                numFailed += !apply(edit);
+            batch.clear();
+            
+            // Trained here rather than by the trackers on their next frame
+            next->train();
+            const double buildTime = (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+            
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_latest = next;
+            m_isPublished = true;
+            m_version++;
+            m_numBuilding = 0;
+            m_numFailed += numFailed;
+            m_lastBuildTime = buildTime;
+            m_progress.notify_all();
+        }
+    }
+    
+    bool PatternUpdater::apply(const Edit& edit)
+    {
+        switch (edit.type)
+        {
+            case Edit::ADD:
+                return m_builder.add(edit.image, edit.name) >= 0;
+            case Edit::REPLACE:
+                return m_builder.replace(edit.index, edit.image, edit.name);
+            case Edit::REMOVE:
+                return m_builder.remove(edit.index);
+            case Edit::LOAD:
+            default:
+                return m_builder.load(edit.name) >= 0;
+        }
+    }
+    
+}
@@ -0,0 +1,103 @@
+//
+//  PatternUpdater.h
+//
+//  Edits of the patterns of a tracker applied on a background thread while it keeps tracking.
+//
+
+#pragma once
+
+#include "PatternTracker.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace cv {
+    
+    /**
+     * Edits the patterns of a tracker while it keeps tracking at full rate. The edits are queued and a background
+     * thread applies them to a clone of the last database : the features of the new patterns are extracted there,
+     * the matcher & vocabulary index of the clone are trained, and the clone is published. The trackers swap it in
+     * between two frames with PatternTracker::setDatabase(), the published databases are never modified.
+     *
+     *   add() / replace() / remove() / load() -> queue -> clone, describe & train -> poll() -> setDatabase()
+     *
+     * The edits queued while a database is built are applied together to the next one.
+     */
+    class PatternUpdater
+    {
+    public:
+        PatternUpdater();
+        ~PatternUpdater();
+        
+        /**
+         * Apply the edits, the queued ones included, to clones of the database of tracker.
+         * The new patterns are described by its feature backend. Until stop(), the database
+         * of the tracker should only be edited through the updater.
+         */
+        void start(const PatternTracker& tracker);
+        void stop();
+        bool isRunning() const { return m_worker.joinable(); }
+        
+        /**
+         * Queue an edit, from any thread, the image being copied. The patterns are appended in the order they're
+         * queued, so that replace() & remove() can take the index of a pattern queued before as well.
+         */
+        void add(const cv::Mat& image, const std::string& name = "");
+        void replace(int index, const cv::Mat& image, const std::string& name = "");
+        void remove(int index);
+        void load(const std::string& path);
+        
+        /**
+         * The last published database if it's newer than version, which is then updated.
+         * Each tracker polling the updater keeps its own version, 0 at first.
+         */
+        bool poll(unsigned long long& version, cv::Ptr<PatternDatabase>& database) const;
+        
+        /**
+         * Wait until every queued edit is published
+         */
+        void flush();
+        
+        size_t getNumPending() const;
+        unsigned long long getNumFailed() const;    // edits that couldn't be applied, e.g. to an unknown index
+        double getLastBuildTime() const;            // ms, from the clone to the publication
+    
+    protected:
+        /**
+         * A queued edit, the path of the file to load being in name
+         */
+        struct Edit
+        {
+            enum Type { ADD, REPLACE, REMOVE, LOAD };
+            
+            Type                      type;
+            int                       index;
+            cv::Mat                   image;
+            std::string               name;
+        };
+        
+        void push(const Edit& edit);
+        void work();
+        bool apply(const Edit& edit);
+    
+    private:
+        PatternTracker            m_builder;        // describes the new patterns into the database being built
+        cv::Ptr<PatternDatabase>  m_latest;         // the clone of the tracker's database until something is published
+        bool                      m_isPublished;
+        
+        std::deque<Edit>          m_edits;
+        size_t                    m_numBuilding;
+        unsigned long long        m_version;
+        unsigned long long        m_numFailed;
+        double                    m_lastBuildTime;
+        bool                      m_stop;
+        
+        std::thread               m_worker;
+        mutable std::mutex        m_mutex;
+        std::condition_variable   m_editReady;
+        std::condition_variable   m_progress;
+    };
+    
+}
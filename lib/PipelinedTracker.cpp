@@ -0,0 +1,268 @@
+//
+//  PipelinedTracker.cpp
+//
+//  PatternTracker running on several frames at once, its stages connected by bounded queues.
+//
+
+#include "PipelinedTracker.h"
+
+namespace cv {
+    
+    PipelinedTracker::PipelinedTracker()
+    : dropOldestFrames(true)
+    , m_queueSize(2)
+    , m_numWorkers(0)
+    , m_nextIndex(0)
+    , m_integrating(false)
+    , m_paused(false)
+    , m_stop(false)
+    , m_numProcessed(0)
+    , m_numDropped(0)
+    {
+    }
+    
+    PipelinedTracker::~PipelinedTracker()
+    {
+        stop();
+    }
+    
+    void PipelinedTracker::start(int numWorkers, int queueSize)
+    {
+        stop();
+        
+        // Matching from several workers is only safe on a trained database
+        m_tracker.getDatabase().train();
+        
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queueSize = std::max(1, queueSize);
+            m_numWorkers = std::max(1, numWorkers);
+            m_stop = false;
+        }
+        
+        for (size_t i = 0; i < m_numWorkers; i++)
+            m_workers.push_back(std::thread(&PipelinedTracker::work, this));
+    }
+    
+    void PipelinedTracker::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_numWorkers = 0;
+        }
+        m_workReady.notify_all();
+        m_progress.notify_all();
+        
+        for (auto & worker : m_workers)
+            worker.join();
+        m_workers.clear();
+        
+        // Frames still in the pipeline are dropped
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (FrameData* frame : m_input)
+            m_freeFrames.push_back(frame);
+        for (FrameData* frame : m_detected)
+            m_freeFrames.push_back(frame);
+        for (auto & verified : m_verified)
+            m_freeFrames.push_back(verified.second);
+        m_numDropped += m_input.size() + m_detected.size() + m_verified.size();
+        m_input.clear();
+        m_detected.clear();
+        m_verified.clear();
+        m_inFlight.clear();
+    }
+    
+    long long PipelinedTracker::push(const cv::Mat& image, PixelFormat format)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        FrameData* frame = acquireFrame();
+        const int64 ticks = cv::getTickCount();
+        
+        // Nobody else knows about this frame yet, copy the image out of the lock
+        lock.unlock();
+        image.copyTo(frame->image);
+        frame->imageFormat = format;
+        lock.lock();
+        
+        if (!dropOldestFrames)
+            m_progress.wait(lock, [this]{ return m_input.size() < m_queueSize || m_stop; });
+        
+        if (m_input.size() >= m_queueSize)
+        {
+            m_freeFrames.push_back(m_input.front());
+            m_input.pop_front();
+            m_numDropped++;
+        }
+        
+        frame->index = m_nextIndex++;
+        frame->ticks = ticks;
+        m_input.push_back(frame);
+        m_workReady.notify_one();
+        
+        return frame->index;
+    }
+    
+    void PipelinedTracker::flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_progress.wait(lock, [this]{ return (m_input.empty() && m_inFlight.empty()) || m_numWorkers == 0; });
+    }
+    
+    int PipelinedTracker::add(const cv::Mat& image, const std::string& name)
+    {
+        pause();
+        int index = m_tracker.add(image, name);
+        resume();
+        return index;
+    }
+    
+    int PipelinedTracker::load(const std::string& path)
+    {
+        pause();
+        int numLoaded = m_tracker.load(path);
+        resume();
+        return numLoaded;
+    }
+    
+    bool PipelinedTracker::loadVocabulary(const std::string& path)
+    {
+        pause();
+        bool loaded = m_tracker.loadVocabulary(path);
+        resume();
+        return loaded;
+    }
+    
+    void PipelinedTracker::setDatabase(const cv::Ptr<PatternDatabase>& database)
+    {
+        pause();
+        m_tracker.setDatabase(database);
+        resume();
+    }
+    
+    unsigned long long PipelinedTracker::getNumProcessed() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numProcessed;
+    }
+    
+    unsigned long long PipelinedTracker::getNumDropped() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numDropped;
+    }
+
+#pragma mark - Protected
+    
+    void PipelinedTracker::work()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_workReady.wait(lock, [this]{ return m_stop || !m_detected.empty() || canExtract(); });
+            if (m_stop)
+                return;
+            
+            if (!m_detected.empty())
+            {
+                // Finish the frames already in the pipeline first
+                FrameData* frame = m_detected.front();
+                m_detected.pop_front();
+                m_workReady.notify_all();
+                
+                lock.unlock();
+                m_tracker.match(*frame);
+                lock.lock();
+                
+                m_verified[frame->index] = frame;
+                integrateReady(lock);
+            }
+            else
+            {
+                FrameData* frame = m_input.front();
+                m_input.pop_front();
+                m_inFlight.insert(frame->index);
+                m_progress.notify_all();
+                
+                lock.unlock();
+                m_tracker.prepare(frame->image, *frame, frame->imageFormat);
+                m_tracker.extract(*frame, cv::Rect(0, 0, frame->image.cols, frame->image.rows));
+                lock.lock();
+                
+                m_detected.push_back(frame);
+                m_workReady.notify_all();
+            }
+        }
+    }
+    
+    void PipelinedTracker::integrateReady(std::unique_lock<std::mutex>& lock)
+    {
+        while (!m_integrating && !m_inFlight.empty())
+        {
+            // Only the oldest frame in flight can be integrated
+            const long long index = *m_inFlight.begin();
+            auto it = m_verified.find(index);
+            if (it == m_verified.end())
+                return;
+            
+            FrameData* frame = it->second;
+            m_verified.erase(it);
+            m_integrating = true;
+            
+            lock.unlock();
+            frame->timings.total = (cv::getTickCount() - frame->ticks) * 1000. / cv::getTickFrequency();
+            m_tracker.integrate(*frame);
+            if (m_callback)
+                m_callback(m_tracker);
+            lock.lock();
+            
+            // frame now holds the buffers of the previously integrated frame
+            m_freeFrames.push_back(frame);
+            m_inFlight.erase(index);
+            m_integrating = false;
+            m_numProcessed++;
+            
+            m_workReady.notify_all();
+            m_progress.notify_all();
+        }
+    }
+    
+    bool PipelinedTracker::canExtract() const
+    {
+        // The detected queue & the frames waiting for an older one bound the frames in flight
+        return !m_paused && !m_input.empty()
+            && m_detected.size() < m_queueSize
+            && m_inFlight.size() < m_numWorkers + 2 * m_queueSize;
+    }
+    
+    void PipelinedTracker::pause()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_paused = true;
+        m_progress.wait(lock, [this]{ return m_inFlight.empty() || m_numWorkers == 0; });
+    }
+    
+    void PipelinedTracker::resume()
+    {
+        // Still paused, no worker touches the database
+        m_tracker.getDatabase().train();
+        
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_paused = false;
+        m_workReady.notify_all();
+    }
+    
+    FrameData* PipelinedTracker::acquireFrame()
+    {
+        if (m_freeFrames.empty())
+        {
+            m_frames.push_back(std::unique_ptr<FrameData>(new FrameData()));
+            return m_frames.back().get();
+        }
+        
+        FrameData* frame = m_freeFrames.back();
+        m_freeFrames.pop_back();
+        return frame;
+    }
+    
+}
@@ -0,0 +1,139 @@
+//
+//  PipelinedTracker.h
+//
+//  PatternTracker running on several frames at once, its stages connected by bounded queues.
+//
+
+#pragma once
+
+#include "PatternTracker.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+
+namespace cv {
+    
+    /**
+     * Runs a PatternTracker on several frames at once. find() is split in stages connected by bounded queues :
+     *
+     *   push() -> input -> resize, gray, detect & describe -> detected -> match, RANSAC & refinement
+     *          -> reorder -> integrate & callback, in frame order
+     *
+     * A pool of workers runs the first stages, each worker taking the frame the furthest down the
+     * pipeline first. The last stage runs on the worker that completes the next frame in order,
+     * one frame at a time, so that the optical flow, the tracker state and the callback see the
+     * frames in the order they were pushed. The total timing of a frame is its latency from push()
+     * to its integration.
+     */
+    class PipelinedTracker
+    {
+    public:
+        /**
+         * Called after each integrate() with the tracker exposing the frame, see PatternTracker::getFrame().
+         * It runs on a worker, in frame order and never concurrently : solve the pose & publish the results there.
+         */
+        typedef std::function<void(PatternTracker& tracker)> Callback;
+        
+        PipelinedTracker();
+        ~PipelinedTracker();
+        
+        /**
+         * Setup & configure the tracker before start()
+         */
+        PatternTracker& getTracker() { return m_tracker; }
+        void setCallback(const Callback& callback) { m_callback = callback; }
+        
+        /**
+         * numWorkers threads share the stages, the input & detected queues hold up to queueSize frames
+         */
+        void start(int numWorkers, int queueSize = 2);
+        void stop();
+        bool isRunning() const { return !m_workers.empty(); }
+        
+        /**
+         * Queue a copy of the image and return its frame index. When the input queue is full,
+         * its oldest frame is dropped so that the latency stays bounded, or push() waits
+         * for some room if dropOldestFrames is false. Only the luma plane of YUV frames needs to be pushed,
+         * see PatternTracker::find().
+         */
+        long long push(const cv::Mat& image, PixelFormat format = PIXEL_FORMAT_AUTO);
+        
+        /**
+         * Wait until every queued frame went through the pipeline
+         */
+        void flush();
+        
+        /**
+         * Wait for the frames in flight, then add patterns or a vocabulary to the tracker.
+         * Don't call them from several threads at once.
+         */
+        int add(const cv::Mat& image, const std::string& name = "");
+        int load(const std::string& path);
+        bool loadVocabulary(const std::string& path);
+        
+        /**
+         * Wait for the frames in flight, then swap in a database built by a PatternUpdater
+         */
+        void setDatabase(const cv::Ptr<PatternDatabase>& database);
+        
+        unsigned long long getNumProcessed() const;
+        unsigned long long getNumDropped() const;
+        
+        bool dropOldestFrames;
+    
+    protected:
+        void work();
+        
+        /**
+         * Integrate the verified frames next in order, unless another worker does already.
+         * Called with the lock held.
+         */
+        void integrateReady(std::unique_lock<std::mutex>& lock);
+        
+        /**
+         * Whether a worker can start extracting a new frame, called with the lock held
+         */
+        bool canExtract() const;
+        
+        /**
+         * Keep new frames out of the pipeline and wait until it's empty, the lock is released on return.
+         * resume() retrains the database and lets the frames in again.
+         */
+        void pause();
+        void resume();
+        
+        FrameData* acquireFrame();
+    
+    private:
+        PatternTracker                          m_tracker;
+        Callback                                m_callback;
+        
+        std::vector<std::thread>                m_workers;
+        std::vector< std::unique_ptr<FrameData> > m_frames;     // every allocated frame
+        std::vector<FrameData*>                 m_freeFrames;
+        std::deque<FrameData*>                  m_input;
+        std::deque<FrameData*>                  m_detected;
+        std::map<long long, FrameData*>         m_verified;     // waiting for their turn, by index
+        std::set<long long>                     m_inFlight;     // out of the input queue, not integrated yet
+        
+        size_t                                  m_queueSize;
+        size_t                                  m_numWorkers;
+        long long                               m_nextIndex;
+        bool                                    m_integrating;
+        bool                                    m_paused;
+        bool                                    m_stop;
+        unsigned long long                      m_numProcessed;
+        unsigned long long                      m_numDropped;
+        
+        mutable std::mutex                      m_mutex;
+        std::condition_variable                 m_workReady;
+        std::condition_variable                 m_progress;
+    };
+    
+}
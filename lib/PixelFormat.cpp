@@ -0,0 +1,82 @@
+//
+//  PixelFormat.cpp
+//
+//  Layouts of the frames handed to PatternTracker, YUV camera buffers being read in place.
+//
+
+#include "PixelFormat.h"
+#include "FixedPointKernel.h"
+
+namespace cv {
+    
+    namespace {
+        
+        // Bilinear weights in 8 bits fixed point, those of fixedpoint::bilinearTap()
+        const int weightBits = 8;
+        const int weightOne = 1 << weightBits;
+    }
+    
+    cv::Mat wrapPixels(const uchar* data, int width, int height, size_t stride, PixelFormat format)
+    {
+        CV_Assert(format == PIXEL_FORMAT_Y || format == PIXEL_FORMAT_YUYV || format == PIXEL_FORMAT_UYVY);
+        
+        const int type = format == PIXEL_FORMAT_Y ? CV_8UC1 : CV_8UC2;
+        return cv::Mat(height, width, type, const_cast<uchar*>(data), stride ? stride : (size_t)cv::Mat::AUTO_STEP);
+    }
+    
+    void extractLuma(const cv::Mat& image, PixelFormat format, double scale, cv::Mat& gray)
+    {
+        const cv::Size size(scale * image.cols, scale * image.rows);
+        
+        if (format == PIXEL_FORMAT_Y)
+        {
+            CV_Assert(image.type() == CV_8UC1);
+            if (scale == 1)
+                gray = image;
+            else
+                cv::resize(image, gray, size);
+            return;
+        }
+        
+        CV_Assert((format == PIXEL_FORMAT_YUYV || format == PIXEL_FORMAT_UYVY) && image.type() == CV_8UC2);
+        const int lumaOffset = format == PIXEL_FORMAT_YUYV ? 0 : 1;
+        
+        if (scale == 1)
+        {
+            cv::extractChannel(image, gray, lumaOffset);
+            return;
+        }
+        
+        // Each destination pixel blends the luma of 4 source pixels, read straight from the packed rows
+        gray.create(size, CV_8UC1);
+        const double inverseScale = 1. / scale;
+        
+        cv::AutoBuffer<int> xTaps(3 * size.width);
+        int* x0 = xTaps;
+        int* x1 = x0 + size.width;
+        int* wx = x1 + size.width;
+        for (int x = 0; x < size.width; x++)
+        {
+            fixedpoint::bilinearTap(x, inverseScale, image.cols, x0[x], x1[x], wx[x]);
+            x0[x] = 2 * x0[x] + lumaOffset;
+            x1[x] = 2 * x1[x] + lumaOffset;
+        }
+        
+        for (int y = 0; y < size.height; y++)
+        {
+            int y0, y1, wy;
+            fixedpoint::bilinearTap(y, inverseScale, image.rows, y0, y1, wy);
+            const uchar* top = image.ptr(y0);
+            const uchar* bottom = image.ptr(y1);
+            uchar* dst = gray.ptr(y);
+            
+            for (int x = 0; x < size.width; x++)
+            {
+                const int t = top[x0[x]] * (weightOne - wx[x]) + top[x1[x]] * wx[x];
+                const int b = bottom[x0[x]] * (weightOne - wx[x]) + bottom[x1[x]] * wx[x];
+                dst[x] = (uchar)((t * (weightOne - wy) + b * wy + (1 << (2 * weightBits - 1))) >> (2 * weightBits));
+            }
+        }
+    }
+    
+}
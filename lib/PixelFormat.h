@@ -0,0 +1,37 @@
+//
+//  PixelFormat.h
+//
+//  Layouts of the frames handed to PatternTracker, YUV camera buffers being read in place.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * Layouts of the frames handed to PatternTracker. Only the luma is tracked, so the YUV
+     * camera buffers are read in place rather than converted to BGR & back to gray.
+     */
+    enum PixelFormat
+    {
+        PIXEL_FORMAT_AUTO,      // from the channels : gray, BGR or BGRA
+        PIXEL_FORMAT_Y,         // luma only, also the Y plane of the planar & semi planar formats (NV12, NV21, I420, YV12)
+        PIXEL_FORMAT_YUYV,      // packed 4:2:2 as CV_8UC2, Y0 U Y1 V
+        PIXEL_FORMAT_UYVY       // packed 4:2:2 as CV_8UC2, U Y0 V Y1
+    };
+    
+    /**
+     * Header over a camera buffer, without copy : CV_8UC1 for PIXEL_FORMAT_Y, CV_8UC2 for the packed formats.
+     * For NV12, NV21 & I420, data is the start of the buffer, i.e. the Y plane. stride is in bytes, 0 if the rows are contiguous.
+     */
+    cv::Mat wrapPixels(const uchar* data, int width, int height, size_t stride, PixelFormat format);
+    
+    /**
+     * Luma of a PIXEL_FORMAT_Y or packed YUV image, scaled by scale with a bilinear filter in the same pass.
+     * gray shares the data of image for PIXEL_FORMAT_Y at scale 1.
+     */
+    void extractLuma(const cv::Mat& image, PixelFormat format, double scale, cv::Mat& gray);
+    
+}
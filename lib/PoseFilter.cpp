@@ -0,0 +1,107 @@
+//
+//  PoseFilter.cpp
+//
+//  One Euro filtering of the poses of the tracked patterns.
+//
+
+#include "PoseFilter.h"
+
+namespace cv {
+    
+    namespace {
+        
+        // Smoothing factor of an exponential filter with the given cutoff frequency
+        inline double smoothingFactor(double dt, double cutoff)
+        {
+            const double tau = 1. / (2 * CV_PI * cutoff);
+            return 1. / (1. + tau / dt);
+        }
+        
+        cv::Vec3d toVec3d(const cv::Mat& m)
+        {
+            cv::Mat d;
+            m.convertTo(d, CV_64F);
+            return cv::Vec3d(d.at<double>(0), d.at<double>(1), d.at<double>(2));
+        }
+        
+        cv::Vec4d toQuaternion(const cv::Vec3d& rvec)
+        {
+            const double angle = cv::norm(rvec);
+            if (angle < 1e-12)
+                return cv::Vec4d(1, 0, 0, 0);
+            
+            const double s = std::sin(angle * 0.5) / angle;
+            return cv::Vec4d(std::cos(angle * 0.5), rvec[0] * s, rvec[1] * s, rvec[2] * s);
+        }
+        
+        cv::Vec3d toRotationVector(const cv::Vec4d& q)
+        {
+            const double sinHalf = std::sqrt(q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            if (sinHalf < 1e-12)
+                return cv::Vec3d(0, 0, 0);
+            
+            const double angle = 2 * std::atan2(sinHalf, q[0]);
+            return cv::Vec3d(q[1], q[2], q[3]) * (angle / sinHalf);
+        }
+    }
+    
+    double OneEuroFilter::filter(double value, double dt, double minCutoff, double beta, double derivativeCutoff)
+    {
+        if (!m_initialized || dt <= 0)
+        {
+            m_initialized = true;
+            m_value = value;
+            m_derivative = 0;
+            return value;
+        }
+        
+        // The cutoff follows the smoothed speed of the signal
+        const double derivative = (value - m_value) / dt;
+        m_derivative += smoothingFactor(dt, derivativeCutoff) * (derivative - m_derivative);
+        
+        const double cutoff = minCutoff + beta * std::abs(m_derivative);
+        m_value += smoothingFactor(dt, cutoff) * (value - m_value);
+        return m_value;
+    }
+    
+    PoseFilter::PoseFilter()
+    : minCutoff(1)
+    , beta(0.5f)
+    , derivativeCutoff(1)
+    , m_hasQuaternion(false)
+    {
+    }
+    
+    void PoseFilter::filter(const cv::Mat& rvec, const cv::Mat& tvec, double dt, cv::Mat& filteredRvec, cv::Mat& filteredTvec)
+    {
+        const cv::Vec3d r = toVec3d(rvec);
+        cv::Vec3d t = toVec3d(tvec);
+        
+        for (int i = 0; i < 3; i++)
+            t[i] = m_translation[i].filter(t[i], dt, minCutoff, beta, derivativeCutoff);
+        
+        // q & -q are the same rotation, keep the one closest to the last pose so that the components stay continuous
+        cv::Vec4d q = toQuaternion(r);
+        if (m_hasQuaternion && q.dot(m_quaternion) < 0)
+            q = -q;
+        for (int i = 0; i < 4; i++)
+            q[i] = m_rotation[i].filter(q[i], dt, minCutoff, beta, derivativeCutoff);
+        q *= 1. / cv::norm(q);
+        m_quaternion = q;
+        m_hasQuaternion = true;
+        
+        // New matrices, the previous ones may be shared with the readers of older poses
+        filteredRvec = cv::Mat(toRotationVector(q), true);
+        filteredTvec = cv::Mat(t, true);
+    }
+    
+    void PoseFilter::reset()
+    {
+        for (auto & f : m_translation)
+            f.reset();
+        for (auto & f : m_rotation)
+            f.reset();
+        m_hasQuaternion = false;
+    }
+    
+}
@@ -0,0 +1,64 @@
+//
+//  PoseFilter.h
+//
+//  One Euro filtering of the poses of the tracked patterns.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * One Euro filter of a scalar signal (Casiez et al. 2012) : a low pass filter whose cutoff
+     * rises with the speed of the signal, smoothing the jitter at rest without lagging behind fast motions.
+     */
+    class OneEuroFilter
+    {
+    public:
+        OneEuroFilter() : m_initialized(false), m_value(0), m_derivative(0) {}
+        
+        /**
+         * Filter the next sample, dt seconds after the previous one. The cutoffs are in Hz.
+         */
+        double filter(double value, double dt, double minCutoff, double beta, double derivativeCutoff);
+        void reset() { m_initialized = false; }
+    
+    private:
+        bool    m_initialized;
+        double  m_value;
+        double  m_derivative;
+    };
+    
+    /**
+     * One Euro filter of a pose from solvePnP, on the components of the translation & of the rotation quaternion.
+     * The pattern coordinates being normalized, the translation is in pattern sizes.
+     */
+    class PoseFilter
+    {
+    public:
+        PoseFilter();
+        
+        /**
+         * Smooth rvec & tvec, dt seconds after the previous pose, into new matrices
+         */
+        void filter(const cv::Mat& rvec, const cv::Mat& tvec, double dt, cv::Mat& filteredRvec, cv::Mat& filteredTvec);
+        
+        /**
+         * Forget the previous poses, e.g. when the pattern was lost
+         */
+        void reset();
+        
+        float minCutoff;            // Hz, lower for less jitter at rest
+        float beta;                 // higher for less lag in fast motions
+        float derivativeCutoff;     // Hz
+    
+    private:
+        OneEuroFilter   m_translation[3];
+        OneEuroFilter   m_rotation[4];
+        cv::Vec4d       m_quaternion;       // last filtered rotation, keeps the quaternions in the same hemisphere
+        bool            m_hasQuaternion;
+    };
+    
+}
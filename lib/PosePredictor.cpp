@@ -0,0 +1,258 @@
+//
+//  PosePredictor.cpp
+//
+//  Extrapolation of the pose of a pattern to any time, e.g. the next display refresh.
+//
+
+#include "PosePredictor.h"
+
+namespace cv {
+    
+    namespace {
+        
+        cv::Matx33d skew(const cv::Vec3d& w)
+        {
+            return cv::Matx33d(    0, -w[2],  w[1],
+                                w[2],     0, -w[0],
+                               -w[1],  w[0],     0);
+        }
+        
+        /**
+         * Rigid motion of a twist (rotation, translation), closed form of the exponential map of SE(3)
+         */
+        void exponential(const cv::Vec6d& twist, cv::Matx33d& rotation, cv::Vec3d& translation)
+        {
+            const cv::Vec3d w(twist[0], twist[1], twist[2]), v(twist[3], twist[4], twist[5]);
+            const double theta2 = w.dot(w), theta = std::sqrt(theta2);
+            
+            // Taylor expansions near the identity
+            double a, b, c;
+            if (theta < 1e-6)
+            {
+                a = 1 - theta2 / 6;
+                b = 0.5 - theta2 / 24;
+                c = 1. / 6 - theta2 / 120;
+            }
+            else
+            {
+                a = std::sin(theta) / theta;
+                b = (1 - std::cos(theta)) / theta2;
+                c = (theta - std::sin(theta)) / (theta2 * theta);
+            }
+            
+            const cv::Matx33d K = skew(w), K2 = K * K;
+            rotation = cv::Matx33d::eye() + a * K + b * K2;
+            translation = (cv::Matx33d::eye() + b * K + c * K2) * v;
+        }
+        
+        /**
+         * Twist of a rigid motion, inverse of exponential()
+         */
+        cv::Vec6d logarithm(const cv::Matx33d& rotation, const cv::Vec3d& translation)
+        {
+            cv::Vec3d w;
+            cv::Rodrigues(rotation, w);
+            const double theta2 = w.dot(w), theta = std::sqrt(theta2);
+            
+            double d;
+            if (theta < 1e-6)
+                d = 1. / 12 + theta2 / 720;
+            else
+                d = (1 - theta * std::sin(theta) / (2 * (1 - std::cos(theta)))) / theta2;
+            
+            const cv::Matx33d K = skew(w);
+            const cv::Vec3d v = (cv::Matx33d::eye() - 0.5 * K + d * (K * K)) * translation;
+            return cv::Vec6d(w[0], w[1], w[2], v[0], v[1], v[2]);
+        }
+    }
+    
+    PosePredictor::PosePredictor()
+    : motionModel(MOTION_CONSTANT_VELOCITY)
+    , maxPredictionMs(100)
+    , maxGapMs(200)
+    , smoothing(0.5f)
+    , m_sequence(0)
+    , m_found(0)
+    , m_patternIdx(-1)
+    , m_frameIndex(-1)
+    , m_ticks(0)
+    , m_numUpdates(0)
+    {
+        for (int v = 0; v < NUM_VALUES; v++)
+            m_values[v].store(0, std::memory_order_relaxed);
+        reset();
+    }
+    
+    void PosePredictor::reset()
+    {
+        m_hasLast = false;
+        m_lastTicks = 0;
+        m_lastPatternIdx = -1;
+        m_hasVelocity = false;
+        m_hasAcceleration = false;
+        m_velocity = cv::Vec6d::all(0);
+        m_acceleration = cv::Vec6d::all(0);
+        publish(false, Pose());
+    }
+    
+    void PosePredictor::update(const Pose& pose)
+    {
+        if (!pose.found || pose.rvec.empty() || pose.tvec.empty())
+        {
+            reset();
+            return;
+        }
+        
+        cv::Mat rvec, tvec;
+        pose.rvec.convertTo(rvec, CV_64F);
+        pose.tvec.convertTo(tvec, CV_64F);
+        cv::Matx33d rotation;
+        cv::Rodrigues(rvec, rotation);
+        const cv::Vec3d translation(tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2));
+        
+        const double dt = (pose.ticks - m_lastTicks) / cv::getTickFrequency();
+        const bool continuous = m_hasLast && pose.patternIdx == m_lastPatternIdx && dt > 0 && dt * 1000 <= maxGapMs;
+        if (continuous)
+        {
+            // Motion from the last pose to this one, in camera coordinates
+            const cv::Matx33d relativeRotation = rotation * m_lastRotation.t();
+            const cv::Vec3d relativeTranslation = translation - relativeRotation * m_lastTranslation;
+            const cv::Vec6d velocity = logarithm(relativeRotation, relativeTranslation) * (1 / dt);
+            
+            if (m_hasVelocity)
+            {
+                const cv::Vec6d acceleration = (velocity - m_velocity) * (1 / dt);
+                m_acceleration = m_hasAcceleration ? smoothing * m_acceleration + (1 - smoothing) * acceleration : acceleration;
+                m_hasAcceleration = true;
+                m_velocity = smoothing * m_velocity + (1 - smoothing) * velocity;
+            }
+            else
+                m_velocity = velocity;
+            m_hasVelocity = true;
+        }
+        else
+        {
+            m_hasVelocity = false;
+            m_hasAcceleration = false;
+            m_velocity = cv::Vec6d::all(0);
+            m_acceleration = cv::Vec6d::all(0);
+        }
+        
+        m_hasLast = true;
+        m_lastTicks = pose.ticks;
+        m_lastPatternIdx = pose.patternIdx;
+        m_lastRotation = rotation;
+        m_lastTranslation = translation;
+        publish(true, pose);
+    }
+    
+    bool PosePredictor::predict(int64 ticks, cv::Matx33d& rotation, cv::Vec3d& translation) const
+    {
+        Snapshot snapshot;
+        if (!read(snapshot))
+            return false;
+        
+        extrapolate(snapshot, ticks, rotation, translation);
+        return true;
+    }
+    
+    bool PosePredictor::predict(int64 ticks, Pose& pose) const
+    {
+        Snapshot snapshot;
+        pose = Pose();
+        if (!read(snapshot))
+            return false;
+        
+        cv::Matx33d rotation;
+        cv::Vec3d translation;
+        extrapolate(snapshot, ticks, rotation, translation);
+        
+        pose.found = true;
+        pose.ticks = ticks;
+        pose.frameIndex = snapshot.frameIndex;
+        pose.patternIdx = snapshot.patternIdx;
+        cv::Vec3d rvec;
+        cv::Rodrigues(rotation, rvec);
+        pose.rvec = cv::Mat(rvec, true);
+        pose.tvec = cv::Mat(translation, true);
+        return true;
+    }
+
+#pragma mark - Protected
+    
+    
+    bool PosePredictor::read(Snapshot& snapshot) const
+    {
+        while (true)
+        {
+            // An odd or different sequence number means an update landed meanwhile
+            const unsigned long long sequence = m_sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+                continue;
+            
+            const bool found = m_found.load(std::memory_order_relaxed) != 0;
+            snapshot.patternIdx = m_patternIdx.load(std::memory_order_relaxed);
+            snapshot.frameIndex = m_frameIndex.load(std::memory_order_relaxed);
+            snapshot.ticks = m_ticks.load(std::memory_order_relaxed);
+            for (int v = 0; v < NUM_VALUES; v++)
+                snapshot.values[v] = m_values[v].load(std::memory_order_relaxed);
+            
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) == sequence)
+                return found;
+        }
+    }
+    
+    void PosePredictor::extrapolate(const Snapshot& snapshot, int64 ticks, cv::Matx33d& rotation, cv::Vec3d& translation) const
+    {
+        const double* values = snapshot.values;
+        const double horizon = values[VALUE_HORIZON];
+        const double dt = std::max(-horizon, std::min(horizon, (ticks - snapshot.ticks) / cv::getTickFrequency()));
+        
+        cv::Vec6d twist;
+        for (int i = 0; i < 6; i++)
+            twist[i] = values[VALUE_VELOCITY + i] * dt + 0.5 * values[VALUE_ACCELERATION + i] * dt * dt;
+        
+        cv::Matx33d motionRotation;
+        cv::Vec3d motionTranslation;
+        exponential(twist, motionRotation, motionTranslation);
+        
+        const cv::Matx33d lastRotation(values + VALUE_ROTATION);
+        const cv::Vec3d lastTranslation(values[VALUE_TRANSLATION], values[VALUE_TRANSLATION + 1], values[VALUE_TRANSLATION + 2]);
+        rotation = motionRotation * lastRotation;
+        translation = motionRotation * lastTranslation + motionTranslation;
+    }
+    
+    void PosePredictor::publish(bool found, const Pose& pose)
+    {
+        double values[NUM_VALUES] = { 0 };
+        if (found)
+        {
+            for (int i = 0; i < 9; i++)
+                values[VALUE_ROTATION + i] = m_lastRotation.val[i];
+            for (int i = 0; i < 3; i++)
+                values[VALUE_TRANSLATION + i] = m_lastTranslation[i];
+            for (int i = 0; i < 6; i++)
+            {
+                values[VALUE_VELOCITY + i] = m_velocity[i];
+                values[VALUE_ACCELERATION + i] = motionModel == MOTION_CONSTANT_ACCELERATION ? m_acceleration[i] : 0;
+            }
+            values[VALUE_HORIZON] = std::max(0.f, maxPredictionMs) / 1000.;
+        }
+        
+        const unsigned long long sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_found.store(found, std::memory_order_relaxed);
+        m_patternIdx.store(pose.patternIdx, std::memory_order_relaxed);
+        m_frameIndex.store(pose.frameIndex, std::memory_order_relaxed);
+        m_ticks.store(pose.ticks, std::memory_order_relaxed);
+        for (int v = 0; v < NUM_VALUES; v++)
+            m_values[v].store(values[v], std::memory_order_relaxed);
+        m_sequence.store(sequence + 2, std::memory_order_release);
+        
+        if (found)
+            m_numUpdates.fetch_add(1, std::memory_order_release);
+    }
+    
+}
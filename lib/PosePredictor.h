@@ -0,0 +1,109 @@
+//
+//  PosePredictor.h
+//
+//  Extrapolation of the pose of a pattern to any time, e.g. the next display refresh.
+//
+
+#pragma once
+
+#include "PatternTracker.h"
+
+#include <atomic>
+
+namespace cv {
+    
+    /**
+     * Extrapolates the pose of a pattern to any time, e.g. when the next display refresh reaches the screen,
+     * so that a render loop faster than the tracker neither lags behind the motion nor stair-steps.
+     * The motion is a twist on SE(3), a screw motion in camera coordinates, estimated from the poses of
+     * consecutive frames & the capture time of their frames (Pose::ticks), with an optional constant acceleration.
+     *
+     * One thread updates the predictor, any number of threads predict. The state is published like the slots of
+     * TrackerProfiler : relaxed atomic stores guarded by a sequence number, the update never waits and the predictions
+     * only read it again in the rare case an update lands meanwhile.
+     */
+    class PosePredictor
+    {
+    public:
+        enum MotionModel
+        {
+            MOTION_CONSTANT_VELOCITY,       // robust to noisy poses
+            MOTION_CONSTANT_ACCELERATION    // follows changes of speed sooner, but overshoots on jitter
+        };
+        
+        PosePredictor();
+        
+        /**
+         * The pose solved for a frame, in frame order. A pose not found, of another pattern or more than
+         * maxGapMs after the previous one restarts the motion estimation.
+         */
+        void update(const Pose& pose);
+        void reset();
+        
+        /**
+         * Pose at ticks (cv::getTickCount() time), at most maxPredictionMs from the capture of the last pose.
+         * False when the last pose wasn't found. Lock free, from any thread.
+         */
+        bool predict(int64 ticks, cv::Matx33d& rotation, cv::Vec3d& translation) const;
+        bool predict(int64 ticks, Pose& pose) const;
+        
+        unsigned long long getNumUpdates() const { return m_numUpdates.load(std::memory_order_acquire); }
+        
+        // read by update(), set them from the updating thread
+        MotionModel motionModel;
+        float maxPredictionMs;      // extrapolation horizon past the last pose, the pose holds beyond
+        float maxGapMs;             // between the frames of a continuous motion
+        float smoothing;            // weight of the previous velocity & acceleration in [0, 1), against jitter
+    
+    protected:
+        enum
+        {
+            VALUE_ROTATION = 0,             // 3x3, row major
+            VALUE_TRANSLATION = 9,
+            VALUE_VELOCITY = 12,            // twist per second, rotation then translation
+            VALUE_ACCELERATION = 18,        // twist per second squared, 0 with MOTION_CONSTANT_VELOCITY
+            VALUE_HORIZON = 24,             // seconds
+            NUM_VALUES = 25
+        };
+        
+        /**
+         * Published state, consistent
+         */
+        struct Snapshot
+        {
+            int                       patternIdx;
+            long long                 frameIndex;
+            long long                 ticks;        // capture of the last pose
+            double                    values[NUM_VALUES];
+        };
+        
+        /**
+         * Copy the published state, false if the last pose wasn't found
+         */
+        bool read(Snapshot& snapshot) const;
+        void extrapolate(const Snapshot& snapshot, int64 ticks, cv::Matx33d& rotation, cv::Vec3d& translation) const;
+        void publish(bool found, const Pose& pose);
+    
+    private:
+        // motion estimation, on the updating thread
+        bool                            m_hasLast;
+        int64                           m_lastTicks;
+        int                             m_lastPatternIdx;
+        cv::Matx33d                     m_lastRotation;
+        cv::Vec3d                       m_lastTranslation;
+        bool                            m_hasVelocity;
+        bool                            m_hasAcceleration;
+        cv::Vec6d                       m_velocity;
+        cv::Vec6d                       m_acceleration;
+        
+        // published state
+        std::atomic<unsigned long long> m_sequence;     // odd while being written
+        std::atomic<int>                m_found;
+        std::atomic<int>                m_patternIdx;
+        std::atomic<long long>          m_frameIndex;
+        std::atomic<long long>          m_ticks;
+        std::atomic<double>             m_values[NUM_VALUES];
+        std::atomic<unsigned long long> m_numUpdates;
+    };
+    
+}
@@ -0,0 +1,221 @@
+//
+//  QualityController.cpp
+//
+//  Latency budget of a PatternTracker, held by moving along a ladder of operating points.
+//
+
+#include "QualityController.h"
+
+namespace cv {
+    
+    namespace {
+        
+        bool samePoint(const OperatingPoint& a, const OperatingPoint& b)
+        {
+            return a.numFeatures == b.numFeatures && a.numLevels == b.numLevels
+                && a.rescale == b.rescale && a.refinement == b.refinement;
+        }
+        
+        // Pixels of an ORB pyramid relative to its first level, the levels being scaled by 1.2
+        double pyramidArea(int numLevels)
+        {
+            const double q = 1 / (1.2 * 1.2);
+            return (1 - std::pow(q, numLevels)) / (1 - q);
+        }
+    }
+    
+    QualityController::QualityController()
+    : targetMs(33)
+    , percentile(0.95f)
+    , windowSize(60)
+    , minSamples(10)
+    , minSamplesUp(30)
+    , headroom(0.75f)
+    , lowConfidenceHeadroom(0.9f)
+    , minConfidentInliers(15)
+    , m_level(0)
+    , m_numSamples(0)
+    , m_numLowConfidence(0)
+    , m_latency(0)
+    , m_refinementMsPerFeature(-1)
+    , m_movedUp(false)
+    , m_upBackoff(1)
+    , m_numChanges(0)
+    {
+        // update() may be called before setup()
+        clearSamples();
+    }
+    
+    void QualityController::setup(PatternTracker& tracker, double _targetMs)
+    {
+        targetMs = _targetMs;
+        
+        if (ladder.empty())
+        {
+            // Keypoints go first, then the refinement, the pyramid & the resolution
+            const OperatingPoint best = tracker.getOperatingPoint();
+            const int minFeatures = std::min(best.numFeatures, 100);
+            OperatingPoint point = best;
+            ladder.push_back(point);
+            
+            std::vector<OperatingPoint> steps;
+            point.numFeatures = std::max(minFeatures, best.numFeatures * 3 / 4);   steps.push_back(point);
+            point.numFeatures = std::max(minFeatures, best.numFeatures / 2);       steps.push_back(point);
+            point.refinement = false;                                              steps.push_back(point);
+            point.numLevels = std::max(1, best.numLevels - 2);                     steps.push_back(point);
+            point.rescale = best.rescale * 0.75f;                                  steps.push_back(point);
+            point.numLevels = std::max(1, best.numLevels / 2);                     steps.push_back(point);
+            point.numFeatures = std::max(minFeatures, best.numFeatures / 3);       steps.push_back(point);
+            point.rescale = best.rescale * 0.5f;                                   steps.push_back(point);
+            
+            for (const OperatingPoint& step : steps)
+                if (!samePoint(step, ladder.back()))
+                    ladder.push_back(step);
+        }
+        
+        m_refinementMsPerFeature = -1;
+        reset(tracker);
+    }
+    
+    void QualityController::reset(PatternTracker& tracker)
+    {
+        m_movedUp = false;
+        m_upBackoff = 1;
+        m_numChanges = 0;
+        m_latency = 0;
+        m_level = 0;
+        if (!ladder.empty())
+            tracker.setOperatingPoint(ladder[0]);
+        clearSamples();
+    }
+    
+    void QualityController::update(PatternTracker& tracker, double frameMs)
+    {
+        if (ladder.empty())
+            return;
+        
+        const StageTimings& timings = tracker.getTimings();
+        const double ms = frameMs >= 0 ? frameMs : timings.total;
+        
+        m_samples[m_numSamples % m_samples.size()] = ms;
+        m_numSamples++;
+        m_stageSums.resize += timings.resize;
+        m_stageSums.gray += timings.gray;
+        m_stageSums.detection += timings.detection;
+        m_stageSums.description += timings.description;
+        m_stageSums.matching += timings.matching;
+        m_stageSums.estimation += timings.estimation;
+        m_stageSums.refinement += timings.refinement;
+        m_stageSums.tracking += timings.tracking;
+        m_stageSums.pose += timings.pose;
+        m_stageSums.total += ms;
+        if (tracker.getCounters().inliers < std::max(1, minConfidentInliers))
+            m_numLowConfidence++;
+        
+        if (m_numSamples < (size_t)minSamples)
+            return;
+        
+        // Latency percentile of the last frames at this point
+        const size_t n = std::min(m_numSamples, m_samples.size());
+        m_sorted.assign(m_samples.begin(), m_samples.begin() + n);
+        const size_t k = std::min(n - 1, (size_t)std::max(0., std::ceil(percentile * (double)n) - 1));
+        std::nth_element(m_sorted.begin(), m_sorted.begin() + k, m_sorted.end());
+        m_latency = m_sorted[k];
+        
+        const double currentMs = predictMs(m_level);
+        
+        if (m_latency > targetMs)
+        {
+            if (m_level + 1 >= (int)ladder.size())
+                return;
+            
+            // The best point predicted to fit, or the cheapest one
+            int level = m_level + 1;
+            while (level + 1 < (int)ladder.size() && m_latency * predictMs(level) / currentMs > targetMs)
+                level++;
+            
+            // The last move up didn't hold
+            if (m_movedUp)
+                m_upBackoff = std::min(m_upBackoff * 2, 16);
+            m_movedUp = false;
+            moveTo(tracker, level);
+            return;
+        }
+        
+        // The last move up held for a whole window
+        if (m_movedUp && m_numSamples >= m_samples.size())
+        {
+            m_movedUp = false;
+            m_upBackoff = 1;
+        }
+        
+        if (m_level == 0)
+            return;
+        
+        // Tracking poorly, quality matters more than the headroom
+        const bool lowConfidence = m_numLowConfidence * 2 > m_numSamples;
+        const size_t required = (lowConfidence ? minSamples : minSamplesUp) * m_upBackoff;
+        if (m_numSamples < required)
+            return;
+        
+        const double upLatency = m_latency * predictMs(m_level - 1) / currentMs;
+        if (upLatency < targetMs * (lowConfidence ? lowConfidenceHeadroom : headroom))
+        {
+            m_movedUp = true;
+            moveTo(tracker, m_level - 1);
+        }
+    }
+    
+    double QualityController::predictMs(int level) const
+    {
+        const OperatingPoint& from = ladder[m_level];
+        const OperatingPoint& to = ladder[level];
+        const double n = std::max<size_t>(m_numSamples, 1);
+        const StageTimings& s = m_stageSums;
+        
+        // The gray image & the pyramid scale with the pixels, the description, matching & estimation with the keypoints
+        const double pixels = (to.rescale * to.rescale) / (from.rescale * from.rescale);
+        const double pyramid = pyramidArea(to.numLevels) / pyramidArea(from.numLevels);
+        const double features = (double)to.numFeatures / from.numFeatures;
+        
+        const double stages = s.resize + s.gray + s.detection + s.description + s.matching + s.estimation
+                            + s.refinement + s.tracking + s.pose;
+        const double other = s.resize + s.tracking + s.pose + std::max(0., s.total - stages);
+        
+        double ms = other + s.gray * pixels + s.detection * pixels * pyramid
+                  + (s.description + s.matching + s.estimation) * features;
+        
+        if (to.refinement)
+        {
+            if (from.refinement)
+                ms += s.refinement * features;
+            else if (m_refinementMsPerFeature >= 0)
+                ms += m_refinementMsPerFeature * to.numFeatures * n;
+            else
+                ms += (s.detection * pixels * pyramid + s.description * features);   // never measured, as costly as detecting again
+        }
+        
+        return std::max(ms / n, 1e-3);
+    }
+    
+    void QualityController::moveTo(PatternTracker& tracker, int level)
+    {
+        const OperatingPoint& current = ladder[m_level];
+        if (current.refinement && m_numSamples > 0)
+            m_refinementMsPerFeature = m_stageSums.refinement / m_numSamples / current.numFeatures;
+        
+        m_level = level;
+        tracker.setOperatingPoint(ladder[level]);
+        m_numChanges++;
+        clearSamples();
+    }
+    
+    void QualityController::clearSamples()
+    {
+        m_samples.assign(std::max(1, windowSize), 0.f);
+        m_numSamples = 0;
+        m_stageSums = StageTimings();
+        m_numLowConfidence = 0;
+    }
+    
+}
@@ -0,0 +1,92 @@
+//
+//  QualityController.h
+//
+//  Latency budget of a PatternTracker, held by moving along a ladder of operating points.
+//
+
+#pragma once
+
+#include "PatternTracker.h"
+
+namespace cv {
+    
+    /**
+     * Holds the per-frame latency of a PatternTracker under a budget by moving along a ladder of
+     * operating points, the cheaper ones giving up keypoints, pyramid levels, resolution & refinement.
+     *
+     * After each find(), update() records the frame time. Once enough frames ran at the current point :
+     * - when their latency percentile exceeds the target, it moves down to the best point predicted to fit
+     * - when the next better point is predicted to fit with some headroom, it moves up to it,
+     *   sooner & with less headroom when the tracking confidence is low
+     * The other points are predicted from the mean stage timings measured at the current one.
+     * Moving up again right after a move back down waits longer each time, so that it doesn't oscillate.
+     *
+     * Only for trackers driven by find(), not while the stages of a PipelinedTracker run.
+     */
+    class QualityController
+    {
+    public:
+        QualityController();
+        
+        /**
+         * Build the ladder down from the current settings of the tracker, if it's empty, and start from its best point
+         */
+        void setup(PatternTracker& tracker, double targetMs);
+        
+        /**
+         * Record the last find() of the tracker & apply the next operating point.
+         * frameMs is the measured frame time, e.g. including the pose, the find() total if negative.
+         */
+        void update(PatternTracker& tracker, double frameMs = -1);
+        
+        /**
+         * Go back to the best point & forget the measurements
+         */
+        void reset(PatternTracker& tracker);
+        
+        const OperatingPoint& getOperatingPoint() const { return ladder[m_level]; }
+        int getLevel() const { return m_level; }    // index in the ladder, 0 being the best quality
+        double getLatency() const { return m_latency; } // percentile of the frames at the current point, in ms
+        unsigned long long getNumChanges() const { return m_numChanges; }
+        
+        double targetMs;
+        float percentile;               // of the frame times held under targetMs, 0.95
+        int windowSize;                 // frames kept at the current point
+        int minSamples;                 // frames at a point before moving down
+        int minSamplesUp;               // frames at a point before moving up
+        float headroom;                 // moves up when the next point is predicted under targetMs * headroom
+        float lowConfidenceHeadroom;    // same when most frames at the current point are low confidence
+        int minConfidentInliers;        // frames with fewer inliers of the best pattern are low confidence
+        
+        // from the best to the cheapest point, setup() fills it when empty
+        std::vector<OperatingPoint> ladder;
+    
+    protected:
+        
+        /**
+         * Mean frame time predicted at a point of the ladder, from the stages measured at the current one
+         */
+        double predictMs(int level) const;
+        
+        void moveTo(PatternTracker& tracker, int level);
+        void clearSamples();
+    
+    private:
+        int                     m_level;
+        std::vector<float>      m_samples;          // ring of the frame times at the current point
+        size_t                  m_numSamples;
+        std::vector<float>      m_sorted;
+        StageTimings            m_stageSums;        // stage & frame totals at the current point
+        size_t                  m_numLowConfidence;
+        double                  m_latency;
+        
+        // refinement cost per keypoint, measured at the last point refining
+        double                  m_refinementMsPerFeature;
+        
+        // whether the current point was reached by moving up, & the backoff of the next moves up
+        bool                    m_movedUp;
+        int                     m_upBackoff;
+        unsigned long long      m_numChanges;
+    };
+    
+}
@@ -0,0 +1,370 @@
+//
+//  RobustHomography.cpp
+//
+//  Robust homography of point correspondences with PROSAC sampling & SPRT verification.
+//
+
+#include "RobustHomography.h"
+
+namespace cv {
+    
+    namespace {
+        
+        const int sampleSize = 4;
+        
+        // a * b of 3x3 row major matrices
+        void multiply(const double* a, const double* b, double* ab)
+        {
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 3; c++)
+                    ab[r * 3 + c] = a[r * 3] * b[c] + a[r * 3 + 1] * b[3 + c] + a[r * 3 + 2] * b[6 + c];
+        }
+        
+        // Similarity moving the points to their centroid, at a mean distance of sqrt(2), and its inverse
+        void normalization(const cv::Point2f* pts, double* T, double* inverse)
+        {
+            double cx = 0, cy = 0;
+            for (int i = 0; i < sampleSize; i++)
+            {
+                cx += pts[i].x;
+                cy += pts[i].y;
+            }
+            cx /= sampleSize;
+            cy /= sampleSize;
+            
+            double d = 0;
+            for (int i = 0; i < sampleSize; i++)
+                d += std::sqrt((pts[i].x - cx) * (pts[i].x - cx) + (pts[i].y - cy) * (pts[i].y - cy));
+            const double s = d > 0 ? std::sqrt(2.) * sampleSize / d : 1;
+            
+            const double t[9] = { s, 0, -s * cx, 0, s, -s * cy, 0, 0, 1 };
+            const double i[9] = { 1 / s, 0, cx, 0, 1 / s, cy, 0, 0, 1 };
+            std::copy(t, t + 9, T);
+            std::copy(i, i + 9, inverse);
+        }
+        
+        // Homography mapping the 4 points of src to those of dst, false if they're degenerate
+        bool fourPointHomography(const cv::Point2f* src, const cv::Point2f* dst, double* h)
+        {
+            double Ts[9], TsInv[9], Td[9], TdInv[9];
+            normalization(src, Ts, TsInv);
+            normalization(dst, Td, TdInv);
+            
+            // 8x8 system of the normalized points, h[8] = 1
+            double a[8][9];
+            for (int i = 0; i < sampleSize; i++)
+            {
+                const double x = Ts[0] * src[i].x + Ts[2], y = Ts[4] * src[i].y + Ts[5];
+                const double u = Td[0] * dst[i].x + Td[2], v = Td[4] * dst[i].y + Td[5];
+                const double r0[9] = { x, y, 1, 0, 0, 0, -u * x, -u * y, u };
+                const double r1[9] = { 0, 0, 0, x, y, 1, -v * x, -v * y, v };
+                std::copy(r0, r0 + 9, a[2 * i]);
+                std::copy(r1, r1 + 9, a[2 * i + 1]);
+            }
+            
+            // Gaussian elimination with partial pivoting
+            for (int c = 0; c < 8; c++)
+            {
+                int pivot = c;
+                for (int r = c + 1; r < 8; r++)
+                    if (std::abs(a[r][c]) > std::abs(a[pivot][c]))
+                        pivot = r;
+                if (std::abs(a[pivot][c]) < 1e-9)
+                    return false;
+                if (pivot != c)
+                    std::swap_ranges(a[c] + c, a[c] + 9, a[pivot] + c);
+                
+                for (int r = c + 1; r < 8; r++)
+                {
+                    const double f = a[r][c] / a[c][c];
+                    for (int k = c; k < 9; k++)
+                        a[r][k] -= f * a[c][k];
+                }
+            }
+            
+            double hn[9];
+            for (int c = 7; c >= 0; c--)
+            {
+                double s = a[c][8];
+                for (int k = c + 1; k < 8; k++)
+                    s -= a[c][k] * hn[k];
+                hn[c] = s / a[c][c];
+            }
+            hn[8] = 1;
+            
+            // h = Td^-1 * hn * Ts
+            double tmp[9];
+            multiply(hn, Ts, tmp);
+            multiply(TdInv, tmp, h);
+            return std::abs(h[8]) > 1e-12;
+        }
+        
+        double cross(const cv::Point2f& a, const cv::Point2f& b, const cv::Point2f& c)
+        {
+            return (double)(b.x - a.x) * (c.y - a.y) - (double)(b.y - a.y) * (c.x - a.x);
+        }
+        
+        // The triangles of the sample keep their orientation, as with a plane seen from the front,
+        // and none of them is flat
+        bool goodSample(const cv::Point2f* src, const cv::Point2f* dst)
+        {
+            static const int triangles[4][3] = { { 0, 1, 2 }, { 0, 1, 3 }, { 0, 2, 3 }, { 1, 2, 3 } };
+            for (const auto& t : triangles)
+            {
+                if (cross(src[t[0]], src[t[1]], src[t[2]]) * cross(dst[t[0]], dst[t[1]], dst[t[2]]) <= 0)
+                    return false;
+            }
+            return true;
+        }
+        
+        // Squared distance between the projection of s & d
+        float reprojectionError(const double* h, const cv::Point2f& s, const cv::Point2f& d)
+        {
+            const double w = h[6] * s.x + h[7] * s.y + h[8];
+            if (std::abs(w) < 1e-12)
+                return FLT_MAX;
+            const double dx = (h[0] * s.x + h[1] * s.y + h[2]) / w - d.x;
+            const double dy = (h[3] * s.x + h[4] * s.y + h[5]) / w - d.y;
+            return (float)(dx * dx + dy * dy);
+        }
+        
+        // Index in [0, n) not among the first count of sample
+        int drawDistinct(cv::RNG& rng, int n, const int* sample, int count)
+        {
+            while (true)
+            {
+                const int index = rng.uniform(0, n);
+                if (std::find(sample, sample + count, index) == sample + count)
+                    return index;
+            }
+        }
+    }
+    
+    RobustHomography::RobustHomography()
+    : m_threshold2(0)
+    , m_epsilon(0)
+    , m_delta(0)
+    , m_sprtThreshold(0)
+    , m_sprtModelCost(0)
+    , m_numIterations(0)
+    , m_numHypotheses(0)
+    , m_numRejected(0)
+    {
+    }
+    
+    bool RobustHomography::estimate(const std::vector<cv::Point2f>& src, const std::vector<cv::Point2f>& dst, float threshold,
+                                    const RobustHomographyParams& params, cv::Mat& homography, std::vector<unsigned char>& mask,
+                                    const cv::Mat& seed)
+    {
+        CV_Assert(src.size() == dst.size());
+        const int N = src.size();
+        
+        m_numIterations = 0;
+        m_numHypotheses = 0;
+        m_numRejected = 0;
+        mask.assign(N, 0);
+        homography = cv::Mat();
+        if (N < sampleSize)
+            return false;
+        
+        // The same samples on every call, like cv::findHomography()
+        m_rng = cv::RNG(-1);
+        m_threshold2 = threshold * threshold;
+        m_mask.resize(N);
+        m_bestMask.assign(N, 0);
+        
+        m_delta = std::min(std::max(params.sprtDelta, 1e-3), 0.5);
+        m_epsilon = params.sprtEpsilon;
+        m_sprtModelCost = params.sprtModelCost;
+        updateSprtThreshold();
+        
+        double best[9];
+        int bestInliers = 0;
+        
+        // The seed is verified on all the points
+        if (!seed.empty())
+        {
+            cv::Mat header(3, 3, CV_64F, best);
+            seed.convertTo(header, CV_64F);
+            m_numHypotheses++;
+            bestInliers = std::max(0, verify(src, dst, best, false, 0));
+            m_bestMask.swap(m_mask);
+            if (bestInliers >= sampleSize)
+                refit(src, dst, best, bestInliers);
+            if ((double)bestInliers / N > m_delta)
+                m_epsilon = (double)bestInliers / N;
+            updateSprtThreshold();
+        }
+        
+        const int cap = std::min(params.maxIterations, iterationsFor(params.minInlierRatio, params));
+        int maxIterations = bestInliers >= sampleSize ? std::min(cap, iterationsFor((double)bestInliers / N, params)) : cap;
+        
+        // PROSAC : the first samples come from the n best points, n growing with the iterations
+        const int m = sampleSize;
+        double Tn = params.prosacGrowth;
+        for (int i = 0; i < m; i++)
+            Tn *= (double)(m - i) / (N - i);
+        double TnPrime = 1;
+        int n = m;
+        
+        int sample[sampleSize];
+        cv::Point2f sampleSrc[sampleSize], sampleDst[sampleSize];
+        double h[9];
+        
+        for (int t = 1; t <= maxIterations; t++)
+        {
+            m_numIterations++;
+            if (t > TnPrime && n < N)
+            {
+                const double next = Tn * (n + 1) / (n + 1 - m);
+                TnPrime += std::ceil(next - Tn);
+                Tn = next;
+                n++;
+            }
+            
+            // Either any m of the n best points, or the n-th & m - 1 better ones
+            if (TnPrime < t)
+            {
+                for (int i = 0; i < m; i++)
+                    sample[i] = drawDistinct(m_rng, n, sample, i);
+            }
+            else
+            {
+                for (int i = 0; i < m - 1; i++)
+                    sample[i] = drawDistinct(m_rng, n - 1, sample, i);
+                sample[m - 1] = n - 1;
+            }
+            
+            for (int i = 0; i < m; i++)
+            {
+                sampleSrc[i] = src[sample[i]];
+                sampleDst[i] = dst[sample[i]];
+            }
+            if (!goodSample(sampleSrc, sampleDst) || !fourPointHomography(sampleSrc, sampleDst, h))
+                continue;
+            
+            m_numHypotheses++;
+            const int inliers = verify(src, dst, h, params.enableSprt, bestInliers);
+            if (inliers <= bestInliers)
+                continue;
+            
+            bestInliers = inliers;
+            std::copy(h, h + 9, best);
+            m_bestMask.swap(m_mask);
+            refit(src, dst, best, bestInliers);
+            
+            if ((double)bestInliers / N > m_delta)
+                m_epsilon = (double)bestInliers / N;
+            updateSprtThreshold();
+            maxIterations = std::min(cap, iterationsFor((double)bestInliers / N, params));
+        }
+        
+        if (bestInliers < sampleSize)
+            return false;
+        
+        homography = cv::Mat(3, 3, CV_64F, best).clone();
+        mask.assign(m_bestMask.begin(), m_bestMask.end());
+        return true;
+    }
+    
+    void RobustHomography::refit(const std::vector<cv::Point2f>& src, const std::vector<cv::Point2f>& dst, double* best, int& bestInliers)
+    {
+        m_inlierSrc.clear();
+        m_inlierDst.clear();
+        for (size_t i = 0; i < src.size(); i++)
+        {
+            if (!m_bestMask[i])
+                continue;
+            m_inlierSrc.push_back(src[i]);
+            m_inlierDst.push_back(dst[i]);
+        }
+        
+        cv::Mat refined = cv::findHomography(m_inlierSrc, m_inlierDst, 0);
+        if (refined.empty())
+            return;
+        
+        const int inliers = verify(src, dst, refined.ptr<double>(), false, 0);
+        if (inliers < bestInliers)
+            return;
+        
+        bestInliers = inliers;
+        std::copy(refined.ptr<double>(), refined.ptr<double>() + 9, best);
+        m_bestMask.swap(m_mask);
+    }
+    
+    int RobustHomography::verify(const std::vector<cv::Point2f>& src, const std::vector<cv::Point2f>& dst, const double* h,
+                                 bool sprt, int minInliers)
+    {
+        const int N = src.size();
+        
+        // SPRT needs the points in random order, the best ones coming first
+        const int start = sprt ? m_rng.uniform(0, N) : 0;
+        const double inlierRatio = m_delta / m_epsilon;
+        const double outlierRatio = (1 - m_delta) / (1 - m_epsilon);
+        
+        double likelihood = 1;
+        int inliers = 0;
+        for (int k = 0; k < N; k++)
+        {
+            const int i = start + k < N ? start + k : start + k - N;
+            const bool inlier = reprojectionError(h, src[i], dst[i]) <= m_threshold2;
+            m_mask[i] = inlier;
+            inliers += inlier;
+            
+            // Can't beat the best model anymore
+            if (minInliers > 0 && inliers + (N - k - 1) <= minInliers)
+                return -1;
+            
+            if (!sprt)
+                continue;
+            
+            likelihood *= inlier ? inlierRatio : outlierRatio;
+            if (likelihood > m_sprtThreshold)
+            {
+                // Most points are consistent with a bad model about this often
+                m_delta = std::min(std::max(0.95 * m_delta + 0.05 * inliers / (k + 1), 1e-3), 0.5);
+                updateSprtThreshold();
+                m_numRejected++;
+                return -1;
+            }
+        }
+        return inliers;
+    }
+    
+    int RobustHomography::iterationsFor(double inlierRatio, const RobustHomographyParams& params) const
+    {
+        // Good models are also rejected by SPRT, about 1 / threshold of the time
+        const double p = std::pow(inlierRatio, sampleSize) * (params.enableSprt ? 1 - 1 / m_sprtThreshold : 1);
+        if (p <= 0)
+            return params.maxIterations;
+        if (p >= 1)
+            return 1;
+        
+        const double k = std::log(1 - params.confidence) / std::log(1 - p);
+        return k < params.maxIterations ? std::max(1, cvCeil(k)) : params.maxIterations;
+    }
+    
+    void RobustHomography::updateSprtThreshold()
+    {
+        // Without a bad model less consistent than a good one, nothing can be rejected
+        if (m_epsilon <= m_delta)
+        {
+            m_sprtThreshold = DBL_MAX;
+            return;
+        }
+        
+        // Optimal threshold A of the test, the fixed point of A = modelCost * C + 1 + log(A)
+        const double C = (1 - m_delta) * std::log((1 - m_delta) / (1 - m_epsilon)) + m_delta * std::log(m_delta / m_epsilon);
+        const double k = m_sprtModelCost * C + 1;
+        double A = k;
+        for (int i = 0; i < 10; i++)
+        {
+            const double next = k + std::log(A);
+            if (std::abs(next - A) < 1e-6)
+                break;
+            A = next;
+        }
+        m_sprtThreshold = A;
+    }
+    
+}
@@ -0,0 +1,114 @@
+//
+//  RobustHomography.h
+//
+//  Robust homography of point correspondences with PROSAC sampling & SPRT verification.
+//
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace cv {
+    
+    /**
+     * Settings of RobustHomography
+     */
+    struct RobustHomographyParams
+    {
+        RobustHomographyParams()
+        : maxIterations(2000), confidence(0.995), minInlierRatio(0.25f), prosacGrowth(200000)
+        , enableSprt(true), sprtEpsilon(0.1), sprtDelta(0.01), sprtModelCost(200) {}
+        
+        int                       maxIterations;
+        double                    confidence;       // of drawing an all inliers sample before stopping
+        
+        // Give up after the samples needed to find a model with this share of inliers, so that
+        // a candidate without the pattern doesn't run all of maxIterations
+        float                     minInlierRatio;
+        
+        // Samples after which PROSAC draws from all the points, like RANSAC
+        double                    prosacGrowth;
+        
+        // SPRT early rejection : a model is dropped as soon as the points verified so far make it
+        // unlikely to be good. sprtEpsilon & sprtDelta are the initial shares of the points consistent
+        // with a good & a bad model, updated from the best & the rejected ones. Good models are rejected
+        // when sprtEpsilon overestimates their inliers. sprtModelCost is the cost of a minimal fit, in points verified.
+        bool                      enableSprt;
+        double                    sprtEpsilon;
+        double                    sprtDelta;
+        double                    sprtModelCost;
+    };
+    
+    /**
+     * Robust homography of point correspondences, a faster alternative to cv::findHomography(CV_FM_RANSAC) :
+     * - PROSAC sampling : the points are given best first, e.g. by match distance, and the minimal
+     *   samples are drawn from the best ones first, growing to the whole set like RANSAC
+     * - SPRT : the models are verified on the points in random order and rejected early
+     * - adaptive termination from the best inlier ratio, capped for the sets without enough inliers
+     * - an optional seed, e.g. the homography of the previous frame, verified before any sample
+     * - each new best model, the seed included, is refit on its inliers with Levenberg-Marquardt like
+     *   cv::findHomography() does with its final one, which raises the inlier ratio the termination sees
+     *
+     * It keeps scratch buffers, use one estimator per thread.
+     */
+    class RobustHomography
+    {
+    public:
+        RobustHomography();
+        
+        /**
+         * Homography mapping src to dst within threshold pixels & its inliers mask, false if there's none.
+         * The points are sorted by decreasing quality. The samples are the same for the same points.
+         */
+        bool estimate(const std::vector<cv::Point2f>& src, const std::vector<cv::Point2f>& dst, float threshold,
+                      const RobustHomographyParams& params, cv::Mat& homography, std::vector<unsigned char>& mask,
+                      const cv::Mat& seed = cv::Mat());
+        
+        /**
+         * Statistics of the last estimate()
+         */
+        int getNumIterations() const { return m_numIterations; }   // samples drawn
+        int getNumHypotheses() const { return m_numHypotheses; }   // models verified, the seed included
+        int getNumRejected() const { return m_numRejected; }       // models rejected early by SPRT
+    
+    protected:
+        
+        /**
+         * Inliers of the model h in m_mask, -1 once it can't have more than minInliers
+         * or, with SPRT, as soon as it's rejected
+         */
+        int verify(const std::vector<cv::Point2f>& src, const std::vector<cv::Point2f>& dst, const double* h,
+                   bool sprt, int minInliers);
+        
+        /**
+         * Samples needed to draw an all inliers one with this inlier ratio
+         */
+        int iterationsFor(double inlierRatio, const RobustHomographyParams& params) const;
+        
+        /**
+         * Least squares & Levenberg-Marquardt fit of the inliers of best, kept if it doesn't lose any
+         */
+        void refit(const std::vector<cv::Point2f>& src, const std::vector<cv::Point2f>& dst, double* best, int& bestInliers);
+        
+        void updateSprtThreshold();
+    
+    private:
+        cv::RNG                     m_rng;
+        std::vector<unsigned char>  m_mask;           // of the model being verified
+        std::vector<unsigned char>  m_bestMask;
+        std::vector<cv::Point2f>    m_inlierSrc;
+        std::vector<cv::Point2f>    m_inlierDst;
+        float                       m_threshold2;
+        
+        // SPRT share of the points consistent with a good & a bad model, and decision threshold
+        double                      m_epsilon;
+        double                      m_delta;
+        double                      m_sprtThreshold;
+        double                      m_sprtModelCost;
+        
+        int                         m_numIterations;
+        int                         m_numHypotheses;
+        int                         m_numRejected;
+    };
+    
+}
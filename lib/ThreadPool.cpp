@@ -0,0 +1,112 @@
+//
+//  ThreadPool.cpp
+//
+//  Minimal fork-join pool of worker threads.
+//
+
+#include "ThreadPool.h"
+
+namespace cv {
+    
+    ThreadPool::ThreadPool(int numThreads)
+    : m_task(0)
+    , m_count(0)
+    , m_next(0)
+    , m_done(0)
+    , m_generation(0)
+    , m_stop(false)
+    {
+        setNumThreads(numThreads);
+    }
+    
+    ThreadPool::~ThreadPool()
+    {
+        stop();
+    }
+    
+    void ThreadPool::setNumThreads(int numThreads)
+    {
+        std::lock_guard<std::mutex> parallelForGuard(m_parallelForMutex);
+        
+        if (numThreads < 1)
+            numThreads = 1;
+        if (numThreads == getNumThreads())
+            return;
+        
+        stop();
+        m_stop = false;
+        for (int i = 1; i < numThreads; i++)
+            m_workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+    
+    void ThreadPool::parallelFor(int count, const std::function<void(int)>& task)
+    {
+        std::lock_guard<std::mutex> parallelForGuard(m_parallelForMutex);
+        
+        if (m_workers.empty() || count < 2)
+        {
+            for (int i = 0; i < count; i++)
+                task(i);
+            return;
+        }
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_done = 0;
+        m_generation++;
+        m_taskReady.notify_all();
+        
+        // Help the workers, then wait for the iterations they're still running
+        runTasks(lock);
+        m_taskDone.wait(lock, [this]{ return m_done == m_count; });
+        m_task = 0;
+    }
+    
+    void ThreadPool::stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stop = true;
+            m_taskReady.notify_all();
+        }
+        for (auto & worker : m_workers)
+            worker.join();
+        m_workers.clear();
+    }
+    
+    void ThreadPool::work()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        unsigned generation = m_generation;
+        
+        while (true)
+        {
+            m_taskReady.wait(lock, [&]{ return m_stop || (m_task && generation != m_generation); });
+            if (m_stop)
+                return;
+            
+            generation = m_generation;
+            runTasks(lock);
+        }
+    }
+    
+    void ThreadPool::runTasks(std::unique_lock<std::mutex>& lock)
+    {
+        const std::function<void(int)>& task = *m_task;
+        
+        while (m_next < m_count)
+        {
+            int i = m_next++;
+            
+            lock.unlock();
+            task(i);
+            lock.lock();
+            
+            if (++m_done == m_count)
+                m_taskDone.notify_all();
+        }
+    }
+    
+}
@@ -0,0 +1,59 @@
+//
+//  ThreadPool.h
+//
+//  Minimal fork-join pool of worker threads.
+//
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace cv {
+
+    /**
+     * Minimal fork-join pool : parallelFor() splits a loop over the workers
+     * and the calling thread, and returns once every iteration ran.
+     */
+    class ThreadPool
+    {
+    public:
+        /**
+         * numThreads includes the calling thread, so 1 means no worker at all
+         */
+        ThreadPool(int numThreads = 1);
+        ~ThreadPool();
+        
+        void setNumThreads(int numThreads);
+        int getNumThreads() const { return m_workers.size() + 1; }
+        
+        /**
+         * Run task(i) for every i in [0, count)
+         */
+        void parallelFor(int count, const std::function<void(int)>& task);
+        
+    protected:
+        void stop();
+        void work();
+        void runTasks(std::unique_lock<std::mutex>& lock);
+        
+    private:
+        std::vector<std::thread>         m_workers;
+        
+        std::mutex                       m_parallelForMutex;   // one loop at a time
+        std::mutex                       m_mutex;
+        std::condition_variable          m_taskReady;
+        std::condition_variable          m_taskDone;
+        
+        const std::function<void(int)>*  m_task;
+        int                              m_count;
+        int                              m_next;
+        int                              m_done;
+        unsigned                         m_generation;
+        bool                             m_stop;
+    };
+    
+}
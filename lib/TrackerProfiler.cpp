@@ -0,0 +1,165 @@
+//
+//  TrackerProfiler.cpp
+//
+//  Rolling window of the per stage timings & counters of PatternTracker::find().
+//
+
+#include "TrackerProfiler.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace cv {
+    
+    namespace {
+        
+        unsigned toMicroseconds(double ms)
+        {
+            return ms > 0 ? (unsigned)(ms * 1000. + 0.5) : 0;
+        }
+        
+        unsigned toCount(int count)
+        {
+            return count > 0 ? count : 0;
+        }
+        
+        TrackerProfiler::Percentiles getPercentiles(std::vector<unsigned>& values)
+        {
+            TrackerProfiler::Percentiles p;
+            if (values.empty())
+                return p;
+            
+            std::sort(values.begin(), values.end());
+            
+            double sum = 0;
+            for (unsigned v : values)
+                sum += v;
+            
+            const size_t last = values.size() - 1;
+            p.mean = sum / values.size();
+            p.p50  = values[last * 50 / 100];
+            p.p90  = values[last * 90 / 100];
+            p.p99  = values[last * 99 / 100];
+            p.max  = values[last];
+            return p;
+        }
+    }
+    
+    TrackerProfiler::TrackerProfiler(int windowSize)
+    : m_windowSize(std::max(1, windowSize))
+    , m_slots(new Slot[m_windowSize])
+    , m_numFrames(0)
+    {
+        for (int i = 0; i < m_windowSize; i++)
+        {
+            m_slots[i].sequence.store(0, std::memory_order_relaxed);
+            for (int v = 0; v < NUM_VALUES; v++)
+                m_slots[i].values[v].store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    void TrackerProfiler::record(const StageTimings& timings, const FrameCounters& counters)
+    {
+        unsigned values[NUM_VALUES];
+        values[STAGE_RESIZE]        = toMicroseconds(timings.resize);
+        values[STAGE_GRAY]          = toMicroseconds(timings.gray);
+        values[STAGE_DETECTION]     = toMicroseconds(timings.detection);
+        values[STAGE_DESCRIPTION]   = toMicroseconds(timings.description);
+        values[STAGE_MATCHING]      = toMicroseconds(timings.matching);
+        values[STAGE_ESTIMATION]    = toMicroseconds(timings.estimation);
+        values[STAGE_REFINEMENT]    = toMicroseconds(timings.refinement);
+        values[STAGE_TRACKING]      = toMicroseconds(timings.tracking);
+        values[STAGE_POSE]          = toMicroseconds(timings.pose);
+        values[STAGE_TOTAL]         = toMicroseconds(timings.total);
+        values[NUM_STAGES + COUNTER_KEYPOINTS]          = toCount(counters.keypoints);
+        values[NUM_STAGES + COUNTER_RAW_MATCHES]        = toCount(counters.rawMatches);
+        values[NUM_STAGES + COUNTER_RATIO_TEST_MATCHES] = toCount(counters.ratioTestMatches);
+        values[NUM_STAGES + COUNTER_INLIERS]            = toCount(counters.inliers);
+        values[NUM_STAGES + COUNTER_HYPOTHESES]         = toCount(counters.hypotheses);
+        
+        const unsigned long long frame = m_numFrames.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[frame % m_windowSize];
+        
+        // Readers seeing an odd or different sequence number skip the slot
+        slot.sequence.store(2 * frame + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int v = 0; v < NUM_VALUES; v++)
+            slot.values[v].store(values[v], std::memory_order_relaxed);
+        slot.sequence.store(2 * frame + 2, std::memory_order_release);
+        
+        m_numFrames.store(frame + 1, std::memory_order_release);
+    }
+    
+    bool TrackerProfiler::read(unsigned long long frame, unsigned values[NUM_VALUES]) const
+    {
+        const Slot& slot = m_slots[frame % m_windowSize];
+        
+        const unsigned long long sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * frame + 2)
+            return false;
+        
+        for (int v = 0; v < NUM_VALUES; v++)
+            values[v] = slot.values[v].load(std::memory_order_relaxed);
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+    
+    void TrackerProfiler::getSummary(Summary& summary) const
+    {
+        const unsigned long long numFrames = getNumFrames();
+        const unsigned long long first = numFrames > (unsigned long long)m_windowSize ? numFrames - m_windowSize : 0;
+        
+        std::vector<unsigned> columns[NUM_VALUES];
+        for (auto & column : columns)
+            column.reserve(numFrames - first);
+        
+        unsigned values[NUM_VALUES];
+        for (unsigned long long frame = first; frame < numFrames; frame++)
+        {
+            if (!read(frame, values))
+                continue;
+            for (int v = 0; v < NUM_VALUES; v++)
+                columns[v].push_back(values[v]);
+        }
+        
+        summary.numFrames = columns[0].size();
+        for (int s = 0; s < NUM_STAGES; s++)
+            summary.stages[s] = getPercentiles(columns[s]);
+        for (int c = 0; c < NUM_COUNTERS; c++)
+            summary.counters[c] = getPercentiles(columns[NUM_STAGES + c]);
+    }
+    
+    bool TrackerProfiler::getLast(unsigned stages[NUM_STAGES], unsigned counters[NUM_COUNTERS]) const
+    {
+        const unsigned long long numFrames = getNumFrames();
+        if (numFrames == 0)
+            return false;
+        
+        unsigned values[NUM_VALUES];
+        if (!read(numFrames - 1, values))
+            return false;
+        
+        std::copy(values, values + NUM_STAGES, stages);
+        std::copy(values + NUM_STAGES, values + NUM_VALUES, counters);
+        return true;
+    }
+    
+    const char* TrackerProfiler::getStageName(int stage)
+    {
+        static const char* names[NUM_STAGES] = {
+            "resize", "gray", "detection", "description", "matching",
+            "estimation", "refinement", "tracking", "pose", "total"
+        };
+        return stage >= 0 && stage < NUM_STAGES ? names[stage] : "";
+    }
+    
+    const char* TrackerProfiler::getCounterName(int counter)
+    {
+        static const char* names[NUM_COUNTERS] = {
+            "keypoints", "raw matches", "ratio test matches", "inliers", "hypotheses"
+        };
+        return counter >= 0 && counter < NUM_COUNTERS ? names[counter] : "";
+    }
+    
+}
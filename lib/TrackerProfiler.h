@@ -0,0 +1,130 @@
+//
+//  TrackerProfiler.h
+//
+//  Rolling window of the per stage timings & counters of PatternTracker::find().
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace cv {
+    
+    /**
+     * Time spent in each stage of the last PatternTracker::find(), in milliseconds
+     */
+    struct StageTimings
+    {
+        StageTimings()
+        : resize(0), gray(0), detection(0), description(0), matching(0), estimation(0)
+        , refinement(0), tracking(0), pose(0), total(0) {}
+        
+        double resize;
+        double gray;
+        double detection;   // with tiled extraction, includes the description which runs along
+        double description;
+        double matching;
+        double estimation;  // RANSAC homographies of the candidates
+        double refinement;
+        double tracking;    // optical flow path
+        double pose;        // solvePnP & pose filter, filled by the first PatternTracker::getPose() of the frame
+        double total;
+    };
+    
+    /**
+     * Sizes of the intermediate results of the last PatternTracker::find()
+     */
+    struct FrameCounters
+    {
+        FrameCounters() : keypoints(0), rawMatches(0), ratioTestMatches(0), inliers(0), hypotheses(0) {}
+        
+        int keypoints;
+        int rawMatches;         // query descriptors matched with the database
+        int ratioTestMatches;   // survivors of the ratio test, same as rawMatches without it
+        int inliers;            // inliers of the best pattern
+        int hypotheses;         // homographies verified by HOMOGRAPHY_PROSAC, 0 with RANSAC
+    };
+    
+    /**
+     * Rolling window of the timings & counters of the last frames.
+     * One thread records, any number of threads read the statistics : records only
+     * do relaxed atomic stores into a ring of slots guarded by sequence numbers, and
+     * readers skip the slots being overwritten instead of blocking the writer.
+     */
+    class TrackerProfiler
+    {
+    public:
+        enum Stage
+        {
+            STAGE_RESIZE, STAGE_GRAY, STAGE_DETECTION, STAGE_DESCRIPTION, STAGE_MATCHING,
+            STAGE_ESTIMATION, STAGE_REFINEMENT, STAGE_TRACKING, STAGE_POSE, STAGE_TOTAL,
+            NUM_STAGES
+        };
+        
+        enum Counter
+        {
+            COUNTER_KEYPOINTS, COUNTER_RAW_MATCHES, COUNTER_RATIO_TEST_MATCHES, COUNTER_INLIERS,
+            COUNTER_HYPOTHESES, NUM_COUNTERS
+        };
+        
+        struct Percentiles
+        {
+            Percentiles() : mean(0), p50(0), p90(0), p99(0), max(0) {}
+            float mean, p50, p90, p99, max;
+        };
+        
+        /**
+         * Statistics over the window, stages in microseconds
+         */
+        struct Summary
+        {
+            Summary() : numFrames(0) {}
+            int numFrames;
+            Percentiles stages[NUM_STAGES];
+            Percentiles counters[NUM_COUNTERS];
+        };
+        
+        TrackerProfiler(int windowSize = 256);
+        
+        /**
+         * Record a frame, only call it from one thread at a time
+         */
+        void record(const StageTimings& timings, const FrameCounters& counters);
+        
+        /**
+         * Statistics of the last windowSize frames, or less if some are being recorded
+         */
+        void getSummary(Summary& summary) const;
+        
+        /**
+         * Values of the last recorded frame, stages in microseconds. False if there's none yet.
+         */
+        bool getLast(unsigned stages[NUM_STAGES], unsigned counters[NUM_COUNTERS]) const;
+        
+        unsigned long long getNumFrames() const { return m_numFrames.load(std::memory_order_acquire); }
+        int getWindowSize() const { return m_windowSize; }
+        
+        static const char* getStageName(int stage);
+        static const char* getCounterName(int counter);
+    
+    protected:
+        enum { NUM_VALUES = NUM_STAGES + NUM_COUNTERS };
+        
+        struct Slot
+        {
+            std::atomic<unsigned long long> sequence;   // odd while being written
+            std::atomic<unsigned>           values[NUM_VALUES];
+        };
+        
+        /**
+         * Copy the values of a frame if its slot holds it and isn't overwritten meanwhile
+         */
+        bool read(unsigned long long frame, unsigned values[NUM_VALUES]) const;
+        
+        const int                       m_windowSize;
+        std::unique_ptr<Slot[]>         m_slots;
+        std::atomic<unsigned long long> m_numFrames;
+    };
+    
+}
@@ -0,0 +1,716 @@
+//
+//  TrackerTrace.cpp
+//
+//  Recording & reading back of the frames & settings of a tracking session.
+//
+
+#include "TrackerTrace.h"
+
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+
+namespace cv {
+    
+    namespace {
+        
+        const char magic[8] = { 'O', 'F', 'X', 'C', 'V', 'T', 'R', 'C' };
+        const uint32_t version = 1;
+        const uint32_t maxRecordSize = 1 << 28;    // beyond, the trace is corrupt
+        
+        enum
+        {
+            RECORD_CONFIG = 1,
+            RECORD_FRAME  = 2
+        };
+        
+        enum
+        {
+            POSE_FOUND    = 1 << 0,
+            POSE_FILTERED = 1 << 1
+        };
+        
+        struct FileHeader
+        {
+            char     magic[8];
+            uint32_t version;
+            uint32_t encoding;
+            uint32_t matcherType;
+            uint32_t hasCamera;
+            uint32_t numDistCoeffs;
+            float    frameScale;
+            double   tickFrequency;
+            double   cameraMatrix[9];
+            double   distCoeffs[8];
+            char     featureBackend[32];    // zero terminated
+        };
+        
+        struct RecordHeader
+        {
+            uint32_t type;
+            uint32_t size;                  // of the payload following the header
+        };
+        
+        struct FileConfig
+        {
+            double   confidence, prosacGrowth, sprtEpsilon, sprtDelta, sprtModelCost;
+            int32_t  numFeatures, numLevels, refinement, minNumberMatchesAllowed;
+            int32_t  enableRatioTest, enableFixedPointKernels, homographyMethod, maxIterations;
+            int32_t  enableSprt, refinementMethod, refinementPatchRadius, refinementSearchRadius;
+            int32_t  refinementMaxPoints, maxPatternsPerFrame, maxCandidatesPerFrame, retrievalShortlistSize;
+            int32_t  numExtractionThreads, gridWidth, gridHeight, enableRoiPrediction;
+            int32_t  enableOpticalFlowTracking, minTrackedPointsAllowed, searchInterval, enablePoseFilter;
+            float    rescale, homographyReprojectionThreshold, minInlierRatio, refinementReprojectionThreshold;
+            float    roiPadding, maxTrackingReprojectionError, poseFilterMinCutoff, poseFilterBeta;
+            float    poseFilterDerivativeCutoff, reserved;
+        };
+        
+        // Followed by the results, the poses & the encoded luma
+        struct FileFrame
+        {
+            int64_t  index;
+            int64_t  ticks;
+            float    timings[10];           // ms, in the order of StageTimings
+            int32_t  counters[5];           // in the order of FrameCounters
+            int32_t  width, height;
+            int32_t  numPatterns;
+            int32_t  path;
+            int32_t  found;
+            int32_t  numResults;
+            int32_t  numPoses;
+            int32_t  lumaWidth, lumaHeight;
+            float    lumaScale;
+            uint32_t lumaSize;
+        };
+        
+        struct FileResult
+        {
+            int32_t  patternIdx;
+            int32_t  numInliers;
+            double   homography[9];
+        };
+        
+        struct FilePose
+        {
+            int32_t  patternIdx;
+            uint32_t flags;
+            double   rvec[3];
+            double   tvec[3];
+        };
+        
+        FileConfig toFile(const TraceConfig& config)
+        {
+            FileConfig c;
+            memset(&c, 0, sizeof(c));
+            
+            const RobustHomographyParams& params = config.homographyParams;
+            c.confidence = params.confidence;
+            c.prosacGrowth = params.prosacGrowth;
+            c.sprtEpsilon = params.sprtEpsilon;
+            c.sprtDelta = params.sprtDelta;
+            c.sprtModelCost = params.sprtModelCost;
+            c.maxIterations = params.maxIterations;
+            c.enableSprt = params.enableSprt;
+            c.minInlierRatio = params.minInlierRatio;
+            
+            c.numFeatures = config.operatingPoint.numFeatures;
+            c.numLevels = config.operatingPoint.numLevels;
+            c.rescale = config.operatingPoint.rescale;
+            c.refinement = config.operatingPoint.refinement;
+            c.minNumberMatchesAllowed = config.minNumberMatchesAllowed;
+            c.enableRatioTest = config.enableRatioTest;
+            c.homographyReprojectionThreshold = config.homographyReprojectionThreshold;
+            c.enableFixedPointKernels = config.enableFixedPointKernels;
+            c.homographyMethod = config.homographyMethod;
+            c.refinementMethod = config.refinementMethod;
+            c.refinementReprojectionThreshold = config.refinementReprojectionThreshold;
+            c.refinementPatchRadius = config.refinementPatchRadius;
+            c.refinementSearchRadius = config.refinementSearchRadius;
+            c.refinementMaxPoints = config.refinementMaxPoints;
+            c.maxPatternsPerFrame = config.maxPatternsPerFrame;
+            c.maxCandidatesPerFrame = config.maxCandidatesPerFrame;
+            c.retrievalShortlistSize = config.retrievalShortlistSize;
+            c.numExtractionThreads = config.numExtractionThreads;
+            c.gridWidth = config.extractionGrid.width;
+            c.gridHeight = config.extractionGrid.height;
+            c.enableRoiPrediction = config.enableRoiPrediction;
+            c.roiPadding = config.roiPadding;
+            c.enableOpticalFlowTracking = config.enableOpticalFlowTracking;
+            c.minTrackedPointsAllowed = config.minTrackedPointsAllowed;
+            c.maxTrackingReprojectionError = config.maxTrackingReprojectionError;
+            c.searchInterval = config.searchInterval;
+            c.enablePoseFilter = config.enablePoseFilter;
+            c.poseFilterMinCutoff = config.poseFilterMinCutoff;
+            c.poseFilterBeta = config.poseFilterBeta;
+            c.poseFilterDerivativeCutoff = config.poseFilterDerivativeCutoff;
+            return c;
+        }
+        
+        void fromFile(const FileConfig& c, TraceConfig& config)
+        {
+            RobustHomographyParams& params = config.homographyParams;
+            params.confidence = c.confidence;
+            params.prosacGrowth = c.prosacGrowth;
+            params.sprtEpsilon = c.sprtEpsilon;
+            params.sprtDelta = c.sprtDelta;
+            params.sprtModelCost = c.sprtModelCost;
+            params.maxIterations = c.maxIterations;
+            params.enableSprt = c.enableSprt != 0;
+            params.minInlierRatio = c.minInlierRatio;
+            
+            config.operatingPoint = OperatingPoint(c.numFeatures, c.numLevels, c.rescale, c.refinement != 0);
+            config.minNumberMatchesAllowed = c.minNumberMatchesAllowed;
+            config.enableRatioTest = c.enableRatioTest != 0;
+            config.homographyReprojectionThreshold = c.homographyReprojectionThreshold;
+            config.enableFixedPointKernels = c.enableFixedPointKernels != 0;
+            config.homographyMethod = (HomographyMethod)c.homographyMethod;
+            config.refinementMethod = (RefinementMethod)c.refinementMethod;
+            config.refinementReprojectionThreshold = c.refinementReprojectionThreshold;
+            config.refinementPatchRadius = c.refinementPatchRadius;
+            config.refinementSearchRadius = c.refinementSearchRadius;
+            config.refinementMaxPoints = c.refinementMaxPoints;
+            config.maxPatternsPerFrame = c.maxPatternsPerFrame;
+            config.maxCandidatesPerFrame = c.maxCandidatesPerFrame;
+            config.retrievalShortlistSize = c.retrievalShortlistSize;
+            config.numExtractionThreads = c.numExtractionThreads;
+            config.extractionGrid = cv::Size(c.gridWidth, c.gridHeight);
+            config.enableRoiPrediction = c.enableRoiPrediction != 0;
+            config.roiPadding = c.roiPadding;
+            config.enableOpticalFlowTracking = c.enableOpticalFlowTracking != 0;
+            config.minTrackedPointsAllowed = c.minTrackedPointsAllowed;
+            config.maxTrackingReprojectionError = c.maxTrackingReprojectionError;
+            config.searchInterval = c.searchInterval;
+            config.enablePoseFilter = c.enablePoseFilter != 0;
+            config.poseFilterMinCutoff = c.poseFilterMinCutoff;
+            config.poseFilterBeta = c.poseFilterBeta;
+            config.poseFilterDerivativeCutoff = c.poseFilterDerivativeCutoff;
+        }
+        
+        void toFile(const StageTimings& t, float* timings)
+        {
+            const double values[10] = { t.resize, t.gray, t.detection, t.description, t.matching,
+                                        t.estimation, t.refinement, t.tracking, t.pose, t.total };
+            std::copy(values, values + 10, timings);
+        }
+        
+        void fromFile(const float* timings, StageTimings& t)
+        {
+            double* values[10] = { &t.resize, &t.gray, &t.detection, &t.description, &t.matching,
+                                   &t.estimation, &t.refinement, &t.tracking, &t.pose, &t.total };
+            for (int i = 0; i < 10; i++)
+                *values[i] = timings[i];
+        }
+        
+        void copyMatrix(const cv::Mat& m, double* values, size_t size)
+        {
+            std::fill(values, values + size, 0.);
+            if (m.empty())
+                return;
+            
+            cv::Mat m64;
+            m.convertTo(m64, CV_64F);
+            m64 = m64.reshape(1, 1);
+            for (int i = 0; i < std::min((int)size, m64.cols); i++)
+                values[i] = m64.at<double>(i);
+        }
+        
+        void append(std::vector<uchar>& buffer, const void* data, size_t size)
+        {
+            if (size)
+                buffer.insert(buffer.end(), (const uchar*)data, (const uchar*)data + size);
+        }
+        
+        /**
+         * Luma of an image given to PatternTracker::find(), in a buffer of its own
+         */
+        void copyLuma(const cv::Mat& image, PixelFormat format, float scale, cv::Mat& luma)
+        {
+            cv::Mat full;
+            if (format == PIXEL_FORMAT_AUTO && image.channels() == 3)
+                cv::cvtColor(image, full, CV_BGR2GRAY);
+            else if (format == PIXEL_FORMAT_AUTO && image.channels() == 4)
+                cv::cvtColor(image, full, CV_BGRA2GRAY);
+            else if (format == PIXEL_FORMAT_AUTO)
+                full = image;
+            else
+                extractLuma(image, format, 1, full);
+            
+            if (scale != 1)
+                cv::resize(full, luma, cv::Size(), scale, scale, cv::INTER_AREA);
+            else
+                luma = full.data == image.data ? full.clone() : full;
+        }
+    }
+    
+    TraceConfig::TraceConfig()
+    : minNumberMatchesAllowed(0)
+    , enableRatioTest(false)
+    , homographyReprojectionThreshold(0)
+    , enableFixedPointKernels(false)
+    , homographyMethod(HOMOGRAPHY_RANSAC)
+    , refinementMethod(REFINEMENT_WARP)
+    , refinementReprojectionThreshold(0)
+    , refinementPatchRadius(0)
+    , refinementSearchRadius(0)
+    , refinementMaxPoints(0)
+    , maxPatternsPerFrame(0)
+    , maxCandidatesPerFrame(0)
+    , retrievalShortlistSize(0)
+    , numExtractionThreads(0)
+    , enableRoiPrediction(false)
+    , roiPadding(0)
+    , enableOpticalFlowTracking(false)
+    , minTrackedPointsAllowed(0)
+    , maxTrackingReprojectionError(0)
+    , searchInterval(0)
+    , enablePoseFilter(false)
+    , poseFilterMinCutoff(0)
+    , poseFilterBeta(0)
+    , poseFilterDerivativeCutoff(0)
+    {
+    }
+    
+    void TraceConfig::read(const PatternTracker& tracker)
+    {
+        operatingPoint = tracker.getOperatingPoint();
+        minNumberMatchesAllowed = tracker.minNumberMatchesAllowed;
+        enableRatioTest = tracker.enableRatioTest;
+        homographyReprojectionThreshold = tracker.homographyReprojectionThreshold;
+        enableFixedPointKernels = tracker.enableFixedPointKernels;
+        homographyMethod = tracker.homographyMethod;
+        homographyParams = tracker.homographyParams;
+        refinementMethod = tracker.refinementMethod;
+        refinementReprojectionThreshold = tracker.refinementReprojectionThreshold;
+        refinementPatchRadius = tracker.refinementPatchRadius;
+        refinementSearchRadius = tracker.refinementSearchRadius;
+        refinementMaxPoints = tracker.refinementMaxPoints;
+        maxPatternsPerFrame = tracker.maxPatternsPerFrame;
+        maxCandidatesPerFrame = tracker.maxCandidatesPerFrame;
+        retrievalShortlistSize = tracker.retrievalShortlistSize;
+        numExtractionThreads = tracker.numExtractionThreads;
+        extractionGrid = tracker.extractionGrid;
+        enableRoiPrediction = tracker.enableRoiPrediction;
+        roiPadding = tracker.roiPadding;
+        enableOpticalFlowTracking = tracker.enableOpticalFlowTracking;
+        minTrackedPointsAllowed = tracker.minTrackedPointsAllowed;
+        maxTrackingReprojectionError = tracker.maxTrackingReprojectionError;
+        searchInterval = tracker.searchInterval;
+        enablePoseFilter = tracker.enablePoseFilter;
+        poseFilterMinCutoff = tracker.poseFilter.minCutoff;
+        poseFilterBeta = tracker.poseFilter.beta;
+        poseFilterDerivativeCutoff = tracker.poseFilter.derivativeCutoff;
+    }
+    
+    void TraceConfig::apply(PatternTracker& tracker) const
+    {
+        tracker.setOperatingPoint(operatingPoint);
+        tracker.minNumberMatchesAllowed = minNumberMatchesAllowed;
+        tracker.enableRatioTest = enableRatioTest;
+        tracker.homographyReprojectionThreshold = homographyReprojectionThreshold;
+        tracker.enableFixedPointKernels = enableFixedPointKernels;
+        tracker.homographyMethod = homographyMethod;
+        tracker.homographyParams = homographyParams;
+        tracker.refinementMethod = refinementMethod;
+        tracker.refinementReprojectionThreshold = refinementReprojectionThreshold;
+        tracker.refinementPatchRadius = refinementPatchRadius;
+        tracker.refinementSearchRadius = refinementSearchRadius;
+        tracker.refinementMaxPoints = refinementMaxPoints;
+        tracker.maxPatternsPerFrame = maxPatternsPerFrame;
+        tracker.maxCandidatesPerFrame = maxCandidatesPerFrame;
+        tracker.retrievalShortlistSize = retrievalShortlistSize;
+        tracker.numExtractionThreads = numExtractionThreads;
+        tracker.extractionGrid = extractionGrid;
+        tracker.enableRoiPrediction = enableRoiPrediction;
+        tracker.roiPadding = roiPadding;
+        tracker.enableOpticalFlowTracking = enableOpticalFlowTracking;
+        tracker.minTrackedPointsAllowed = minTrackedPointsAllowed;
+        tracker.maxTrackingReprojectionError = maxTrackingReprojectionError;
+        tracker.searchInterval = searchInterval;
+        tracker.enablePoseFilter = enablePoseFilter;
+        tracker.poseFilter.minCutoff = poseFilterMinCutoff;
+        tracker.poseFilter.beta = poseFilterBeta;
+        tracker.poseFilter.derivativeCutoff = poseFilterDerivativeCutoff;
+    }
+    
+    bool TraceConfig::operator==(const TraceConfig& other) const
+    {
+        // Same as recorded
+        const FileConfig a = toFile(*this), b = toFile(other);
+        return memcmp(&a, &b, sizeof(FileConfig)) == 0;
+    }
+    
+    TraceWriter::TraceWriter()
+    : m_hasConfig(false)
+    , m_numFrames(0)
+    , m_numBytes(0)
+    , m_stop(true)
+    {
+    }
+    
+    TraceWriter::~TraceWriter()
+    {
+        close();
+    }
+    
+    bool TraceWriter::open(const std::string& path, const PatternTracker& tracker, const Options& options)
+    {
+        close();
+        
+        FileHeader header;
+        memset(&header, 0, sizeof(header));
+        const std::string backend = tracker.getFeatureBackend().getName();
+        if (backend.size() >= sizeof(header.featureBackend))
+            return false;
+        
+        m_file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!m_file)
+            return false;
+        
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.encoding = options.encoding;
+        header.matcherType = tracker.getMatcherType();
+        header.frameScale = options.frameScale;
+        header.tickFrequency = cv::getTickFrequency();
+        if (!options.cameraMatrix.empty())
+        {
+            header.hasCamera = 1;
+            header.numDistCoeffs = std::min(options.distCoeffs.total(), (size_t)8);
+            copyMatrix(options.cameraMatrix, header.cameraMatrix, 9);
+            copyMatrix(options.distCoeffs, header.distCoeffs, header.numDistCoeffs);
+        }
+        strncpy(header.featureBackend, backend.c_str(), sizeof(header.featureBackend) - 1);
+        m_file.write((const char*)&header, sizeof(header));
+        
+        m_options = options;
+        m_hasConfig = false;
+        m_entries.clear();
+        m_numFrames = 0;
+        m_numBytes = sizeof(header);
+        m_stop = false;
+        m_worker = std::thread(&TraceWriter::work, this);
+        return true;
+    }
+    
+    void TraceWriter::close()
+    {
+        if (!m_worker.joinable())
+            return;
+        
+        // The queued frames are written first
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_entryReady.notify_all();
+        m_worker.join();
+        m_file.close();
+    }
+    
+    void TraceWriter::record(const PatternTracker& tracker, const cv::Mat& image, PixelFormat format, const std::vector<Pose>& poses)
+    {
+        if (!isOpen())
+            return;
+        
+        Entry entry;
+        entry.config.read(tracker);
+        entry.hasConfig = !m_hasConfig || entry.config != m_config;
+        if (entry.hasConfig)
+        {
+            m_config = entry.config;
+            m_hasConfig = true;
+        }
+        
+        // The results & poses share their matrices, which are never written in place
+        const FrameData& data = tracker.getFrame();
+        TraceFrame& frame = entry.frame;
+        frame.index = data.index;
+        frame.ticks = data.ticks;
+        frame.numPatterns = tracker.getDatabase().size();
+        frame.imageSize = data.imageSize;
+        frame.path = data.path;
+        frame.found = data.found;
+        frame.timings = data.timings;
+        frame.counters = data.counters;
+        frame.results = data.results;
+        frame.poses = poses;
+        if (m_options.encoding != FRAMES_NONE)
+        {
+            copyLuma(image, format, m_options.frameScale, frame.luma);
+            frame.lumaScale = m_options.frameScale;
+        }
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_entryWritten.wait(lock, [this]{ return m_entries.size() < (size_t)std::max(1, m_options.maxQueuedFrames); });
+        m_entries.push_back(entry);
+        m_entryReady.notify_one();
+    }
+    
+    unsigned long long TraceWriter::getNumFrames() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numFrames;
+    }
+    
+    unsigned long long TraceWriter::getNumBytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numBytes;
+    }
+    
+    const char* TraceWriter::getEncodingName(FrameEncoding encoding)
+    {
+        switch (encoding)
+        {
+            case FRAMES_NONE:
+                return "none";
+            case FRAMES_RAW:
+                return "raw";
+            case FRAMES_PNG:
+                return "png";
+            case FRAMES_JPEG:
+            default:
+                return "jpeg";
+        }
+    }
+
+#pragma mark - Protected
+    
+    
+    void TraceWriter::work()
+    {
+        std::vector<uchar> buffer, encoded;
+        while (true)
+        {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_entryReady.wait(lock, [this]{ return m_stop || !m_entries.empty(); });
+                if (m_entries.empty())
+                    return;
+                
+                entry = m_entries.front();
+                m_entries.pop_front();
+            }
+            m_entryWritten.notify_one();
+            
+            write(entry, buffer, encoded);
+            
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_numFrames++;
+            m_numBytes += buffer.size();
+        }
+    }
+    
+    void TraceWriter::write(const Entry& entry, std::vector<uchar>& buffer, std::vector<uchar>& encoded)
+    {
+        buffer.clear();
+        if (entry.hasConfig)
+        {
+            const FileConfig config = toFile(entry.config);
+            const RecordHeader header = { RECORD_CONFIG, sizeof(config) };
+            append(buffer, &header, sizeof(header));
+            append(buffer, &config, sizeof(config));
+        }
+        
+        const TraceFrame& frame = entry.frame;
+        encoded.clear();
+        if (!frame.luma.empty())
+        {
+            if (m_options.encoding == FRAMES_RAW)
+            {
+                const cv::Mat luma = frame.luma.isContinuous() ? frame.luma : frame.luma.clone();
+                append(encoded, luma.data, luma.total());
+            }
+            else if (m_options.encoding == FRAMES_PNG)
+            {
+                // Fastest compression, the frames of a camera hardly compress further
+                std::vector<int> params(2);
+                params[0] = CV_IMWRITE_PNG_COMPRESSION;
+                params[1] = 1;
+                cv::imencode(".png", frame.luma, encoded, params);
+            }
+            else
+            {
+                std::vector<int> params(2);
+                params[0] = CV_IMWRITE_JPEG_QUALITY;
+                params[1] = m_options.jpegQuality;
+                cv::imencode(".jpg", frame.luma, encoded, params);
+            }
+        }
+        
+        FileFrame f;
+        memset(&f, 0, sizeof(f));
+        f.index = frame.index;
+        f.ticks = frame.ticks;
+        toFile(frame.timings, f.timings);
+        f.counters[0] = frame.counters.keypoints;
+        f.counters[1] = frame.counters.rawMatches;
+        f.counters[2] = frame.counters.ratioTestMatches;
+        f.counters[3] = frame.counters.inliers;
+        f.counters[4] = frame.counters.hypotheses;
+        f.width = frame.imageSize.width;
+        f.height = frame.imageSize.height;
+        f.numPatterns = frame.numPatterns;
+        f.path = frame.path;
+        f.found = frame.found;
+        f.numResults = frame.results.size();
+        f.numPoses = frame.poses.size();
+        f.lumaWidth = frame.luma.cols;
+        f.lumaHeight = frame.luma.rows;
+        f.lumaScale = frame.lumaScale;
+        f.lumaSize = encoded.size();
+        
+        const RecordHeader header = { RECORD_FRAME, (uint32_t)(sizeof(FileFrame) + f.numResults * sizeof(FileResult)
+                                                               + f.numPoses * sizeof(FilePose) + encoded.size()) };
+        append(buffer, &header, sizeof(header));
+        append(buffer, &f, sizeof(f));
+        
+        for (const auto & result : frame.results)
+        {
+            FileResult r;
+            r.patternIdx = result.patternIdx;
+            r.numInliers = result.numInliers;
+            copyMatrix(result.homography, r.homography, 9);
+            append(buffer, &r, sizeof(r));
+        }
+        for (const auto & pose : frame.poses)
+        {
+            FilePose p;
+            p.patternIdx = pose.patternIdx;
+            p.flags = (pose.found ? POSE_FOUND : 0) | (pose.filtered ? POSE_FILTERED : 0);
+            copyMatrix(pose.rvec, p.rvec, 3);
+            copyMatrix(pose.tvec, p.tvec, 3);
+            append(buffer, &p, sizeof(p));
+        }
+        append(buffer, encoded.empty() ? 0 : &encoded[0], encoded.size());
+        
+        m_file.write((const char*)&buffer[0], buffer.size());
+        m_file.flush();
+    }
+    
+    TraceReader::TraceReader()
+    : m_matcherType(MATCHER_PACKED_HAMMING)
+    , m_tickFrequency(0)
+    , m_encoding(TraceWriter::FRAMES_NONE)
+    {
+    }
+    
+    bool TraceReader::open(const std::string& path)
+    {
+        m_file.close();
+        m_file.clear();
+        m_file.open(path.c_str(), std::ios::binary);
+        
+        FileHeader header;
+        if (!m_file.read((char*)&header, sizeof(header)) || memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+            return false;
+        
+        header.featureBackend[sizeof(header.featureBackend) - 1] = 0;
+        m_featureBackend = header.featureBackend;
+        m_matcherType = (MatcherType)header.matcherType;
+        m_tickFrequency = header.tickFrequency;
+        m_encoding = (TraceWriter::FrameEncoding)header.encoding;
+        m_cameraMatrix.release();
+        m_distCoeffs.release();
+        if (header.hasCamera)
+        {
+            m_cameraMatrix = cv::Mat(3, 3, CV_64F, header.cameraMatrix).clone();
+            m_distCoeffs = cv::Mat(1, std::min(header.numDistCoeffs, 8u), CV_64F, header.distCoeffs).clone();
+        }
+        m_config = TraceConfig();
+        return true;
+    }
+    
+    bool TraceReader::next(TraceFrame& frame, TraceConfig& config)
+    {
+        RecordHeader header;
+        while (m_file.read((char*)&header, sizeof(header)))
+        {
+            if (header.size > maxRecordSize)
+                return false;
+            
+            m_buffer.resize(header.size);
+            if (header.size && !m_file.read((char*)&m_buffer[0], header.size))
+                return false;
+            
+            // Records of unknown types are skipped
+            if (header.type == RECORD_CONFIG && header.size >= sizeof(FileConfig))
+            {
+                FileConfig c;
+                memcpy(&c, &m_buffer[0], sizeof(c));
+                fromFile(c, m_config);
+                continue;
+            }
+            if (header.type != RECORD_FRAME || header.size < sizeof(FileFrame))
+                continue;
+            
+            FileFrame f;
+            memcpy(&f, &m_buffer[0], sizeof(f));
+            const size_t size = sizeof(FileFrame) + (size_t)f.numResults * sizeof(FileResult) + (size_t)f.numPoses * sizeof(FilePose) + f.lumaSize;
+            if (f.numResults < 0 || f.numPoses < 0 || size != header.size)
+                return false;
+            
+            frame.index = f.index;
+            frame.ticks = f.ticks;
+            frame.numPatterns = f.numPatterns;
+            frame.imageSize = cv::Size(f.width, f.height);
+            frame.lumaScale = f.lumaScale;
+            frame.path = (TrackingPath)f.path;
+            frame.found = f.found != 0;
+            fromFile(f.timings, frame.timings);
+            frame.counters.keypoints = f.counters[0];
+            frame.counters.rawMatches = f.counters[1];
+            frame.counters.ratioTestMatches = f.counters[2];
+            frame.counters.inliers = f.counters[3];
+            frame.counters.hypotheses = f.counters[4];
+            
+            const uchar* data = &m_buffer[sizeof(FileFrame)];
+            frame.results.resize(f.numResults);
+            for (auto & result : frame.results)
+            {
+                FileResult r;
+                memcpy(&r, data, sizeof(r));
+                data += sizeof(r);
+                result.patternIdx = r.patternIdx;
+                result.numInliers = r.numInliers;
+                result.homography = cv::Mat(3, 3, CV_64F, r.homography).clone();
+                result.points2d.clear();
+            }
+            
+            frame.poses.resize(f.numPoses);
+            for (auto & pose : frame.poses)
+            {
+                FilePose p;
+                memcpy(&p, data, sizeof(p));
+                data += sizeof(p);
+                pose = Pose();
+                pose.found = (p.flags & POSE_FOUND) != 0;
+                pose.filtered = (p.flags & POSE_FILTERED) != 0;
+                pose.frameIndex = frame.index;
+                pose.ticks = frame.ticks;
+                pose.patternIdx = p.patternIdx;
+                pose.rvec = cv::Mat(3, 1, CV_64F, p.rvec).clone();
+                pose.tvec = cv::Mat(3, 1, CV_64F, p.tvec).clone();
+            }
+            
+            frame.luma.release();
+            if (f.lumaSize && m_encoding == TraceWriter::FRAMES_RAW)
+            {
+                if ((size_t)f.lumaWidth * f.lumaHeight != f.lumaSize)
+                    return false;
+                frame.luma = cv::Mat(f.lumaHeight, f.lumaWidth, CV_8UC1, (void*)data).clone();
+            }
+            else if (f.lumaSize)
+            {
+                const std::vector<uchar> encoded(data, data + f.lumaSize);
+                frame.luma = cv::imdecode(encoded, CV_LOAD_IMAGE_GRAYSCALE);
+            }
+            
+            config = m_config;
+            return true;
+        }
+        return false;
+    }
+    
+}
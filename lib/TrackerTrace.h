@@ -0,0 +1,209 @@
+//
+//  TrackerTrace.h
+//
+//  Recording & reading back of the frames & settings of a tracking session.
+//
+
+#pragma once
+
+#include "PatternTracker.h"
+
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace cv {
+    
+    /**
+     * Settings of a PatternTracker changing what find() does, recorded by a trace whenever they change
+     */
+    struct TraceConfig
+    {
+        TraceConfig();
+        
+        /**
+         * Copy the settings of a tracker, or set them
+         */
+        void read(const PatternTracker& tracker);
+        void apply(PatternTracker& tracker) const;
+        
+        bool operator==(const TraceConfig& other) const;
+        bool operator!=(const TraceConfig& other) const { return !(*this == other); }
+        
+        OperatingPoint            operatingPoint;   // keypoint budget, pyramid, rescale & refinement
+        int                       minNumberMatchesAllowed;
+        bool                      enableRatioTest;
+        float                     homographyReprojectionThreshold;
+        bool                      enableFixedPointKernels;
+        HomographyMethod          homographyMethod;
+        RobustHomographyParams    homographyParams;
+        RefinementMethod          refinementMethod;
+        float                     refinementReprojectionThreshold;
+        int                       refinementPatchRadius;
+        int                       refinementSearchRadius;
+        int                       refinementMaxPoints;
+        int                       maxPatternsPerFrame;
+        int                       maxCandidatesPerFrame;
+        int                       retrievalShortlistSize;
+        int                       numExtractionThreads;
+        cv::Size                  extractionGrid;
+        bool                      enableRoiPrediction;
+        float                     roiPadding;
+        bool                      enableOpticalFlowTracking;
+        int                       minTrackedPointsAllowed;
+        float                     maxTrackingReprojectionError;
+        int                       searchInterval;
+        bool                      enablePoseFilter;
+        float                     poseFilterMinCutoff;
+        float                     poseFilterBeta;
+        float                     poseFilterDerivativeCutoff;
+    };
+    
+    /**
+     * A traced frame : what find() was given & what it found
+     */
+    struct TraceFrame
+    {
+        TraceFrame() : index(-1), ticks(0), numPatterns(0), lumaScale(1), path(TRACKING_PATH_NONE), found(false) {}
+        
+        long long                 index;        // FrameData::index & ticks
+        int64                     ticks;
+        int                       numPatterns;  // in the database
+        cv::Size                  imageSize;    // of the image given to find()
+        cv::Mat                   luma;         // its luma scaled by lumaScale, empty if the frames aren't recorded
+        float                     lumaScale;
+        TrackingPath              path;
+        bool                      found;
+        StageTimings              timings;
+        FrameCounters             counters;
+        std::vector<TrackingInfo> results;      // pattern, homography & inliers, the quads aren't recorded
+        std::vector<Pose>         poses;        // if any were solved
+    };
+    
+    /**
+     * Records the frames of a PatternTracker into a compact binary trace, to replay them offline with
+     * the replayTrace tool. Little endian layout, each record being its type & size and a payload :
+     *
+     *   header (feature backend, matcher, tick frequency, camera, frame encoding) | config | frame | frame | config | frame ...
+     *
+     * A configuration is recorded before the first frame and whenever the settings change, e.g. by a QualityController.
+     * A frame holds its timings, counters, results, poses & luma, raw or compressed. record() copies the luma and
+     * queues the frame, a background thread compressing & writing it, so the tracking thread only waits on a full queue.
+     */
+    class TraceWriter
+    {
+    public:
+        enum FrameEncoding
+        {
+            FRAMES_NONE,            // the outputs only, for monitoring, the trace can't be replayed
+            FRAMES_RAW,             // lossless & cheap, but large
+            FRAMES_PNG,             // lossless, slower to write
+            FRAMES_JPEG             // lossy, the replay is approximate
+        };
+        
+        struct Options
+        {
+            Options() : encoding(FRAMES_PNG), frameScale(1), jpegQuality(90), maxQueuedFrames(32) {}
+            
+            FrameEncoding             encoding;
+            float                     frameScale;       // scale of the recorded luma, below 1 the replay is approximate
+            int                       jpegQuality;
+            int                       maxQueuedFrames;  // record() waits beyond
+            cv::Mat                   cameraMatrix;     // the poses are solved with, for the replay
+            cv::Mat                   distCoeffs;
+        };
+        
+        TraceWriter();
+        ~TraceWriter();
+        
+        /**
+         * Start tracing the frames of tracker, false if the file can't be created
+         */
+        bool open(const std::string& path, const PatternTracker& tracker, const Options& options = Options());
+        void close();
+        bool isOpen() const { return m_worker.joinable(); }
+        
+        /**
+         * Record the frame last found by tracker, from the thread calling find() : image & format as given to find(),
+         * and the poses solved for it if any.
+         */
+        void record(const PatternTracker& tracker, const cv::Mat& image, PixelFormat format = PIXEL_FORMAT_AUTO,
+                    const std::vector<Pose>& poses = std::vector<Pose>());
+        
+        unsigned long long getNumFrames() const;
+        unsigned long long getNumBytes() const;     // written so far
+        
+        static const char* getEncodingName(FrameEncoding encoding);
+    
+    protected:
+        /**
+         * A queued frame, and the configuration preceding it when it changed
+         */
+        struct Entry
+        {
+            bool                      hasConfig;
+            TraceConfig               config;
+            TraceFrame                frame;
+        };
+        
+        void work();
+        void write(const Entry& entry, std::vector<uchar>& buffer, std::vector<uchar>& encoded);
+    
+    private:
+        std::ofstream             m_file;
+        Options                   m_options;
+        TraceConfig               m_config;         // last recorded
+        bool                      m_hasConfig;
+        
+        std::deque<Entry>         m_entries;
+        unsigned long long        m_numFrames;
+        unsigned long long        m_numBytes;
+        bool                      m_stop;
+        
+        std::thread               m_worker;
+        mutable std::mutex        m_mutex;
+        std::condition_variable   m_entryReady;
+        std::condition_variable   m_entryWritten;
+    };
+    
+    /**
+     * Reads a trace written by TraceWriter, frame by frame
+     */
+    class TraceReader
+    {
+    public:
+        TraceReader();
+        
+        /**
+         * Read the header of a trace, false if it isn't one
+         */
+        bool open(const std::string& path);
+        
+        /**
+         * Next frame & the configuration it was found with, false at the end of the trace.
+         * A trace cut short, e.g. by a crash, ends at its last complete frame.
+         */
+        bool next(TraceFrame& frame, TraceConfig& config);
+        
+        const std::string& getFeatureBackend() const { return m_featureBackend; }
+        MatcherType getMatcherType() const { return m_matcherType; }
+        double getTickFrequency() const { return m_tickFrequency; }
+        TraceWriter::FrameEncoding getEncoding() const { return m_encoding; }
+        const cv::Mat& getCameraMatrix() const { return m_cameraMatrix; }   // empty if the poses weren't solved
+        const cv::Mat& getDistCoeffs() const { return m_distCoeffs; }
+    
+    private:
+        std::ifstream             m_file;
+        std::string               m_featureBackend;
+        MatcherType               m_matcherType;
+        double                    m_tickFrequency;
+        TraceWriter::FrameEncoding m_encoding;
+        cv::Mat                   m_cameraMatrix;
+        cv::Mat                   m_distCoeffs;
+        TraceConfig               m_config;
+        std::vector<uchar>        m_buffer;
+    };
+    
+}
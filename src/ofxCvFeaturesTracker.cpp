@@ -11,43 +11,113 @@
 using namespace cv;
 
 namespace ofxCv {
-
-    void FeaturesTracker::setup(Calibration _calibration){
+    
+    void FeaturesTracker::setup(Calibration _calibration, cv::MatcherType matcherType){
         calibration = _calibration;
-        tracker.setup();
+        tracker.setup(matcherType);
+        if(profiler.empty()) profiler = new TrackerProfiler();
         found = false;
     }
-
-    void FeaturesTracker::add(ofBaseHasPixels & img){
-        tracker.add(toCv(img));
+    
+    void FeaturesTracker::setLatencyTarget(double latencyTarget){
+        if(latencyTarget > 0){
+            if(enableQualityControl) quality.targetMs = latencyTarget;
+            else quality.setup(tracker, latencyTarget);
+            enableQualityControl = true;
+        }
+        else if(enableQualityControl){
+            quality.reset(tracker);
+            enableQualityControl = false;
+        }
     }
-
+    
+    bool FeaturesTracker::startTrace(const std::string & path, const cv::TraceWriter::Options & options){
+        cv::TraceWriter::Options traceOptions = options;
+        if(traceOptions.cameraMatrix.empty()){
+            traceOptions.cameraMatrix = calibration.getDistortedIntrinsics().getCameraMatrix();
+            traceOptions.distCoeffs = calibration.getDistCoeffs();
+        }
+        if(trace.empty()) trace = new TraceWriter();
+        bool opened = trace->open(ofToDataPath(path), tracker, traceOptions);
+        if(!opened) ofLogError() << "couldn't write a trace to " << path;
+        return opened;
+    }
+    
+    void FeaturesTracker::stopTrace(){
+        if(!trace.empty()) trace->close();
+    }
+    
+    int FeaturesTracker::add(ofBaseHasPixels & img){
+        return tracker.add(toCv(img));
+    }
+    
+    int FeaturesTracker::add(const cv::Mat & img){
+        return tracker.add(img);
+    }
+    
+    int FeaturesTracker::load(const std::string & path){
+        int numLoaded = tracker.load(ofToDataPath(path));
+        if(numLoaded < 0) ofLogError() << "couldn't load patterns from " << path;
+        return numLoaded;
+    }
+    
+    bool FeaturesTracker::loadVocabulary(const std::string & path){
+        bool loaded = tracker.loadVocabulary(ofToDataPath(path));
+        if(!loaded) ofLogError() << "couldn't load a vocabulary from " << path;
+        return loaded;
+    }
+    
     void FeaturesTracker::update(ofBaseHasPixels & frame){
+        update(toCv(frame));
+    }
+    
+    void FeaturesTracker::update(const unsigned char * pixels, int width, int height, size_t stride, cv::PixelFormat format){
+        update(wrapPixels(pixels, width, height, stride, format), format);
+    }
+    
+    void FeaturesTracker::update(const cv::Mat & frame, cv::PixelFormat format, int64 ticks){
         
-        int prevMillis = ofGetElapsedTimeMillis();
+        int64 start = getTickCount();
         
-        found = tracker.find(toCv(frame));
+        found = tracker.find(frame, format, ticks);
         
+        // solved once per frame, getModelMatrix() & getRT() reuse it for the same camera
+        Mat cameraMatrix = calibration.getDistortedIntrinsics().getCameraMatrix();
+        poses = tracker.getPoses(cameraMatrix, calibration.getDistCoeffs());
+        pose = tracker.getPose(cameraMatrix, calibration.getDistCoeffs());
         if(found){
-            Mat rvec, tvec;
-            Mat cameraMatrix = calibration.getDistortedIntrinsics().getCameraMatrix();
-            tracker.getPose(cameraMatrix, calibration.getDistCoeffs(), rvec, tvec);
+            rvec = pose.rvec;
+            tvec = pose.tvec;
             modelMatrix = makeMatrix(rvec, tvec);
         }
+        modelMatrices.resize(poses.size());
+        for(size_t i = 0; i < poses.size(); i++){
+            modelMatrices[i] = makeMatrix(poses[i].rvec, poses[i].tvec);
+        }
         
-        updateTime = ofGetElapsedTimeMillis()-prevMillis;
+        // the pose is solved out of find(), the total covers both
+        StageTimings timings = tracker.getTimings();
+        timings.total = (getTickCount() - start) * 1000. / getTickFrequency();
+        profiler->record(timings, tracker.getCounters());
+        
+        // before the quality controller changes the settings for the next frame
+        if(isTracing()) trace->record(tracker, frame, format, poses);
+        
+        // the next frame runs at the operating point chosen from this one
+        if(enableQualityControl) quality.update(tracker, timings.total);
+        
+        updateTime = timings.total;
     }
-
+    
     ofMatrix4x4 & FeaturesTracker::getModelMatrix(cv::Mat & cameraMatrix, cv::Mat & distCoefs){
         
         if(found){
-            Mat rvec, tvec;
-            tracker.getPose(cameraMatrix, distCoefs, rvec, tvec);
-            modelMatrix = makeMatrix(rvec, tvec);
+            const cv::Pose & p = tracker.getPose(cameraMatrix, distCoefs);
+            modelMatrix = makeMatrix(p.rvec, p.tvec);
         }
         return modelMatrix;
     }
-
+    
     bool FeaturesTracker::getRT(const cv::Mat & cameraMatrix, const cv::Mat & distCoefs, cv::Mat & rvec, cv::Mat & tvec){
         if(found){
             tracker.getPose(cameraMatrix, distCoefs, rvec, tvec);
@@ -57,7 +127,7 @@ namespace ofxCv {
             return false;
         }
     }
-
+    
     void FeaturesTracker::draw(){
         
         ofPushStyle();
@@ -75,34 +145,34 @@ namespace ofxCv {
         
         ofPopStyle();
     }
-
+    
     #pragma mark - Private
-
+    
     void FeaturesTracker::drawImgKeyPoints(){
         int length = 2;
         ofPushMatrix();
         ofTranslate(640, 0);
-        std::vector<cv::KeyPoint> keyPts = getPatternKeyPoints();
+        const std::vector<cv::KeyPoint> & keyPts = getPatternKeyPoints();
         for (auto & pt : keyPts) {
             ofLine(pt.pt.x-length, pt.pt.y, pt.pt.x+length, pt.pt.y);
             ofLine(pt.pt.x, pt.pt.y-length, pt.pt.x, pt.pt.y+length);
         }
         ofPopMatrix();
     }
-
+    
     void FeaturesTracker::drawQueryPoints(){
         int length = 2;
-        std::vector<cv::KeyPoint> keyPts = getQueryKeyPoints();
+        const std::vector<cv::KeyPoint> & keyPts = getQueryKeyPoints();
         for (auto & pt : keyPts) {
             ofLine(pt.pt.x-length, pt.pt.y, pt.pt.x+length, pt.pt.y);
             ofLine(pt.pt.x, pt.pt.y-length, pt.pt.x, pt.pt.y+length);
         }
     }
-
+    
     void FeaturesTracker::drawMatches(){
-        std::vector<cv::KeyPoint> pKeyPts = getPatternKeyPoints();
-        std::vector<cv::KeyPoint> keyPts = getQueryKeyPoints();
-        std::vector<cv::DMatch> matches = getMatches();
+        const std::vector<cv::KeyPoint> & pKeyPts = getPatternKeyPoints();
+        const std::vector<cv::KeyPoint> & keyPts = getQueryKeyPoints();
+        const std::vector<cv::DMatch> & matches = getMatches();
         cv::Point2f in, out;
         for (auto & m : matches) {
             in = keyPts[m.queryIdx].pt;
@@ -110,10 +180,15 @@ namespace ofxCv {
             ofLine(in.x, in.y, out.x+640, out.y);
         }
     }
-
+    
     void FeaturesTracker::drawQuad(){
+        for (auto & result : getResults()) {
+            drawQuad(result.points2d);
+        }
+    }
+    
+    void FeaturesTracker::drawQuad(const std::vector<cv::Point2f> & pts){
         int i;
-        const auto & pts = getQuad();
         for (i=0; i<pts.size()-1; i++){
             const Point2f & p = pts[i];
             const Point2f & pn = pts[i+1];
@@ -11,47 +11,107 @@
 #include "ofMain.h"
 #include "ofxCv.h"
 #include "PatternTracker.h"
+#include "QualityController.h"
+#include "TrackerTrace.h"
 
 namespace ofxCv {
-
+    
     class FeaturesTracker {
-        
+    
     public:
         
+        FeaturesTracker() : found(false), updateTime(0), enableQualityControl(false) {}
         virtual ~FeaturesTracker(){ ofLog() << "destroying featuresTracker"; }
         
-        void setup(ofxCv::Calibration calibration);
-        void add(ofBaseHasPixels & img);
+        void setup(ofxCv::Calibration calibration, cv::MatcherType matcherType = cv::MATCHER_PACKED_HAMMING);
+        
+        // detector & descriptor of the patterns & frames, "orb" by default, see cv::FeatureBackend.
+        // Set it before adding patterns, false if there's no backend of this name.
+        bool setFeatureBackend(const std::string & name) { return tracker.setFeatureBackend(name); }
+        
+        // every update is recorded into the profiler, which can be shared with other threads
+        // reading its statistics. setup() creates one if none was set.
+        void setProfiler(cv::Ptr<cv::TrackerProfiler> _profiler) { profiler = _profiler; }
+        int add(ofBaseHasPixels & img);
+        int add(const cv::Mat & img);
+        int load(const std::string & path);
+        
+        // match the frames with the patterns sharing the most visual words with them only, for
+        // catalogs of thousands of patterns. The vocabulary is built by the buildVocabulary tool.
+        bool loadVocabulary(const std::string & path);
         void update(ofBaseHasPixels & frame);
+        // ticks : cv::getTickCount() when the frame was captured, now if 0, see cv::PatternTracker::find()
+        void update(const cv::Mat & frame, cv::PixelFormat format = cv::PIXEL_FORMAT_AUTO, int64 ticks = 0);
+        
+        // camera buffers read in place, only their luma being tracked : pass the start of
+        // NV12, NV21 & I420 buffers as cv::PIXEL_FORMAT_Y. stride is in bytes, 0 if contiguous.
+        void update(const unsigned char * pixels, int width, int height, size_t stride, cv::PixelFormat format);
         void draw();
         
+        // adapt the keypoint budget, pyramid, rescale & refinement frame by frame to hold the
+        // p95 update time under latencyTarget ms, see cv::QualityController. 0 to turn it off.
+        void setLatencyTarget(double latencyTarget);
+        const cv::QualityController & getQualityController() const { return quality; }
+        cv::OperatingPoint getOperatingPoint() const { return tracker.getOperatingPoint(); }
+        
+        // record the frames, settings & results of every update into a trace, to replay them offline with
+        // the replayTrace tool, see cv::TraceWriter. The poses are recorded with the calibration of the setup.
+        bool startTrace(const std::string & path, const cv::TraceWriter::Options & options = cv::TraceWriter::Options());
+        void stopTrace();
+        bool isTracing() const { return !trace.empty() && trace->isOpen(); }
+        
         virtual bool isFound() const { return found; }
+        virtual int getPatternIndex() const { return tracker.getInfo().patternIdx; }
+        virtual int getNumPatterns() const { return tracker.getDatabase().size(); }
+        virtual const std::vector<cv::TrackingInfo> & getResults() const { return tracker.getResults(); }
         
         virtual int getUpdateTime() const { return updateTime; }
         virtual int getNumFeatures() const { return tracker.getQueryKeyPoints().size(); }
         virtual int getNumMatches() const { return tracker.getMatches().size(); }
+        virtual cv::TrackingPath getLastPath() const { return tracker.getLastPath(); }
+        virtual const cv::StageTimings & getTimings() const { return tracker.getTimings(); }
+        virtual const cv::FrameCounters & getCounters() const { return tracker.getCounters(); }
+        const cv::TrackerProfiler & getProfiler() const { return *profiler; }
         
-        virtual std::vector<cv::KeyPoint> getPatternKeyPoints() const { return tracker.getPatternKeyPoints(); }
-        virtual std::vector<cv::KeyPoint> getQueryKeyPoints() const { return tracker.getQueryKeyPoints(); }
-        virtual std::vector<cv::DMatch> getMatches() const { return tracker.getMatches(); }
-        virtual std::vector<cv::Point2f> getQuad() const { return tracker.getQuad(); }
+        // references to the tracker buffers, valid until the next update
+        virtual const std::vector<cv::KeyPoint> & getPatternKeyPoints() const { return tracker.getPatternKeyPoints(); }
+        virtual const std::vector<cv::KeyPoint> & getQueryKeyPoints() const { return tracker.getQueryKeyPoints(); }
+        virtual const std::vector<cv::DMatch> & getMatches() const { return tracker.getMatches(); }
+        virtual const std::vector<cv::Point2f> & getQuad() const { return tracker.getQuad(); }
         
+        // pose of the last update(), with the index & cv::getTickCount() of its frame
+        const cv::Pose & getPose() const { return pose; }
         virtual ofMatrix4x4 & getModelMatrix() { return modelMatrix; }
         virtual ofMatrix4x4 & getModelMatrix(cv::Mat & cameraMatrix, cv::Mat & distCoefs);
         virtual bool getRT(const cv::Mat & cameraMatrix, const cv::Mat & distCoefs, cv::Mat & rvec, cv::Mat & tvec);
         
+        // poses & model matrices of every pattern found by the last update(), in the order of getResults()
+        const std::vector<cv::Pose> & getPoses() const { return poses; }
+        const std::vector<ofMatrix4x4> & getModelMatrices() const { return modelMatrices; }
+        
+        cv::PatternTracker & getPatternTracker() { return tracker; }
+    
     protected:
         
         void drawImgKeyPoints();
         void drawQueryPoints();
         void drawMatches();
         void drawQuad();
+        void drawQuad(const std::vector<cv::Point2f> & pts);
         
         bool found;
         int updateTime;
         cv::PatternTracker tracker;
+        cv::Ptr<cv::TrackerProfiler> profiler;
+        cv::QualityController quality;
+        bool enableQualityControl;
+        cv::Ptr<cv::TraceWriter> trace;
         Calibration calibration;
         ofMatrix4x4 modelMatrix;
+        cv::Mat rvec, tvec;
+        cv::Pose pose;
+        std::vector<cv::Pose> poses;
+        std::vector<ofMatrix4x4> modelMatrices;
     };
-
+    
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+//
+//  ofxCvFeaturesTrackerMultiCamera.h
+//
+//  openFrameworks wrapper of MultiCameraTracker.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "ofxCvFeaturesTrackerThreaded.h"
+#include "MultiCameraTracker.h"
+
+namespace ofxCv {
+    
+    /**
+     * Tracks the same patterns in several cameras through a cv::MultiCameraTracker : one pattern database
+     * and one pool of workers for all the cameras, instead of a FeaturesTrackerThreaded per camera.
+     * Each camera has its own calibration & latency target, and publishes its own results.
+     */
+    class FeaturesTrackerMultiCamera {
+    
+    public:
+        
+        ~FeaturesTrackerMultiCamera() {
+            ofLog() << "destroying multi camera tracker";
+            tracker.stop();
+        }
+        
+        void setup(cv::MatcherType matcherType = cv::MATCHER_PACKED_HAMMING){
+            tracker.setup(matcherType);
+            tracker.setCallback([this](int camera, cv::PatternTracker & cameraTracker, const cv::MultiCameraTracker::Result & r){
+                publish(camera, cameraTracker, r);
+            });
+        }
+        
+        // see FeaturesTracker::setFeatureBackend(). Call it before adding the cameras.
+        bool setFeatureBackend(const std::string & name){
+            return tracker.setFeatureBackend(name);
+        }
+        
+        // cameras are added before start(), latencyTarget in ms
+        int addCamera(ofxCv::Calibration calibration, double latencyTarget = 33){
+            cv::Mat cameraMatrix = calibration.getDistortedIntrinsics().getCameraMatrix();
+            results.push_back(std::shared_ptr<const TrackingResult>(new TrackingResult()));
+            return tracker.addCamera(cameraMatrix, calibration.getDistCoeffs(), latencyTarget);
+        }
+        
+        void start(int numWorkers = 2){
+            tracker.start(numWorkers);
+        }
+        
+        // patterns are added between two frames, once the frames in flight are done
+        int add(ofBaseHasPixels & img){
+            return tracker.add(toCv(img));
+        }
+        
+        int load(const std::string & path){
+            int numLoaded = tracker.load(ofToDataPath(path));
+            if(numLoaded < 0) ofLogError() << "couldn't load patterns from " << path;
+            return numLoaded;
+        }
+        
+        // see FeaturesTracker::loadVocabulary()
+        bool loadVocabulary(const std::string & path){
+            bool loaded = tracker.loadVocabulary(ofToDataPath(path));
+            if(!loaded) ofLogError() << "couldn't load a vocabulary from " << path;
+            return loaded;
+        }
+        
+        // the frame is copied, replacing the previous frame of the camera if no worker took it yet
+        void update(int camera, ofBaseHasPixels & frame){
+            tracker.push(camera, toCv(frame));
+        }
+        
+        // camera buffers, see FeaturesTracker::update() : the Y plane or the packed pixels are queued, without conversion
+        void update(int camera, const unsigned char * pixels, int width, int height, size_t stride, cv::PixelFormat format){
+            tracker.push(camera, cv::wrapPixels(pixels, width, height, stride, format), format);
+        }
+        
+        std::shared_ptr<const TrackingResult> getResult(int camera) {
+            std::lock_guard<std::mutex> guard(resultMutex);
+            return results[camera];
+        }
+        
+        /**
+         * Statistics of the last frames of a camera, the total being the latency from update() to the result
+         */
+        const cv::TrackerProfiler & getProfiler(int camera) const { return tracker.getProfiler(camera); }
+        cv::MultiCameraTracker & getMultiCameraTracker() { return tracker; }
+        
+        bool isFound(int camera) { return getResult(camera)->found; }
+        int getPatternIndex(int camera) { return getResult(camera)->patternIndex; }
+        ofMatrix4x4 getModelMatrix(int camera) { return getResult(camera)->modelMatrix; }
+        std::vector<cv::Pose> getPoses(int camera) { return getResult(camera)->poses; }
+        std::vector<ofMatrix4x4> getModelMatrices(int camera) { return getResult(camera)->modelMatrices; }
+        
+        bool getRT(int camera, cv::Mat & rvec_out, cv::Mat & tvec_out) {
+            std::shared_ptr<const TrackingResult> r = getResult(camera);
+            r->rvec.copyTo(rvec_out);
+            r->tvec.copyTo(tvec_out);
+            return r->found;
+        }
+    
+    protected:
+        
+        // runs on a worker, in frame order for each camera
+        void publish(int camera, cv::PatternTracker & cameraTracker, const cv::MultiCameraTracker::Result & tracked) {
+            const cv::FrameData & frame = cameraTracker.getFrame();
+            
+            std::shared_ptr<TrackingResult> r(new TrackingResult());
+            r->found            = tracked.found;
+            r->patternIndex     = tracked.patternIdx;
+            r->numPatterns      = cameraTracker.getDatabase().size();
+            r->numFeatures      = frame.queryKeypoints.size();
+            r->numMatches       = frame.matches.size();
+            r->lastPath         = tracked.path;
+            r->operatingPoint   = cameraTracker.getOperatingPoint();
+            r->timings          = tracked.timings;
+            r->updateTime       = tracked.timings.total;
+            r->patternKeyPoints = cameraTracker.getPatternKeyPoints();
+            r->queryKeyPoints   = frame.queryKeypoints;
+            r->matches          = frame.matches;
+            r->quad             = tracked.quad;
+            r->results          = tracked.results;
+            r->poses            = tracked.poses;
+            r->rvec             = tracked.rvec;
+            r->tvec             = tracked.tvec;
+            r->frameIndex       = tracked.frameIndex;
+            r->frameTicks       = tracked.frameTicks;
+            if(r->found) r->modelMatrix = makeMatrix(r->rvec, r->tvec);
+            for(auto & pose : r->poses) r->modelMatrices.push_back(makeMatrix(pose.rvec, pose.tvec));
+            
+            std::lock_guard<std::mutex> guard(resultMutex);
+            results[camera] = r;
+        }
+    
+    private:
+        
+        cv::MultiCameraTracker tracker;
+        
+        std::vector< std::shared_ptr<const TrackingResult> > results;
+        std::mutex resultMutex;
+    };
+    
+}
@@ -0,0 +1,198 @@
+//
+//  ofxCvFeaturesTrackerPipelined.h
+//
+//  openFrameworks wrapper of PipelinedTracker.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "ofxCvFeaturesTrackerThreaded.h"
+#include "PipelinedTracker.h"
+#include "PatternUpdater.h"
+
+namespace ofxCv {
+    
+    /**
+     * Same interface as FeaturesTrackerThreaded, but the frames go through a cv::PipelinedTracker :
+     * several workers extract & match consecutive frames at once, so that the throughput scales
+     * with the cores while the results are still published in frame order.
+     */
+    class FeaturesTrackerPipelined {
+    
+    public:
+        
+        FeaturesTrackerPipelined()
+        :databaseVersion(0)
+        ,result(new TrackingResult())
+        ,profiler(new cv::TrackerProfiler())
+        {}
+        
+        ~FeaturesTrackerPipelined() {
+            ofLog() << "destroying pipelined tracker";
+            updater.stop();
+            pipeline.stop();
+        }
+        
+        void setup(ofxCv::Calibration calib, cv::MatcherType matcherType = cv::MATCHER_PACKED_HAMMING, int numWorkers = 2){
+            calibration = calib;
+            pipeline.getTracker().setup(matcherType);
+            pipeline.setCallback([this](cv::PatternTracker & tracker){ publish(tracker); });
+            pipeline.start(numWorkers);
+            updater.start(pipeline.getTracker());
+        }
+        
+        // see FeaturesTracker::setFeatureBackend(). Call it before setup().
+        bool setFeatureBackend(const std::string & name){
+            return pipeline.getTracker().setFeatureBackend(name);
+        }
+        
+        // patterns are described by the updater's thread, then swapped in by update() once the frames in flight are done
+        void add(ofBaseHasPixels & img){
+            updater.add(toCv(img.getPixelsRef()));
+        }
+        
+        void load(const std::string & path){
+            updater.load(ofToDataPath(path));
+        }
+        
+        // the indices of the patterns stay the same, a removed pattern leaves an empty slot
+        void replace(int index, ofBaseHasPixels & img){
+            updater.replace(index, toCv(img.getPixelsRef()));
+        }
+        
+        void remove(int index){
+            updater.remove(index);
+        }
+        
+        int getNumPendingPatterns() const { return updater.getNumPending(); }
+        
+        // see FeaturesTracker::loadVocabulary(), the pending patterns are swapped in first
+        bool loadVocabulary(const std::string & path){
+            updater.flush();
+            swapDatabase();
+            bool loaded = pipeline.loadVocabulary(ofToDataPath(path));
+            if(!loaded) ofLogError() << "couldn't load a vocabulary from " << path;
+            updater.start(pipeline.getTracker());
+            return loaded;
+        }
+        
+        // the frame is copied, the oldest queued frame is dropped if the workers fall behind
+        void update(ofBaseHasPixels & frame){
+            swapDatabase();
+            pipeline.push(toCv(frame));
+        }
+        
+        // camera buffers, see FeaturesTracker::update() : the Y plane or the packed pixels are queued, without conversion
+        void update(const unsigned char * pixels, int width, int height, size_t stride, cv::PixelFormat format){
+            swapDatabase();
+            pipeline.push(cv::wrapPixels(pixels, width, height, stride, format), format);
+        }
+        
+        std::shared_ptr<const TrackingResult> getResult() {
+            std::lock_guard<std::mutex> guard(resultMutex);
+            return result;
+        }
+        
+        /**
+         * Statistics of the last frames, the total being the latency from update() to the result
+         */
+        const cv::TrackerProfiler & getProfiler() const { return *profiler; }
+        cv::PipelinedTracker & getPipeline() { return pipeline; }
+        
+        bool isFound(){
+            return getResult()->found;
+        }
+        
+        int getPatternIndex() { return getResult()->patternIndex; }
+        int getNumPatterns() { return getResult()->numPatterns; }
+        std::vector<cv::TrackingInfo> getResults() { return getResult()->results; }
+        
+        int getNumFeatures() { return getResult()->numFeatures; }
+        int getNumMatches() { return getResult()->numMatches; }
+        int getUpdateTime() { return getResult()->updateTime; }
+        cv::TrackingPath getLastPath() { return getResult()->lastPath; }
+        cv::StageTimings getTimings() { return getResult()->timings; }
+        
+        std::vector<cv::KeyPoint> getPatternKeyPoints() { return getResult()->patternKeyPoints; }
+        std::vector<cv::KeyPoint> getQueryKeyPoints() { return getResult()->queryKeyPoints; }
+        std::vector<cv::DMatch>   getMatches() { return getResult()->matches; }
+        std::vector<cv::Point2f>  getQuad() { return getResult()->quad; }
+        
+        ofMatrix4x4 getModelMatrix() { return getResult()->modelMatrix; }
+        std::vector<cv::Pose> getPoses() { return getResult()->poses; }
+        std::vector<ofMatrix4x4> getModelMatrices() { return getResult()->modelMatrices; }
+        
+        bool getRT(cv::Mat & rvec_out, cv::Mat & tvec_out) {
+            std::shared_ptr<const TrackingResult> r = getResult();
+            r->rvec.copyTo(rvec_out);
+            r->tvec.copyTo(tvec_out);
+            return r->found;
+        }
+    
+    protected:
+        
+        void swapDatabase() {
+            cv::Ptr<cv::PatternDatabase> database;
+            if(updater.poll(databaseVersion, database)){
+                pipeline.setDatabase(database);
+            }
+        }
+        
+        // runs on a worker, one frame at a time & in order
+        void publish(cv::PatternTracker & tracker) {
+            const cv::FrameData & frame = tracker.getFrame();
+            
+            std::shared_ptr<TrackingResult> r(new TrackingResult());
+            r->found            = frame.found;
+            r->patternIndex     = tracker.getInfo().patternIdx;
+            r->numPatterns      = tracker.getDatabase().size();
+            r->numFeatures      = frame.queryKeypoints.size();
+            r->numMatches       = frame.matches.size();
+            r->lastPath         = frame.path;
+            r->operatingPoint   = tracker.getOperatingPoint();
+            r->patternKeyPoints = tracker.getPatternKeyPoints();
+            r->queryKeyPoints   = frame.queryKeypoints;
+            r->matches          = frame.matches;
+            r->quad             = tracker.getQuad();
+            r->results          = frame.results;
+            
+            r->frameIndex       = frame.index;
+            r->frameTicks       = frame.ticks;
+            
+            // solved once per frame, also when lost so that the pose filter restarts
+            cv::Mat cameraMatrix = calibration.getDistortedIntrinsics().getCameraMatrix();
+            r->poses = tracker.getPoses(cameraMatrix, calibration.getDistCoeffs());
+            if(r->found){
+                r->rvec = r->poses[0].rvec;
+                r->tvec = r->poses[0].tvec;
+                r->modelMatrix = makeMatrix(r->rvec, r->tvec);
+            }
+            for(auto & pose : r->poses){
+                r->modelMatrices.push_back(makeMatrix(pose.rvec, pose.tvec));
+            }
+            
+            // the pipeline set the total to the latency since the frame was pushed
+            r->timings          = tracker.getTimings();
+            r->updateTime       = r->timings.total;
+            profiler->record(r->timings, tracker.getCounters());
+            
+            std::lock_guard<std::mutex> guard(resultMutex);
+            result = r;
+        }
+    
+    private:
+        
+        cv::PipelinedTracker pipeline;
+        cv::PatternUpdater updater;
+        unsigned long long databaseVersion;
+        
+        std::shared_ptr<const TrackingResult> result;
+        std::mutex resultMutex;
+        
+        cv::Ptr<cv::TrackerProfiler> profiler;
+        
+        Calibration calibration;
+    };
+    
+}
@@ -10,136 +10,340 @@
 
 #include "ofMain.h"
 #include "ofxCvFeaturesTracker.h"
+#include "PatternUpdater.h"
+#include "PosePredictor.h"
 
-namespace ofxCv {
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
-    class FeaturesTrackerThreaded : public ofThread {
+namespace ofxCv {
+    
+    /**
+     * Immutable snapshot of the tracker state after one frame.
+     * Published by the tracking thread, shared with the readers without copy.
+     */
+    struct TrackingResult {
+        
+        TrackingResult()
+        :found(false)
+        ,patternIndex(-1)
+        ,numPatterns(0)
+        ,numFeatures(0)
+        ,numMatches(0)
+        ,updateTime(0)
+        ,lastPath(cv::TRACKING_PATH_NONE)
+        ,frameIndex(-1)
+        ,frameTicks(0)
+        {}
+        
+        bool found;
+        int patternIndex;
+        int numPatterns;
+        int numFeatures;
+        int numMatches;
+        int updateTime;
+        cv::TrackingPath lastPath;
+        cv::StageTimings timings;
+        cv::OperatingPoint operatingPoint;  // settings the frame was tracked with
+        
+        std::vector<cv::KeyPoint> patternKeyPoints;
+        std::vector<cv::KeyPoint> queryKeyPoints;
+        std::vector<cv::DMatch> matches;
+        std::vector<cv::Point2f> quad;
+        std::vector<cv::TrackingInfo> results;
+        
+        ofMatrix4x4 modelMatrix;
+        cv::Mat rvec, tvec;
+        
+        // of every pattern found, in the order of results
+        std::vector<cv::Pose> poses;
+        std::vector<ofMatrix4x4> modelMatrices;
         
+        // the frame the pose comes from : its index & cv::getTickCount() when it was captured
+        long long frameIndex;
+        int64 frameTicks;
+    };
+    
+    class FeaturesTrackerThreaded : public ofThread {
+    
     public:
         
         FeaturesTrackerThreaded()
-        :needUpdateFront(false)
-        ,needUpdateBack(false)
-        ,bFound(false)
+        :writeIndex(0)
+        ,readyIndex(1)
+        ,readIndex(2)
+        ,hasNewFrame(false)
+        ,nextFrameIndex(0)
+        ,result(new TrackingResult())
+        ,profiler(new cv::TrackerProfiler())
+        ,enablePoseFilter(false)
+        ,latencyTarget(0)
+        ,featureBackend("orb")
         {}
         
         ~FeaturesTrackerThreaded() {
             ofLog() << "destroying threaded tracker";
             stopThread();
+            frameReady.notify_all();
+            waitForThread(false);
         }
         
-        void setup(ofxCv::Calibration calib){
+        void setup(ofxCv::Calibration calib, cv::MatcherType _matcherType = cv::MATCHER_PACKED_HAMMING){
             calibration = calib;
-            frameFront.setUseTexture(false);
-            frameBack = new ofImage();
-            frameBack->setUseTexture(false);
+            matcherType = _matcherType;
+        }
+        
+        // smooth the poses over the consecutive frames, see cv::PoseFilter. Call it before starting the thread.
+        void setPoseFilter(bool enabled, const cv::PoseFilter & filter = cv::PoseFilter()){
+            enablePoseFilter = enabled;
+            poseFilter = filter;
+        }
+        
+        // adapt the tracking quality to hold the p95 update time under latencyTarget ms,
+        // see FeaturesTracker::setLatencyTarget(). Call it before starting the thread.
+        void setLatencyTarget(double _latencyTarget){
+            latencyTarget = _latencyTarget;
+        }
+        
+        // see FeaturesTracker::setFeatureBackend(). Call it before starting the thread.
+        bool setFeatureBackend(const std::string & name){
+            if(cv::FeatureBackend::create(name).empty()) return false;
+            featureBackend = name;
+            return true;
+        }
+        
+        // record every update into a trace, see FeaturesTracker::startTrace(). Call it before starting the thread.
+        void setTrace(const std::string & path, const cv::TraceWriter::Options & options = cv::TraceWriter::Options()){
+            tracePath = path;
+            traceOptions = options;
+        }
+        
+        // see FeaturesTracker::loadVocabulary(), loaded by the tracking thread. Call it before starting the thread.
+        void loadVocabulary(const std::string & path){
+            vocabularyPath = path;
         }
         
         void add(ofBaseHasPixels & img){
-            bool bRestart = isThreadRunning();
-            if(bRestart){
-                stopThread();
-                ofSleepMillis(100);
-            }
-            imgs.push_back(&img);
-            if(bRestart) startThread(true, false);
+            // the image is copied and described on the updater's thread, the tracking thread
+            // swaps the new patterns in between two frames and keeps tracking at full rate meanwhile
+            updater.add(toCv(img.getPixelsRef()));
+        }
+        
+        void load(const std::string & path){
+            updater.load(ofToDataPath(path));
+        }
+        
+        // the indices of the patterns stay the same, a removed pattern leaves an empty slot
+        void replace(int index, ofBaseHasPixels & img){
+            updater.replace(index, toCv(img.getPixelsRef()));
         }
         
-        void update(ofBaseHasPixels & _frame){
-            lock();
-            frameFront.setFromPixels( _frame.getPixelsRef() );
-            needUpdateFront = true;
-            unlock();
+        void remove(int index){
+            updater.remove(index);
         }
         
+        // edits not swapped in yet, see cv::PatternUpdater
+        int getNumPendingPatterns() const { return updater.getNumPending(); }
+        
+        // captureTicks : cv::getTickCount() when the frame was captured, e.g. from the timestamp of the camera
+        // driver, the time of the call if 0. The poses & their prediction are timed from it.
+        void update(ofBaseHasPixels & _frame, int64 captureTicks = 0){
+            // frames are triple buffered : the tracking thread never reads the slot we write to,
+            // so the copy happens outside of the lock, which only protects the swap of the indices
+            const ofPixels & pixels = _frame.getPixelsRef();
+            frames[writeIndex].pixels.setFromPixels(pixels.getPixels(), pixels.getWidth(), pixels.getHeight(), pixels.getNumChannels());
+            frames[writeIndex].format = cv::PIXEL_FORMAT_AUTO;
+            publishFrame(captureTicks);
+        }
+        
+        // camera buffers, see FeaturesTracker::update() : only their luma is copied, in a single pass
+        void update(const unsigned char * pixels, int width, int height, size_t stride, cv::PixelFormat format, int64 captureTicks = 0){
+            cv::Mat src = cv::wrapPixels(pixels, width, height, stride, format);
+            frames[writeIndex].pixels.allocate(width, height, 1);
+            cv::Mat luma = toCv(frames[writeIndex].pixels);
+            if(format == cv::PIXEL_FORMAT_Y) src.copyTo(luma);
+            else cv::extractLuma(src, format, 1, luma);
+            frames[writeIndex].format = cv::PIXEL_FORMAT_Y;
+            publishFrame(captureTicks);
+        }
+        
+        /**
+         * Last published result, consistent & safe to keep while the tracker moves on
+         */
+        std::shared_ptr<const TrackingResult> getResult() {
+            std::lock_guard<std::mutex> guard(resultMutex);
+            return result;
+        }
+        
+        /**
+         * Statistics of the last frames, readable at any time without blocking the tracking thread
+         */
+        const cv::TrackerProfiler & getProfiler() const { return *profiler; }
+        
         bool isFound(){
-            return bFound;
+            return getResult()->found;
         }
         
-        int getNumFeatures() { return numFeatures; }
-        int getNumMatches() { return numMatches; }
-        int getUpdateTime() { return updateTime; }
+        int getPatternIndex() { return getResult()->patternIndex; }
+        int getNumPatterns() { return getResult()->numPatterns; }
+        std::vector<cv::TrackingInfo> getResults() { return getResult()->results; }
         
-        std::vector<cv::KeyPoint> getPatternKeyPoints() { return patternKeyPoints; }
-        std::vector<cv::KeyPoint> getQueryKeyPoints() { return queryKeyPoints; }
-        std::vector<cv::DMatch>   getMatches() { return matches; }
-        std::vector<cv::Point2f>  getQuad() { return quad; }
+        int getNumFeatures() { return getResult()->numFeatures; }
+        int getNumMatches() { return getResult()->numMatches; }
+        int getUpdateTime() { return getResult()->updateTime; }
+        cv::TrackingPath getLastPath() { return getResult()->lastPath; }
+        cv::StageTimings getTimings() { return getResult()->timings; }
         
-        ofMatrix4x4 & getModelMatrix() { return modelMatrix; }
+        std::vector<cv::KeyPoint> getPatternKeyPoints() { return getResult()->patternKeyPoints; }
+        std::vector<cv::KeyPoint> getQueryKeyPoints() { return getResult()->queryKeyPoints; }
+        std::vector<cv::DMatch>   getMatches() { return getResult()->matches; }
+        std::vector<cv::Point2f>  getQuad() { return getResult()->quad; }
         
-        bool getRT(cv::Mat & rvec_out, cv::Mat & tvec_out) {
-            rvec.copyTo(rvec_out);
-            tvec.copyTo(tvec_out);
+        ofMatrix4x4 getModelMatrix() { return getResult()->modelMatrix; }
+        
+        // pose of the best pattern extrapolated to ticks (cv::getTickCount() time, now if 0), e.g. when the next
+        // refresh reaches the screen, so that the overlay neither lags nor stair-steps at the display rate.
+        // Lock free, the last model matrix when no pattern is found.
+        ofMatrix4x4 getPredictedModelMatrix(int64 ticks = 0){
+            cv::Pose predicted;
+            if(!predictor.predict(ticks ? ticks : cv::getTickCount(), predicted)) return getModelMatrix();
+            return makeMatrix(predicted.rvec, predicted.tvec);
         }
         
+        // motion model & horizon of the prediction, read by the tracking thread : set them before starting it
+        cv::PosePredictor & getPosePredictor() { return predictor; }
+        std::vector<cv::Pose> getPoses() { return getResult()->poses; }
+        std::vector<ofMatrix4x4> getModelMatrices() { return getResult()->modelMatrices; }
+        
+        bool getRT(cv::Mat & rvec_out, cv::Mat & tvec_out) {
+            std::shared_ptr<const TrackingResult> r = getResult();
+            r->rvec.copyTo(rvec_out);
+            r->tvec.copyTo(tvec_out);
+            return r->found;
+        }
+    
     protected:
         
+        /**
+         * A frame of the triple buffer, timestamped when it was captured
+         */
+        struct Frame {
+            Frame() : format(cv::PIXEL_FORMAT_AUTO), index(0), ticks(0) {}
+            ofPixels pixels;
+            cv::PixelFormat format;
+            long long index;
+            int64 ticks;
+        };
+        
+        void publishFrame(int64 captureTicks){
+            frames[writeIndex].index = nextFrameIndex++;
+            frames[writeIndex].ticks = captureTicks ? captureTicks : cv::getTickCount();
+            
+            std::lock_guard<std::mutex> guard(frameMutex);
+            std::swap(writeIndex, readyIndex);
+            hasNewFrame = true;
+            frameReady.notify_one();
+        }
+        
         void threadedFunction() {
-            threadedTracker = new FeaturesTracker();
-            threadedTracker->setup(calibration);
-            for (auto img : imgs) {
-                threadedTracker->add(*img);
-            }
+            FeaturesTracker tracker;
+            tracker.setProfiler(profiler);
+            tracker.setFeatureBackend(featureBackend);
+            tracker.setup(calibration, matcherType);
+            if(!vocabularyPath.empty()) tracker.loadVocabulary(vocabularyPath);
+            tracker.getPatternTracker().enablePoseFilter = enablePoseFilter;
+            tracker.getPatternTracker().poseFilter = poseFilter;
+            tracker.setLatencyTarget(latencyTarget);
+            if(!tracePath.empty()) tracker.startTrace(tracePath, traceOptions);
+            
+            // the patterns added before the thread started are built on its database as well
+            updater.start(tracker.getPatternTracker());
+            unsigned long long databaseVersion = 0;
+            cv::Ptr<cv::PatternDatabase> database;
+            
             while (isThreadRunning()) {
                 
-                lock();
-                
-                if (needUpdateFront) {
-                    needUpdateBack = needUpdateFront;
-                    frameBack->setFromPixels( frameFront.getPixelsRef() );
-                    needUpdateFront = false;
+                {
+                    // sleep until there's a frame
+                    std::unique_lock<std::mutex> guard(frameMutex);
+                    frameReady.wait_for(guard, std::chrono::milliseconds(100), [this]{
+                        return hasNewFrame || !isThreadRunning();
+                    });
+                    if (!hasNewFrame) continue;
+                    std::swap(readIndex, readyIndex);
+                    hasNewFrame = false;
                 }
                 
-                unlock();
-                
-                if(needUpdateBack) {
-                    // todo : this systematically crash on exit.. need to figure out why :(
-                    threadedTracker->update(*frameBack);
-                    needUpdateBack = false;
-                } else {
-                    ofSleepMillis(10);
+                // a pointer swap, the new patterns were described & indexed by the updater
+                if (updater.poll(databaseVersion, database)) {
+                    tracker.getPatternTracker().setDatabase(database);
                 }
                 
+                Frame & frame = frames[readIndex];
+                const cv::OperatingPoint operatingPoint = tracker.getOperatingPoint();
+                tracker.update(toCv(frame.pixels), frame.format, frame.ticks);
+                predictor.update(tracker.getPose());
                 
-                lock();
-                
-                const auto t = threadedTracker;
-                bFound           = t->isFound();
-                numFeatures      = t->getNumFeatures();
-                numMatches       = t->getNumMatches();
-                updateTime       = t->getUpdateTime();
-                patternKeyPoints = t->getPatternKeyPoints();
-                queryKeyPoints   = t->getQueryKeyPoints();
-                matches          = t->getMatches();
-                quad             = t->getQuad();
+                // the snapshot is built outside of any lock, publishing it is a pointer swap
+                std::shared_ptr<TrackingResult> r(new TrackingResult());
+                r->found            = tracker.isFound();
+                r->patternIndex     = tracker.getPatternIndex();
+                r->numPatterns      = tracker.getNumPatterns();
+                r->numFeatures      = tracker.getNumFeatures();
+                r->numMatches       = tracker.getNumMatches();
+                r->updateTime       = tracker.getUpdateTime();
+                r->lastPath         = tracker.getLastPath();
+                r->timings          = tracker.getTimings();
+                r->operatingPoint   = operatingPoint;
+                r->patternKeyPoints = tracker.getPatternKeyPoints();
+                r->queryKeyPoints   = tracker.getQueryKeyPoints();
+                r->matches          = tracker.getMatches();
+                r->quad             = tracker.getQuad();
+                r->results          = tracker.getResults();
+                r->modelMatrix      = tracker.getModelMatrix();
                 
-                modelMatrix.set( threadedTracker->getModelMatrix().getPtr() );
-                threadedTracker->getRT(calibration.getDistortedIntrinsics().getCameraMatrix(), calibration.getDistCoeffs(), rvec, tvec);
+                // the pose solved by update(), its matrices are never written in place & shared as is
+                r->rvec             = tracker.getPose().rvec;
+                r->tvec             = tracker.getPose().tvec;
+                r->poses            = tracker.getPoses();
+                r->modelMatrices    = tracker.getModelMatrices();
+                r->frameIndex       = frame.index;
+                r->frameTicks       = frame.ticks;
                 
-                unlock();
+                std::lock_guard<std::mutex> guard(resultMutex);
+                result = r;
             }
-            delete threadedTracker;
+            updater.stop();
         }
+    
+    private:
         
-        int numFeatures;
-        int numMatches;
-        ofMatrix4x4 modelMatrix;
-        std::vector<cv::KeyPoint> patternKeyPoints;
-        std::vector<cv::KeyPoint> queryKeyPoints;
-        std::vector<cv::DMatch> matches;
-        std::vector<cv::Point2f> quad;
-        int updateTime;
-        bool bFound;
+        cv::PatternUpdater updater;
+        cv::PosePredictor predictor;
         
-    private:
+        Frame frames[3];
+        int writeIndex, readyIndex, readIndex;
+        bool hasNewFrame;
+        long long nextFrameIndex;
+        std::mutex frameMutex;
+        std::condition_variable frameReady;
+        
+        std::shared_ptr<const TrackingResult> result;
+        std::mutex resultMutex;
+        
+        cv::Ptr<cv::TrackerProfiler> profiler;
         
-        FeaturesTracker * threadedTracker;
-        vector<ofBaseHasPixels*> imgs;
-        bool needUpdateFront, needUpdateBack;
-        ofImage frameFront/*, frameBack */;
-        ofImage * frameBack;
         Calibration calibration;
-        cv::Mat rvec, tvec;
+        cv::MatcherType matcherType;
+        bool enablePoseFilter;
+        cv::PoseFilter poseFilter;
+        double latencyTarget;
+        std::string featureBackend;
+        std::string vocabularyPath;
+        std::string tracePath;
+        cv::TraceWriter::Options traceOptions;
     };
-
+    
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+//
+//  buildVocabulary.cpp
+//
+//  Offline training of the visual vocabulary of a pattern file written by compilePatterns,
+//  loaded with PatternTracker::loadVocabulary() / FeaturesTracker::loadVocabulary() to search
+//  large catalogs coarse to fine.
+//
+//  usage : buildVocabulary <pattern file> <output file> [--branching 10] [--depth 5] [--max-descriptors 500000]
+//
+//  --branching & --depth : shape of the vocabulary tree, up to branching ^ depth words.
+//                          The default 100000 words suit catalogs of a few thousand patterns.
+//  --max-descriptors     : descriptors of the patterns sampled for the training
+//
+
+#include "PatternFile.h"
+#include "BinaryVocabulary.h"
+#include "InvertedIndex.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace cv;
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage : %s <pattern file> <output file> [--branching 10] [--depth 5] [--max-descriptors 500000]\n", argv[0]);
+        return 1;
+    }
+    
+    int branching = 10, depth = 5, maxDescriptors = 500000;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--branching") == 0 && i + 1 < argc)
+            branching = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+            depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-descriptors") == 0 && i + 1 < argc)
+            maxDescriptors = atoi(argv[++i]);
+    }
+    if (branching < 2 || depth < 1 || maxDescriptors < 1)
+    {
+        fprintf(stderr, "branching must be at least 2, depth & max descriptors at least 1\n");
+        return 1;
+    }
+    
+    std::vector<Pattern> patterns;
+    std::string backend;
+    if (!PatternFile::read(argv[1], patterns, 0, &backend) || patterns.empty())
+    {
+        fprintf(stderr, "couldn't read patterns from %s\n", argv[1]);
+        return 1;
+    }
+    
+    // Sample the descriptors of all the patterns, from a fixed seed
+    std::vector< std::pair<int, int> > rows;
+    for (size_t p = 0; p < patterns.size(); p++)
+    {
+        for (int r = 0; r < patterns[p].descriptors.rows; r++)
+            rows.push_back(std::make_pair((int)p, r));
+    }
+    RNG rng(0x5eed);
+    for (size_t i = rows.size(); i > 1; i--)
+        std::swap(rows[i - 1], rows[rng.uniform(0, (int)i)]);
+    rows.resize(std::min(rows.size(), (size_t)maxDescriptors));
+    
+    if (rows.empty())
+    {
+        fprintf(stderr, "%s has no descriptors\n", argv[1]);
+        return 1;
+    }
+    
+    const int descriptorSize = patterns[0].descriptors.cols;
+    Mat descriptors(rows.size(), descriptorSize, CV_8UC1);
+    for (size_t i = 0; i < rows.size(); i++)
+        patterns[rows[i].first].descriptors.row(rows[i].second).copyTo(descriptors.row(i));
+    
+    int64 t0 = getTickCount();
+    BinaryVocabulary vocabulary;
+    vocabulary.train(descriptors, branching, depth);
+    vocabulary.setFeatureBackend(backend);
+    printf("%d words trained on %d descriptors of %d patterns (%s) in %.1f s\n", vocabulary.getNumWords(), (int)rows.size(),
+           (int)patterns.size(), backend.c_str(), (getTickCount() - t0) / getTickFrequency());
+    
+    if (!vocabulary.save(argv[2]))
+    {
+        fprintf(stderr, "couldn't write %s\n", argv[2]);
+        return 1;
+    }
+    
+    // Sanity check : each pattern should retrieve itself first from its own descriptors
+    std::vector< std::vector<int> > words(patterns.size());
+    for (size_t p = 0; p < patterns.size(); p++)
+        vocabulary.transform(patterns[p].descriptors, words[p]);
+    
+    InvertedIndex index;
+    index.build(words, vocabulary.getNumWords());
+    
+    RetrievalScratch scratch;
+    std::vector<int> best;
+    int numFirst = 0;
+    for (size_t p = 0; p < patterns.size(); p++)
+    {
+        index.query(words[p], 1, best, scratch);
+        numFirst += !best.empty() && best[0] == (int)p;
+    }
+    
+    printf("vocabulary written to %s, %d / %d patterns retrieve themselves first\n", argv[2], numFirst, (int)patterns.size());
+    return 0;
+}
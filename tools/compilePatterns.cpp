@@ -0,0 +1,116 @@
+//
+//  compilePatterns.cpp
+//
+//  Offline training of a directory of pattern images into a single pattern file,
+//  loaded at startup with PatternTracker::load() / FeaturesTracker::load() without any detection.
+//
+//  usage : compilePatterns <images directory> <output file> [--matcher bruteforce|packed|lsh|mih] [--backend <name>] [--gray]
+//
+//  --matcher : matcher the tracker will use, its index is stored in the file when it supports it (mih)
+//  --backend : feature backend the tracker will use, orb by default, recorded in the file
+//  --gray    : also store the gray images of the patterns
+//
+
+#include "PatternTracker.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+using namespace cv;
+
+namespace {
+    
+    bool isImage(const std::string& path)
+    {
+        static const char* extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff" };
+        
+        std::string lower = path;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+        {
+            const size_t n = strlen(extensions[i]);
+            if (lower.size() > n && lower.compare(lower.size() - n, n, extensions[i]) == 0)
+                return true;
+        }
+        return false;
+    }
+    
+    std::string baseName(const std::string& path)
+    {
+        size_t slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage : %s <images directory> <output file> [--matcher bruteforce|packed|lsh|mih] [--backend <name>] [--gray]\n", argv[0]);
+        return 1;
+    }
+    
+    MatcherType matcherType = MATCHER_PACKED_HAMMING;
+    std::string backend = "orb";
+    bool withGrayImages = false;
+    
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--gray") == 0)
+            withGrayImages = true;
+        else if (strcmp(argv[i], "--matcher") == 0 && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "bruteforce") matcherType = MATCHER_BRUTEFORCE;
+            else if (name == "packed") matcherType = MATCHER_PACKED_HAMMING;
+            else if (name == "lsh") matcherType = MATCHER_FLANN_LSH;
+            else if (name == "mih") matcherType = MATCHER_MULTI_INDEX_HASH;
+            else
+            {
+                fprintf(stderr, "unknown matcher %s\n", name.c_str());
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            backend = argv[++i];
+    }
+    
+    std::vector<std::string> files;
+    glob(std::string(argv[1]) + "/*", files);
+    files.erase(std::remove_if(files.begin(), files.end(), [](const std::string& f) { return !isImage(f); }), files.end());
+    std::sort(files.begin(), files.end());
+    
+    PatternTracker tracker;
+    if (!tracker.setFeatureBackend(backend))
+    {
+        fprintf(stderr, "unknown feature backend %s\n", backend.c_str());
+        return 1;
+    }
+    tracker.setup(matcherType);
+    
+    int64 t0 = getTickCount();
+    for (const std::string& file : files)
+    {
+        Mat image = imread(file);
+        if (image.empty())
+        {
+            fprintf(stderr, "skipping %s : couldn't read it\n", file.c_str());
+            continue;
+        }
+        
+        int index = tracker.add(image, baseName(file));
+        printf("%4d %-40s %5d keypoints\n", index, baseName(file).c_str(),
+               (int)tracker.getDatabase().getPattern(index).keypoints.size());
+    }
+    
+    if (!tracker.save(argv[2], withGrayImages))
+    {
+        fprintf(stderr, "couldn't write %s\n", argv[2]);
+        return 1;
+    }
+    
+    printf("%d patterns written to %s in %.1f s\n", (int)tracker.getDatabase().size(), argv[2],
+           (getTickCount() - t0) / getTickFrequency());
+    return 0;
+}
@@ -0,0 +1,324 @@
+//
+//  replayTrace.cpp
+//
+//  Offline replay of a trace recorded by cv::TraceWriter, e.g. with FeaturesTracker::startTrace() on a
+//  device in the field. The recorded frames run through a PatternTracker set up like the recording one,
+//  with the settings in effect for each frame & its recorded timestamp, then the outputs are compared
+//  frame by frame : found, tracking path, patterns, corners, counters & poses. The stage timings of
+//  the recording & the replay are summarized side by side, along with the slowest recorded frames :
+//  a slowdown that replays is caused by the frames or the settings and can be bisected with --from & --to,
+//  one that doesn't came from the device.
+//
+//  The replay is bit exact for frames recorded losslessly at full resolution, tracked at a rescale of 1 or with
+//  the fixed point kernels, as only their luma is recorded. The database has to hold the patterns of the
+//  recording in the same order, from pattern files and / or images.
+//
+//  usage : replayTrace <trace> [--patterns <file>] [--pattern <image>] [--vocabulary <file>]
+//                      [--from <frame>] [--to <frame>] [--tolerance <px>] [--csv <file>]
+//
+//  --patterns & --pattern : added in the order they're given
+//  --from & --to          : frame indices of the recording to compare, the frames before --from
+//                           are replayed too, so that the tracker state is the same
+//  --tolerance            : corner distance of the same result, 0.01 px by default
+//  --csv                  : outputs & timings of each compared frame
+//
+//  Returns 2 if any compared frame differs.
+//
+
+#include "TrackerTrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace cv;
+
+namespace {
+    
+    /**
+     * Recorded & replayed timings of a stage, ms
+     */
+    struct StageStats
+    {
+        std::vector<float> recorded, replayed;
+    };
+    
+    /**
+     * Total time of a compared frame, ms
+     */
+    
+    struct FrameTime
+    {
+        long long index;
+        float recorded, replayed;
+    };
+    
+    float percentile(std::vector<float> values, double p)
+    {
+        if (values.empty())
+            return 0;
+        
+        const size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+    
+    double* stage(StageTimings& timings, int s)
+    {
+        double* stages[] = { &timings.resize, &timings.gray, &timings.detection, &timings.description, &timings.matching,
+                             &timings.estimation, &timings.refinement, &timings.tracking, &timings.pose, &timings.total };
+        return stages[s];
+    }
+    
+    const char* stageNames[] = { "resize", "gray", "detection", "description", "matching",
+                                 "estimation", "refinement", "tracking", "pose", "total" };
+    const int numStages = 10;
+    
+    bool sameCounters(const FrameCounters& a, const FrameCounters& b)
+    {
+        return a.keypoints == b.keypoints && a.rawMatches == b.rawMatches && a.ratioTestMatches == b.ratioTestMatches
+            && a.inliers == b.inliers && a.hypotheses == b.hypotheses;
+    }
+    
+    /**
+     * Largest corner distance between the recorded & replayed results, -1 if they aren't the same patterns
+     */
+    float cornerError(const PatternTracker& tracker, const std::vector<TrackingInfo>& recorded)
+    {
+        const std::vector<TrackingInfo>& replayed = tracker.getResults();
+        if (recorded.size() != replayed.size())
+            return -1;
+        
+        float error = 0;
+        std::vector<Point2f> corners;
+        for (size_t i = 0; i < recorded.size(); i++)
+        {
+            const int patternIdx = recorded[i].patternIdx;
+            if (patternIdx != replayed[i].patternIdx || patternIdx < 0 || patternIdx >= (int)tracker.getDatabase().size())
+                return -1;
+            
+            perspectiveTransform(tracker.getDatabase().getPattern(patternIdx).points2d, corners, recorded[i].homography);
+            for (size_t c = 0; c < corners.size() && c < replayed[i].points2d.size(); c++)
+                error = std::max(error, (float)norm(corners[c] - replayed[i].points2d[c]));
+        }
+        return error;
+    }
+    
+    /**
+     * Largest translation difference between the recorded & replayed poses, relative to the recorded distance
+     */
+    float poseError(const std::vector<Pose>& recorded, const std::vector<Pose>& replayed)
+    {
+        if (recorded.size() != replayed.size())
+            return -1;
+        
+        float error = 0;
+        for (size_t i = 0; i < recorded.size(); i++)
+        {
+            if (recorded[i].found != replayed[i].found || recorded[i].patternIdx != replayed[i].patternIdx)
+                return -1;
+            if (!recorded[i].found || replayed[i].tvec.empty())
+                continue;
+            
+            Mat tvec;
+            replayed[i].tvec.convertTo(tvec, CV_64F);
+            error = std::max(error, (float)(norm(tvec - recorded[i].tvec) / std::max(norm(recorded[i].tvec), 1e-6)));
+        }
+        return error;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage : %s <trace> [--patterns <file>] [--pattern <image>] [--vocabulary <file>]\n"
+                        "       [--from <frame>] [--to <frame>] [--tolerance <px>] [--csv <file>]\n", argv[0]);
+        return 1;
+    }
+    
+    TraceReader reader;
+    if (!reader.open(argv[1]))
+    {
+        fprintf(stderr, "couldn't read a trace from %s\n", argv[1]);
+        return 1;
+    }
+    if (reader.getEncoding() == TraceWriter::FRAMES_NONE)
+    {
+        fprintf(stderr, "%s doesn't record its frames, it can't be replayed\n", argv[1]);
+        return 1;
+    }
+    
+    PatternTracker tracker;
+    if (!tracker.setFeatureBackend(reader.getFeatureBackend()))
+    {
+        fprintf(stderr, "unknown feature backend %s\n", reader.getFeatureBackend().c_str());
+        return 1;
+    }
+    tracker.setup(reader.getMatcherType());
+    
+    long long from = 0, to = -1;
+    float tolerance = 0.01f;
+    std::string csvFile, vocabularyFile;
+    for (int i = 2; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--patterns") == 0 && hasValue)
+        {
+            if (tracker.load(argv[++i]) < 0)
+            {
+                fprintf(stderr, "couldn't load patterns from %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--pattern") == 0 && hasValue)
+        {
+            Mat image = imread(argv[++i]);
+            if (image.empty() || tracker.add(image, argv[i]) < 0)
+            {
+                fprintf(stderr, "couldn't add the pattern %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--vocabulary") == 0 && hasValue)
+            vocabularyFile = argv[++i];
+        else if (strcmp(argv[i], "--from") == 0 && hasValue)
+            from = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--to") == 0 && hasValue)
+            to = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--tolerance") == 0 && hasValue)
+            tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--csv") == 0 && hasValue)
+            csvFile = argv[++i];
+    }
+    if (!vocabularyFile.empty() && !tracker.loadVocabulary(vocabularyFile))
+    {
+        fprintf(stderr, "couldn't load a vocabulary from %s\n", vocabularyFile.c_str());
+        return 1;
+    }
+    tracker.getDatabase().train();
+    
+    FILE* csv = csvFile.empty() ? 0 : fopen(csvFile.c_str(), "w");
+    if (!csvFile.empty() && !csv)
+    {
+        fprintf(stderr, "couldn't write %s\n", csvFile.c_str());
+        return 1;
+    }
+    if (csv)
+    {
+        fprintf(csv, "frame,found,replayed found,path,replayed path,corner error,pose error,keypoints,replayed keypoints,inliers,replayed inliers");
+        for (int s = 0; s < numStages; s++)
+            fprintf(csv, ",%s ms,replayed %s ms", stageNames[s], stageNames[s]);
+        fprintf(csv, "\n");
+    }
+    
+    printf("trace %s : %s backend, %s frames, %d patterns loaded\n", argv[1], reader.getFeatureBackend().c_str(),
+           TraceWriter::getEncodingName(reader.getEncoding()), (int)tracker.getDatabase().size());
+    
+    // The recorded timestamps in the ticks of this machine, for the pose filter
+    const double tickRatio = getTickFrequency() / reader.getTickFrequency();
+    
+    TraceFrame frame;
+    TraceConfig config;
+    StageStats stats[numStages];
+    std::vector<FrameTime> slowest;
+    int numFrames = 0, numCompared = 0, numDiverged = 0, numPatternWarnings = 0;
+    long long firstDiverged = -1;
+    Mat image;
+    
+    while (reader.next(frame, config))
+    {
+        if (to >= 0 && frame.index > to)
+            break;
+        if (frame.luma.empty())
+        {
+            fprintf(stderr, "frame %lld has no image, stopping\n", frame.index);
+            break;
+        }
+        if (frame.numPatterns != (int)tracker.getDatabase().size() && numPatternWarnings++ == 0)
+            fprintf(stderr, "warning : frame %lld was tracked with %d patterns, %d are loaded\n",
+                    frame.index, frame.numPatterns, (int)tracker.getDatabase().size());
+        
+        // Frames recorded below full resolution go back to the size the tracker was given
+        if (frame.luma.size() != frame.imageSize)
+            resize(frame.luma, image, frame.imageSize, 0, 0, INTER_LINEAR);
+        else
+            image = frame.luma;
+        
+        config.apply(tracker);
+        tracker.find(image, PIXEL_FORMAT_Y, (int64)(frame.ticks * tickRatio));
+        
+        // The poses are solved after find() like the recording did, their time being the pose stage out of the total
+        std::vector<Pose> poses;
+        if (!reader.getCameraMatrix().empty())
+            poses = tracker.getPoses(reader.getCameraMatrix(), reader.getDistCoeffs());
+        StageTimings timings = tracker.getTimings();
+        numFrames++;
+        
+        // Earlier frames only bring the tracker to the state of the recording
+        if (frame.index < from)
+            continue;
+        
+        const float corners = cornerError(tracker, frame.results);
+        const float pose = reader.getCameraMatrix().empty() ? 0 : poseError(frame.poses, poses);
+        const bool same = frame.found == tracker.getFrame().found && frame.path == tracker.getLastPath()
+                       && sameCounters(frame.counters, tracker.getCounters()) && corners >= 0 && corners <= tolerance && pose >= 0;
+        numCompared++;
+        if (!same)
+        {
+            if (numDiverged++ == 0)
+                firstDiverged = frame.index;
+            if (numDiverged <= 10)
+                printf("frame %lld differs : found %d / %d, path %d / %d, keypoints %d / %d, inliers %d / %d, corners %.3f px\n",
+                       frame.index, frame.found, tracker.getFrame().found, frame.path, tracker.getLastPath(),
+                       frame.counters.keypoints, tracker.getCounters().keypoints, frame.counters.inliers, tracker.getCounters().inliers, corners);
+        }
+        
+        for (int s = 0; s < numStages; s++)
+        {
+            stats[s].recorded.push_back(*stage(frame.timings, s));
+            stats[s].replayed.push_back(*stage(timings, s));
+        }
+        FrameTime time = { frame.index, (float)frame.timings.total, (float)timings.total };
+        slowest.push_back(time);
+        
+        if (csv)
+        {
+            fprintf(csv, "%lld,%d,%d,%d,%d,%.4f,%.5f,%d,%d,%d,%d", frame.index, frame.found, tracker.getFrame().found,
+                    frame.path, tracker.getLastPath(), corners, pose, frame.counters.keypoints, tracker.getCounters().keypoints,
+                    frame.counters.inliers, tracker.getCounters().inliers);
+            for (int s = 0; s < numStages; s++)
+                fprintf(csv, ",%.3f,%.3f", *stage(frame.timings, s), *stage(timings, s));
+            fprintf(csv, "\n");
+        }
+    }
+    if (csv)
+        fclose(csv);
+    
+    if (numCompared == 0)
+    {
+        fprintf(stderr, "no frame to compare\n");
+        return 1;
+    }
+    
+    printf("\n%d frames replayed, %d compared, %d differ", numFrames, numCompared, numDiverged);
+    if (firstDiverged >= 0)
+        printf(", the first being %lld", firstDiverged);
+    printf("\n\n%-12s %12s %12s %12s %12s %10s\n", "stage (ms)", "rec p50", "replay p50", "rec p99", "replay p99", "p50 ratio");
+    for (int s = 0; s < numStages; s++)
+    {
+        const StageStats& st = stats[s];
+        const float recorded50 = percentile(st.recorded, 0.5), replayed50 = percentile(st.replayed, 0.5);
+        printf("%-12s %12.2f %12.2f %12.2f %12.2f %10.2f\n", stageNames[s], recorded50, replayed50,
+               percentile(st.recorded, 0.99), percentile(st.replayed, 0.99), recorded50 > 0 ? replayed50 / recorded50 : 0.f);
+    }
+    
+    // The slowest frames of the recording : the device was slow if they aren't slow here too
+    std::sort(slowest.begin(), slowest.end(), [](const FrameTime& a, const FrameTime& b){ return a.recorded > b.recorded; });
+    printf("\nslowest recorded frames :\n");
+    for (size_t i = 0; i < slowest.size() && i < 5; i++)
+        printf("  frame %lld : %.2f ms recorded, %.2f ms replayed\n", slowest[i].index, slowest[i].recorded, slowest[i].replayed);
+    
+    return numDiverged ? 2 : 0;
+}